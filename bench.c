@@ -0,0 +1,1452 @@
+// -----------------------------------------------------------------------------
+// Микробенчмарки MYFS
+// Сборка: make bench
+// Запуск: ./bench [сценарий] [параметры]   (без аргумента выполняются все сценарии;
+//         параметры сценариев core и workload — см. ./bench --help)
+// -----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <getopt.h>
+#include "myfs.h"
+
+#define BENCH_IMAGE "bench.img"
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Форматирует свежий образ и создаёт в нём files файлов с именами file_<i>.dat
+static myfs_t* prepare_image(int files) {
+    if (!format_fs(BENCH_IMAGE)) return NULL;
+    myfs_t* fs = open_fs(BENCH_IMAGE);
+    if (!fs) return NULL;
+
+    char name[64];
+    for (int i = 0; i < files; i++) {
+        snprintf(name, sizeof(name), "file_%d.dat", i);
+        if (create_file(fs, name) < 0) {
+            close_fs(fs);
+            return NULL;
+        }
+    }
+    return fs;
+}
+
+// -----------------------------------------------------------------------------
+// Сценарий lookup: задержка поиска файла по имени при 10, 100 и 1024 файлах
+// -----------------------------------------------------------------------------
+
+static int bench_lookup(void) {
+    const int sizes[] = {10, 100, INODE_COUNT};
+    const int iterations = 1000000;
+
+    printf("%-8s %-14s %-14s\n", "FILES", "HIT ns/op", "MISS ns/op");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int files = sizes[s];
+        myfs_t* fs = prepare_image(files);
+        if (!fs) {
+            fprintf(stderr, "Не удалось подготовить образ на %d файлов\n", files);
+            return 1;
+        }
+
+        // Имена готовим заранее, чтобы в замер не попадал snprintf
+        char (*hits)[32] = malloc(files * sizeof(*hits));
+        char (*misses)[32] = malloc(files * sizeof(*misses));
+        if (!hits || !misses) {
+            free(hits);
+            free(misses);
+            close_fs(fs);
+            return 1;
+        }
+        for (int i = 0; i < files; i++) {
+            snprintf(hits[i], sizeof(hits[i]), "file_%d.dat", i);
+            snprintf(misses[i], sizeof(misses[i]), "missing_%d.dat", i);
+        }
+
+        long found = 0;
+
+        double start = now_ns();
+        for (int i = 0; i < iterations; i++) {
+            found += lookup_file(fs, hits[i % files]) >= 0;
+        }
+        double hit_ns = (now_ns() - start) / iterations;
+
+        start = now_ns();
+        for (int i = 0; i < iterations; i++) {
+            found += lookup_file(fs, misses[i % files]) >= 0;
+        }
+        double miss_ns = (now_ns() - start) / iterations;
+
+        free(hits);
+        free(misses);
+
+        if (found != iterations) {
+            fprintf(stderr, "Ошибка: найдено %ld из %d файлов\n", found, iterations);
+        }
+        printf("%-8d %-14.1f %-14.1f\n", files, hit_ns, miss_ns);
+        close_fs(fs);
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Сценарий alloc: стоимость выделения на пустой, наполовину заполненной и
+// фрагментированной (занят каждый второй блок) карте блоков. Меряется
+// create_file (inode + 1 блок) и write_file на 8 блоков (добор 7 блоков одним
+// непрерывным отрезком). Перед замером образ перемонтируется, чтобы курсор
+// next-fit начинал с начала карты и поиск проходил всю занятую часть.
+// -----------------------------------------------------------------------------
+
+#define ALLOC_FILES 100
+
+// delete_file сообщает об удалении в stdout — на время подготовки образа
+// перенаправляем вывод в /dev/null
+static int mute_stdout(void) {
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull >= 0) {
+        dup2(devnull, STDOUT_FILENO);
+        close(devnull);
+    }
+    return saved;
+}
+
+static void unmute_stdout(int saved) {
+    fflush(stdout);
+    if (saved >= 0) {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+}
+
+static myfs_t* remount(myfs_t* fs) {
+    close_fs(fs);
+    return open_fs(BENCH_IMAGE);
+}
+
+// Заполняет примерно половину блоков файлами по 10 блоков
+static myfs_t* prepare_half_full(void) {
+    myfs_t* fs = prepare_image(0);
+    if (!fs) return NULL;
+
+    size_t len = 10 * BLOCK_SIZE;
+    char* data = malloc(len + 1);
+    if (!data) return fs;
+    memset(data, 'h', len);
+    data[len] = '\0';
+
+    char name[64];
+    for (int i = 0; i < BLOCK_COUNT / 2 / 10; i++) {
+        snprintf(name, sizeof(name), "half_%d.dat", i);
+        if (create_file(fs, name) < 0 || !write_file(fs, name, data)) break;
+    }
+    free(data);
+    return remount(fs);
+}
+
+// Занимает каждый второй блок в начале карты: создаёт файлы по одному блоку
+// и удаляет каждый второй
+static myfs_t* prepare_fragmented(void) {
+    const int files = 800;
+    myfs_t* fs = prepare_image(files);
+    if (!fs) return NULL;
+
+    char name[64];
+    for (int i = 0; i < files; i += 2) {
+        snprintf(name, sizeof(name), "file_%d.dat", i);
+        delete_file(fs, name);
+    }
+    return remount(fs);
+}
+
+static int bench_alloc(void) {
+    struct {
+        const char* label;
+        myfs_t* (*prepare)(void);
+    } layouts[] = {
+        {"empty", NULL},
+        {"half-full", prepare_half_full},
+        {"fragmented", prepare_fragmented},
+    };
+
+    char* data = malloc(8 * BLOCK_SIZE + 1);
+    if (!data) return 1;
+    memset(data, 'd', 8 * BLOCK_SIZE);
+    data[8 * BLOCK_SIZE] = '\0';
+
+    printf("%-12s %-18s %-18s\n", "BITMAP", "create ns/op", "8-block write ns/op");
+    for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+        int saved = mute_stdout();
+        myfs_t* fs = layouts[l].prepare ? layouts[l].prepare() : prepare_image(0);
+        unmute_stdout(saved);
+        if (!fs) {
+            fprintf(stderr, "Не удалось подготовить образ '%s'\n", layouts[l].label);
+            free(data);
+            return 1;
+        }
+
+        char name[64];
+        double start = now_ns();
+        for (int i = 0; i < ALLOC_FILES; i++) {
+            snprintf(name, sizeof(name), "alloc_%d.dat", i);
+            create_file(fs, name);
+        }
+        double create_ns = (now_ns() - start) / ALLOC_FILES;
+
+        fs = remount(fs);
+        start = now_ns();
+        for (int i = 0; i < ALLOC_FILES; i++) {
+            snprintf(name, sizeof(name), "alloc_%d.dat", i);
+            write_file(fs, name, data);
+        }
+        double write_ns = (now_ns() - start) / ALLOC_FILES;
+
+        printf("%-12s %-18.1f %-18.1f\n", layouts[l].label, create_ns, write_ns);
+        close_fs(fs);
+    }
+    free(data);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Сценарий seq: пропускная способность последовательной записи и чтения
+// файлов 1 МиБ, 64 МиБ и 1 ГиБ. Размеры, не помещающиеся в образ, пропускаются.
+// -----------------------------------------------------------------------------
+
+static int bench_seq(void) {
+    const size_t sizes[] = {1 << 20, 64 << 20, (size_t)1 << 30};
+
+    printf("%-10s %-16s %-16s\n", "SIZE", "write MiB/s", "read MiB/s");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t size = sizes[s];
+        // Образ под размер файла: блоки данных, косвенные блоки (1/16 с запасом)
+        // и корневой каталог; количество блоков кратно 8
+        size_t blocks = size / BLOCK_SIZE;
+        myfs_format_options fmt = {.block_count = (uint32_t)((blocks + blocks / 16 + 64 + 7) & ~(size_t)7)};
+
+        char* data = malloc(size + 1);
+        if (!data) return 1;
+        for (size_t i = 0; i < size; i++) data[i] = 'a' + i % 26;
+        data[size] = '\0';
+
+        myfs_t* fs = format_fs_ex(BENCH_IMAGE, &fmt) ? open_fs(BENCH_IMAGE) : NULL;
+        if (!fs || create_file(fs, "seq.dat") < 0) {
+            free(data);
+            if (fs) close_fs(fs);
+            return 1;
+        }
+
+        double start = now_ns();
+        int ok = write_file(fs, "seq.dat", data) && sync_fs(fs);
+        double write_s = (now_ns() - start) / 1e9;
+
+        start = now_ns();
+        int got = read_file(fs, "seq.dat", data, size + 1);
+        double read_s = (now_ns() - start) / 1e9;
+
+        if (!ok || (size_t)got != size) {
+            fprintf(stderr, "Ошибка: записано/прочитано не полностью (%d из %zu)\n", got, size);
+        }
+        double mib = (double)size / (1 << 20);
+        printf("%-10zu %-16.1f %-16.1f\n", size >> 20, mib / write_s, mib / read_s);
+
+        close_fs(fs);
+        free(data);
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Сценарий append: дозапись записей по 64 байта. Сравниваются myfs_append
+// через открытый дескриптор, write_file1 (поиск и открытие на каждый вызов)
+// и pwrite в обычный файл как верхняя граница.
+// -----------------------------------------------------------------------------
+
+#define APPEND_RECORD 64
+#define APPEND_COUNT 100000
+
+static int bench_append(void) {
+    char record[APPEND_RECORD + 1];
+    memset(record, 'r', APPEND_RECORD);
+    record[APPEND_RECORD] = '\0';
+    double mib = (double)APPEND_RECORD * APPEND_COUNT / (1 << 20);
+
+    printf("%-14s %-12s %-12s\n", "PATH", "ns/op", "MiB/s");
+
+    // myfs_append через один дескриптор
+    myfs_t* fs = prepare_image(0);
+    myfs_file_t* f = fs ? myfs_open(fs, "log.dat", MYFS_O_CREAT) : NULL;
+    if (!f) {
+        if (fs) close_fs(fs);
+        return 1;
+    }
+    double start = now_ns();
+    for (int i = 0; i < APPEND_COUNT; i++) {
+        if (myfs_append(f, record, APPEND_RECORD, 0) != APPEND_RECORD) break;
+    }
+    myfs_close(f);
+    sync_fs(fs);
+    double ns = (now_ns() - start) / APPEND_COUNT;
+    printf("%-14s %-12.1f %-12.1f\n", "myfs_append", ns, mib / (ns * APPEND_COUNT / 1e9));
+    close_fs(fs);
+
+    // write_file1: имя ищется и файл открывается на каждую запись
+    fs = prepare_image(0);
+    if (!fs || create_file(fs, "log.dat") < 0) {
+        if (fs) close_fs(fs);
+        return 1;
+    }
+    start = now_ns();
+    for (int i = 0; i < APPEND_COUNT; i++) {
+        if (!write_file1(fs, "log.dat", record)) break;
+    }
+    sync_fs(fs);
+    ns = (now_ns() - start) / APPEND_COUNT;
+    printf("%-14s %-12.1f %-12.1f\n", "write_file1", ns, mib / (ns * APPEND_COUNT / 1e9));
+    close_fs(fs);
+
+    // pwrite в обычный файл
+    int fd = open(BENCH_IMAGE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return 1;
+    start = now_ns();
+    for (int i = 0; i < APPEND_COUNT; i++) {
+        if (pwrite(fd, record, APPEND_RECORD, (off_t)i * APPEND_RECORD) != APPEND_RECORD) break;
+    }
+    ns = (now_ns() - start) / APPEND_COUNT;
+    printf("%-14s %-12.1f %-12.1f\n", "raw pwrite", ns, mib / (ns * APPEND_COUNT / 1e9));
+    close(fd);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Сценарий journal: создание файлов в секунду при fsync после каждой
+// операции и при групповой фиксации с разной допустимой задержкой.
+// Время включает итоговый sync_fs, то есть все изменения долговечны.
+// -----------------------------------------------------------------------------
+
+#define JOURNAL_CREATES 1000
+
+static int bench_journal(void) {
+    struct {
+        const char* label;
+        myfs_options opts;
+    } modes[] = {
+        {"fsync/op", {.sync_each_op = true}},
+        {"group 1ms", {.commit_latency_us = 1000}},
+        {"group 10ms", {.commit_latency_us = 10000}},
+        {"group 100ms", {.commit_latency_us = 100000}},
+    };
+
+    printf("%-12s %-14s %-12s\n", "COMMIT", "creates/s", "us/create");
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        if (!format_fs(BENCH_IMAGE)) return 1;
+        myfs_t* fs = open_fs_ex(BENCH_IMAGE, &modes[m].opts);
+        if (!fs) return 1;
+
+        char name[64];
+        double start = now_ns();
+        for (int i = 0; i < JOURNAL_CREATES; i++) {
+            snprintf(name, sizeof(name), "file_%d.dat", i);
+            if (create_file(fs, name) < 0) break;
+        }
+        sync_fs(fs);
+        double s = (now_ns() - start) / 1e9;
+
+        printf("%-12s %-14.0f %-12.1f\n", modes[m].label, JOURNAL_CREATES / s, s * 1e6 / JOURNAL_CREATES);
+        close_fs(fs);
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Сценарий cache: многократное перечитывание одних и тех же небольших файлов
+// (раздача конфигурации) с буферным кэшем блоков и без него.
+// -----------------------------------------------------------------------------
+
+#define CACHE_FILES 300
+#define CACHE_FILE_SIZE 3000
+#define CACHE_ROUNDS 50
+
+static int bench_cache(void) {
+    struct {
+        const char* label;
+        int32_t cache_blocks;
+    } modes[] = {
+        {"no cache", -1},
+        {"cache 1024", 1024},
+    };
+
+    char data[CACHE_FILE_SIZE + 1];
+    memset(data, 'c', CACHE_FILE_SIZE);
+    data[CACHE_FILE_SIZE] = '\0';
+    char buffer[CACHE_FILE_SIZE + 1];
+
+    printf("%-12s %-14s %-10s\n", "MODE", "reads/s", "hit %");
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        myfs_t* fs = prepare_image(CACHE_FILES);
+        if (!fs) return 1;
+        char name[64];
+        for (int i = 0; i < CACHE_FILES; i++) {
+            snprintf(name, sizeof(name), "file_%d.dat", i);
+            write_file(fs, name, data);
+        }
+        close_fs(fs);
+
+        myfs_options opts = {.cache_blocks = modes[m].cache_blocks};
+        fs = open_fs_ex(BENCH_IMAGE, &opts);
+        if (!fs) return 1;
+
+        double start = now_ns();
+        for (int r = 0; r < CACHE_ROUNDS; r++) {
+            for (int i = 0; i < CACHE_FILES; i++) {
+                snprintf(name, sizeof(name), "file_%d.dat", i);
+                read_file(fs, name, buffer, sizeof(buffer));
+            }
+        }
+        double s = (now_ns() - start) / 1e9;
+
+        myfs_cache_stats stats;
+        double hit = 0;
+        if (myfs_get_cache_stats(fs, &stats) && stats.hits + stats.misses > 0) {
+            hit = 100.0 * stats.hits / (stats.hits + stats.misses);
+        }
+        printf("%-12s %-14.0f %-10.1f\n", modes[m].label, CACHE_FILES * CACHE_ROUNDS / s, hit);
+        close_fs(fs);
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Сценарий readahead: последовательное чтение фрагментированного файла (он
+// дописывался вперемешку с другим, экстенты по 64 КиБ) через дескриптор
+// фрагментами по 16 КиБ с холодным страничным кэшем, без упреждающего чтения
+// и с ним. Между фрагментами — немного работы с данными, чтобы подгрузка
+// следующих экстентов могла идти параллельно.
+// -----------------------------------------------------------------------------
+
+#define RA_FILE_SIZE (6 << 20)
+#define RA_PIECE (64 * 1024)
+#define RA_IO_SIZE (16 * 1024)
+
+// Выгружает образ из страничного кэша хоста
+static void drop_image_cache(void) {
+    int fd = open(BENCH_IMAGE, O_RDONLY);
+    if (fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+static int bench_readahead(void) {
+    struct {
+        const char* label;
+        int32_t readahead_blocks;
+    } modes[] = {
+        {"off", -1},
+        {"on", 0},
+    };
+
+    uint8_t piece[RA_PIECE];
+    for (size_t i = 0; i < sizeof(piece); i++) piece[i] = 'a' + i % 26;
+    myfs_t* fs = prepare_image(0);
+    bool ok = fs && create_file(fs, "ra.dat") >= 0 && create_file(fs, "other.dat") >= 0;
+    myfs_file_t* files[2] = {NULL, NULL};
+    if (ok) {
+        files[0] = myfs_open(fs, "ra.dat", 0);
+        files[1] = myfs_open(fs, "other.dat", 0);
+    }
+    for (size_t off = 0; ok && off < RA_FILE_SIZE; off += RA_PIECE) {
+        for (int i = 0; i < 2 && ok; i++) {
+            ok = files[i] && myfs_append(files[i], piece, sizeof(piece), 0) == (ssize_t)sizeof(piece);
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        if (files[i]) myfs_close(files[i]);
+    }
+    if (fs) close_fs(fs);
+    if (!ok) return 1;
+
+    printf("%-10s %-14s %-10s %-12s %-10s\n", "READAHEAD", "read MiB/s", "windows", "hinted KiB", "hit %");
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        drop_image_cache();
+        myfs_options opts = {.readahead_blocks = modes[m].readahead_blocks};
+        fs = open_fs_ex(BENCH_IMAGE, &opts);
+        myfs_file_t* f = fs ? myfs_open(fs, "ra.dat", 0) : NULL;
+        if (!f) {
+            if (fs) close_fs(fs);
+            return 1;
+        }
+
+        uint8_t buf[RA_IO_SIZE];
+        uint64_t sum = 0, total = 0;
+        double start = now_ns();
+        ssize_t n;
+        while ((n = myfs_read(f, buf, sizeof(buf))) > 0) {
+            for (ssize_t i = 0; i < n; i++) sum += buf[i];
+            total += (uint64_t)n;
+        }
+        double s = (now_ns() - start) / 1e9;
+        if (n < 0 || total != RA_FILE_SIZE) {
+            fprintf(stderr, "Ошибка: прочитано %llu из %d байт\n", (unsigned long long)total, RA_FILE_SIZE);
+        }
+
+        myfs_stats st = {0};
+        double hit = 0;
+        if (myfs_get_stats(fs, &st) && st.ra_bytes > 0) hit = 100.0 * st.ra_hit_bytes / st.ra_bytes;
+        printf("%-10s %-14.1f %-10llu %-12llu %-10.1f\n", modes[m].label, (double)total / (1 << 20) / s,
+               (unsigned long long)st.ra_windows, (unsigned long long)(st.ra_hinted >> 10), hit);
+        myfs_close(f);
+        close_fs(fs);
+        if (sum == 0) fprintf(stderr, "Ошибка: пустые данные\n");
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Сценарий compress: журнал из записей JSON дописывается порциями по 8 КиБ,
+// затем читается через дескриптор с холодным страничным кэшем — в образе без
+// сжатия и со сжатием. Сравниваются занятые блоки, байты, прочитанные из
+// образа, и скорость записи и чтения.
+// -----------------------------------------------------------------------------
+
+#define COMP_FILE_SIZE (4 << 20)
+#define COMP_PIECE (8 * 1024)
+
+// Заполняет buf строками журнала в формате JSON; n — номер первой записи
+static void fill_log(char* buf, size_t size, unsigned* n) {
+    static const char* const levels[] = {"INFO", "WARN", "ERROR", "DEBUG"};
+    size_t pos = 0;
+    while (pos < size) {
+        char line[160];
+        unsigned id = (*n)++;
+        int len = snprintf(line, sizeof(line),
+                           "{\"ts\": %u, \"level\": \"%s\", \"user\": \"user%03u\", \"op\": \"write\", \"bytes\": %u}\n",
+                           1700000000u + id * 7, levels[id % 4], id * 37 % 1000, id * 131 % 65536);
+        size_t n_copy = size - pos < (size_t)len ? size - pos : (size_t)len;
+        memcpy(buf + pos, line, n_copy);
+        pos += n_copy;
+    }
+}
+
+static int bench_compress(void) {
+    printf("%-10s %-12s %-12s %-14s %-14s %-8s\n", "COMPRESS", "blocks", "read KiB", "append MiB/s", "read MiB/s", "ratio");
+    for (int on = 0; on < 2; on++) {
+        myfs_format_options fmt = {.compress = on};
+        myfs_t* fs = format_fs_ex(BENCH_IMAGE, &fmt) ? open_fs(BENCH_IMAGE) : NULL;
+        myfs_file_t* f = fs && create_file(fs, "log.json") >= 0 ? myfs_open(fs, "log.json", 0) : NULL;
+        if (!f) {
+            if (fs) close_fs(fs);
+            return 1;
+        }
+        char piece[COMP_PIECE];
+        unsigned n = 0;
+        bool ok = true;
+        double start = now_ns();
+        for (size_t off = 0; ok && off < COMP_FILE_SIZE; off += sizeof(piece)) {
+            fill_log(piece, sizeof(piece), &n);
+            ok = myfs_append(f, piece, sizeof(piece), 0) == (ssize_t)sizeof(piece);
+        }
+        ok = myfs_close(f) && ok;
+        double append_s = (now_ns() - start) / 1e9;
+        myfs_stats st = {0};
+        myfs_get_stats(fs, &st);
+        uint64_t blocks = st.blocks_allocated - st.blocks_freed;
+        double ratio = st.comp_bytes_out ? (double)st.comp_bytes_in / st.comp_bytes_out : 1.0;
+        close_fs(fs);
+        if (!ok) return 1;
+
+        drop_image_cache();
+        fs = open_fs(BENCH_IMAGE);
+        f = fs ? myfs_open(fs, "log.json", 0) : NULL;
+        if (!f) {
+            if (fs) close_fs(fs);
+            return 1;
+        }
+        uint8_t buf[RA_IO_SIZE];
+        uint64_t total = 0, lines = 0;
+        ssize_t got;
+        start = now_ns();
+        while ((got = myfs_read(f, buf, sizeof(buf))) > 0) {
+            for (ssize_t i = 0; i < got; i++) lines += buf[i] == '\n';
+            total += (uint64_t)got;
+        }
+        double read_s = (now_ns() - start) / 1e9;
+        if (got < 0 || total != COMP_FILE_SIZE || lines == 0) {
+            fprintf(stderr, "Ошибка: прочитано %llu из %d байт\n", (unsigned long long)total, COMP_FILE_SIZE);
+        }
+        myfs_get_stats(fs, &st);
+        printf("%-10s %-12llu %-12llu %-14.1f %-14.1f %-8.2f\n", on ? "on" : "off", (unsigned long long)blocks,
+               (unsigned long long)(st.bytes_read >> 10), COMP_FILE_SIZE / (1 << 20) / append_s,
+               (double)total / (1 << 20) / read_s, ratio);
+        myfs_close(f);
+        close_fs(fs);
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Сценарий small: случайная смесь записи, усечения, дозаписи и чтения
+// (мелкими фрагментами через кэш блоков и крупными мимо него) в образах с
+// блоком 512 Б и 1 КиБ — меньше буфера stdio — с перемонтированиями.
+// Содержимое сверяется с копией в памяти: при блоке меньше буфера stdio
+// устаревший буфер чтения возвращал старые данные блоков, записанных
+// pwritev при сбросе кэша.
+// -----------------------------------------------------------------------------
+
+#define SMALL_FILE_MAX (1536 * 1024)
+#define SMALL_OPS 2000
+#define SMALL_SEEDS 4
+
+// Длина фрагмента: обычно — внутри кэша, иногда — крупнее порога обхода кэша
+static size_t small_len(unsigned* seed) {
+    return 1 + (size_t)rand_r(seed) % (rand_r(seed) % 3 ? 3000 : 40000);
+}
+
+// Один прогон: false — содержимое разошлось с копией или операция не удалась
+static bool small_run(uint32_t block_size, unsigned seed, uint8_t* ref, uint8_t* buf, uint64_t* ops) {
+    myfs_format_options fmt = {.block_size = block_size, .block_count = 16384};
+    myfs_t* fs = format_fs_ex(BENCH_IMAGE, &fmt) ? open_fs(BENCH_IMAGE) : NULL;
+    myfs_file_t* f = fs && create_file(fs, "small.dat") >= 0 ? myfs_open(fs, "small.dat", 0) : NULL;
+    size_t size = 0;
+    bool ok = f != NULL;
+    for (int it = 0; ok && it < SMALL_OPS; it++) {
+        int op = rand_r(&seed) % 5;
+        size_t len = small_len(&seed);
+        for (size_t i = 0; i < len; i++) buf[i] = (uint8_t)rand_r(&seed);
+        if (op == 0) {
+            size_t off = (size_t)rand_r(&seed) % (size + 100);
+            if (off + len > SMALL_FILE_MAX) continue;
+            ok = myfs_pwrite(f, buf, len, off) == (ssize_t)len;
+            if (off > size) memset(ref + size, 0, off - size);
+            memcpy(ref + off, buf, len);
+            if (off + len > size) size = off + len;
+        } else if (op == 1) {
+            size_t new_size = (size_t)rand_r(&seed) % (size + 1000);
+            if (new_size > SMALL_FILE_MAX) continue;
+            ok = myfs_truncate(f, new_size);
+            if (new_size > size) memset(ref + size, 0, new_size - size);
+            size = new_size;
+        } else if (op == 2) {
+            if (size + len > SMALL_FILE_MAX) continue;
+            ok = myfs_append(f, buf, len, 0) == (ssize_t)len;
+            memcpy(ref + size, buf, len);
+            size += len;
+        } else if (op == 3 && it % 20 == 0) {
+            myfs_close(f);
+            fs = remount(fs);
+            f = fs ? myfs_open(fs, "small.dat", 0) : NULL;
+            ok = f != NULL;
+        } else {
+            size_t got = 0;
+            ssize_t n = 1;
+            while (got < size && n > 0) {
+                n = myfs_pread(fs, myfs_file_ino(f), buf + got, small_len(&seed), got);
+                if (n > 0) got += (size_t)n;
+            }
+            ok = got == size && memcmp(buf, ref, size) == 0;
+        }
+        (*ops)++;
+    }
+    if (f) myfs_close(f);
+    if (fs) close_fs(fs);
+    return ok;
+}
+
+static int bench_small(void) {
+    uint8_t* ref = malloc(SMALL_FILE_MAX);
+    uint8_t* buf = malloc(SMALL_FILE_MAX + 40000);
+    if (!ref || !buf) {
+        free(ref);
+        free(buf);
+        return 1;
+    }
+    int rc = 0;
+    printf("%-10s %-12s %-10s\n", "BLOCK", "ops/s", "check");
+    for (uint32_t block_size = 512; block_size <= 1024; block_size *= 2) {
+        uint64_t ops = 0;
+        int failed = 0;
+        double start = now_ns();
+        for (unsigned seed = 1; seed <= SMALL_SEEDS; seed++) {
+            if (!small_run(block_size, seed, ref, buf, &ops)) failed++;
+        }
+        double s = (now_ns() - start) / 1e9;
+        printf("%-10u %-12.0f %d/%d\n", block_size, ops / s, SMALL_SEEDS - failed, SMALL_SEEDS);
+        if (failed) rc = 1;
+    }
+    free(ref);
+    free(buf);
+    return rc;
+}
+
+// -----------------------------------------------------------------------------
+// Сценарий threads: пропускная способность чтения и записи из 1..32 потоков
+// в потокобезопасном режиме. Чтение — фрагменты общих файлов в случайных
+// местах, запись — перезапись фрагментов своего файла у каждого потока.
+// -----------------------------------------------------------------------------
+
+#define THREAD_FILES 32
+#define THREAD_FILE_SIZE (256 * 1024)
+#define THREAD_IO_SIZE (16 * 1024)
+#define THREAD_RUN_MS 300
+
+typedef struct {
+    myfs_t* fs;
+    int ino[THREAD_FILES];
+    atomic_bool stop;
+    atomic_uint_fast64_t bytes;
+} ThreadBench;
+
+typedef struct {
+    ThreadBench* tb;
+    unsigned id;
+    bool write;
+} ThreadArg;
+
+static void* thread_worker(void* p) {
+    ThreadArg* a = p;
+    ThreadBench* tb = a->tb;
+    unsigned seed = a->id * 2654435761u + 1;
+    uint8_t buf[THREAD_IO_SIZE];
+    memset(buf, 'a' + a->id % 26, sizeof(buf));
+
+    char name[64];
+    snprintf(name, sizeof(name), "file_%u.dat", a->id % THREAD_FILES);
+    myfs_file_t* f = a->write ? myfs_open(tb->fs, name, 0) : NULL;
+
+    uint64_t done = 0;
+    while (!atomic_load_explicit(&tb->stop, memory_order_relaxed)) {
+        uint64_t offset = (uint64_t)(rand_r(&seed) % (THREAD_FILE_SIZE / THREAD_IO_SIZE)) * THREAD_IO_SIZE;
+        ssize_t n = a->write ? myfs_pwrite(f, buf, sizeof(buf), offset)
+                             : myfs_pread(tb->fs, tb->ino[rand_r(&seed) % THREAD_FILES], buf, sizeof(buf), offset);
+        if (n != (ssize_t)sizeof(buf)) break;
+        done += (uint64_t)n;
+    }
+    if (f) myfs_close(f);
+    atomic_fetch_add(&tb->bytes, done);
+    return NULL;
+}
+
+// MiB/s при заданном числе потоков
+static double thread_run(ThreadBench* tb, int threads, bool write) {
+    pthread_t tid[32];
+    ThreadArg args[32];
+    atomic_store(&tb->stop, false);
+    atomic_store(&tb->bytes, 0);
+
+    double start = now_ns();
+    int started = 0;
+    for (int t = 0; t < threads; t++) {
+        args[t] = (ThreadArg){tb, (unsigned)t, write};
+        if (pthread_create(&tid[t], NULL, thread_worker, &args[t]) != 0) break;
+        started++;
+    }
+    usleep(THREAD_RUN_MS * 1000);
+    atomic_store(&tb->stop, true);
+    for (int t = 0; t < started; t++) {
+        pthread_join(tid[t], NULL);
+    }
+    double s = (now_ns() - start) / 1e9;
+    return atomic_load(&tb->bytes) / s / (1024.0 * 1024.0);
+}
+
+static int bench_threads(void) {
+    const int counts[] = {1, 2, 4, 8, 16, 32};
+    const myfs_backend backends[] = {MYFS_BACKEND_STDIO, MYFS_BACKEND_MMAP};
+
+    printf("%-8s %-16s %-16s %-16s %-16s\n", "THREADS",
+           "stdio rd MiB/s", "stdio wr MiB/s", "mmap rd MiB/s", "mmap wr MiB/s");
+    double result[2][6][2];
+    for (size_t b = 0; b < 2; b++) {
+        myfs_t* fs = prepare_image(THREAD_FILES);
+        if (!fs) return 1;
+        close_fs(fs);
+
+        static ThreadBench tb;
+        myfs_options opts = {.backend = backends[b], .thread_safe = true};
+        tb.fs = open_fs_ex(BENCH_IMAGE, &opts);
+        if (!tb.fs) return 1;
+
+        // Файлы заполняются целиком, чтобы чтение не упиралось в конец файла
+        uint8_t* fill = calloc(1, THREAD_FILE_SIZE);
+        char name[64];
+        for (int i = 0; i < THREAD_FILES && fill; i++) {
+            snprintf(name, sizeof(name), "file_%d.dat", i);
+            myfs_file_t* f = myfs_open(tb.fs, name, 0);
+            if (f) myfs_pwrite(f, fill, THREAD_FILE_SIZE, 0);
+            myfs_close(f);
+            tb.ino[i] = lookup_file(tb.fs, name);
+        }
+        free(fill);
+        sync_fs(tb.fs);
+
+        for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+            result[b][c][0] = thread_run(&tb, counts[c], false);
+            result[b][c][1] = thread_run(&tb, counts[c], true);
+        }
+        close_fs(tb.fs);
+    }
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        printf("%-8d %-16.0f %-16.0f %-16.0f %-16.0f\n", counts[c],
+               result[0][c][0], result[0][c][1], result[1][c][0], result[1][c][1]);
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Сценарий batch: импорт множества мелких файлов — create_file + write_file на
+// каждый файл (с fsync после каждой операции и с групповой фиксацией) против
+// одного пакета myfs_batch_*. Время включает итоговый sync_fs. Файлов столько,
+// что импорт длится много окон групповой фиксации; режиму с fsync на каждую
+// операцию хватает меньшего числа. Из BATCH_ROUNDS прогонов режима берётся
+// лучший. Сценарий не проходит, если пакет (stdio) не быстрее групповой
+// фиксации хотя бы в BATCH_MIN_SPEEDUP раз.
+// -----------------------------------------------------------------------------
+
+#define BATCH_FILES 8000
+#define BATCH_SYNC_FILES 1000
+#define BATCH_FILE_SIZE 2000
+#define BATCH_ROUNDS 5
+#define BATCH_MIN_SPEEDUP 1.25
+
+static int bench_batch(void) {
+    struct {
+        const char* label;
+        myfs_options opts;
+        bool batch;
+        int files;
+        int rounds;
+    } modes[] = {
+        {"fsync/op", {.sync_each_op = true}, false, BATCH_SYNC_FILES, 1},
+        {"group 10ms", {.commit_latency_us = 10000}, false, BATCH_FILES, BATCH_ROUNDS},
+        {"batch", {0}, true, BATCH_FILES, BATCH_ROUNDS},
+        {"batch mmap", {.backend = MYFS_BACKEND_MMAP}, true, BATCH_FILES, BATCH_ROUNDS},
+    };
+    // Каждому файлу — inode и блок данных, плюс корневой каталог
+    myfs_format_options fmt = {
+        .inode_count = (BATCH_FILES + 64) & ~7,
+        .block_count = (BATCH_FILES * ((BATCH_FILE_SIZE + BLOCK_SIZE - 1) / BLOCK_SIZE) + 64) & ~7,
+    };
+
+    char data[BATCH_FILE_SIZE + 1];
+    memset(data, 'b', BATCH_FILE_SIZE);
+    data[BATCH_FILE_SIZE] = '\0';
+
+    printf("%-12s %-14s %-12s\n", "MODE", "files/s", "us/file");
+    double group_rate = 0;
+    int result = 0;
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        double best = 0;
+        for (int r = 0; r < modes[m].rounds; r++) {
+            if (!format_fs_ex(BENCH_IMAGE, &fmt)) return 1;
+            myfs_t* fs = open_fs_ex(BENCH_IMAGE, &modes[m].opts);
+            if (!fs) return 1;
+
+            char name[64];
+            double start = now_ns();
+            if (modes[m].batch) {
+                myfs_batch_t* b = myfs_batch_begin(fs);
+                for (int i = 0; i < modes[m].files; i++) {
+                    snprintf(name, sizeof(name), "file_%d.dat", i);
+                    myfs_batch_create(b, name);
+                    myfs_batch_write(b, name, data, BATCH_FILE_SIZE);
+                }
+                if (!myfs_batch_commit(b)) {
+                    close_fs(fs);
+                    return 1;
+                }
+            } else {
+                for (int i = 0; i < modes[m].files; i++) {
+                    snprintf(name, sizeof(name), "file_%d.dat", i);
+                    if (create_file(fs, name) < 0 || !write_file(fs, name, data)) break;
+                }
+            }
+            sync_fs(fs);
+            double s = (now_ns() - start) / 1e9;
+            if (best == 0 || s < best) best = s;
+            close_fs(fs);
+        }
+
+        double rate = modes[m].files / best;
+        printf("%-12s %-14.0f %-12.1f\n", modes[m].label, rate, best * 1e6 / modes[m].files);
+        if (!modes[m].batch && !modes[m].opts.sync_each_op) group_rate = rate;
+        if (modes[m].batch && modes[m].opts.backend == MYFS_BACKEND_STDIO && rate < group_rate * BATCH_MIN_SPEEDUP) {
+            fprintf(stderr, "Ошибка: пакет быстрее групповой фиксации лишь в %.2f раза\n", rate / group_rate);
+            result = 1;
+        }
+    }
+    return result;
+}
+
+// -----------------------------------------------------------------------------
+// Сценарии core и workload: задержки отдельных операций (p50/p99/p999),
+// операций в секунду и системных вызовов на операцию. Результат — JSON в
+// stdout. Параметры задаются после имени сценария, например:
+//   ./bench workload --files=200 --size=1k-64k --dist=log --read=70 --threads=4
+// Системные вызовы считаются по /proc/self/io (syscr — чтения, syscw — записи).
+// -----------------------------------------------------------------------------
+
+typedef struct {
+    int files;               // Число файлов
+    size_t size_min;         // Размер файла: от size_min до size_max
+    size_t size_max;
+    bool size_log;           // Размеры распределены по степеням двойки (иначе равномерно)
+    int read_pct;            // Доля чтений в смеси workload, %
+    bool random;             // Случайный доступ (иначе последовательный)
+    int threads;             // Потоков в workload
+    long ops;                // Операций в workload на все потоки
+    size_t io_size;          // Размер одного чтения/записи в workload
+    myfs_backend backend;
+    myfs_io_engine io_engine;  // Исполнитель ввода-вывода в core и workload
+    int repeat;              // Повторы format_fs и list_files в core
+    unsigned seed;
+} BenchConfig;
+
+#define MAX_BENCH_THREADS 64
+
+static BenchConfig cfg = {
+    .files = 100,
+    .size_min = 4096,
+    .size_max = 4096,
+    .read_pct = 50,
+    .random = true,
+    .threads = 1,
+    .ops = 100000,
+    .io_size = 4096,
+    .repeat = 20,
+    .seed = 1,
+};
+
+// Задержки операций одного вида, нс
+typedef struct {
+    uint64_t* ns;
+    size_t count, cap;
+} LatencyLog;
+
+static bool lat_init(LatencyLog* l, size_t cap) {
+    l->count = 0;
+    l->cap = cap ? cap : 1;
+    l->ns = malloc(l->cap * sizeof(uint64_t));
+    return l->ns != NULL;
+}
+
+// Место выделено заранее: запись в журнал не должна попадать в замер
+static void lat_add(LatencyLog* l, double start_ns) {
+    if (l->count < l->cap) l->ns[l->count++] = (uint64_t)(now_ns() - start_ns);
+}
+
+static int u64_cmp(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Перцентиль p (0..1) отсортированного журнала, мкс
+static double lat_pct(const LatencyLog* l, double p) {
+    if (l->count == 0) return 0;
+    size_t i = (size_t)(p * l->count);
+    if (i >= l->count) i = l->count - 1;
+    return l->ns[i] / 1000.0;
+}
+
+// Счётчики ввода-вывода процесса; valid = false, если /proc/self/io недоступен
+typedef struct {
+    uint64_t syscr, syscw;
+    bool valid;
+} IoCounters;
+
+// Одно чтение /proc/self/io само стоит один syscr — он вычитается в io_delta
+static void io_sample(IoCounters* c) {
+    char buf[512];
+    c->valid = false;
+    int fd = open("/proc/self/io", O_RDONLY);
+    if (fd < 0) return;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return;
+    buf[n] = '\0';
+    char* r = strstr(buf, "syscr:");
+    char* w = strstr(buf, "syscw:");
+    if (!r || !w) return;
+    c->syscr = strtoull(r + 6, NULL, 10);
+    c->syscw = strtoull(w + 6, NULL, 10);
+    c->valid = true;
+}
+
+// Выводит результат операции name: "name": {...}
+static void json_op(const char* name, LatencyLog* l, double seconds,
+                    const IoCounters* before, const IoCounters* after, bool last) {
+    qsort(l->ns, l->count, sizeof(uint64_t), u64_cmp);
+    printf("    \"%s\": {\"count\": %zu, \"ops_per_sec\": %.1f, \"p50_us\": %.2f, "
+           "\"p99_us\": %.2f, \"p999_us\": %.2f, \"max_us\": %.2f",
+           name, l->count, seconds > 0 ? l->count / seconds : 0,
+           lat_pct(l, 0.50), lat_pct(l, 0.99), lat_pct(l, 0.999), lat_pct(l, 1.0));
+    if (before && after && before->valid && after->valid && l->count > 0) {
+        uint64_t r = after->syscr - before->syscr;
+        r = r > 0 ? r - 1 : 0;
+        printf(", \"syscr_per_op\": %.2f, \"syscw_per_op\": %.2f",
+               (double)r / l->count, (double)(after->syscw - before->syscw) / l->count);
+    }
+    printf("}%s\n", last ? "" : ",");
+}
+
+static const char* const engine_names[] = {"sync", "uring", "threads"};
+
+static void json_config(const char* scenario) {
+    printf("{\n  \"scenario\": \"%s\",\n", scenario);
+    printf("  \"config\": {\"files\": %d, \"size_min\": %zu, \"size_max\": %zu, \"dist\": \"%s\", "
+           "\"read_pct\": %d, \"pattern\": \"%s\", \"threads\": %d, \"ops\": %ld, \"io_size\": %zu, "
+           "\"backend\": \"%s\", \"engine\": \"%s\", \"repeat\": %d, \"seed\": %u},\n",
+           cfg.files, cfg.size_min, cfg.size_max, cfg.size_log ? "log" : "uniform",
+           cfg.read_pct, cfg.random ? "rand" : "seq", cfg.threads, cfg.ops, cfg.io_size,
+           cfg.backend == MYFS_BACKEND_MMAP ? "mmap" : "stdio", engine_names[cfg.io_engine],
+           cfg.repeat, cfg.seed);
+    printf("  \"results\": {\n");
+}
+
+// Размер очередного файла по распределению из cfg
+static size_t pick_size(unsigned* seed) {
+    if (cfg.size_max <= cfg.size_min) return cfg.size_min;
+    if (!cfg.size_log) return cfg.size_min + (size_t)rand_r(seed) % (cfg.size_max - cfg.size_min + 1);
+
+    // Сначала случайный порядок величины, затем размер внутри него: мелких
+    // файлов столько же, сколько крупных в каждом диапазоне [2^k, 2^(k+1))
+    int lo = 63 - __builtin_clzll(cfg.size_min), hi = 63 - __builtin_clzll(cfg.size_max);
+    int k = lo + rand_r(seed) % (hi - lo + 1);
+    size_t from = (size_t)1 << k, to = ((size_t)2 << k) - 1;
+    if (from < cfg.size_min) from = cfg.size_min;
+    if (to > cfg.size_max) to = cfg.size_max;
+    return from + (size_t)rand_r(seed) % (to - from + 1);
+}
+
+// Проверяет, что файлы наибольшего размера поместятся в образ
+static bool check_capacity(void) {
+    uint64_t blocks = (uint64_t)cfg.files * ((cfg.size_max + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    if (cfg.files > INODE_COUNT || blocks >= BLOCK_COUNT) {
+        fprintf(stderr, "Ошибка: %d файлов до %zu байт не помещаются в образ (%d inode, %d блоков)\n",
+                cfg.files, cfg.size_max, INODE_COUNT, BLOCK_COUNT);
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// Сценарий core: каждая основная операция ФС отдельной фазой — format_fs,
+// create_file, write_file, write_file1, read_file, list_files, delete_file.
+// -----------------------------------------------------------------------------
+
+typedef enum {
+    CORE_FORMAT, CORE_CREATE, CORE_WRITE, CORE_WRITE1, CORE_READ, CORE_LIST, CORE_DELETE, CORE_OPS
+} CoreOp;
+
+static const char* const core_names[CORE_OPS] = {
+    "format_fs", "create_file", "write_file", "write_file1", "read_file", "list_files", "delete_file"
+};
+
+static int bench_core(void) {
+    if (!check_capacity()) return 1;
+    LatencyLog logs[CORE_OPS];
+    double seconds[CORE_OPS];
+    IoCounters before[CORE_OPS], after[CORE_OPS];
+    size_t* sizes = malloc(cfg.files * sizeof(size_t));
+    char* data = malloc(cfg.size_max + 1);
+    char* buffer = malloc(cfg.size_max + APPEND_RECORD + 2);
+    bool ok = sizes && data && buffer;
+    for (int op = 0; op < CORE_OPS; op++) {
+        size_t n = (op == CORE_FORMAT || op == CORE_LIST) ? (size_t)cfg.repeat : (size_t)cfg.files;
+        if (!lat_init(&logs[op], n)) ok = false;
+    }
+    if (!ok) return 1;
+
+    unsigned seed = cfg.seed;
+    for (int i = 0; i < cfg.files; i++) sizes[i] = pick_size(&seed);
+    memset(data, 'w', cfg.size_max);
+    char record[APPEND_RECORD + 1];
+    memset(record, 'r', APPEND_RECORD);
+    record[APPEND_RECORD] = '\0';
+
+    myfs_t* fs = NULL;
+    myfs_options opts = {.backend = cfg.backend, .io_engine = cfg.io_engine};
+    char name[64];
+    for (int op = 0; op < CORE_OPS && ok; op++) {
+        // Сообщения delete_file и таблица list_files не должны попасть в JSON
+        int saved = mute_stdout();
+        io_sample(&before[op]);
+        double phase = now_ns();
+        size_t n = logs[op].cap;
+        for (size_t i = 0; i < n && ok; i++) {
+            snprintf(name, sizeof(name), "file_%zu.dat", i);
+            double start = now_ns();
+            switch ((CoreOp)op) {
+                case CORE_FORMAT:
+                    ok = format_fs(BENCH_IMAGE);
+                    break;
+                case CORE_CREATE:
+                    ok = create_file(fs, name) >= 0;
+                    break;
+                case CORE_WRITE:
+                    data[sizes[i]] = '\0';
+                    ok = write_file(fs, name, data);
+                    data[sizes[i]] = 'w';
+                    break;
+                case CORE_WRITE1:
+                    ok = write_file1(fs, name, record);
+                    break;
+                case CORE_READ:
+                    ok = read_file(fs, name, buffer, cfg.size_max + APPEND_RECORD + 2) > 0;
+                    break;
+                case CORE_LIST:
+                    list_files(fs);
+                    break;
+                case CORE_DELETE:
+                    ok = delete_file(fs, name);
+                    break;
+                default:
+                    break;
+            }
+            lat_add(&logs[op], start);
+        }
+        seconds[op] = (now_ns() - phase) / 1e9;
+        io_sample(&after[op]);
+        unmute_stdout(saved);
+
+        // Изменения фазы фиксируются вне замера
+        if (op == CORE_FORMAT) {
+            fs = ok ? open_fs_ex(BENCH_IMAGE, &opts) : NULL;
+            ok = fs != NULL;
+        } else if (!sync_fs(fs)) {
+            ok = false;
+        }
+        if (!ok) fprintf(stderr, "Ошибка в фазе %s\n", core_names[op]);
+    }
+    if (fs) close_fs(fs);
+
+    if (ok) {
+        json_config("core");
+        for (int op = 0; op < CORE_OPS; op++) {
+            json_op(core_names[op], &logs[op], seconds[op], &before[op], &after[op], op == CORE_OPS - 1);
+        }
+        printf("  }\n}\n");
+    }
+    for (int op = 0; op < CORE_OPS; op++) free(logs[op].ns);
+    free(sizes);
+    free(data);
+    free(buffer);
+    return ok ? 0 : 1;
+}
+
+// -----------------------------------------------------------------------------
+// Сценарий workload: смесь чтений и записей по io_size байт из нескольких
+// потоков над файлами заданных размеров. Последовательный доступ проходит
+// файлы подряд от начала до конца, случайный выбирает файл и смещение.
+// -----------------------------------------------------------------------------
+
+typedef struct {
+    myfs_t* fs;
+    int* ino;
+    size_t* sizes;
+} Workload;
+
+typedef struct {
+    Workload* w;
+    unsigned id;
+    long ops;
+    LatencyLog reads, writes;
+    bool failed;
+} WorkloadThread;
+
+static void* workload_worker(void* p) {
+    WorkloadThread* t = p;
+    Workload* w = t->w;
+    unsigned seed = cfg.seed * 2654435761u + t->id;
+    uint8_t* buf = malloc(cfg.io_size);
+    myfs_file_t** handles = calloc(cfg.files, sizeof(myfs_file_t*));
+    if (!buf || !handles) {
+        t->failed = true;
+        free(buf);
+        free(handles);
+        return NULL;
+    }
+    memset(buf, 'a' + t->id % 26, cfg.io_size);
+
+    // Последовательные потоки начинают с разных файлов
+    int file = (int)(t->id * (unsigned)cfg.files / (unsigned)cfg.threads);
+    uint64_t offset = 0;
+    for (long i = 0; i < t->ops && !t->failed; i++) {
+        if (cfg.random) {
+            file = rand_r(&seed) % cfg.files;
+            size_t chunks = w->sizes[file] / cfg.io_size;
+            offset = chunks > 0 ? (uint64_t)(rand_r(&seed) % chunks) * cfg.io_size : 0;
+        } else if (offset >= w->sizes[file]) {
+            file = (file + 1) % cfg.files;
+            offset = 0;
+        }
+        size_t len = w->sizes[file] - offset < cfg.io_size ? w->sizes[file] - (size_t)offset : cfg.io_size;
+        bool read = rand_r(&seed) % 100 < cfg.read_pct;
+
+        // Дескриптор для записи открывается при первой записи в файл (вне замера)
+        if (!read && !handles[file]) {
+            snprintf((char*)buf, cfg.io_size, "file_%d.dat", file);
+            handles[file] = myfs_open(w->fs, (char*)buf, 0);
+            memset(buf, 'a' + t->id % 26, cfg.io_size);
+            if (!handles[file]) {
+                t->failed = true;
+                break;
+            }
+        }
+
+        double start = now_ns();
+        ssize_t n = read ? myfs_pread(w->fs, w->ino[file], buf, len, offset)
+                         : myfs_pwrite(handles[file], buf, len, offset);
+        lat_add(read ? &t->reads : &t->writes, start);
+        if (n != (ssize_t)len) t->failed = true;
+        offset += len;
+    }
+    for (int f = 0; f < cfg.files; f++) {
+        if (handles[f]) myfs_close(handles[f]);
+    }
+    free(handles);
+    free(buf);
+    return NULL;
+}
+
+// Склеивает журналы потоков в один
+static bool lat_merge(LatencyLog* dst, const LatencyLog* const* src, int n) {
+    size_t total = 0;
+    for (int i = 0; i < n; i++) total += src[i]->count;
+    if (!lat_init(dst, total)) return false;
+    for (int i = 0; i < n; i++) {
+        memcpy(dst->ns + dst->count, src[i]->ns, src[i]->count * sizeof(uint64_t));
+        dst->count += src[i]->count;
+    }
+    return true;
+}
+
+static int bench_workload(void) {
+    if (!check_capacity() || cfg.io_size == 0 || cfg.size_min == 0) {
+        if (cfg.io_size == 0 || cfg.size_min == 0) fprintf(stderr, "Ошибка: нулевой размер файла или запроса\n");
+        return 1;
+    }
+    if (!format_fs(BENCH_IMAGE)) return 1;
+    myfs_options opts = {.backend = cfg.backend, .thread_safe = cfg.threads > 1, .io_engine = cfg.io_engine};
+    Workload w = {.fs = open_fs_ex(BENCH_IMAGE, &opts)};
+    w.ino = malloc(cfg.files * sizeof(int));
+    w.sizes = malloc(cfg.files * sizeof(size_t));
+    char* fill = calloc(1, cfg.size_max);
+    bool ok = w.fs && w.ino && w.sizes && fill;
+
+    // Наполнение файлов (вне замера)
+    unsigned seed = cfg.seed;
+    char name[64];
+    for (int i = 0; i < cfg.files && ok; i++) {
+        snprintf(name, sizeof(name), "file_%d.dat", i);
+        w.sizes[i] = pick_size(&seed);
+        myfs_file_t* f = myfs_open(w.fs, name, MYFS_O_CREAT);
+        ok = f && myfs_pwrite(f, fill, w.sizes[i], 0) == (ssize_t)w.sizes[i];
+        if (f && !myfs_close(f)) ok = false;
+        w.ino[i] = lookup_file(w.fs, name);
+    }
+    free(fill);
+    if (ok) ok = sync_fs(w.fs);
+
+    static WorkloadThread threads[MAX_BENCH_THREADS];
+    pthread_t tid[MAX_BENCH_THREADS];
+    int started = 0;
+    IoCounters before, after;
+    double seconds = 0;
+    if (ok) {
+        for (int t = 0; t < cfg.threads && ok; t++) {
+            long ops = cfg.ops / cfg.threads + (t < cfg.ops % cfg.threads);
+            threads[t] = (WorkloadThread){.w = &w, .id = (unsigned)t, .ops = ops};
+            ok = lat_init(&threads[t].reads, (size_t)ops) && lat_init(&threads[t].writes, (size_t)ops);
+        }
+        io_sample(&before);
+        double start = now_ns();
+        for (; ok && started < cfg.threads; started++) {
+            if (pthread_create(&tid[started], NULL, workload_worker, &threads[started]) != 0) break;
+        }
+        for (int t = 0; t < started; t++) pthread_join(tid[t], NULL);
+        seconds = (now_ns() - start) / 1e9;
+        io_sample(&after);
+        if (started < cfg.threads) ok = false;
+    }
+    for (int t = 0; t < started; t++) {
+        if (threads[t].failed) ok = false;
+    }
+    if (w.fs) close_fs(w.fs);
+
+    if (ok) {
+        const LatencyLog* reads[MAX_BENCH_THREADS];
+        const LatencyLog* writes[MAX_BENCH_THREADS];
+        const LatencyLog* both[2 * MAX_BENCH_THREADS];
+        for (int t = 0; t < started; t++) {
+            reads[t] = both[2 * t] = &threads[t].reads;
+            writes[t] = both[2 * t + 1] = &threads[t].writes;
+        }
+        LatencyLog r, wr, all;
+        ok = lat_merge(&r, reads, started) && lat_merge(&wr, writes, started) &&
+             lat_merge(&all, both, 2 * started);
+        if (ok) {
+            json_config("workload");
+            json_op("read", &r, seconds, NULL, NULL, false);
+            json_op("write", &wr, seconds, NULL, NULL, false);
+            json_op("all", &all, seconds, &before, &after, true);
+            printf("  }\n}\n");
+            free(r.ns);
+            free(wr.ns);
+            free(all.ns);
+        }
+    } else {
+        fprintf(stderr, "Ошибка в сценарии workload\n");
+    }
+    for (int t = 0; t < cfg.threads; t++) {
+        free(threads[t].reads.ns);
+        free(threads[t].writes.ns);
+    }
+    free(w.ino);
+    free(w.sizes);
+    return ok ? 0 : 1;
+}
+
+typedef struct {
+    const char* name;
+    int (*run)(void);
+    bool json;               // Выводит JSON (без заголовка сценария)
+} Scenario;
+
+static const Scenario scenarios[] = {
+    {"lookup", bench_lookup, false},
+    {"alloc", bench_alloc, false},
+    {"seq", bench_seq, false},
+    {"append", bench_append, false},
+    {"journal", bench_journal, false},
+    {"cache", bench_cache, false},
+    {"readahead", bench_readahead, false},
+    {"compress", bench_compress, false},
+    {"small", bench_small, false},
+    {"threads", bench_threads, false},
+    {"batch", bench_batch, false},
+    {"core", bench_core, true},
+    {"workload", bench_workload, true},
+};
+
+// Размер с необязательным суффиксом k/m: 4096, 64k, 1m
+static bool parse_size(const char* s, size_t* out) {
+    char* end;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (end == s) return false;
+    if (*end == 'k' || *end == 'K') v <<= 10, end++;
+    else if (*end == 'm' || *end == 'M') v <<= 20, end++;
+    *out = (size_t)v;
+    return *end == '\0' || *end == '-';
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Использование: ./bench [сценарий] [параметры]\n"
+            "Параметры сценариев core и workload:\n"
+            "  --files=N          число файлов (%d)\n"
+            "  --size=S[-MAX]     размер файла или диапазон размеров, суффиксы k/m (%zu)\n"
+            "  --dist=uniform|log распределение размеров в диапазоне\n"
+            "  --read=PCT         доля чтений в workload, %% (%d)\n"
+            "  --pattern=seq|rand порядок доступа в workload\n"
+            "  --threads=N        потоков в workload (%d, до %d)\n"
+            "  --ops=N            операций в workload (%ld)\n"
+            "  --io=S             размер чтения/записи в workload (%zu)\n"
+            "  --backend=stdio|mmap\n"
+            "  --engine=sync|uring|threads исполнитель ввода-вывода\n"
+            "  --repeat=N         повторы format_fs и list_files в core (%d)\n"
+            "  --seed=N\n",
+            cfg.files, cfg.size_min, cfg.read_pct, cfg.threads, MAX_BENCH_THREADS, cfg.ops,
+            cfg.io_size, cfg.repeat);
+}
+
+static bool parse_options(int argc, char** argv) {
+    static const struct option longopts[] = {
+        {"files", required_argument, NULL, 'f'},
+        {"size", required_argument, NULL, 's'},
+        {"dist", required_argument, NULL, 'd'},
+        {"read", required_argument, NULL, 'r'},
+        {"pattern", required_argument, NULL, 'p'},
+        {"threads", required_argument, NULL, 't'},
+        {"ops", required_argument, NULL, 'o'},
+        {"io", required_argument, NULL, 'i'},
+        {"backend", required_argument, NULL, 'b'},
+        {"engine", required_argument, NULL, 'g'},
+        {"repeat", required_argument, NULL, 'n'},
+        {"seed", required_argument, NULL, 'e'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+        bool ok = true;
+        switch (opt) {
+            case 'f': cfg.files = atoi(optarg); ok = cfg.files > 0; break;
+            case 's': {
+                ok = parse_size(optarg, &cfg.size_min);
+                const char* dash = strchr(optarg, '-');
+                cfg.size_max = cfg.size_min;
+                if (ok && dash) ok = parse_size(dash + 1, &cfg.size_max) && cfg.size_max >= cfg.size_min;
+                ok = ok && cfg.size_min > 0;
+                break;
+            }
+            case 'd': cfg.size_log = strcmp(optarg, "log") == 0; ok = cfg.size_log || strcmp(optarg, "uniform") == 0; break;
+            case 'r': cfg.read_pct = atoi(optarg); ok = cfg.read_pct >= 0 && cfg.read_pct <= 100; break;
+            case 'p': cfg.random = strcmp(optarg, "rand") == 0; ok = cfg.random || strcmp(optarg, "seq") == 0; break;
+            case 't': cfg.threads = atoi(optarg); ok = cfg.threads > 0 && cfg.threads <= MAX_BENCH_THREADS; break;
+            case 'o': cfg.ops = atol(optarg); ok = cfg.ops > 0; break;
+            case 'i': ok = parse_size(optarg, &cfg.io_size) && cfg.io_size > 0; break;
+            case 'b':
+                cfg.backend = strcmp(optarg, "mmap") == 0 ? MYFS_BACKEND_MMAP : MYFS_BACKEND_STDIO;
+                ok = cfg.backend == MYFS_BACKEND_MMAP || strcmp(optarg, "stdio") == 0;
+                break;
+            case 'g':
+                ok = false;
+                for (int e = 0; e < 3; e++) {
+                    if (strcmp(optarg, engine_names[e]) == 0) {
+                        cfg.io_engine = (myfs_io_engine)e;
+                        ok = true;
+                    }
+                }
+                break;
+            case 'n': cfg.repeat = atoi(optarg); ok = cfg.repeat > 0; break;
+            case 'e': cfg.seed = (unsigned)strtoul(optarg, NULL, 10); break;
+            default: ok = false; break;
+        }
+        if (!ok) {
+            if (opt != '?') fprintf(stderr, "Недопустимое значение параметра: %s\n", argv[optind - 1]);
+            return false;
+        }
+    }
+    return optind == argc;
+}
+
+int main(int argc, char** argv) {
+    // Параметры идут после имени сценария
+    if (argc > 2 && !parse_options(argc - 1, argv + 1)) {
+        usage();
+        return 2;
+    }
+    int rc = 0;
+    bool found = false;
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        if (argc > 1 && strcmp(argv[1], scenarios[i].name) != 0) continue;
+        found = true;
+        if (!scenarios[i].json) printf("== %s ==\n", scenarios[i].name);
+        rc |= scenarios[i].run();
+        fflush(stdout);
+    }
+    remove(BENCH_IMAGE);
+    if (!found) {
+        usage();
+        return 2;
+    }
+    return rc;
+}
@@ -22,6 +22,9 @@ void show_menu() {
     printf("%s 6.%s ➕ Дозаписать в файл\n", GREEN, RESET);
     printf("%s 7.%s 📖 Прочитать файл\n", GREEN, RESET);
     printf("%s 8.%s ℹ️  Описание команд\n", GREEN, RESET);
+    printf("%s 9.%s 📁 Создать каталог\n", GREEN, RESET);
+    printf("%s10.%s 🗑️  Удалить каталог\n", GREEN, RESET);
+    printf("%s11.%s 🗂️  Содержимое каталога\n", GREEN, RESET);
     printf("%s 0.%s 🚪 Выход\n", RED, RESET);
     printf("%sВыбор:%s ", BOLD, RESET);
 }
@@ -36,9 +39,30 @@ void show_help() {
     printf("6. Дозаписать — добавляет текст в конец файла\n");
     printf("7. Прочитать файл — выводит содержимое файла\n");
     printf("8. Описание — выводит эту справку\n");
+    printf("9. Создать каталог — имена файлов могут быть путями через '/' (docs/a.txt)\n");
+    printf("10. Удалить каталог — удаляет пустой каталог\n");
+    printf("11. Содержимое каталога — записи одного каталога (пустой ввод — корень)\n");
     printf("0. Выход — завершает программу\n");
 }
 
+// Выводит очередной фрагмент файла в stdout (обработчик myfs_read_stream)
+static bool print_chunk(const void* data, size_t len, uint64_t offset, void* ctx) {
+    (void)offset;
+    (void)ctx;
+    return fwrite(data, 1, len, stdout) == len;
+}
+
+// Выводит запись каталога (обработчик myfs_list_dir)
+static bool print_entry(const myfs_dirent* e, void* ctx) {
+    (void)ctx;
+    if (e->is_dir) {
+        printf("%-6d %-30s %s\n", e->ino, e->name, "<DIR>");
+    } else {
+        printf("%-6d %-30s %llu\n", e->ino, e->name, (unsigned long long)e->size);
+    }
+    return true;
+}
+
 // Автор: Тимур
 char* read_multiline_input() {
     printf("Введите данные (завершите Ctrl+D или Ctrl+Z):\n\n");
@@ -63,7 +87,7 @@ char* read_multiline_input() {
 
 int main() {
     const char* fs_name = "disk.img";
-    FILE* fs = NULL;
+    myfs_t* fs = NULL;
 
     // Автоинициализация ФС
     FILE* test = fopen(fs_name, "rb");
@@ -93,6 +117,11 @@ int main() {
 
         switch (choice) {
             case 1:
+                // Метаданные смонтированной ФС живут в памяти — перед форматированием отмонтируем её
+                if (fs) {
+                    close_fs(fs);
+                    fs = NULL;
+                }
                 if (format_fs(fs_name)) {
                     printf("%s[ОК]%s ФС успешно отформатирована и инициализирована\n", GREEN, RESET);
                 } else {
@@ -187,11 +216,17 @@ int main() {
                     fgets(filename, sizeof(filename), stdin);
                     filename[strcspn(filename, "\n")] = '\0';
 
-                    char buffer[1024];
-                    if (read_file(fs, filename, buffer, sizeof(buffer))) {
-                        printf("Содержимое файла:\n%s\n", buffer);
+                    // Файл выводится потоком, без ограничения на размер буфера
+                    int ino = lookup_file(fs, filename);
+                    if (ino < 0) {
+                        printf("Файл '%s' не найден\n", filename);
                     } else {
-                        printf("Ошибка чтения\n");
+                        printf("Содержимое файла:\n");
+                        if (myfs_read_stream(fs, ino, 0, print_chunk, NULL)) {
+                            printf("\n");
+                        } else {
+                            printf("\nОшибка чтения\n");
+                        }
                     }
                 }
                 break;
@@ -200,6 +235,47 @@ int main() {
                 show_help();
                 break;
 
+            case 9:
+                if (!fs) fs = open_fs(fs_name);
+                if (fs) {
+                    printf("Путь каталога: ");
+                    fgets(filename, sizeof(filename), stdin);
+                    filename[strcspn(filename, "\n")] = '\0';
+                    if (myfs_mkdir(fs, filename) >= 0) {
+                        printf("Каталог создан\n");
+                    } else {
+                        printf("Ошибка создания каталога\n");
+                    }
+                }
+                break;
+
+            case 10:
+                if (!fs) fs = open_fs(fs_name);
+                if (fs) {
+                    printf("Путь каталога: ");
+                    fgets(filename, sizeof(filename), stdin);
+                    filename[strcspn(filename, "\n")] = '\0';
+                    if (myfs_rmdir(fs, filename)) {
+                        printf("Каталог удалён\n");
+                    } else {
+                        printf("Ошибка удаления каталога\n");
+                    }
+                }
+                break;
+
+            case 11:
+                if (!fs) fs = open_fs(fs_name);
+                if (fs) {
+                    printf("Путь каталога: ");
+                    fgets(filename, sizeof(filename), stdin);
+                    filename[strcspn(filename, "\n")] = '\0';
+                    printf("\n%-6s %-30s %s\n", "INODE", "NAME", "SIZE");
+                    if (!myfs_list_dir(fs, filename, print_entry, NULL)) {
+                        printf("Ошибка чтения каталога\n");
+                    }
+                }
+                break;
+
             case 0:
                 if (fs) close_fs(fs);
                 printf("%sДо свидания!%s\n", CYAN, RESET);
@@ -1,54 +1,4135 @@
+#define _GNU_SOURCE
+// linux/io_uring.h подключает linux/fs.h со своим BLOCK_SIZE (1024): он
+// подключается первым, а макрос убирается до определения в myfs.h
+#include <linux/io_uring.h>
+#undef BLOCK_SIZE
 #include "myfs.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
 
 #define FS_MAGIC 0x4D594653 // "MYFS"
 
+// -----------------------------------------------------------------------------
+// Смонтированная файловая система: резидентные метаданные
+// -----------------------------------------------------------------------------
+
+// Ёмкость хеш-индекса имён — степень двойки, не меньше 2 * inode_count,
+// чтобы заполненность открытой адресации не превышала 1/2
+#define NAME_INDEX_EMPTY    (-1)
+
+// Ячейка индекса имён: хеш имени и номер inode (NAME_INDEX_EMPTY — ячейка свободна)
+typedef struct {
+    uint32_t hash;
+    int32_t ino;
+} NameSlot;
+
+// Кадр буферного кэша блоков (см. раздел «Буферный кэш блоков»)
+typedef struct {
+    uint32_t block;          // Номер блока образа (смещение / block_size)
+    bool valid;              // Кадр занят
+    bool dirty;              // Содержимое изменено и не записано в образ
+    bool ref;                // Бит обращения для алгоритма CLOCK
+    bool pinned;             // Заполняется cache_load_run: вытеснять нельзя
+} CacheFrame;
+
+// Доля статистики операций одной группы потоков (см. раздел «Статистика»)
+typedef struct {
+    myfs_stats s;
+} __attribute__((aligned(64))) StatsShard;
+
+// Загруженный inode вместе с картой экстентов (см. раздел «Кэш inode»)
+typedef struct CachedInode CachedInode;
+
+struct myfs {
+    myfs_backend backend;                     // Способ доступа к образу
+    FILE* fp;                                 // Открытый файл образа ФС (MYFS_BACKEND_STDIO)
+    long fp_pos;                              // Позиция потока после последней операции (-1 — неизвестна)
+    bool fp_writing;                          // Последней операцией с потоком была запись
+
+    // Буферный кэш блоков образа (режим stdio; NULL — выключен)
+    CacheFrame* cache;                        // Кадры
+    uint8_t* cache_data;                      // Содержимое кадров, block_size на кадр
+    int32_t* cache_index;                     // Хеш «блок образа -> кадр», открытая адресация
+    uint32_t cache_index_mask;
+    uint32_t cache_frames;                    // Всего кадров
+    uint32_t cache_used;                      // Кадров, занятых хотя бы раз
+    uint32_t cache_hand;                      // Стрелка CLOCK
+    myfs_cache_stats cache_stats;
+    int fd;                                   // Дескриптор файла образа (MYFS_BACKEND_MMAP)
+    uint8_t* map;                             // Отображение образа в память (MYFS_BACKEND_MMAP)
+    size_t map_size;                          // Размер отображения
+
+    // Геометрия образа из суперблока (см. раздел «Геометрия»). Размер блока —
+    // степень двойки, поэтому деление на него заменяется сдвигом
+    uint32_t block_size;
+    uint32_t block_shift;                     // log2(block_size)
+    int inode_count;                          // Номера inode в API — int
+    uint32_t block_count;
+    size_t inode_bitmap_size;                 // Байт в битовой карте inode
+    size_t block_bitmap_size;                 // Байт в битовой карте блоков
+
+    // Метаданные: в режиме stdio указывают на копии ниже, в режиме mmap — прямо в отображение
+    SuperBlock* sb;
+    uint8_t* inode_bitmap;
+    uint8_t* block_bitmap;
+    SuperBlock sb_copy;                       // Копия суперблока в памяти
+    uint8_t* inode_bitmap_copy;               // Копия битовой карты inode
+    uint8_t* block_bitmap_copy;               // Копия битовой карты блоков
+
+    bool sb_dirty;                            // Суперблок изменён и не записан
+    bool inode_bitmap_dirty;                  // Битовая карта inode изменена и не записана
+    bool block_bitmap_dirty;                  // Битовая карта блоков изменена и не записана
+    size_t dirty_lo, dirty_hi;                // mmap: диапазон отображения, изменённый write_region
+
+    uint32_t block_cursor;                    // Подсказка next-fit: с какого блока начинать поиск
+    uint32_t inode_hint;                      // Все inode ниже этого номера заняты (подсказка first-fit)
+
+    // Журнал метаданных (режим stdio): текущая транзакция копится в памяти
+    bool journal;                             // Метаданные пишутся через журнал
+    uint8_t* txn_buf;                         // Записи JournalRecord транзакции подряд
+    size_t txn_len, txn_cap;
+    uint32_t txn_records;
+    struct TxnSlot* txn_index;                // Индекс записей транзакции по гранулам образа
+    size_t txn_index_cap, txn_index_used;
+    uint32_t txn_gen;                         // Поколение транзакции: слоты прошлых поколений пусты
+    uint64_t txn_start_ns;                    // Когда в транзакции появились первые изменения (0 — пусто)
+    uint64_t commit_latency_ns;               // Допустимая задержка групповой фиксации
+    bool sync_each_op;                        // Фиксировать после каждой операции
+    uint32_t journal_head;                    // Смещение следующей транзакции внутри журнала
+    uint32_t journal_next_seq;                // Номер следующей транзакции
+    bool trim_pending;                        // Есть освобождённые блоки, дыры в которых ещё не пробиты
+    struct myfs_batch* batch;                 // Пакет, который сейчас фиксируется (см. раздел «Пакеты»)
+
+    NameSlot* name_index;                     // Хеш-индекс «(каталог, имя) -> номер inode»
+    uint32_t name_index_mask;                 // Ёмкость индекса минус 1
+    char** names;                             // Имена занятых inode (для сравнения без чтения с диска)
+    int32_t* parent;                          // Каталог каждого занятого inode (ROOT_DIR — корень)
+    bool* is_dir;                             // Занятый inode — каталог
+    int32_t* dir_first;                       // Первая запись каталога: [ROOT_DIR + 1] — корня, [ino + 1] — каталога ino
+    int32_t* dir_next;                        // Следующая и предыдущая запись того же каталога (-1 — нет)
+    int32_t* dir_prev;
+    CachedInode** inodes;                     // Кэш inode и их карт экстентов (загружаются при первом обращении)
+    uint16_t* open_count;                     // Число открытых дескрипторов на каждый inode
+
+    // Потокобезопасный режим (см. раздел «Блокировки»)
+    bool thread_safe;
+    pthread_rwlock_t meta_lock;
+    pthread_mutex_t io_lock;
+    pthread_rwlock_t* inode_locks;            // По одной на inode
+
+    // Совместный доступ нескольких процессов (см. раздел «Совместный доступ»)
+    bool shared;
+    bool pio;                                 // Образ читается и пишется через pread/pwrite
+    uint32_t generation;                      // sb->generation, с которым совпадают копии битовых карт
+    uint32_t name_generation;                 // sb->name_generation, по которому построен индекс имён
+
+    StatsShard* stats;                        // STATS_SHARDS долей статистики операций
+
+    // Исполнитель ввода-вывода (см. раздел «Исполнитель ввода-вывода»)
+    myfs_io_engine io_engine;                 // Фактический: без io_uring — MYFS_IO_THREADS
+    struct IoRing* ring;                      // Кольцо io_uring (MYFS_IO_URING, режим stdio)
+    struct IoPool* pool;                      // Пул потоков: пакеты MYFS_IO_THREADS и асинхронные чтения
+
+    uint32_t readahead_max;                   // Наибольшее окно упреждающего чтения, блоков (0 — выключено)
+    bool compress;                            // Сжимать все записываемые файлы (см. раздел «Сжатые файлы»)
+    uint64_t cluster_gen;                     // Последнее выданное поколение таблицы кластеров
+};
+
+// -----------------------------------------------------------------------------
+// Блокировки потокобезопасного режима (myfs_options.thread_safe). Без него
+// все функции раздела ничего не делают.
+//   inode_locks[ino] — чтение данных файла идёт параллельно, изменение — под
+//                      исключительной блокировкой; защищает CachedInode;
+//   meta_lock        — битовые карты, суперблок, аллокатор, транзакция журнала,
+//                      таблица кэша inode, индекс имён, open_count;
+//   io_lock          — буферный кэш блоков и диапазон изменений mmap.
+// Порядок захвата: inode -> meta_lock -> io_lock. Сами данные файлов читаются
+// и пишутся без meta_lock: блоки файла меняет только владелец его блокировки.
+// В режиме shared блокировки inode и meta_lock — блокировки fcntl на участки
+// образа (см. раздел «Совместный доступ»).
+// -----------------------------------------------------------------------------
+
+static void shared_meta_lock(myfs_t* fs, short type);
+static void shared_meta_unlock(myfs_t* fs);
+static void shared_inode_lock(myfs_t* fs, int ino, short type);
+static void shared_inode_unlock(myfs_t* fs, int ino);
+
+static int image_fd(const myfs_t* fs) {
+    return fs->fp ? fileno(fs->fp) : fs->fd;
+}
+
+// Функция: range_lock
+// Назначение: Блокировка fcntl участка образа [start, start + len): F_RDLCK,
+// F_WRLCK (с ожиданием) или F_UNLCK. Блокировки OFD принадлежат открытому
+// файлу, а не процессу: их не снимает закрытие другого дескриптора того же
+// образа, и два монтирования в одном процессе исключают друг друга.
+static bool range_lock(myfs_t* fs, off_t start, off_t len, short type) {
+    struct flock fl = {.l_type = type, .l_whence = SEEK_SET, .l_start = start, .l_len = len};
+    while (fcntl(image_fd(fs), F_OFD_SETLKW, &fl) != 0) {
+        if (errno != EINTR) {
+            perror("Ошибка блокировки участка образа");
+            return false;
+        }
+    }
+    return true;
+}
+
+static void meta_rdlock(myfs_t* fs) {
+    if (fs->thread_safe) pthread_rwlock_rdlock(&fs->meta_lock);
+    if (fs->shared) shared_meta_lock(fs, F_RDLCK);
+}
+
+static void meta_wrlock(myfs_t* fs) {
+    if (fs->thread_safe) pthread_rwlock_wrlock(&fs->meta_lock);
+    if (fs->shared) shared_meta_lock(fs, F_WRLCK);
+}
+
+static void meta_unlock(myfs_t* fs) {
+    if (fs->shared) shared_meta_unlock(fs);
+    if (fs->thread_safe) pthread_rwlock_unlock(&fs->meta_lock);
+}
+
+static void inode_lock(myfs_t* fs, int ino, bool write) {
+    if (fs->shared) shared_inode_lock(fs, ino, write ? F_WRLCK : F_RDLCK);
+    if (!fs->thread_safe) return;
+    if (write) {
+        pthread_rwlock_wrlock(&fs->inode_locks[ino]);
+    } else {
+        pthread_rwlock_rdlock(&fs->inode_locks[ino]);
+    }
+}
+
+static void inode_unlock(myfs_t* fs, int ino) {
+    if (fs->thread_safe) pthread_rwlock_unlock(&fs->inode_locks[ino]);
+    if (fs->shared) shared_inode_unlock(fs, ino);
+}
+
+static void io_lock(myfs_t* fs) {
+    if (fs->thread_safe) pthread_mutex_lock(&fs->io_lock);
+}
+
+static void io_unlock(myfs_t* fs) {
+    if (fs->thread_safe) pthread_mutex_unlock(&fs->io_lock);
+}
+
+// Функция: locks_init
+// Назначение: Включает потокобезопасный режим. Вызывается в конце
+// монтирования, когда остальные потоки ещё не видят дескриптор.
+static bool locks_init(myfs_t* fs) {
+    fs->inode_locks = malloc(fs->inode_count * sizeof(pthread_rwlock_t));
+    if (!fs->inode_locks) return false;
+    for (int i = 0; i < fs->inode_count; i++) {
+        pthread_rwlock_init(&fs->inode_locks[i], NULL);
+    }
+    pthread_rwlock_init(&fs->meta_lock, NULL);
+    pthread_mutex_init(&fs->io_lock, NULL);
+    fs->thread_safe = true;
+    return true;
+}
+
+static void locks_free(myfs_t* fs) {
+    if (!fs->inode_locks) return;
+    for (int i = 0; i < fs->inode_count; i++) {
+        pthread_rwlock_destroy(&fs->inode_locks[i]);
+    }
+    free(fs->inode_locks);
+    fs->inode_locks = NULL;
+    pthread_rwlock_destroy(&fs->meta_lock);
+    pthread_mutex_destroy(&fs->io_lock);
+    fs->thread_safe = false;
+}
+
+// -----------------------------------------------------------------------------
+// Статистика операций (myfs_get_stats). Счётчики разбиты на STATS_SHARDS долей
+// по строке кэша и больше: поток пишет только в свою долю, поэтому потоки не
+// делят строки кэша, а чтение статистики складывает доли. Без потокобезопасного
+// режима счётчики увеличиваются обычным сложением, в нём — атомарным (долю
+// делят потоки с одинаковым номером по модулю STATS_SHARDS).
+// Время меряется только у внешней публичной операции: вложенные вызовы
+// (myfs_open внутри write_file1) отдельно не учитываются.
+// -----------------------------------------------------------------------------
+
+#define STATS_SHARDS 16
+
+static _Thread_local int stats_shard_id = -1;  // Доля текущего потока
+static _Thread_local int op_depth;             // Глубина вложенности публичных операций
+static unsigned stats_next_shard;              // Раздача долей новым потокам
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static myfs_stats* stats_shard(const myfs_t* fs) {
+    if (stats_shard_id < 0) {
+        stats_shard_id = (int)(__atomic_fetch_add(&stats_next_shard, 1, __ATOMIC_RELAXED) % STATS_SHARDS);
+    }
+    return &fs->stats[stats_shard_id].s;
+}
+
+static void stat_add(const myfs_t* fs, uint64_t* counter, uint64_t n) {
+    if (fs->thread_safe) __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+    else *counter += n;
+}
+
+#define STAT_ADD(fs, field, n) stat_add((fs), &stats_shard(fs)->field, (uint64_t)(n))
+
+// Функция: op_begin / op_end
+// Назначение: Обрамляют публичную операцию. op_begin возвращает время начала
+// (0 — вложенный вызов, он не учитывается); op_end добавляет вызов в счётчики
+// и гистограмму операции op. Каждому op_begin соответствует ровно один op_end.
+static uint64_t op_begin(void) {
+    return op_depth++ == 0 ? monotonic_ns() : 0;
+}
+
+static void op_end(myfs_t* fs, myfs_op op, uint64_t start, bool ok) {
+    op_depth--;
+    if (start == 0 || !fs || !fs->stats) return;
+    uint64_t ns = monotonic_ns() - start;
+    int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+    if (bucket >= MYFS_STATS_BUCKETS) bucket = MYFS_STATS_BUCKETS - 1;
+
+    myfs_op_stats* st = &stats_shard(fs)->ops[op];
+    stat_add(fs, &st->calls, 1);
+    if (!ok) stat_add(fs, &st->errors, 1);
+    stat_add(fs, &st->total_ns, ns);
+    stat_add(fs, &st->hist[bucket], 1);
+}
+
+// Учитывает запрос к участку образа: данные или метаданные
+static void stat_region(const myfs_t* fs, long offset, size_t size, bool write) {
+    bool data = offset >= (long)fs->sb->data_start &&
+                (fs->sb->journal_size == 0 || offset < (long)fs->sb->journal_start);
+    myfs_stats* st = stats_shard(fs);
+    if (write) {
+        stat_add(fs, data ? &st->data_writes : &st->meta_writes, 1);
+        stat_add(fs, &st->bytes_written, size);
+    } else {
+        stat_add(fs, data ? &st->data_reads : &st->meta_reads, 1);
+        stat_add(fs, &st->bytes_read, size);
+    }
+}
+
+/**
+ * Возвращает статистику операций смонтированной ФС (сумму долей всех потоков).
+ * Счётчики читаются без остановки других потоков: снимок не атомарен, но
+ * каждый счётчик монотонен.
+ * @param fs    Указатель на открытую файловую систему
+ * @param stats Куда записать статистику
+ * @return      false при неверных параметрах
+ */
+bool myfs_get_stats(myfs_t* fs, myfs_stats* stats) {
+    if (!fs || !stats || !fs->stats) return false;
+    memset(stats, 0, sizeof(*stats));
+    uint64_t* dst = (uint64_t*)stats;
+    for (int i = 0; i < STATS_SHARDS; i++) {
+        const uint64_t* src = (const uint64_t*)&fs->stats[i].s;
+        for (size_t k = 0; k < sizeof(myfs_stats) / sizeof(uint64_t); k++) {
+            dst[k] += __atomic_load_n(&src[k], __ATOMIC_RELAXED);
+        }
+    }
+    return true;
+}
+
+// Обнуляет статистику (вызовы, идущие в это время в других потоках, могут
+// оказаться учтены частично)
+void myfs_reset_stats(myfs_t* fs) {
+    if (!fs || !fs->stats) return;
+    for (int i = 0; i < STATS_SHARDS; i++) {
+        uint64_t* p = (uint64_t*)&fs->stats[i].s;
+        for (size_t k = 0; k < sizeof(myfs_stats) / sizeof(uint64_t); k++) {
+            __atomic_store_n(&p[k], 0, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Имя операции для отчётов: совпадает с именем функции API
+const char* myfs_op_name(myfs_op op) {
+    static const char* const names[MYFS_OP_COUNT] = {
+        [MYFS_OP_OPEN_FS] = "open_fs",
+        [MYFS_OP_SYNC] = "sync_fs",
+        [MYFS_OP_CREATE] = "create_file",
+        [MYFS_OP_DELETE] = "delete_file",
+        [MYFS_OP_LIST] = "list_files",
+        [MYFS_OP_LOOKUP] = "lookup_file",
+        [MYFS_OP_WRITE_FILE] = "write_file",
+        [MYFS_OP_WRITE_FILE1] = "write_file1",
+        [MYFS_OP_READ_FILE] = "read_file",
+        [MYFS_OP_PREAD] = "myfs_pread",
+        [MYFS_OP_READ_STREAM] = "myfs_read_stream",
+        [MYFS_OP_OPEN] = "myfs_open",
+        [MYFS_OP_CLOSE] = "myfs_close",
+        [MYFS_OP_PWRITE] = "myfs_pwrite",
+        [MYFS_OP_TRUNCATE] = "myfs_truncate",
+        [MYFS_OP_APPEND] = "myfs_append",
+        [MYFS_OP_NEXT_FILE] = "myfs_next_file",
+        [MYFS_OP_IMPORT] = "myfs_import_fd",
+        [MYFS_OP_EXPORT] = "myfs_export_fd",
+        [MYFS_OP_BATCH_COMMIT] = "myfs_batch_commit",
+        [MYFS_OP_MKDIR] = "myfs_mkdir",
+        [MYFS_OP_RMDIR] = "myfs_rmdir",
+        [MYFS_OP_LIST_DIR] = "myfs_list_dir",
+        [MYFS_OP_SET_COMPRESSED] = "myfs_set_compressed",
+    };
+    return (unsigned)op < MYFS_OP_COUNT ? names[op] : NULL;
+}
+
+// -----------------------------------------------------------------------------
+// Геометрия образа. Размер блока, количество inode и блоков задаются при
+// форматировании и хранятся в суперблоке; при монтировании они проверяются,
+// копируются в дескриптор, и под них выделяются резидентные массивы. Размер
+// блока — степень двойки, поэтому номер блока и смещение внутри него
+// вычисляются сдвигом и маской, без деления.
+// -----------------------------------------------------------------------------
+
+static bool is_pow2(uint32_t x) {
+    return x != 0 && (x & (x - 1)) == 0;
+}
+
+static uint64_t align_up(uint64_t x, uint32_t align) {
+    return (x + align - 1) & ~(uint64_t)(align - 1);
+}
+
+// Номер блока, в котором лежит байт offset (образа или файла)
+static uint32_t block_index(const myfs_t* fs, uint64_t offset) {
+    return (uint32_t)(offset >> fs->block_shift);
+}
+
+// Смещение байта offset внутри его блока
+static size_t block_within(const myfs_t* fs, uint64_t offset) {
+    return (size_t)(offset & (fs->block_size - 1));
+}
+
+// Сколько блоков занимают bytes байт
+static uint32_t blocks_for(const myfs_t* fs, uint64_t bytes) {
+    return (uint32_t)((bytes + fs->block_size - 1) >> fs->block_shift);
+}
+
+// Размер журнала для геометрии: битовые карты при фиксации пишутся в журнал
+// целиком, и транзакция с обеими должна занимать не больше четверти журнала
+static uint32_t journal_size_for(uint32_t block_size, uint32_t inode_count, uint32_t block_count) {
+    uint64_t size = 4 * ((uint64_t)(inode_count + 7) / 8 + (block_count + 7) / 8);
+    if (size < JOURNAL_SIZE) size = JOURNAL_SIZE;
+    return (uint32_t)align_up(size, block_size);
+}
+
+// Функция: layout_compute
+// Назначение: Заполняет геометрию и смещения областей суперблока нового
+// образа. Области идут подряд, каждая с границы блока; таблица inode и
+// область имён занимают ровно inode_count записей.
+// Возвращает: false, если параметры недопустимы (сообщение выводится)
+static bool layout_compute(SuperBlock* sb, uint32_t block_size, uint32_t inode_count, uint32_t block_count) {
+    if (!is_pow2(block_size) || block_size < MYFS_MIN_BLOCK_SIZE || block_size > MYFS_MAX_BLOCK_SIZE) {
+        fprintf(stderr, "Ошибка: размер блока %u — не степень двойки от %u до %u\n",
+                block_size, MYFS_MIN_BLOCK_SIZE, MYFS_MAX_BLOCK_SIZE);
+        return false;
+    }
+    if (inode_count == 0 || inode_count % 8 != 0 || block_count == 0 || block_count % 8 != 0) {
+        fprintf(stderr, "Ошибка: количество inode (%u) и блоков (%u) должно быть положительным и кратным 8\n",
+                inode_count, block_count);
+        return false;
+    }
+
+    uint64_t inode_bitmap = align_up(sizeof(SuperBlock), block_size);
+    uint64_t block_bitmap = inode_bitmap + align_up(inode_count / 8, block_size);
+    uint64_t inode_table = block_bitmap + align_up(block_count / 8, block_size);
+    uint64_t name_table = inode_table + align_up((uint64_t)inode_count * sizeof(Inode), block_size);
+    uint64_t data_start = name_table + align_up((uint64_t)inode_count * MYFS_NAME_SLOT, block_size);
+    uint64_t journal_start = data_start + (uint64_t)block_count * block_size;
+    uint32_t journal_size = journal_size_for(block_size, inode_count, block_count);
+    if (journal_start + journal_size > UINT32_MAX) {
+        fprintf(stderr, "Ошибка: образ с такой геометрией больше 4 ГиБ\n");
+        return false;
+    }
+
+    sb->block_size = block_size;
+    sb->inode_count = inode_count;
+    sb->block_count = block_count;
+    sb->free_inodes = inode_count;
+    sb->free_blocks = block_count - 1;  // Блок 0 зарезервирован
+    sb->inode_bitmap = (uint32_t)inode_bitmap;
+    sb->block_bitmap = (uint32_t)block_bitmap;
+    sb->inode_table = (uint32_t)inode_table;
+    sb->name_table = (uint32_t)name_table;
+    sb->data_start = (uint32_t)data_start;
+    sb->journal_start = (uint32_t)journal_start;
+    sb->journal_size = journal_size;
+    sb->version = MYFS_VERSION;
+    return true;
+}
+
+// Функция: geometry_init
+// Назначение: Проверяет геометрию суперблока смонтированного образа и
+// выделяет под неё массивы дескриптора. Смещения областей берутся из
+// суперблока. У образа v1 (его открывает только myfs_convert_v1) таблица
+// inode могла заходить в область данных, поэтому её размер не проверяется.
+static bool geometry_init(myfs_t* fs) {
+    const SuperBlock* sb = fs->sb;
+    uint64_t inode_bitmap_size = (sb->inode_count + 7) / 8;
+    uint64_t block_bitmap_size = (sb->block_count + 7) / 8;
+    uint64_t table_end = sb->inode_table + (uint64_t)sb->inode_count * sizeof(Inode);
+    uint64_t names_end = sb->name_table + (uint64_t)sb->inode_count * MYFS_NAME_SLOT;
+    bool v2 = sb->version == MYFS_VERSION;
+    if (!is_pow2(sb->block_size) || sb->block_size < MYFS_MIN_BLOCK_SIZE || sb->block_size > MYFS_MAX_BLOCK_SIZE) {
+        fprintf(stderr, "Ошибка: недопустимый размер блока (%u)\n", sb->block_size);
+        return false;
+    }
+    if (sb->inode_count == 0 || sb->inode_count > INT32_MAX || sb->block_count < 2 || sb->inode_bitmap < sizeof(SuperBlock) ||
+        sb->inode_bitmap + inode_bitmap_size > sb->block_bitmap ||
+        sb->block_bitmap + block_bitmap_size > sb->inode_table || sb->inode_table >= sb->data_start ||
+        (v2 && (table_end > sb->name_table || names_end > sb->data_start))) {
+        fprintf(stderr, "Ошибка: повреждена геометрия в суперблоке\n");
+        return false;
+    }
+
+    fs->block_size = sb->block_size;
+    fs->block_shift = (uint32_t)__builtin_ctz(sb->block_size);
+    fs->inode_bitmap_size = (size_t)inode_bitmap_size;
+    fs->block_bitmap_size = (size_t)block_bitmap_size;
+
+    uint32_t capacity = 1;
+    while (capacity < 2 * sb->inode_count) capacity <<= 1;
+    fs->name_index = malloc(capacity * sizeof(NameSlot));
+    fs->name_index_mask = capacity - 1;
+    fs->names = calloc(sb->inode_count, sizeof(char*));
+    fs->parent = malloc(sb->inode_count * sizeof(int32_t));
+    fs->is_dir = calloc(sb->inode_count, sizeof(bool));
+    fs->dir_first = malloc(((size_t)sb->inode_count + 1) * sizeof(int32_t));
+    fs->dir_next = malloc(sb->inode_count * sizeof(int32_t));
+    fs->dir_prev = malloc(sb->inode_count * sizeof(int32_t));
+    fs->inodes = calloc(sb->inode_count, sizeof(CachedInode*));
+    fs->open_count = calloc(sb->inode_count, sizeof(uint16_t));
+    if (fs->backend == MYFS_BACKEND_STDIO) {
+        fs->inode_bitmap_copy = malloc(fs->inode_bitmap_size);
+        fs->block_bitmap_copy = malloc(fs->block_bitmap_size);
+    }
+    if (!fs->name_index || !fs->names || !fs->parent || !fs->is_dir || !fs->dir_first || !fs->dir_next ||
+        !fs->dir_prev || !fs->inodes || !fs->open_count ||
+        (fs->backend == MYFS_BACKEND_STDIO && (!fs->inode_bitmap_copy || !fs->block_bitmap_copy))) {
+        perror("Ошибка выделения памяти под метаданные");
+        return false;
+    }
+    // Массивы выделены: теперь по inode_count их можно обходить (release_fs)
+    fs->inode_count = (int)sb->inode_count;
+    fs->block_count = sb->block_count;
+    return true;
+}
+
+static void geometry_free(myfs_t* fs) {
+    free(fs->name_index);
+    free(fs->names);
+    free(fs->parent);
+    free(fs->is_dir);
+    free(fs->dir_first);
+    free(fs->dir_next);
+    free(fs->dir_prev);
+    free(fs->inodes);
+    free(fs->open_count);
+    free(fs->inode_bitmap_copy);
+    free(fs->block_bitmap_copy);
+}
+
 // -----------------------------------------------------------------------------
 // Описание: Функции для чтения и записи суперблока файловой системы
 // Разработчик: Дарья
 // -----------------------------------------------------------------------------
 
-// Функция: write_superblock
-// Назначение: Записывает структуру SuperBlock в файл образа ФС.
-// Параметры:
-//   - fs: указатель на открытый файл образа файловой системы
-//   - sb: указатель на структуру SuperBlock, которую необходимо записать
-// Возвращает:
-//   - true, если операция записи прошла успешно
-//   - false, если возникла ошибка при перемещении указателя или записи
-static bool write_superblock(FILE* fs, const SuperBlock* sb) {
-    if (fseek(fs, SUPERBLOCK_OFFSET, SEEK_SET) != 0) {  // Устанавливаем указатель в начало суперблока
-        perror("Ошибка fseek при записи суперблока");
-        return false;
+// Функция: write_superblock
+// Назначение: Записывает структуру SuperBlock в файл образа ФС.
+// Параметры:
+//   - fs: указатель на открытый файл образа файловой системы
+//   - sb: указатель на структуру SuperBlock, которую необходимо записать
+// Возвращает:
+//   - true, если операция записи прошла успешно
+//   - false, если возникла ошибка при перемещении указателя или записи
+static bool write_superblock(FILE* fs, const SuperBlock* sb) {
+    if (fseek(fs, SUPERBLOCK_OFFSET, SEEK_SET) != 0) {  // Устанавливаем указатель в начало суперблока
+        perror("Ошибка fseek при записи суперблока");
+        return false;
+    }
+    if (fwrite(sb, sizeof(SuperBlock), 1, fs) != 1) {   // Записываем структуру SuperBlock в файл
+        perror("Ошибка fwrite при записи суперблока");
+        return false;
+    }
+    return true;
+}
+
+// Функция: read_superblock
+// Назначение: Считывает суперблок из файла образа файловой системы.
+// Параметры:
+//   - fs: указатель на открытый файл образа файловой системы
+//   - sb: указатель на структуру SuperBlock, куда будут загружены данные
+// Возвращает:
+//   - true, если операция чтения прошла успешно
+//   - false, если возникла ошибка при перемещении указателя или чтении
+static bool read_superblock(FILE* fs, SuperBlock* sb) {
+    if (fseek(fs, SUPERBLOCK_OFFSET, SEEK_SET) != 0) {  // Устанавливаем указатель в начало суперблока
+        perror("Ошибка fseek при чтении суперблока");
+        return false;
+    }
+    if (fread(sb, sizeof(SuperBlock), 1, fs) != 1) {    // Считываем суперблок из файла в структуру
+        perror("Ошибка fread при чтении суперблока");
+        return false;
+    }
+    return true;
+}
+
+// Функция: pio_read / pio_write
+// Назначение: Позиционные pread/pwrite до полной передачи (без позиции потока,
+// поэтому безопасны из нескольких потоков одновременно).
+static bool pio_read(int fd, long offset, void* buf, size_t size) {
+    uint8_t* p = buf;
+    while (size > 0) {
+        ssize_t n = pread(fd, p, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        offset += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static bool pio_write(int fd, long offset, const void* buf, size_t size) {
+    const uint8_t* p = buf;
+    while (size > 0) {
+        ssize_t n = pwrite(fd, p, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        offset += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+// Функция: pio_vec
+// Назначение: Позиционные preadv/pwritev до полной передачи: участок образа с
+// offset читается в буферы iov по порядку (или пишется из них). iov меняется.
+static bool pio_vec(int fd, long offset, struct iovec* iov, int cnt, bool write) {
+    while (cnt > 0) {
+        ssize_t n = write ? pwritev(fd, iov, cnt, offset) : preadv(fd, iov, cnt, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        offset += n;
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (uint8_t*)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return true;
+}
+
+// Функция: stdio_read / stdio_write
+// Назначение: Читает/записывает участок образа через поток stdio. fseek
+// пропускается, если поток уже стоит на нужном смещении и направление не
+// меняется: fseek сбрасывает буфер, а последовательные записи тогда копятся
+// в буфере stdio. В потокобезопасном режиме и режиме shared — через pread/pwrite.
+static bool stdio_read(myfs_t* fs, long offset, void* buf, size_t size) {
+    STAT_ADD(fs, image_reads, 1);
+    if (fs->pio) return pio_read(fileno(fs->fp), offset, buf, size);
+    bool seek = fs->fp_pos != offset || fs->fp_writing;
+    if (seek) STAT_ADD(fs, image_seeks, 1);
+    bool ok = (!seek || fseek(fs->fp, offset, SEEK_SET) == 0) && fread(buf, size, 1, fs->fp) == 1;
+    fs->fp_pos = ok ? offset + (long)size : -1;
+    fs->fp_writing = false;
+    return ok;
+}
+
+static bool stdio_write(myfs_t* fs, long offset, const void* buf, size_t size) {
+    STAT_ADD(fs, image_writes, 1);
+    if (fs->pio) return pio_write(fileno(fs->fp), offset, buf, size);
+    bool seek = fs->fp_pos != offset || !fs->fp_writing;
+    if (seek) STAT_ADD(fs, image_seeks, 1);
+    bool ok = (!seek || fseek(fs->fp, offset, SEEK_SET) == 0) && fwrite(buf, size, 1, fs->fp) == 1;
+    fs->fp_pos = ok ? offset + (long)size : -1;
+    fs->fp_writing = true;
+    return ok;
+}
+
+// Функция: stdio_vec
+// Назначение: Один preadv/pwritev непрерывного участка образа в разрозненные
+// буферы. Запрос идёт мимо потока stdio, поэтому буфер потока сначала
+// сбрасывается в любом режиме: буфер записи пишется в образ, а буфер чтения
+// отбрасывается. fseek его не отбросил бы — если цель лежит внутри буфера,
+// glibc только сдвигает указатель, и блок, записанный здесь pwritev, при
+// следующем fread (размер блока меньше буфера stdio) вернулся бы старым.
+static bool stdio_vec(myfs_t* fs, long offset, struct iovec* iov, int cnt, bool write) {
+    if (write) STAT_ADD(fs, image_writes, 1);
+    else STAT_ADD(fs, image_reads, 1);
+    if (!fs->pio) {
+        if (fflush(fs->fp) != 0) return false;
+        fs->fp_pos = -1;
+    }
+    return pio_vec(fileno(fs->fp), offset, iov, cnt, write);
+}
+
+// -----------------------------------------------------------------------------
+// Буферный кэш блоков (режим stdio). Весь ввод-вывод образа — данные и
+// метаданные — идёт через кадры размером с блок, найденные по номеру блока
+// образа. Вытеснение — CLOCK; изменённые кадры записываются при вытеснении
+// и при синхронизации (cache_flush), в порядке возрастания номеров блоков.
+// Крупные запросы (от CACHE_BYPASS_BYTES) идут мимо кэша, чтобы потоковое
+// чтение больших файлов не вымывало горячие блоки. Журнал тоже пишется мимо
+// кэша: его блоки читаются только при восстановлении. Соседние по номеру
+// блоки читаются при промахе и записываются при сбросе одним preadv/pwritev
+// в разные кадры (до CACHE_RUN_BLOCKS за запрос).
+// -----------------------------------------------------------------------------
+
+#define CACHE_BYPASS_BLOCKS 32
+#define CACHE_RUN_BLOCKS 64
+#define CACHE_INDEX_EMPTY (-1)
+
+static uint32_t cache_hash(uint32_t block) {
+    return block * 2654435761u;
+}
+
+// Кадр с блоком block или -1
+static int32_t cache_lookup(const myfs_t* fs, uint32_t block) {
+    for (uint32_t i = cache_hash(block) & fs->cache_index_mask; ; i = (i + 1) & fs->cache_index_mask) {
+        int32_t f = fs->cache_index[i];
+        if (f == CACHE_INDEX_EMPTY) return -1;
+        if (fs->cache[f].block == block) return f;
+    }
+}
+
+static void cache_index_insert(myfs_t* fs, uint32_t block, int32_t frame) {
+    uint32_t i = cache_hash(block) & fs->cache_index_mask;
+    while (fs->cache_index[i] != CACHE_INDEX_EMPTY) i = (i + 1) & fs->cache_index_mask;
+    fs->cache_index[i] = frame;
+}
+
+// Удаление из открытой адресации со сдвигом назад (как в индексе имён)
+static void cache_index_remove(myfs_t* fs, uint32_t block) {
+    uint32_t mask = fs->cache_index_mask;
+    uint32_t i = cache_hash(block) & mask;
+    while (fs->cache_index[i] == CACHE_INDEX_EMPTY || fs->cache[fs->cache_index[i]].block != block) {
+        if (fs->cache_index[i] == CACHE_INDEX_EMPTY) return;
+        i = (i + 1) & mask;
+    }
+    fs->cache_index[i] = CACHE_INDEX_EMPTY;
+    for (uint32_t j = (i + 1) & mask; fs->cache_index[j] != CACHE_INDEX_EMPTY; j = (j + 1) & mask) {
+        uint32_t home = cache_hash(fs->cache[fs->cache_index[j]].block) & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            fs->cache_index[i] = fs->cache_index[j];
+            fs->cache_index[j] = CACHE_INDEX_EMPTY;
+            i = j;
+        }
+    }
+}
+
+static uint8_t* frame_data(const myfs_t* fs, int32_t f) {
+    return fs->cache_data + ((size_t)f << fs->block_shift);
+}
+
+static bool cache_writeback(myfs_t* fs, int32_t f) {
+    CacheFrame* fr = &fs->cache[f];
+    if (!stdio_write(fs, (long)fr->block << fs->block_shift, frame_data(fs, f), fs->block_size)) return false;
+    fr->dirty = false;
+    fs->cache_stats.writebacks++;
+    return true;
+}
+
+// Функция: cache_init
+// Назначение: Выделяет кэш на frames кадров.
+static bool cache_init(myfs_t* fs, uint32_t frames) {
+    uint32_t capacity = 1;
+    while (capacity < 2 * frames) capacity <<= 1;
+
+    fs->cache = calloc(frames, sizeof(CacheFrame));
+    fs->cache_data = malloc((size_t)frames << fs->block_shift);
+    fs->cache_index = malloc(capacity * sizeof(int32_t));
+    if (!fs->cache || !fs->cache_data || !fs->cache_index) {
+        perror("Ошибка выделения памяти под кэш блоков");
+        return false;
+    }
+    for (uint32_t i = 0; i < capacity; i++) fs->cache_index[i] = CACHE_INDEX_EMPTY;
+    fs->cache_index_mask = capacity - 1;
+    fs->cache_frames = frames;
+    fs->cache_stats.capacity = frames;
+    return true;
+}
+
+static void cache_free(myfs_t* fs) {
+    free(fs->cache);
+    free(fs->cache_data);
+    free(fs->cache_index);
+    fs->cache = NULL;
+    fs->cache_data = NULL;
+    fs->cache_index = NULL;
+}
+
+// Функция: cache_victim
+// Назначение: Выбирает кадр под новый блок: сначала ещё не занятые, затем по
+// CLOCK — первый кадр без бита обращения (изменённый предварительно записывается).
+// Возвращает: номер кадра или -1, если запись вытесняемого кадра не удалась
+static int32_t cache_victim(myfs_t* fs) {
+    if (fs->cache_used < fs->cache_frames) return (int32_t)fs->cache_used++;
+
+    for (;;) {
+        int32_t f = (int32_t)fs->cache_hand;
+        fs->cache_hand = (fs->cache_hand + 1) % fs->cache_frames;
+        CacheFrame* fr = &fs->cache[f];
+        if (!fr->valid) return f;
+        if (fr->pinned) continue;
+        if (fr->ref) {
+            fr->ref = false;
+            continue;
+        }
+        if (fr->dirty && !cache_writeback(fs, f)) return -1;
+        cache_index_remove(fs, fr->block);
+        fr->valid = false;
+        fs->cache_stats.evictions++;
+        return f;
+    }
+}
+
+// Функция: cache_get
+// Назначение: Возвращает кадр с блоком образа, при промахе загружая его
+// (load = false — блок будет целиком перезаписан, читать его не нужно).
+static int32_t cache_get(myfs_t* fs, uint32_t block, bool load) {
+    int32_t f = cache_lookup(fs, block);
+    if (f >= 0) {
+        fs->cache_stats.hits++;
+        fs->cache[f].ref = true;
+        return f;
+    }
+
+    fs->cache_stats.misses++;
+    f = cache_victim(fs);
+    if (f < 0) return -1;
+    if (load && !stdio_read(fs, (long)block << fs->block_shift, frame_data(fs, f), fs->block_size)) return -1;
+
+    CacheFrame* fr = &fs->cache[f];
+    fr->block = block;
+    fr->valid = true;
+    fr->dirty = false;
+    fr->ref = true;
+    cache_index_insert(fs, block, f);
+    return f;
+}
+
+// Функция: cache_load_run
+// Назначение: Загружает подряд идущие отсутствующие в кэше блоки с first до
+// last включительно (не больше CACHE_RUN_BLOCKS) одним preadv в их кадры.
+// *end — следующий за загруженными блок. Возвращает: кадр блока first или -1
+static int32_t cache_load_run(myfs_t* fs, uint32_t first, uint32_t last, uint32_t* end) {
+    int32_t frames[CACHE_RUN_BLOCKS];
+    struct iovec iov[CACHE_RUN_BLOCKS];
+    uint32_t max_run = fs->cache_frames - 1 < CACHE_RUN_BLOCKS ? fs->cache_frames - 1 : CACHE_RUN_BLOCKS;
+    uint32_t n = 0;
+    bool ok = true;
+    do {
+        // Кадр сразу занимается под блок и закрепляется: иначе cache_victim
+        // отдал бы его снова
+        int32_t f = cache_victim(fs);
+        if (f < 0) {
+            ok = false;
+            break;
+        }
+        CacheFrame* fr = &fs->cache[f];
+        fr->block = first + n;
+        fr->valid = true;
+        fr->dirty = false;
+        fr->ref = true;
+        fr->pinned = true;
+        cache_index_insert(fs, fr->block, f);
+        frames[n] = f;
+        iov[n] = (struct iovec){.iov_base = frame_data(fs, f), .iov_len = fs->block_size};
+        n++;
+    } while (n < max_run && first + n <= last && cache_lookup(fs, first + n) < 0);
+
+    fs->cache_stats.misses += n;
+    for (uint32_t i = 0; i < n; i++) fs->cache[frames[i]].pinned = false;
+    if (ok && n > 0) {
+        ok = n == 1 ? stdio_read(fs, (long)first << fs->block_shift, iov[0].iov_base, fs->block_size)
+                    : stdio_vec(fs, (long)first << fs->block_shift, iov, (int)n, false);
+    }
+    if (!ok) {
+        for (uint32_t i = 0; i < n; i++) {
+            cache_index_remove(fs, first + i);
+            fs->cache[frames[i]].valid = false;
+        }
+        return -1;
+    }
+    *end = first + n;
+    return frames[0];
+}
+
+static bool cache_read(myfs_t* fs, long offset, void* buf, size_t size) {
+    uint8_t* p = buf;
+    uint32_t last = block_index(fs, (uint64_t)offset + size - 1);
+    uint32_t loaded_end = 0;  // Блоки до него только что загружены: это не попадания
+    while (size > 0) {
+        uint32_t block = block_index(fs, (uint64_t)offset);
+        size_t in_block = block_within(fs, (uint64_t)offset);
+        size_t chunk = fs->block_size - in_block < size ? fs->block_size - in_block : size;
+
+        int32_t f = cache_lookup(fs, block);
+        if (f < 0) {
+            f = cache_load_run(fs, block, last, &loaded_end);
+            if (f < 0) return false;
+        } else if (block >= loaded_end) {
+            fs->cache_stats.hits++;
+            fs->cache[f].ref = true;
+        }
+        memcpy(p, frame_data(fs, f) + in_block, chunk);
+
+        p += chunk;
+        offset += (long)chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+static bool cache_write(myfs_t* fs, long offset, const void* buf, size_t size) {
+    const uint8_t* p = buf;
+    while (size > 0) {
+        uint32_t block = block_index(fs, (uint64_t)offset);
+        size_t in_block = block_within(fs, (uint64_t)offset);
+        size_t chunk = fs->block_size - in_block < size ? fs->block_size - in_block : size;
+
+        int32_t f = cache_get(fs, block, chunk != fs->block_size);
+        if (f < 0) return false;
+        memcpy(frame_data(fs, f) + in_block, p, chunk);
+        fs->cache[f].dirty = true;
+
+        p += chunk;
+        offset += (long)chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+static int frame_by_block(const void* a, const void* b, void* fs) {
+    const CacheFrame* frames = ((const myfs_t*)fs)->cache;
+    uint32_t x = frames[*(const int32_t*)a].block, y = frames[*(const int32_t*)b].block;
+    return (x > y) - (x < y);
+}
+
+// Функция: cache_flush
+// Назначение: Записывает изменённые кадры из блоков [first, first + count)
+// в порядке возрастания номеров (запись идёт последовательно).
+static bool cache_flush_range(myfs_t* fs, uint32_t first, uint32_t count) {
+    if (!fs->cache) return true;
+
+    int32_t* dirty = malloc(fs->cache_used * sizeof(int32_t));
+    if (!dirty) return false;
+    uint32_t n = 0;
+    for (uint32_t f = 0; f < fs->cache_used; f++) {
+        const CacheFrame* fr = &fs->cache[f];
+        if (fr->valid && fr->dirty && fr->block - first < count) dirty[n++] = (int32_t)f;
+    }
+    qsort_r(dirty, n, sizeof(int32_t), frame_by_block, fs);
+
+    // Кадры соседних блоков записываются одним pwritev
+    bool ok = true;
+    struct iovec iov[CACHE_RUN_BLOCKS];
+    for (uint32_t i = 0, run; i < n && ok; i += run) {
+        uint32_t first_block = fs->cache[dirty[i]].block;
+        run = 1;
+        while (i + run < n && run < CACHE_RUN_BLOCKS && fs->cache[dirty[i + run]].block == first_block + run) run++;
+        if (run == 1) {
+            ok = cache_writeback(fs, dirty[i]);
+            continue;
+        }
+        for (uint32_t j = 0; j < run; j++) {
+            iov[j] = (struct iovec){.iov_base = frame_data(fs, dirty[i + j]), .iov_len = fs->block_size};
+        }
+        ok = stdio_vec(fs, (long)first_block << fs->block_shift, iov, (int)run, true);
+        for (uint32_t j = 0; ok && j < run; j++) {
+            fs->cache[dirty[i + j]].dirty = false;
+            fs->cache_stats.writebacks++;
+        }
+    }
+    free(dirty);
+    return ok;
+}
+
+static bool cache_flush(myfs_t* fs) {
+    io_lock(fs);
+    bool ok = cache_flush_range(fs, 0, UINT32_MAX);
+    io_unlock(fs);
+    return ok;
+}
+
+// Функция: cache_drop
+// Назначение: Выбрасывает кадры блоков [first, first + count) без записи.
+static void cache_drop(myfs_t* fs, uint32_t first, uint32_t count) {
+    if (!fs->cache) return;
+
+    // Короткий участок — поиском по индексу, длинный — проходом по кадрам
+    if (count <= 16) {
+        for (uint32_t b = first; b < first + count; b++) {
+            int32_t f = cache_lookup(fs, b);
+            if (f < 0) continue;
+            cache_index_remove(fs, b);
+            fs->cache[f].valid = false;
+            fs->cache[f].dirty = false;
+        }
+        return;
+    }
+    for (uint32_t f = 0; f < fs->cache_used; f++) {
+        CacheFrame* fr = &fs->cache[f];
+        if (fr->valid && fr->block - first < count) {
+            cache_index_remove(fs, fr->block);
+            fr->valid = false;
+            fr->dirty = false;
+        }
+    }
+}
+
+// Блоки образа, которые затрагивает участок [offset, offset + size)
+static void region_blocks(const myfs_t* fs, long offset, size_t size, uint32_t* first, uint32_t* count) {
+    *first = block_index(fs, (uint64_t)offset);
+    *count = blocks_for(fs, (uint64_t)offset + size) - *first;
+}
+
+// Участок пишется/читается мимо кэша: крупные запросы и журнал
+static bool cache_bypass(const myfs_t* fs, long offset, size_t size) {
+    return !fs->cache || size >= ((size_t)CACHE_BYPASS_BLOCKS << fs->block_shift) ||
+           (fs->sb->journal_size > 0 && offset >= (long)fs->sb->journal_start);
+}
+
+// Функция: cache_sync_region
+// Назначение: Готовит участок к вводу-выводу мимо кэша: изменённые кадры,
+// которые он перекрывает, записываются, а перед записью — ещё и выбрасываются.
+static bool cache_sync_region(myfs_t* fs, long offset, size_t size, bool write) {
+    if (!fs->cache) return true;
+    uint32_t first, count;
+    region_blocks(fs, offset, size, &first, &count);
+    io_lock(fs);
+    bool ok = cache_flush_range(fs, first, count);
+    if (ok && write) cache_drop(fs, first, count);
+    io_unlock(fs);
+    return ok;
+}
+
+// mmap: запоминает изменённый участок отображения для msync при синхронизации
+static void mark_dirty(myfs_t* fs, size_t offset, size_t size) {
+    io_lock(fs);
+    if (fs->dirty_hi == 0 || offset < fs->dirty_lo) fs->dirty_lo = offset;
+    if (offset + size > fs->dirty_hi) fs->dirty_hi = offset + size;
+    io_unlock(fs);
+}
+
+// Функция: read_region / write_region
+// Назначение: Читает/записывает участок образа ФС по абсолютному смещению.
+// В режиме mmap это копирование из/в отображение без системных вызовов;
+// изменённый диапазон запоминается для msync при синхронизации.
+// В режиме stdio запрос обслуживает буферный кэш блоков, если он включён
+// и запрос не крупный; мимо кэша перекрывающиеся кадры предварительно
+// записываются (чтение) или записываются и выбрасываются (запись).
+// Возвращают true при успехе; сообщение об ошибке выводит вызывающая сторона.
+static bool read_region(myfs_t* fs, long offset, void* buf, size_t size) {
+    stat_region(fs, offset, size, false);
+    if (fs->backend == MYFS_BACKEND_MMAP) {
+        if (offset < 0 || (size_t)offset + size > fs->map_size) return false;
+        memcpy(buf, fs->map + offset, size);
+        return true;
+    }
+    if (!cache_bypass(fs, offset, size)) {
+        io_lock(fs);
+        bool ok = cache_read(fs, offset, buf, size);
+        io_unlock(fs);
+        return ok;
+    }
+    return cache_sync_region(fs, offset, size, false) && stdio_read(fs, offset, buf, size);
+}
+
+static bool write_region(myfs_t* fs, long offset, const void* buf, size_t size) {
+    stat_region(fs, offset, size, true);
+    if (fs->backend == MYFS_BACKEND_MMAP) {
+        if (offset < 0 || (size_t)offset + size > fs->map_size) return false;
+        memcpy(fs->map + offset, buf, size);
+        mark_dirty(fs, (size_t)offset, size);
+        return true;
+    }
+    if (!cache_bypass(fs, offset, size)) {
+        io_lock(fs);
+        bool ok = cache_write(fs, offset, buf, size);
+        io_unlock(fs);
+        return ok;
+    }
+    return cache_sync_region(fs, offset, size, true) && stdio_write(fs, offset, buf, size);
+}
+
+// Функция: write_regionv
+// Назначение: write_region для непрерывного участка образа из cnt разрозненных
+// буферов общим размером size. В режиме stdio — один pwritev мимо кэша.
+static bool write_regionv(myfs_t* fs, long offset, struct iovec* iov, int cnt, size_t size) {
+    stat_region(fs, offset, size, true);
+    if (fs->backend == MYFS_BACKEND_MMAP) {
+        if (offset < 0 || (size_t)offset + size > fs->map_size) return false;
+        uint8_t* p = fs->map + offset;
+        for (int i = 0; i < cnt; i++) {
+            memcpy(p, iov[i].iov_base, iov[i].iov_len);
+            p += iov[i].iov_len;
+        }
+        mark_dirty(fs, (size_t)offset, size);
+        return true;
+    }
+    return cache_sync_region(fs, offset, size, true) && stdio_vec(fs, offset, iov, cnt, true);
+}
+
+// -----------------------------------------------------------------------------
+// Исполнитель ввода-вывода (myfs_options.io_engine). map_io собирает отрезки
+// операции, затрагивающей несколько экстентов, в пакет IoSeg и отдаёт его
+// io_run целиком:
+//   MYFS_IO_URING   — все запросы пакета ставятся в кольцо io_uring и
+//                     отправляются одним io_uring_enter, который и ждёт их
+//                     завершения; кольцо одно на ФС, пакеты идут по очереди;
+//   MYFS_IO_THREADS — отрезки раздаются потокам пула, вызывающий поток ждёт.
+// Пул есть при любом исполнителе: в нём же выполняются асинхронные чтения
+// (myfs_pread_async). Внутри потока пула пакет MYFS_IO_THREADS выполняется
+// по очереди — иначе все потоки могли бы ждать друг друга.
+// -----------------------------------------------------------------------------
+
+#define IO_RING_ENTRIES 64   // Размер очереди отправки io_uring
+#define MAP_IO_BATCH 64      // Отрезков в одном пакете map_io
+
+// Отрезок пакета: участок образа и буфер
+typedef struct {
+    long offset;
+    uint8_t* buf;
+    size_t size;
+} IoSeg;
+
+typedef struct IoRing {
+    int fd;
+    pthread_mutex_t lock;                     // Кольцо занимает один пакет за раз
+    unsigned entries;
+    void* sq_ptr;
+    size_t sq_size;
+    void* cq_ptr;                             // Совпадает с sq_ptr при IORING_FEAT_SINGLE_MMAP
+    size_t cq_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe* cqes;
+} IoRing;
+
+// Пакет, выполняемый пулом: сколько отрезков ещё не завершено
+typedef struct {
+    uint32_t pending;
+    bool failed;
+} IoBatch;
+
+// Задание пула: отрезок пакета (batch != NULL) или асинхронное чтение
+typedef struct IoJob {
+    struct IoJob* next;
+    IoBatch* batch;
+    IoSeg seg;
+    bool write;
+    int ino;
+    uint64_t offset;
+    myfs_aio_cb cb;
+    void* ctx;
+    ssize_t result;
+} IoJob;
+
+typedef struct IoPool {
+    pthread_t* threads;
+    uint32_t thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t work;                      // Появилось задание или пул останавливается
+    pthread_cond_t done;                      // Завершился отрезок пакета или асинхронное чтение
+    IoJob* head;                              // Очередь заданий
+    IoJob** tail;
+    IoJob* completed;                         // Завершённые асинхронные чтения (в порядке завершения)
+    IoJob** completed_tail;
+    uint32_t in_flight;                       // Асинхронных чтений ещё не завершено
+    bool stop;
+    int event_fd;                             // Счётчик завершений для цикла событий
+} IoPool;
+
+static _Thread_local bool io_worker;          // Текущий поток — поток пула
+
+static int ring_enter(int fd, unsigned to_submit, unsigned min_complete) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+static void ring_free(IoRing* r) {
+    if (!r) return;
+    if (r->sqes) munmap(r->sqes, r->sqes_size);
+    if (r->cq_ptr && r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_size);
+    if (r->sq_ptr) munmap(r->sq_ptr, r->sq_size);
+    close(r->fd);
+    pthread_mutex_destroy(&r->lock);
+    free(r);
+}
+
+// Функция: ring_init
+// Назначение: Создаёт кольцо io_uring и отображает его очереди в память.
+// Возвращает NULL, если ядро не поддерживает io_uring (или он запрещён).
+static IoRing* ring_init(unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0) return NULL;
+
+    IoRing* r = calloc(1, sizeof(IoRing));
+    if (!r) {
+        close(fd);
+        return NULL;
+    }
+    r->fd = fd;
+    pthread_mutex_init(&r->lock, NULL);
+    r->entries = p.sq_entries;
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && r->cq_size > r->sq_size) r->sq_size = r->cq_size;
+
+    void* sq = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) goto fail;
+    r->sq_ptr = sq;
+    void* cq = single ? sq : mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED) goto fail;
+    r->cq_ptr = cq;
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) goto fail;
+    r->sqes = sqes;
+
+    uint8_t* s = sq;
+    uint8_t* c = cq;
+    r->sq_head = (unsigned*)(s + p.sq_off.head);
+    r->sq_tail = (unsigned*)(s + p.sq_off.tail);
+    r->sq_mask = (unsigned*)(s + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(s + p.sq_off.array);
+    r->cq_head = (unsigned*)(c + p.cq_off.head);
+    r->cq_tail = (unsigned*)(c + p.cq_off.tail);
+    r->cq_mask = (unsigned*)(c + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(c + p.cq_off.cqes);
+    return r;
+
+fail:
+    ring_free(r);
+    return NULL;
+}
+
+// Дочитывает/дописывает остаток отрезка после короткого ответа io_uring
+static bool seg_finish(int fd, const IoSeg* seg, size_t done, bool write) {
+    if (done == seg->size) return true;
+    if (done == 0 && !write) return false;  // Чтение за концом образа
+    return write ? pio_write(fd, seg->offset + (long)done, seg->buf + done, seg->size - done)
+                 : pio_read(fd, seg->offset + (long)done, seg->buf + done, seg->size - done);
+}
+
+// Функция: ring_run
+// Назначение: Выполняет пакет через io_uring: очередь отправки заполняется
+// целиком, один io_uring_enter отправляет её и ждёт завершений. Функция не
+// возвращается, пока ядро не завершило все принятые запросы: буферы пакета
+// живут только до её возврата.
+static bool ring_run(myfs_t* fs, const IoSeg* segs, uint32_t n, bool write) {
+    IoRing* r = fs->ring;
+    int fd = fileno(fs->fp);
+    bool ok = true;
+    pthread_mutex_lock(&r->lock);
+
+    uint32_t queued = 0, completed = 0;
+    unsigned tail = *r->sq_tail;
+    unsigned first = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    while (completed < n) {
+        unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        while (ok && queued < n && tail - head < r->entries) {
+            unsigned idx = tail & *r->sq_mask;
+            struct io_uring_sqe* sqe = &r->sqes[idx];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+            sqe->fd = fd;
+            sqe->off = (uint64_t)segs[queued].offset;
+            sqe->addr = (uint64_t)(uintptr_t)segs[queued].buf;
+            sqe->len = (uint32_t)segs[queued].size;
+            sqe->user_data = queued;
+            r->sq_array[idx] = idx;
+            tail++;
+            queued++;
+        }
+        __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+
+        // Принятые ядром, но ещё не завершённые запросы надо дождаться даже
+        // после ошибки: они пишут в буферы пакета
+        unsigned accepted = head - first;
+        unsigned to_submit = tail - head;
+        if (to_submit == 0 && accepted == completed) break;
+        if (ring_enter(r->fd, to_submit, 1) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            ok = false;
+            tail = head;  // Неотправленные запросы отзываются
+            __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+            queued = n;
+        }
+
+        unsigned cq_head = *r->cq_head;
+        while (cq_head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+            const struct io_uring_cqe* cqe = &r->cqes[cq_head & *r->cq_mask];
+            const IoSeg* seg = &segs[cqe->user_data];
+            if (cqe->res < 0) {
+                errno = -cqe->res;
+                ok = false;
+            } else if (!seg_finish(fd, seg, (size_t)cqe->res, write)) {
+                ok = false;
+            }
+            cq_head++;
+            completed++;
+        }
+        __atomic_store_n(r->cq_head, cq_head, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&r->lock);
+    STAT_ADD(fs, image_reads, write ? 0 : n);
+    STAT_ADD(fs, image_writes, write ? n : 0);
+    return ok;
+}
+
+// Выполняет задание пула (без блокировки пула). Возвращает false, если
+// отрезок пакета не удался
+static bool pool_exec(myfs_t* fs, IoJob* job) {
+    if (job->batch) {
+        return job->write ? stdio_write(fs, job->seg.offset, job->seg.buf, job->seg.size)
+                          : stdio_read(fs, job->seg.offset, job->seg.buf, job->seg.size);
+    }
+    errno = 0;
+    ssize_t n = myfs_pread(fs, job->ino, job->seg.buf, job->seg.size, job->offset);
+    job->result = n >= 0 ? n : -(errno ? errno : EIO);
+    return true;
+}
+
+static void* pool_main(void* arg) {
+    myfs_t* fs = arg;
+    IoPool* p = fs->pool;
+    io_worker = true;
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (!p->head && !p->stop) pthread_cond_wait(&p->work, &p->lock);
+        IoJob* job = p->head;
+        if (!job) break;  // Пул останавливается, очередь пуста
+        p->head = job->next;
+        if (!p->head) p->tail = &p->head;
+        pthread_mutex_unlock(&p->lock);
+
+        bool ok = pool_exec(fs, job);
+
+        pthread_mutex_lock(&p->lock);
+        if (job->batch) {
+            if (!ok) job->batch->failed = true;
+            job->batch->pending--;
+        } else {
+            job->next = NULL;
+            *p->completed_tail = job;
+            p->completed_tail = &job->next;
+            p->in_flight--;
+            uint64_t one = 1;
+            if (write(p->event_fd, &one, sizeof(one)) < 0) perror("Ошибка записи eventfd");
+        }
+        pthread_cond_broadcast(&p->done);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// Ставит задания в очередь пула (под блокировкой пула)
+static void pool_push(IoPool* p, IoJob* job) {
+    job->next = NULL;
+    *p->tail = job;
+    p->tail = &job->next;
+}
+
+// Функция: pool_run
+// Назначение: Раздаёт отрезки пакета потокам пула и ждёт их завершения
+static bool pool_run(myfs_t* fs, const IoSeg* segs, uint32_t n, bool write) {
+    IoPool* p = fs->pool;
+    IoJob jobs[MAP_IO_BATCH];
+    IoBatch batch = {.pending = n, .failed = false};
+    pthread_mutex_lock(&p->lock);
+    for (uint32_t i = 0; i < n; i++) {
+        jobs[i] = (IoJob){.batch = &batch, .seg = segs[i], .write = write};
+        pool_push(p, &jobs[i]);
+    }
+    pthread_cond_broadcast(&p->work);
+    while (batch.pending > 0) pthread_cond_wait(&p->done, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+    return !batch.failed;
+}
+
+// Функция: io_run
+// Назначение: Выполняет пакет отрезков области данных исполнителем ФС.
+// Пакет идёт мимо буферного кэша, как крупные запросы read_region/write_region.
+static bool io_run(myfs_t* fs, const IoSeg* segs, uint32_t n, bool write) {
+    if (n == 1) {
+        return write ? write_region(fs, segs[0].offset, segs[0].buf, segs[0].size)
+                     : read_region(fs, segs[0].offset, segs[0].buf, segs[0].size);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        stat_region(fs, segs[i].offset, segs[i].size, write);
+        if (!cache_sync_region(fs, segs[i].offset, segs[i].size, write)) return false;
+    }
+    if (fs->ring) return ring_run(fs, segs, n, write);
+    if (fs->pool && !io_worker) return pool_run(fs, segs, n, write);
+    for (uint32_t i = 0; i < n; i++) {
+        bool ok = write ? stdio_write(fs, segs[i].offset, segs[i].buf, segs[i].size)
+                        : stdio_read(fs, segs[i].offset, segs[i].buf, segs[i].size);
+        if (!ok) return false;
+    }
+    return true;
+}
+
+// Функция: io_free
+// Назначение: Останавливает пул (потоки сначала выполняют очередь) и
+// закрывает кольцо. Необработанные завершения отбрасываются.
+static void io_free(myfs_t* fs) {
+    IoPool* p = fs->pool;
+    if (p) {
+        pthread_mutex_lock(&p->lock);
+        p->stop = true;
+        pthread_cond_broadcast(&p->work);
+        pthread_mutex_unlock(&p->lock);
+        for (uint32_t i = 0; i < p->thread_count; i++) {
+            pthread_join(p->threads[i], NULL);
+        }
+        while (p->completed) {
+            IoJob* job = p->completed;
+            p->completed = job->next;
+            free(job);
+        }
+        pthread_mutex_destroy(&p->lock);
+        pthread_cond_destroy(&p->work);
+        pthread_cond_destroy(&p->done);
+        if (p->event_fd >= 0) close(p->event_fd);
+        free(p->threads);
+        free(p);
+        fs->pool = NULL;
+    }
+    ring_free(fs->ring);
+    fs->ring = NULL;
+    fs->io_engine = MYFS_IO_SYNC;
+}
+
+// Функция: io_init
+// Назначение: Запускает исполнитель ввода-вывода: кольцо io_uring (если
+// запрошено и доступно, в режиме stdio) и пул из threads потоков.
+static bool io_init(myfs_t* fs, myfs_io_engine engine, uint32_t threads) {
+    fs->io_engine = engine;
+    if (engine == MYFS_IO_URING) {
+        if (fs->backend == MYFS_BACKEND_STDIO) fs->ring = ring_init(IO_RING_ENTRIES);
+        if (!fs->ring) fs->io_engine = MYFS_IO_THREADS;
+    }
+
+    IoPool* p = calloc(1, sizeof(IoPool));
+    if (!p) return false;
+    fs->pool = p;
+    p->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    p->threads = calloc(threads, sizeof(pthread_t));
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->done, NULL);
+    p->tail = &p->head;
+    p->completed_tail = &p->completed;
+    if (p->event_fd < 0 || !p->threads) return false;
+    for (; p->thread_count < threads; p->thread_count++) {
+        if (pthread_create(&p->threads[p->thread_count], NULL, pool_main, fs) != 0) return false;
+    }
+    return true;
+}
+
+// Функция: msync_range
+// Назначение: Синхронно сбрасывает на диск участок отображения [offset, offset + size).
+// Границы выравниваются по странице, как того требует msync.
+static bool msync_range(myfs_t* fs, size_t offset, size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = offset & ~(page - 1);
+    STAT_ADD(fs, image_syncs, 1);
+    if (msync(fs->map + start, offset + size - start, MS_SYNC) != 0) {
+        perror("Ошибка msync");
+        return false;
+    }
+    return true;
+}
+
+// Функция: punch_blocks
+// Назначение: Освобождает место блоков данных в файле-образе (делает «дыру»).
+// Образ остаётся разреженным, а повторно выделенный блок снова читается как
+// нули. Если ФС хоста не умеет пробивать дыры, блоки просто остаются как есть:
+// данные за пределами размера файла никогда не читаются.
+static void punch_blocks(myfs_t* fs, uint32_t start, uint32_t count) {
+    int fd = fs->fd;
+    if (fs->backend == MYFS_BACKEND_STDIO) {
+        // Незаписанные данные из буфера stdio не должны лечь поверх дыры
+        if (fflush(fs->fp) != 0) return;
+        fd = fileno(fs->fp);
+    }
+    off_t offset = fs->sb->data_start + ((off_t)start << fs->block_shift);
+    // Кадры свободных блоков не нужны, а записанные позже, они заполнили бы дыру
+    io_lock(fs);
+    cache_drop(fs, block_index(fs, (uint64_t)offset), count);
+    io_unlock(fs);
+    fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, (off_t)count << fs->block_shift);
+}
+
+// -----------------------------------------------------------------------------
+// Журнал метаданных (режим stdio). Изменения метаданных (inode, блоки карты
+// экстентов, битовые карты, суперблок) не пишутся на место сразу, а копятся
+// в транзакции в памяти; чтение метаданных видит их поверх диска. Фиксация:
+// транзакция целиком дописывается в журнал, один fsync, затем записи
+// переносятся на место. Транзакция защищена контрольной суммой и номером,
+// поэтому недописанная при сбое транзакция при восстановлении отбрасывается,
+// а зафиксированные повторяются (физический redo, повтор безопасен).
+// Освобождённые блоки карты экстентов отзываются записью REVOKE, чтобы
+// повтор старой транзакции не затёр блок, уже отданный под данные.
+// -----------------------------------------------------------------------------
+
+#define JOURNAL_MAGIC 0x4A524E4C  // "JRNL"
+#define JOURNAL_COMMIT_DIVISOR 4  // Фиксировать, когда транзакция выросла до этой доли журнала
+#define ALIGN8(x) (((x) + 7) & ~(size_t)7)
+
+enum {
+    JREC_NONE = 0,           // Запись отменена (блок освобождён в той же транзакции)
+    JREC_WRITE = 1,          // Записать len байт по offset (данные следуют за записью)
+    JREC_REVOKE = 2          // Не повторять более ранние записи в [offset, offset + len)
+};
+
+typedef struct {
+    uint32_t type;
+    uint32_t len;
+    uint64_t offset;
+} JournalRecord;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;            // Номер транзакции
+    uint32_t records;        // Число записей
+    uint32_t length;         // Байт записей после заголовка
+    uint32_t checksum;       // FNV-1a от номера, числа записей и самих записей
+    uint32_t reserved;
+} JournalHeader;
+
+static size_t jrec_size(const JournalRecord* r) {
+    return sizeof(JournalRecord) + (r->type == JREC_REVOKE ? 0 : ALIGN8(r->len));
+}
+
+static uint32_t fnv1a(uint32_t hash, const void* data, size_t len) {
+    const uint8_t* p = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t journal_checksum(const JournalHeader* h, const uint8_t* payload) {
+    uint32_t hash = 2166136261u;
+    hash = fnv1a(hash, &h->seq, sizeof(h->seq));
+    hash = fnv1a(hash, &h->records, sizeof(h->records));
+    hash = fnv1a(hash, &h->length, sizeof(h->length));
+    return fnv1a(hash, payload, h->length);
+}
+
+// -----------------------------------------------------------------------------
+// Индекс транзакции. Образ делится на гранулы по 1 << TXN_GRANULE_SHIFT байт;
+// для каждой гранулы, которой касается запись WRITE, в открытой хеш-таблице
+// лежит слот «гранула -> смещение записи в txn_buf». Так meta_write и meta_read
+// находят свои записи, не просматривая всю транзакцию, и фиксация пакета из N
+// операций стоит O(N), а не O(N^2). Слоты прошлых транзакций отсекаются по
+// поколению, поэтому очистка транзакции таблицу не трогает.
+// -----------------------------------------------------------------------------
+
+#define TXN_GRANULE_SHIFT 6   // Гранула — запись inode: соседние inode не делят слот
+
+typedef struct TxnSlot {
+    uint64_t granule;
+    size_t pos;              // Смещение записи в txn_buf
+    uint32_t gen;            // Поколение транзакции (0 — слот не занимался)
+} TxnSlot;
+
+static size_t txn_slot_hash(uint64_t granule, size_t cap) {
+    return (size_t)((granule * 0x9E3779B97F4A7C15ull) >> 32) & (cap - 1);
+}
+
+static void txn_index_put(myfs_t* fs, uint64_t granule, size_t pos) {
+    size_t i = txn_slot_hash(granule, fs->txn_index_cap);
+    while (fs->txn_index[i].gen == fs->txn_gen) i = (i + 1) & (fs->txn_index_cap - 1);
+    fs->txn_index[i] = (TxnSlot){.granule = granule, .pos = pos, .gen = fs->txn_gen};
+    fs->txn_index_used++;
+}
+
+// Функция: txn_index_reserve
+// Назначение: Готовит таблицу к ещё extra слотам (заполнение не выше половины);
+// при росте в новую таблицу переносятся только слоты текущего поколения.
+static bool txn_index_reserve(myfs_t* fs, size_t extra) {
+    if (fs->txn_gen == 0) fs->txn_gen = 1;
+    if ((fs->txn_index_used + extra) * 2 <= fs->txn_index_cap) return true;
+
+    size_t cap = fs->txn_index_cap ? fs->txn_index_cap : 1024;
+    while ((fs->txn_index_used + extra) * 2 > cap) cap *= 2;
+    TxnSlot* table = calloc(cap, sizeof(TxnSlot));
+    if (!table) return false;
+
+    TxnSlot* old = fs->txn_index;
+    size_t old_cap = fs->txn_index_cap;
+    fs->txn_index = table;
+    fs->txn_index_cap = cap;
+    fs->txn_index_used = 0;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i].gen == fs->txn_gen) txn_index_put(fs, old[i].granule, old[i].pos);
+    }
+    free(old);
+    return true;
+}
+
+// Гранулы участка [offset, offset + len), len > 0
+static uint64_t txn_granules(uint64_t offset, size_t len) {
+    return ((offset + len - 1) >> TXN_GRANULE_SHIFT) - (offset >> TXN_GRANULE_SHIFT) + 1;
+}
+
+// Забывает индекс при очистке транзакции
+static void txn_index_clear(myfs_t* fs) {
+    fs->txn_index_used = 0;
+    if (++fs->txn_gen == 0) {
+        if (fs->txn_index) memset(fs->txn_index, 0, fs->txn_index_cap * sizeof(TxnSlot));
+        fs->txn_gen = 1;
+    }
+}
+
+static int cmp_size(const void* a, const void* b) {
+    size_t x = *(const size_t*)a, y = *(const size_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Смещения найденных записей. Список свой у каждого вызова: meta_read идёт
+// параллельно под meta_rdlock. Обычно хватает места на стеке.
+typedef struct {
+    size_t* pos;
+    size_t n, cap;
+    size_t local[16];
+} TxnHits;
+
+static void txn_hits_init(TxnHits* h) {
+    h->pos = h->local;
+    h->n = 0;
+    h->cap = sizeof(h->local) / sizeof(h->local[0]);
+}
+
+static void txn_hits_free(TxnHits* h) {
+    if (h->pos != h->local) free(h->pos);
+}
+
+static bool txn_hit_push(TxnHits* h, size_t pos) {
+    if (h->n == h->cap) {
+        size_t* grown = malloc(h->cap * 2 * sizeof(size_t));
+        if (!grown) return false;
+        memcpy(grown, h->pos, h->n * sizeof(size_t));
+        txn_hits_free(h);
+        h->pos = grown;
+        h->cap *= 2;
+    }
+    h->pos[h->n++] = pos;
+    return true;
+}
+
+// Функция: txn_collect
+// Назначение: Собирает в h смещения записей WRITE, пересекающих [lo, hi), в
+// порядке транзакции. Узкий участок ищется по индексу; участок шире числа
+// записей дешевле просмотреть целиком.
+// Возвращает false при нехватке памяти.
+static bool txn_collect(const myfs_t* fs, uint64_t lo, uint64_t hi, TxnHits* h) {
+    txn_hits_init(h);
+    if (fs->txn_records == 0 || hi <= lo) return true;
+
+    uint64_t span = txn_granules(lo, hi - lo);
+    if (!fs->txn_index || span > fs->txn_records) {
+        for (size_t pos = 0; pos < fs->txn_len; ) {
+            const JournalRecord* r = (const JournalRecord*)(fs->txn_buf + pos);
+            if (r->type == JREC_WRITE && r->offset < hi && r->offset + r->len > lo && !txn_hit_push(h, pos)) return false;
+            pos += jrec_size(r);
+        }
+        return true;
+    }
+
+    // Запись, занимающая несколько гранул, берётся только в первой из них,
+    // попавшей в участок
+    uint64_t first = lo >> TXN_GRANULE_SHIFT;
+    for (uint64_t g = first; g < first + span; g++) {
+        for (size_t i = txn_slot_hash(g, fs->txn_index_cap); fs->txn_index[i].gen == fs->txn_gen;
+             i = (i + 1) & (fs->txn_index_cap - 1)) {
+            if (fs->txn_index[i].granule != g) continue;
+            const JournalRecord* r = (const JournalRecord*)(fs->txn_buf + fs->txn_index[i].pos);
+            uint64_t r_first = r->offset >> TXN_GRANULE_SHIFT;
+            if (r->type != JREC_WRITE || r->offset >= hi || r->offset + r->len <= lo) continue;
+            if ((r_first > first ? r_first : first) != g) continue;
+            if (!txn_hit_push(h, fs->txn_index[i].pos)) return false;
+        }
+    }
+    if (h->n > 1) qsort(h->pos, h->n, sizeof(size_t), cmp_size);
+    return true;
+}
+
+// Добавляет запись в текущую транзакцию
+static bool txn_append(myfs_t* fs, uint32_t type, long offset, const void* data, size_t len) {
+    JournalRecord rec = {.type = type, .len = (uint32_t)len, .offset = (uint64_t)offset};
+    size_t need = jrec_size(&rec);
+    bool indexed = type == JREC_WRITE && len > 0;
+    if (indexed && !txn_index_reserve(fs, txn_granules(rec.offset, len))) return false;
+    if (fs->txn_len + need > fs->txn_cap) {
+        size_t cap = fs->txn_cap ? fs->txn_cap : 64 * 1024;
+        while (cap < fs->txn_len + need) cap *= 2;
+        uint8_t* buf = realloc(fs->txn_buf, cap);
+        if (!buf) return false;
+        fs->txn_buf = buf;
+        fs->txn_cap = cap;
+    }
+
+    uint8_t* p = fs->txn_buf + fs->txn_len;
+    memcpy(p, &rec, sizeof(rec));
+    if (type == JREC_WRITE) {
+        memcpy(p + sizeof(rec), data, len);
+        memset(p + sizeof(rec) + len, 0, need - sizeof(rec) - len);
+    }
+    if (indexed) {
+        uint64_t first = rec.offset >> TXN_GRANULE_SHIFT;
+        for (uint64_t g = 0; g < txn_granules(rec.offset, len); g++) txn_index_put(fs, first + g, fs->txn_len);
+    }
+    fs->txn_len += need;
+    fs->txn_records++;
+    return true;
+}
+
+// Ищет в транзакции запись ровно того же участка, чтобы переписать её на месте
+static uint8_t* txn_find(myfs_t* fs, long offset, size_t len) {
+    TxnHits h;
+    uint8_t* slot = NULL;
+    if (txn_collect(fs, (uint64_t)offset, (uint64_t)offset + len, &h)) {
+        for (size_t i = 0; i < h.n && !slot; i++) {
+            JournalRecord* r = (JournalRecord*)(fs->txn_buf + h.pos[i]);
+            if (r->offset == (uint64_t)offset && r->len == len) slot = (uint8_t*)r + sizeof(*r);
+        }
+    }
+    txn_hits_free(&h);
+    return slot;
+}
+
+// Метаданные копятся в транзакции: в режиме журнала и во время фиксации пакета
+static bool txn_active(const myfs_t* fs) {
+    return fs->journal || fs->batch;
+}
+
+// Функция: meta_write
+// Назначение: Записывает метаданные: в режиме журнала (и при фиксации пакета)
+// — в текущую транзакцию, иначе сразу на место.
+static bool meta_write(myfs_t* fs, long offset, const void* buf, size_t size) {
+    if (!txn_active(fs)) return write_region(fs, offset, buf, size);
+
+    uint8_t* slot = txn_find(fs, offset, size);
+    if (slot) {
+        memcpy(slot, buf, size);
+        return true;
+    }
+    if (!txn_append(fs, JREC_WRITE, offset, buf, size)) {
+        errno = ENOMEM;
+        return false;
+    }
+    return true;
+}
+
+// Функция: meta_read
+// Назначение: Читает метаданные с диска и накладывает поверх них ещё не
+// перенесённые на место изменения текущей транзакции.
+static bool meta_read(myfs_t* fs, long offset, void* buf, size_t size) {
+    if (!read_region(fs, offset, buf, size)) return false;
+    if (!txn_active(fs)) return true;
+
+    uint64_t lo = (uint64_t)offset, hi = lo + size;
+    TxnHits h;
+    if (!txn_collect(fs, lo, hi, &h)) {
+        txn_hits_free(&h);
+        errno = ENOMEM;
+        return false;
+    }
+    for (size_t i = 0; i < h.n; i++) {
+        const JournalRecord* r = (const JournalRecord*)(fs->txn_buf + h.pos[i]);
+        uint64_t from = r->offset > lo ? r->offset : lo;
+        uint64_t to = r->offset + r->len < hi ? r->offset + r->len : hi;
+        memcpy((uint8_t*)buf + (from - lo), (const uint8_t*)r + sizeof(*r) + (from - r->offset), to - from);
+    }
+    txn_hits_free(&h);
+    return true;
+}
+
+// Функция: journal_revoke
+// Назначение: Отменяет записи транзакции в освобождаемом участке и
+// запрещает повтор более ранних транзакций поверх него.
+static void journal_revoke(myfs_t* fs, long offset, size_t size) {
+    if (!txn_active(fs)) return;
+
+    uint64_t lo = (uint64_t)offset, hi = lo + size;
+    TxnHits h;
+    bool found = txn_collect(fs, lo, hi, &h);
+    for (size_t i = 0; i < h.n; i++) ((JournalRecord*)(fs->txn_buf + h.pos[i]))->type = JREC_NONE;
+    txn_hits_free(&h);
+    if (!found) {
+        // Без памяти под список — тем же отбором, но просмотром всей транзакции
+        for (size_t pos = 0; pos < fs->txn_len; ) {
+            JournalRecord* r = (JournalRecord*)(fs->txn_buf + pos);
+            if (r->type == JREC_WRITE && r->offset < hi && r->offset + r->len > lo) r->type = JREC_NONE;
+            pos += jrec_size(r);
+        }
+    }
+    if (!txn_append(fs, JREC_REVOKE, offset, NULL, size)) {
+        fprintf(stderr, "Предупреждение: не удалось отозвать блок в журнале\n");
+    }
+}
+
+// Сбрасывает буферы stdio и делает данные образа долговечными
+static bool image_sync(myfs_t* fs) {
+    if (!cache_flush(fs)) {
+        perror("Ошибка записи кэша блоков");
+        return false;
+    }
+    STAT_ADD(fs, image_syncs, 1);
+    if (fflush(fs->fp) != 0 || fdatasync(fileno(fs->fp)) != 0) {
+        perror("Ошибка fsync образа");
+        return false;
+    }
+    return true;
+}
+
+// Переносит записи транзакции на место (без fsync)
+static bool journal_apply(myfs_t* fs, const uint8_t* payload, size_t len) {
+    for (size_t pos = 0; pos < len; ) {
+        const JournalRecord* r = (const JournalRecord*)(payload + pos);
+        if (r->type == JREC_WRITE && !write_region(fs, (long)r->offset, (const uint8_t*)r + sizeof(*r), r->len)) {
+            perror("Ошибка переноса записи журнала");
+            return false;
+        }
+        pos += jrec_size(r);
+    }
+    return true;
+}
+
+// Записывает на место номер первой непроверенной транзакции
+static bool journal_store_seq(myfs_t* fs) {
+    long offset = SUPERBLOCK_OFFSET + (long)offsetof(SuperBlock, journal_seq);
+    if (!write_region(fs, offset, &fs->sb->journal_seq, sizeof(fs->sb->journal_seq))) {
+        perror("Ошибка записи суперблока");
+        return false;
+    }
+    return true;
+}
+
+// Функция: journal_reset
+// Назначение: Освобождает журнал: всё перенесённое на место делается
+// долговечным, после чего журнал начинается с начала со следующим номером.
+static bool journal_reset(myfs_t* fs) {
+    if (!image_sync(fs)) return false;
+    fs->sb->journal_seq = fs->journal_next_seq;
+    if (!journal_store_seq(fs) || !image_sync(fs)) return false;
+    fs->journal_head = 0;
+    return true;
+}
+
+static void journal_clear_txn(myfs_t* fs) {
+    txn_index_clear(fs);
+    fs->txn_len = 0;
+    fs->txn_records = 0;
+    fs->txn_start_ns = 0;
+}
+
+// Функция: journal_commit
+// Назначение: Фиксирует текущую транзакцию: изменённые битовые карты и
+// суперблок добавляются в неё целиком, транзакция дописывается в журнал,
+// один fsync, затем записи переносятся на место.
+static bool journal_commit(myfs_t* fs) {
+    if (fs->inode_bitmap_dirty) {
+        if (!meta_write(fs, fs->sb->inode_bitmap, fs->inode_bitmap, fs->inode_bitmap_size)) return false;
+        fs->inode_bitmap_dirty = false;
+    }
+    if (fs->block_bitmap_dirty) {
+        if (!meta_write(fs, fs->sb->block_bitmap, fs->block_bitmap, fs->block_bitmap_size)) return false;
+        fs->block_bitmap_dirty = false;
+    }
+    if (fs->sb_dirty) {
+        if (!meta_write(fs, SUPERBLOCK_OFFSET, fs->sb, sizeof(SuperBlock))) return false;
+        fs->sb_dirty = false;
+    }
+
+    // Изменились только данные: достаточно fsync
+    if (fs->txn_records == 0) {
+        journal_clear_txn(fs);
+        return image_sync(fs);
+    }
+
+    size_t total = ALIGN8(sizeof(JournalHeader) + fs->txn_len);
+    if (total > fs->sb->journal_size) {
+        // Транзакция не помещается даже в пустой журнал: пишем на место
+        // после fsync данных, без атомарности
+        fprintf(stderr, "Предупреждение: транзакция (%zu байт) больше журнала, запись без журнала\n", total);
+        if (!image_sync(fs) || !journal_apply(fs, fs->txn_buf, fs->txn_len) || !image_sync(fs)) return false;
+        journal_clear_txn(fs);
+        return true;
+    }
+    if (fs->journal_head + total > fs->sb->journal_size && !journal_reset(fs)) return false;
+
+    JournalHeader h = {
+        .magic = JOURNAL_MAGIC,
+        .seq = fs->journal_next_seq,
+        .records = fs->txn_records,
+        .length = (uint32_t)fs->txn_len,
+    };
+    h.checksum = journal_checksum(&h, fs->txn_buf);
+
+    long at = (long)fs->sb->journal_start + fs->journal_head;
+    if (!write_region(fs, at, &h, sizeof(h)) ||
+        !write_region(fs, at + (long)sizeof(h), fs->txn_buf, fs->txn_len)) {
+        perror("Ошибка записи журнала");
+        return false;
+    }
+    // Один fsync делает долговечными и транзакцию, и записанные до неё данные
+    if (!image_sync(fs)) return false;
+
+    fs->journal_head += (uint32_t)total;
+    fs->journal_next_seq++;
+    bool ok = journal_apply(fs, fs->txn_buf, fs->txn_len);
+    journal_clear_txn(fs);
+    return ok;
+}
+
+// Функция: journal_op_end
+// Назначение: Вызывается в конце каждой изменяющей операции. Фиксирует
+// транзакцию, если включена фиксация каждой операции, транзакция выросла
+// до порога или её изменения ждут дольше допустимой задержки.
+static bool journal_op_end(myfs_t* fs) {
+    if (!fs->journal) return true;
+    bool pending = fs->txn_records > 0 || fs->inode_bitmap_dirty || fs->block_bitmap_dirty || fs->sb_dirty;
+    if (!pending) return true;
+
+    uint64_t now = monotonic_ns();
+    if (fs->txn_start_ns == 0) fs->txn_start_ns = now;
+    if (fs->sync_each_op || fs->txn_len >= fs->sb->journal_size / JOURNAL_COMMIT_DIVISOR ||
+        now - fs->txn_start_ns >= fs->commit_latency_ns) {
+        return journal_commit(fs);
+    }
+    return true;
+}
+
+// Функция: journal_recover
+// Назначение: При открытии повторяет зафиксированные, но, возможно, не
+// перенесённые на место транзакции: от journal_seq подряд, пока сходятся
+// номер и контрольная сумма. Записи, отозванные более поздним REVOKE,
+// пропускаются.
+static bool journal_recover(myfs_t* fs) {
+    uint32_t size = fs->sb->journal_size;
+    uint8_t* buf = malloc(size);
+    if (!buf) {
+        perror("Ошибка выделения памяти под журнал");
+        return false;
+    }
+    if (!read_region(fs, fs->sb->journal_start, buf, size)) {
+        perror("Ошибка чтения журнала");
+        free(buf);
+        return false;
+    }
+
+    // Проход 1: цепочка целых транзакций и список отзывов с их порядковыми номерами
+    uint32_t seq = fs->sb->journal_seq;
+    size_t end = 0;
+    uint32_t txns = 0;
+    size_t revoke_count = 0, revoke_cap = 0;
+    struct { uint64_t lo, hi; size_t ordinal; }* revokes = NULL;
+    size_t ordinal = 0;
+    bool ok = true;
+    while (end + sizeof(JournalHeader) <= size) {
+        JournalHeader h;
+        memcpy(&h, buf + end, sizeof(h));
+        if (h.magic != JOURNAL_MAGIC || h.seq != seq || h.length > size - end - sizeof(h) ||
+            journal_checksum(&h, buf + end + sizeof(h)) != h.checksum) break;
+
+        const uint8_t* payload = buf + end + sizeof(h);
+        for (size_t pos = 0; pos < h.length; pos += jrec_size((const JournalRecord*)(payload + pos)), ordinal++) {
+            const JournalRecord* r = (const JournalRecord*)(payload + pos);
+            if (r->type != JREC_REVOKE) continue;
+            if (revoke_count == revoke_cap) {
+                revoke_cap = revoke_cap ? revoke_cap * 2 : 16;
+                void* grown = realloc(revokes, revoke_cap * sizeof(*revokes));
+                if (!grown) {
+                    ok = false;
+                    break;
+                }
+                revokes = grown;
+            }
+            revokes[revoke_count].lo = r->offset;
+            revokes[revoke_count].hi = r->offset + r->len;
+            revokes[revoke_count].ordinal = ordinal;
+            revoke_count++;
+        }
+        if (!ok) break;
+
+        end += ALIGN8(sizeof(h) + h.length);
+        seq++;
+        txns++;
+    }
+
+    // Проход 2: повтор записей
+    ordinal = 0;
+    for (size_t at = 0; ok && at < end; ) {
+        JournalHeader h;
+        memcpy(&h, buf + at, sizeof(h));
+        const uint8_t* payload = buf + at + sizeof(h);
+        for (size_t pos = 0; ok && pos < h.length; ordinal++) {
+            const JournalRecord* r = (const JournalRecord*)(payload + pos);
+            pos += jrec_size(r);
+            if (r->type != JREC_WRITE) continue;
+
+            bool revoked = false;
+            for (size_t k = 0; k < revoke_count && !revoked; k++) {
+                revoked = revokes[k].ordinal > ordinal && revokes[k].lo < r->offset + r->len &&
+                          revokes[k].hi > r->offset;
+            }
+            if (!revoked) ok = write_region(fs, (long)r->offset, (const uint8_t*)r + sizeof(*r), r->len);
+        }
+        at += ALIGN8(sizeof(h) + h.length);
+    }
+    free(revokes);
+    free(buf);
+    if (!ok) {
+        perror("Ошибка восстановления из журнала");
+        return false;
+    }
+
+    fs->journal_next_seq = seq;
+    fs->journal_head = 0;
+    if (txns == 0) return true;
+
+    // Повторённые записи делаем долговечными и только потом продвигаем journal_seq
+    if (fs->backend == MYFS_BACKEND_MMAP) {
+        if (!msync_range(fs, 0, fs->map_size)) return false;
+    } else {
+        if (!image_sync(fs)) return false;
+        fs->fp_pos = -1;
+        if (!read_superblock(fs->fp, fs->sb)) return false;  // Суперблок мог быть в журнале
+    }
+    fs->sb->journal_seq = seq;
+    if (!journal_store_seq(fs)) return false;
+    if (fs->backend == MYFS_BACKEND_MMAP ? !msync_range(fs, 0, sizeof(SuperBlock)) : !image_sync(fs)) return false;
+
+    printf("Журнал: восстановлено транзакций: %u\n", txns);
+    return true;
+}
+
+// Функция: read_inode / write_inode
+// Назначение: Читает/записывает одну запись таблицы inode (через журнал).
+static bool read_inode(myfs_t* fs, int idx, Inode* node) {
+    return meta_read(fs, fs->sb->inode_table + idx * sizeof(Inode), node, sizeof(Inode));
+}
+
+static bool write_inode(myfs_t* fs, int idx, const Inode* node) {
+    return meta_write(fs, fs->sb->inode_table + idx * sizeof(Inode), node, sizeof(Inode));
+}
+
+// Функция: write_name
+// Назначение: Записывает имя файла (len байт, без '\0') в ячейку idx области
+// имён (через журнал). Пишется только имя с завершающим '\0': хвост ячейки не читается.
+static bool write_name(myfs_t* fs, int idx, const char* name, size_t len) {
+    char slot[MYFS_NAME_SLOT];
+    memcpy(slot, name, len);
+    slot[len] = '\0';
+    return meta_write(fs, fs->sb->name_table + (long)idx * MYFS_NAME_SLOT, slot, len + 1);
+}
+
+// -----------------------------------------------------------------------------
+// Аллокатор: битовые карты просматриваются 64-битными словами (ctz/popcount),
+// поиск начинается с подсказки next-fit, блоки выдаются непрерывными отрезками.
+// Бит i хранится в байте i/8, разряд i%8, поэтому на little-endian слово w
+// покрывает биты [64w, 64w + 64).
+// -----------------------------------------------------------------------------
+
+// Загружает слово w битовой карты; биты за пределами nbits считаются занятыми
+static uint64_t bitmap_word(const uint8_t* bm, uint32_t nbits, uint32_t w) {
+    uint32_t first = w * 64;
+    uint32_t nbytes = (nbits + 7) / 8;
+    uint64_t word = 0;
+
+    if (first / 8 + 8 <= nbytes) {
+        memcpy(&word, bm + first / 8, sizeof(word));
+    } else {
+        for (uint32_t b = first / 8; b < nbytes; b++) {
+            word |= (uint64_t)bm[b] << (8 * (b - first / 8));
+        }
+    }
+    if (first + 64 > nbits) {
+        word |= ~0ULL << (nbits - first);
+    }
+    return word;
+}
+
+// Возвращает первый свободный бит в [from, to) или to, если такого нет
+static uint32_t bitmap_find_clear(const uint8_t* bm, uint32_t nbits, uint32_t from, uint32_t to) {
+    for (uint32_t w = from / 64; w * 64 < to; w++) {
+        uint64_t free_bits = ~bitmap_word(bm, nbits, w);
+        if (w == from / 64) free_bits &= ~0ULL << (from % 64);
+        if (free_bits) {
+            uint32_t bit = w * 64 + __builtin_ctzll(free_bits);
+            return bit < to ? bit : to;
+        }
+    }
+    return to;
+}
+
+// Возвращает первый занятый бит в [from, to) или to, если такого нет
+static uint32_t bitmap_find_set(const uint8_t* bm, uint32_t nbits, uint32_t from, uint32_t to) {
+    for (uint32_t w = from / 64; w * 64 < to; w++) {
+        uint64_t used_bits = bitmap_word(bm, nbits, w);
+        if (w == from / 64) used_bits &= ~0ULL << (from % 64);
+        if (used_bits) {
+            uint32_t bit = w * 64 + __builtin_ctzll(used_bits);
+            return bit < to ? bit : to;
+        }
+    }
+    return to;
+}
+
+// Количество занятых бит в карте
+static uint32_t bitmap_count_set(const uint8_t* bm, uint32_t nbits) {
+    uint32_t count = 0;
+    for (uint32_t w = 0; w * 64 < nbits; w++) {
+        count += __builtin_popcountll(bitmap_word(bm, nbits, w));
+    }
+    // bitmap_word помечает хвост за nbits занятым — вычитаем его
+    return count - ((64 - nbits % 64) % 64);
+}
+
+// Устанавливает (value = true) или сбрасывает биты [start, start + count):
+// крайние биты по одному, середина — целыми байтами через memset
+static void bitmap_fill(uint8_t* bm, uint32_t start, uint32_t count, bool value) {
+    uint32_t end = start + count;
+    while (start < end && start % 8 != 0) {
+        if (value) bm[start / 8] |= (1 << (start % 8));
+        else bm[start / 8] &= ~(1 << (start % 8));
+        start++;
+    }
+    if (end - start >= 8) {
+        memset(bm + start / 8, value ? 0xFF : 0x00, (end - start) / 8);
+        start += (end - start) / 8 * 8;
+    }
+    while (start < end) {
+        if (value) bm[start / 8] |= (1 << (start % 8));
+        else bm[start / 8] &= ~(1 << (start % 8));
+        start++;
+    }
+}
+
+// Ищет в [from, to) первый свободный отрезок длиной не меньше want.
+// Если такого нет, возвращает самый длинный найденный (best_len < want).
+static uint32_t bitmap_find_run(const uint8_t* bm, uint32_t nbits, uint32_t from, uint32_t to,
+                                uint32_t want, uint32_t* best_start) {
+    uint32_t best_len = 0;
+    uint32_t pos = from;
+    while (pos < to) {
+        uint32_t run_start = bitmap_find_clear(bm, nbits, pos, to);
+        if (run_start >= to) break;
+        // Длиннее want отрезок мерить незачем
+        uint32_t limit = to - run_start > want ? run_start + want : to;
+        uint32_t run_end = bitmap_find_set(bm, nbits, run_start, limit);
+        uint32_t len = run_end - run_start;
+        if (len > best_len) {
+            best_len = len;
+            *best_start = run_start;
+            if (len >= want) return want;
+        }
+        pos = run_end;
+    }
+    return best_len;
+}
+
+// Функция: alloc_inode
+// Назначение: Выделяет свободный inode (по слову за раз). В отличие от блоков
+// используется first-fit: таблица inode остаётся плотной, и её просмотр
+// (list_files, построение индекса) затрагивает меньше записей. Поиск
+// начинается с inode_hint, поэтому серия созданий не просматривает занятое
+// начало карты каждый раз заново.
+// Возвращает: номер inode или -1, если свободных нет
+static int alloc_inode(myfs_t* fs) {
+    if (fs->sb->free_inodes == 0) return -1;
+
+    uint32_t count = (uint32_t)fs->inode_count;
+    uint32_t from = fs->inode_hint < count ? fs->inode_hint : 0;
+    uint32_t ino = bitmap_find_clear(fs->inode_bitmap, count, from, count);
+    if (ino >= count && from > 0) ino = bitmap_find_clear(fs->inode_bitmap, count, 0, from);
+    if (ino >= count) return -1;
+
+    bitmap_fill(fs->inode_bitmap, ino, 1, true);
+    fs->inode_hint = ino + 1;
+    fs->sb->free_inodes--;
+    fs->inode_bitmap_dirty = true;
+    fs->sb_dirty = true;
+    return (int)ino;
+}
+
+static void free_inode(myfs_t* fs, int ino) {
+    bitmap_fill(fs->inode_bitmap, ino, 1, false);
+    if ((uint32_t)ino < fs->inode_hint) fs->inode_hint = (uint32_t)ino;
+    fs->sb->free_inodes++;
+    fs->inode_bitmap_dirty = true;
+    fs->sb_dirty = true;
+}
+
+// Функция: alloc_blocks
+// Назначение: Выделяет непрерывный отрезок из want блоков, начиная поиск с
+// курсора next-fit и при необходимости продолжая с начала карты. Если отрезка
+// нужной длины нет, выделяет самый длинный из найденных — вызывающая сторона
+// запрашивает остаток следующим вызовом.
+// Возвращает: число выделенных блоков (0 — свободных блоков нет), *start — первый блок
+static uint32_t alloc_blocks(myfs_t* fs, uint32_t want, uint32_t* start) {
+    if (want == 0 || fs->sb->free_blocks == 0) return 0;
+
+    uint32_t cursor = fs->block_cursor;
+    uint32_t tail_start = 0, head_start = 0;
+    uint32_t got = bitmap_find_run(fs->block_bitmap, fs->block_count, cursor, fs->block_count, want, &tail_start);
+    uint32_t scanned = got >= want ? tail_start + want - cursor : fs->block_count - cursor;
+    *start = tail_start;
+    if (got < want && cursor > 0) {
+        uint32_t head = bitmap_find_run(fs->block_bitmap, fs->block_count, 0, cursor, want, &head_start);
+        scanned += head >= want ? head_start + want : cursor;
+        if (head > got) {
+            got = head;
+            *start = head_start;
+        }
+    }
+    STAT_ADD(fs, alloc_calls, 1);
+    STAT_ADD(fs, alloc_scanned, scanned);
+    if (got == 0) return 0;
+    STAT_ADD(fs, blocks_allocated, got);
+
+    bitmap_fill(fs->block_bitmap, *start, got, true);
+    fs->sb->free_blocks -= got;
+    fs->block_cursor = (*start + got) % fs->block_count;
+    fs->block_bitmap_dirty = true;
+    fs->sb_dirty = true;
+    return got;
+}
+
+static void batch_forget(struct myfs_batch* b, uint32_t start, uint32_t count);
+
+// Функция: free_blocks
+// Назначение: Освобождает отрезок блоков и пробивает на его месте дыру в образе
+// (с журналом и в пакете — после фиксации, см. trim_free_blocks).
+static void free_blocks(myfs_t* fs, uint32_t start, uint32_t count) {
+    STAT_ADD(fs, blocks_freed, count);
+    bitmap_fill(fs->block_bitmap, start, count, false);
+    fs->sb->free_blocks += count;
+    fs->block_bitmap_dirty = true;
+    fs->sb_dirty = true;
+    if (fs->batch) batch_forget(fs->batch, start, count);
+
+    // С журналом освобождение ещё не зафиксировано: старые метаданные на
+    // диске могут ссылаться на эти блоки, поэтому дыры пробиваются позже
+    // (trim_free_blocks после фиксации). Пакет при откате возвращает блоки
+    // файлам, так что и их данные до фиксации должны уцелеть
+    if (txn_active(fs)) {
+        fs->trim_pending = true;
+    } else {
+        punch_blocks(fs, start, count);
+    }
+}
+
+// Функция: trim_free_blocks
+// Назначение: Пробивает дыры во всех свободных отрезках карты блоков.
+// Вызывается, когда состояние в памяти совпадает с зафиксированным.
+static void trim_free_blocks(myfs_t* fs) {
+    uint32_t pos = 1;
+    while (pos < fs->block_count) {
+        uint32_t run_start = bitmap_find_clear(fs->block_bitmap, fs->block_count, pos, fs->block_count);
+        if (run_start >= fs->block_count) break;
+        uint32_t run_end = bitmap_find_set(fs->block_bitmap, fs->block_count, run_start, fs->block_count);
+        punch_blocks(fs, run_start, run_end - run_start);
+        pos = run_end;
+    }
+    fs->trim_pending = false;
+}
+
+// Функция: check_counters
+// Назначение: Сверяет счётчики свободных inode/блоков в суперблоке с битовыми
+// картами (popcount по словам) и резервирует блок 0: номер 0 в inode означает
+// «блок не выделен», поэтому отдавать его файлам нельзя.
+static void check_counters(myfs_t* fs) {
+    if (!(fs->block_bitmap[0] & 1)) {
+        fs->block_bitmap[0] |= 1;
+        fs->block_bitmap_dirty = true;
+    }
+
+    uint32_t free_inodes = (uint32_t)fs->inode_count - bitmap_count_set(fs->inode_bitmap, (uint32_t)fs->inode_count);
+    uint32_t free_blocks = fs->block_count - bitmap_count_set(fs->block_bitmap, fs->block_count);
+    if (fs->sb->free_inodes != free_inodes || fs->sb->free_blocks != free_blocks) {
+        fs->sb->free_inodes = free_inodes;
+        fs->sb->free_blocks = free_blocks;
+        fs->sb_dirty = true;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Карта экстентов файла. В памяти это упорядоченный по логическому номеру
+// блока массив отрезков; на диске — INODE_INLINE_EXTENTS экстентов в самом
+// inode, затем косвенный и двойной косвенный блоки (раскладка описана в myfs.h).
+// Файлы старого формата (прямые номера блоков) читаются как карта и при
+// следующей записи сохраняются уже экстентами.
+// -----------------------------------------------------------------------------
+
+typedef struct {
+    uint32_t lblock;         // Логический номер первого блока отрезка в файле
+    uint32_t start;          // Первый физический блок
+    uint32_t len;            // Количество блоков
+} MapExtent;
+
+typedef struct {
+    MapExtent* ext;          // Отрезки в порядке логических блоков
+    uint32_t count;          // Число отрезков
+    uint32_t cap;            // Ёмкость массива ext
+    uint32_t blocks;         // Всего блоков данных в карте
+    uint32_t ind;            // Косвенный блок карты (0 — нет)
+    uint32_t dind;           // Двойной косвенный блок карты (0 — нет)
+    uint32_t* leaves;        // Блоки экстентов, на которые ссылается dind
+    uint32_t leaf_count;
+} ExtentMap;
+
+// Абсолютное смещение блока данных в образе
+static long block_offset(const myfs_t* fs, uint32_t block) {
+    return (long)fs->sb->data_start + ((long)block << fs->block_shift);
+}
+
+static void map_free(ExtentMap* map) {
+    free(map->ext);
+    free(map->leaves);
+    memset(map, 0, sizeof(*map));
+}
+
+// Добавляет отрезок в конец карты, склеивая его с последним, если они соседние
+static bool map_push(ExtentMap* map, uint32_t start, uint32_t len) {
+    if (map->count > 0) {
+        MapExtent* last = &map->ext[map->count - 1];
+        if (last->start + last->len == start) {
+            last->len += len;
+            map->blocks += len;
+            return true;
+        }
+    }
+    if (map->count == map->cap) {
+        uint32_t cap = map->cap ? map->cap * 2 : 8;
+        MapExtent* ext = realloc(map->ext, cap * sizeof(MapExtent));
+        if (!ext) return false;
+        map->ext = ext;
+        map->cap = cap;
+    }
+    map->ext[map->count++] = (MapExtent){ .lblock = map->blocks, .start = start, .len = len };
+    map->blocks += len;
+    return true;
+}
+
+static bool extent_valid(const myfs_t* fs, uint32_t start, uint32_t len) {
+    return start != 0 && start < fs->block_count && len <= fs->block_count - start;
+}
+
+// Добавляет в карту экстенты дискового массива до первой пустой записи
+static bool map_push_extents(const myfs_t* fs, ExtentMap* map, const Extent* ext, uint32_t n) {
+    for (uint32_t i = 0; i < n && ext[i].len != 0; i++) {
+        if (!extent_valid(fs, ext[i].start, ext[i].len)) {
+            fprintf(stderr, "Ошибка: недопустимый экстент %u+%u\n", ext[i].start, ext[i].len);
+            return false;
+        }
+        if (!map_push(map, ext[i].start, ext[i].len)) return false;
+    }
+    return true;
+}
+
+// Функция: map_load
+// Назначение: Загружает карту блоков файла в память (косвенные блоки — по
+// одному запросу на блок).
+static bool map_load(myfs_t* fs, const Inode* node, ExtentMap* map) {
+    memset(map, 0, sizeof(*map));
+    Extent* ext_block = NULL;
+    uint32_t* pointers = NULL;
+
+    // Встроенные данные: блоков у файла нет
+    if (node->flags & INODE_FLAG_INLINE) return true;
+
+    // Старый формат: прямые номера блоков до первого нулевого
+    if (!(node->flags & INODE_FLAG_EXTENTS)) {
+        for (int i = 0; i < 12 && node->blocks[i] != 0; i++) {
+            if (!extent_valid(fs, node->blocks[i], 1)) {
+                fprintf(stderr, "Ошибка: недопустимый номер блока %u\n", node->blocks[i]);
+                map_free(map);
+                return false;
+            }
+            if (!map_push(map, node->blocks[i], 1)) {
+                map_free(map);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    Extent inline_ext[INODE_INLINE_EXTENTS];
+    memcpy(inline_ext, node->blocks, sizeof(inline_ext));
+    if (!map_push_extents(fs, map, inline_ext, INODE_INLINE_EXTENTS)) goto fail;
+
+    map->ind = node->blocks[INODE_EXTENT_IND];
+    map->dind = node->blocks[INODE_EXTENT_DIND];
+    if ((map->ind && !extent_valid(fs, map->ind, 1)) || (map->dind && !extent_valid(fs, map->dind, 1))) {
+        fprintf(stderr, "Ошибка: недопустимый косвенный блок карты\n");
+        goto fail;
+    }
+    if (!map->ind && !map->dind) return true;
+
+    // Блоки карты размером с блок ФС (до MYFS_MAX_BLOCK_SIZE) — в куче, не на стеке
+    uint32_t per_block = (uint32_t)EXTENTS_PER_BLOCK(fs->block_size);
+    uint32_t pointers_per_block = (uint32_t)POINTERS_PER_BLOCK(fs->block_size);
+    ext_block = malloc(fs->block_size);
+    if (!ext_block) goto fail;
+    if (map->ind) {
+        if (!meta_read(fs, block_offset(fs, map->ind), ext_block, fs->block_size) ||
+            !map_push_extents(fs, map, ext_block, per_block)) goto fail;
+    }
+
+    if (map->dind) {
+        pointers = malloc(fs->block_size);
+        map->leaves = malloc(pointers_per_block * sizeof(uint32_t));
+        if (!pointers || !map->leaves) goto fail;
+        if (!meta_read(fs, block_offset(fs, map->dind), pointers, fs->block_size)) goto fail;
+        for (uint32_t i = 0; i < pointers_per_block && pointers[i] != 0; i++) {
+            if (!extent_valid(fs, pointers[i], 1)) goto fail;
+            map->leaves[map->leaf_count++] = pointers[i];
+            if (!meta_read(fs, block_offset(fs, pointers[i]), ext_block, fs->block_size) ||
+                !map_push_extents(fs, map, ext_block, per_block)) goto fail;
+        }
+    }
+    free(ext_block);
+    free(pointers);
+    return true;
+
+fail:
+    free(ext_block);
+    free(pointers);
+    map_free(map);
+    return false;
+}
+
+// Записывает в блок block до EXTENTS_PER_BLOCK экстентов карты, начиная с from
+static bool write_extent_block(myfs_t* fs, uint32_t block, const ExtentMap* map, uint32_t from) {
+    uint32_t per_block = (uint32_t)EXTENTS_PER_BLOCK(fs->block_size);
+    Extent* ext_block = calloc(per_block, sizeof(Extent));
+    if (!ext_block) return false;
+    for (uint32_t i = 0; i < per_block && from + i < map->count; i++) {
+        ext_block[i].start = map->ext[from + i].start;
+        ext_block[i].len = map->ext[from + i].len;
+    }
+    bool ok = meta_write(fs, block_offset(fs, block), ext_block, fs->block_size);
+    free(ext_block);
+    return ok;
+}
+
+// Выделяет один блок под метаданные карты
+// Освобождает блок карты экстентов; журнал больше не повторит записи в него
+static void free_map_block(myfs_t* fs, uint32_t block) {
+    journal_revoke(fs, block_offset(fs, block), fs->block_size);
+    free_blocks(fs, block, 1);
+}
+
+static bool alloc_map_block(myfs_t* fs, uint32_t* block) {
+    if (alloc_blocks(fs, 1, block) == 1) return true;
+    fprintf(stderr, "Ошибка: нет места под блок карты экстентов\n");
+    return false;
+}
+
+// Функция: map_store
+// Назначение: Сохраняет карту в inode (node->blocks) и косвенные блоки.
+// Уже принадлежащие файлу косвенные блоки используются повторно, лишние
+// освобождаются. Сам inode на диск не записывается. Файл старого формата
+// лежит в корне, поэтому его blocks[INODE_PARENT] становится 0. У файла со
+// встроенными данными карта пуста, и blocks[] не трогается.
+static bool map_store(myfs_t* fs, Inode* node, ExtentMap* map) {
+    uint32_t n = map->count;
+    if (node->flags & INODE_FLAG_INLINE) return true;
+    uint32_t parent = (node->flags & INODE_FLAG_EXTENTS) ? node->blocks[INODE_PARENT] : 0;
+
+    memset(node->blocks, 0, sizeof(node->blocks));
+    node->blocks[INODE_PARENT] = parent;
+    node->flags |= INODE_FLAG_EXTENTS;
+
+    Extent inline_ext[INODE_INLINE_EXTENTS];
+    memset(inline_ext, 0, sizeof(inline_ext));
+    for (uint32_t i = 0; i < n && i < INODE_INLINE_EXTENTS; i++) {
+        inline_ext[i].start = map->ext[i].start;
+        inline_ext[i].len = map->ext[i].len;
+    }
+    memcpy(node->blocks, inline_ext, sizeof(inline_ext));
+    uint32_t done = n < INODE_INLINE_EXTENTS ? n : INODE_INLINE_EXTENTS;
+
+    // Косвенный блок
+    uint32_t per_block = (uint32_t)EXTENTS_PER_BLOCK(fs->block_size);
+    uint32_t pointers_per_block = (uint32_t)POINTERS_PER_BLOCK(fs->block_size);
+    if (done < n) {
+        if (!map->ind && !alloc_map_block(fs, &map->ind)) return false;
+        if (!write_extent_block(fs, map->ind, map, done)) return false;
+        done = (n - done < per_block) ? n : done + per_block;
+    } else if (map->ind) {
+        free_map_block(fs, map->ind);
+        map->ind = 0;
+    }
+    node->blocks[INODE_EXTENT_IND] = map->ind;
+
+    // Двойной косвенный блок
+    uint32_t need_leaves = (n - done + per_block - 1) / per_block;
+    if (need_leaves > pointers_per_block) {
+        fprintf(stderr, "Ошибка: файл слишком фрагментирован (%u экстентов)\n", n);
+        return false;
+    }
+    while (map->leaf_count > need_leaves) {
+        free_map_block(fs, map->leaves[--map->leaf_count]);
+    }
+    if (need_leaves > 0) {
+        if (!map->leaves) {
+            map->leaves = malloc(pointers_per_block * sizeof(uint32_t));
+            if (!map->leaves) return false;
+        }
+        while (map->leaf_count < need_leaves) {
+            if (!alloc_map_block(fs, &map->leaves[map->leaf_count])) return false;
+            map->leaf_count++;
+        }
+        for (uint32_t k = 0; k < need_leaves; k++) {
+            if (!write_extent_block(fs, map->leaves[k], map, done + k * per_block)) return false;
+        }
+
+        if (!map->dind && !alloc_map_block(fs, &map->dind)) return false;
+        uint32_t* pointers = calloc(pointers_per_block, sizeof(uint32_t));
+        if (!pointers) return false;
+        memcpy(pointers, map->leaves, need_leaves * sizeof(uint32_t));
+        bool ok = meta_write(fs, block_offset(fs, map->dind), pointers, fs->block_size);
+        free(pointers);
+        if (!ok) return false;
+    } else if (map->dind) {
+        free_map_block(fs, map->dind);
+        map->dind = 0;
+    }
+    node->blocks[INODE_EXTENT_DIND] = map->dind;
+    return true;
+}
+
+// Функция: map_truncate
+// Назначение: Укорачивает карту до nblocks блоков, освобождая хвост.
+static void map_truncate(myfs_t* fs, ExtentMap* map, uint32_t nblocks) {
+    while (map->count > 0 && map->blocks > nblocks) {
+        MapExtent* last = &map->ext[map->count - 1];
+        uint32_t excess = map->blocks - nblocks;
+        uint32_t cut = excess < last->len ? excess : last->len;
+        free_blocks(fs, last->start + last->len - cut, cut);
+        last->len -= cut;
+        map->blocks -= cut;
+        if (last->len == 0) map->count--;
+    }
+}
+
+// Функция: map_release
+// Назначение: Освобождает все блоки файла — и данные, и блоки самой карты.
+static void map_release(myfs_t* fs, ExtentMap* map) {
+    map_truncate(fs, map, 0);
+    for (uint32_t i = 0; i < map->leaf_count; i++) {
+        free_map_block(fs, map->leaves[i]);
+    }
+    map->leaf_count = 0;
+    if (map->dind) free_map_block(fs, map->dind);
+    if (map->ind) free_map_block(fs, map->ind);
+    map->dind = map->ind = 0;
+}
+
+// Функция: map_extend
+// Назначение: Догоняет карту до nblocks блоков. Поиск начинается сразу за
+// последним блоком файла, чтобы дописываемые данные продолжали тот же отрезок.
+// При нехватке места всё выделенное в этом вызове возвращается.
+static bool map_extend(myfs_t* fs, ExtentMap* map, uint32_t nblocks) {
+    uint32_t old_blocks = map->blocks;
+    if (map->count > 0) {
+        const MapExtent* last = &map->ext[map->count - 1];
+        if (last->start + last->len < fs->block_count) fs->block_cursor = last->start + last->len;
+    }
+
+    while (map->blocks < nblocks) {
+        uint32_t start;
+        uint32_t got = alloc_blocks(fs, nblocks - map->blocks, &start);
+        if (got == 0 || !map_push(map, start, got)) {
+            if (got) free_blocks(fs, start, got);
+            map_truncate(fs, map, old_blocks);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Возвращает индекс отрезка, содержащего логический блок lblock, или -1
+static int map_find(const ExtentMap* map, uint32_t lblock) {
+    uint32_t lo = 0, hi = map->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const MapExtent* e = &map->ext[mid];
+        if (lblock < e->lblock) hi = mid;
+        else if (lblock >= e->lblock + e->len) lo = mid + 1;
+        else return (int)mid;
+    }
+    return -1;
+}
+
+// Функция: map_io
+// Назначение: Читает/записывает len байт файла, начиная с байта offset.
+// На каждый затронутый экстент приходится один запрос ввода-вывода; с
+// исполнителем ввода-вывода в режиме stdio запросы уходят пакетами (io_run).
+static bool map_io(myfs_t* fs, const ExtentMap* map, uint64_t offset, void* buf, size_t len, bool write) {
+    uint8_t* p = buf;
+    IoSeg segs[MAP_IO_BATCH];
+    uint32_t n = 0;
+    bool batched = fs->io_engine != MYFS_IO_SYNC && fs->backend == MYFS_BACKEND_STDIO;
+    while (len > 0) {
+        int idx = map_find(map, block_index(fs, offset));
+        if (idx < 0) return false;
+
+        const MapExtent* e = &map->ext[idx];
+        uint64_t ext_begin = (uint64_t)e->lblock << fs->block_shift;
+        uint64_t ext_end = (uint64_t)(e->lblock + e->len) << fs->block_shift;
+        size_t chunk = (ext_end - offset < len) ? (size_t)(ext_end - offset) : len;
+        long phys = block_offset(fs, e->start) + (long)(offset - ext_begin);
+
+        if (batched) {
+            segs[n++] = (IoSeg){.offset = phys, .buf = p, .size = chunk};
+            if (n == MAP_IO_BATCH) {
+                if (!io_run(fs, segs, n, write)) return false;
+                n = 0;
+            }
+        } else if (!(write ? write_region(fs, phys, p, chunk) : read_region(fs, phys, p, chunk))) {
+            return false;
+        }
+
+        p += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+    return n == 0 || io_run(fs, segs, n, write);
+}
+
+static bool map_read(myfs_t* fs, const ExtentMap* map, uint64_t offset, void* buf, size_t len) {
+    return map_io(fs, map, offset, buf, len, false);
+}
+
+static bool map_write(myfs_t* fs, const ExtentMap* map, uint64_t offset, const void* buf, size_t len) {
+    return map_io(fs, map, offset, (void*)buf, len, true);
+}
+
+// -----------------------------------------------------------------------------
+// Кэш inode: копия записи и загруженная карта экстентов. После первого
+// обращения позиционное чтение не тратит ни одного запроса на метаданные —
+// только запросы к блокам данных. Запись в кэш сквозная: store_inode сразу
+// пишет inode и карту на диск.
+// -----------------------------------------------------------------------------
+
+// Таблица кластеров сжатого файла (см. MYFS_CLUSTER_SIZE)
+typedef struct {
+    uint32_t count;          // Кластеров
+    uint32_t* len;           // Записи таблицы: длина кластера в потоке | MYFS_CLUSTER_RAW
+    uint32_t* start;         // Первый блок каждого кластера в потоке (в том же выделении, что len)
+} ClusterTable;
+
+struct CachedInode {
+    Inode node;              // Копия записи таблицы inode
+    ExtentMap map;           // Карта экстентов файла (у сжатого — блоков потока)
+    ClusterTable clusters;   // Таблица кластеров (INODE_FLAG_COMPRESSED)
+    uint64_t gen;            // Поколение таблицы: меняется при каждой записи сжатого файла
+    bool dirty;              // Запись изменена (только mtime) и ещё не записана
+};
+
+static bool comp_load(myfs_t* fs, CachedInode* ci);
+
+// Функция: get_inode
+// Назначение: Возвращает inode из кэша, при промахе загружает его и карту.
+// Возвращает: NULL, если inode не занят или не читается
+static CachedInode* get_inode(myfs_t* fs, int ino) {
+    if (ino < 0 || ino >= fs->inode_count || !(fs->inode_bitmap[ino / 8] & (1 << (ino % 8)))) {
+        return NULL;
+    }
+    if (fs->inodes[ino]) return fs->inodes[ino];
+
+    CachedInode* ci = calloc(1, sizeof(CachedInode));
+    if (!ci) return NULL;
+    if (!read_inode(fs, ino, &ci->node)) {
+        perror("Ошибка чтения inode");
+        free(ci);
+        return NULL;
+    }
+    if (!map_load(fs, &ci->node, &ci->map)) {
+        fprintf(stderr, "Ошибка: карта блоков inode %d повреждена\n", ino);
+        free(ci);
+        return NULL;
+    }
+    if ((ci->node.flags & INODE_FLAG_COMPRESSED) && !comp_load(fs, ci)) {
+        fprintf(stderr, "Ошибка: таблица кластеров inode %d повреждена\n", ino);
+        map_free(&ci->map);
+        free(ci);
+        return NULL;
+    }
+    fs->inodes[ino] = ci;
+    return ci;
+}
+
+// Функция: acquire_inode
+// Назначение: get_inode для вызова без meta_lock (под блокировкой inode):
+// попадание проверяется под блокировкой чтения, загрузка идёт под записью.
+static CachedInode* acquire_inode(myfs_t* fs, int ino) {
+    if (ino < 0 || ino >= fs->inode_count) return NULL;
+    meta_rdlock(fs);
+    bool used = fs->inode_bitmap[ino / 8] & (1 << (ino % 8));
+    CachedInode* ci = used ? fs->inodes[ino] : NULL;
+    // Без потоков загрузка не мешает другим читателям таблицы
+    if (used && !ci && !fs->thread_safe) ci = get_inode(fs, ino);
+    meta_unlock(fs);
+    if (ci || !used || !fs->thread_safe) return ci;
+
+    meta_wrlock(fs);
+    ci = get_inode(fs, ino);
+    meta_unlock(fs);
+    return ci;
+}
+
+// Функция: finish_op
+// Назначение: journal_op_end для вызова без meta_lock.
+static bool finish_op(myfs_t* fs) {
+    if (!fs->journal) return true;
+    meta_wrlock(fs);
+    bool ok = journal_op_end(fs);
+    meta_unlock(fs);
+    return ok;
+}
+
+// Функция: drop_inode
+// Назначение: Выбрасывает inode из кэша (после удаления файла или ошибки,
+// когда копия в памяти могла разойтись с диском).
+static void drop_inode(myfs_t* fs, int ino) {
+    CachedInode* ci = fs->inodes[ino];
+    if (!ci) return;
+    map_free(&ci->map);
+    free(ci->clusters.len);
+    free(ci);
+    fs->inodes[ino] = NULL;
+}
+
+// Функция: store_inode
+// Назначение: Записывает карту экстентов и inode на диск. При ошибке inode
+// выбрасывается из кэша, чтобы следующее обращение перечитало его с диска.
+static bool store_inode(myfs_t* fs, int ino) {
+    CachedInode* ci = fs->inodes[ino];
+    if (!map_store(fs, &ci->node, &ci->map)) {
+        fprintf(stderr, "Ошибка обновления карты блоков inode %d\n", ino);
+        drop_inode(fs, ino);
+        return false;
+    }
+    if (!write_inode(fs, ino, &ci->node)) {
+        perror("Ошибка записи inode");
+        drop_inode(fs, ino);
+        return false;
+    }
+    ci->dirty = false;
+    return true;
+}
+
+// Функция: flush_inode
+// Назначение: Записывает отложенные изменения inode (карта при этом не менялась).
+static bool flush_inode(myfs_t* fs, int ino) {
+    CachedInode* ci = fs->inodes[ino];
+    if (!ci || !ci->dirty) return true;
+    if (!write_inode(fs, ino, &ci->node)) {
+        perror("Ошибка записи inode");
+        return false;
+    }
+    ci->dirty = false;
+    return true;
+}
+
+// Под блокировкой чтения каждого inode: его запись может идти в другом потоке
+static bool flush_inodes(myfs_t* fs) {
+    bool ok = true;
+    if (fs->shared) return true;  // Отложенных изменений нет: см. writeback_inode
+    for (int i = 0; i < fs->inode_count; i++) {
+        inode_lock(fs, i, false);
+        meta_wrlock(fs);
+        if (!flush_inode(fs, i)) ok = false;
+        meta_unlock(fs);
+        inode_unlock(fs, i);
+    }
+    return ok;
+}
+
+// Функция: writeback_inode
+// Назначение: flush_inode для вызова без meta_lock (под блокировкой inode на
+// запись). meta_lock защищает транзакцию журнала или фиксируемого пакета; в
+// режиме shared их нет, и запись inode защищена блокировкой самого inode.
+static bool writeback_inode(myfs_t* fs, int ino) {
+    if (fs->shared) return flush_inode(fs, ino);
+    meta_wrlock(fs);
+    bool ok = flush_inode(fs, ino);
+    meta_unlock(fs);
+    return ok;
+}
+
+static void inode_cache_free(myfs_t* fs) {
+    for (int i = 0; i < fs->inode_count; i++) {
+        drop_inode(fs, i);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Встроенные данные (INODE_FLAG_INLINE): файл до MYFS_INLINE_MAX байт живёт в
+// записи inode, поэтому создание и запись крошечного файла стоят одной записи
+// inode через журнал, без блоков данных и запросов к ним.
+// -----------------------------------------------------------------------------
+
+static bool is_inline(const Inode* node) {
+    return node->flags & INODE_FLAG_INLINE;
+}
+
+static uint8_t* inline_data(Inode* node) {
+    return (uint8_t*)node->blocks;
+}
+
+// Может ли файл с картой ci->map и размером end храниться в inode: у него нет
+// ни блоков данных, ни блоков карты
+static bool inline_fits(const CachedInode* ci, uint64_t end) {
+    return end <= MYFS_INLINE_MAX &&
+           (is_inline(&ci->node) || (ci->map.count == 0 && !ci->map.ind && !ci->map.dind));
+}
+
+// Функция: make_inline
+// Назначение: Переводит файл без блоков во встроенный формат. У файла старого
+// формата в blocks[] — прямые номера блоков и каталога нет: он в корне.
+static void make_inline(Inode* node) {
+    if (is_inline(node)) return;
+    if (node->flags & INODE_FLAG_EXTENTS) memset(node->blocks, 0, MYFS_INLINE_MAX);
+    else memset(node->blocks, 0, sizeof(node->blocks));
+    node->flags |= INODE_FLAG_EXTENTS | INODE_FLAG_INLINE;
+}
+
+// Снимает INODE_FLAG_INLINE: место встроенных данных снова занимает карта
+static void clear_inline(Inode* node) {
+    if (!is_inline(node)) return;
+    memset(inline_data(node), 0, MYFS_INLINE_MAX);
+    node->flags &= ~(uint32_t)INODE_FLAG_INLINE;
+}
+
+// Функция: inline_spill
+// Назначение: Переносит встроенные данные в nblocks новых блоков (под
+// meta_lock на запись). inode потом записывается store_inode.
+static bool inline_spill(myfs_t* fs, CachedInode* ci, uint32_t nblocks) {
+    uint8_t data[MYFS_INLINE_MAX];
+    memcpy(data, inline_data(&ci->node), sizeof(data));
+    if (!map_extend(fs, &ci->map, nblocks)) {
+        fprintf(stderr, "Недостаточно свободных блоков\n");
+        return false;
+    }
+    if (!map_write(fs, &ci->map, 0, data, ci->node.size)) {
+        perror("Ошибка записи данных");
+        map_truncate(fs, &ci->map, 0);
+        return false;
+    }
+    clear_inline(&ci->node);
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// Сжатые файлы (INODE_FLAG_COMPRESSED, формат — в myfs.h у MYFS_CLUSTER_SIZE).
+// Кодек — LZ77 без энтропийного кодирования: сжимает текст и JSON в 2–4 раза
+// и распаковывает быстрее, чем читается диск. Таблица кластеров загружается
+// вместе с картой, поэтому кластер с любого смещения находится без
+// обращений к диску, а чтение целого кластера распаковывается прямо в буфер
+// вызывающего.
+// -----------------------------------------------------------------------------
+
+#define LZ_MIN_MATCH 4           // Самое короткое совпадение
+#define LZ_HASH_BITS 12          // Таблица последних позиций — 16 КиБ на стеке
+#define LZ_MAX_OFFSET 0xFFFF     // Смещение совпадения занимает 2 байта
+#define LZ_SKIP_SHIFT 5          // После 2^5 промахов подряд шаг поиска растёт
+
+// Распакованный кластер дескриптора: мелкие последовательные чтения через
+// myfs_read не распаковывают один и тот же кластер заново
+typedef struct {
+    uint8_t* data;           // MYFS_CLUSTER_SIZE байт (NULL — ещё не нужен)
+    uint32_t index;          // Номер кластера в data
+    uint64_t gen;            // CachedInode.gen на момент распаковки (0 — data пуст)
+} ClusterCache;
+
+static uint32_t lz_hash(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Пишет продолжение длины: байты 255 и остаток
+static uint8_t* lz_put_len(uint8_t* op, size_t n) {
+    for (; n >= 255; n -= 255) *op++ = 255;
+    *op++ = (uint8_t)n;
+    return op;
+}
+
+// Последовательность: признак, литералы [lit, lit + nlit), затем совпадение
+// (mlen = 0 — последняя последовательность без совпадения). NULL — не хватило cap
+static uint8_t* lz_put_seq(uint8_t* op, const uint8_t* end, const uint8_t* lit, size_t nlit, size_t offset, size_t mlen) {
+    size_t need = 1 + nlit / 255 + 1 + nlit + (mlen ? 2 + mlen / 255 + 1 : 0);
+    if ((size_t)(end - op) < need) return NULL;
+    size_t m = mlen ? mlen - LZ_MIN_MATCH : 0;
+    uint8_t* token = op++;
+    *token = (uint8_t)(((nlit < 15 ? nlit : 15) << 4) | (m < 15 ? m : 15));
+    if (nlit >= 15) op = lz_put_len(op, nlit - 15);
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (mlen) {
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        if (m >= 15) op = lz_put_len(op, m - 15);
+    }
+    return op;
+}
+
+// Функция: lz_compress
+// Назначение: Сжимает len байт src в dst (не больше cap байт). Совпадения
+// ищутся по хешу 4 байт; на несжимаемых данных шаг поиска растёт, чтобы
+// кодек не тратил на них время.
+// Возвращает: длину сжатых данных или 0, если они не поместились в cap
+static size_t lz_compress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap) {
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+    const uint8_t* end = dst + cap;
+    uint8_t* op = dst;
+    size_t pos = 1, anchor = 0, misses = 0;
+    while (pos + LZ_MIN_MATCH <= len) {
+        uint32_t h = lz_hash(src + pos);
+        size_t cand = table[h];
+        table[h] = (uint32_t)pos;
+        if (pos - cand > LZ_MAX_OFFSET || memcmp(src + cand, src + pos, LZ_MIN_MATCH) != 0) {
+            pos += 1 + (misses++ >> LZ_SKIP_SHIFT);
+            continue;
+        }
+
+        size_t mlen = LZ_MIN_MATCH;
+        while (pos + mlen < len && src[cand + mlen] == src[pos + mlen]) mlen++;
+        op = lz_put_seq(op, end, src + anchor, pos - anchor, pos - cand, mlen);
+        if (!op) return 0;
+        pos += mlen;
+        anchor = pos;
+        misses = 0;
+        if (pos + LZ_MIN_MATCH <= len) table[lz_hash(src + pos - 2)] = (uint32_t)(pos - 2);
+    }
+    op = lz_put_seq(op, end, src + anchor, len - anchor, 0, 0);
+    return op ? (size_t)(op - dst) : 0;
+}
+
+// Функция: lz_decompress
+// Назначение: Распаковывает srclen байт src ровно в out_len байт dst. Все
+// длины и смещения проверяются, поэтому повреждённые данные не выводят ни
+// за src, ни за dst. Байты src после out_len распакованных не читаются.
+// Возвращает: false, если данные повреждены
+static bool lz_decompress(const uint8_t* src, size_t srclen, uint8_t* dst, size_t out_len) {
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + srclen;
+    size_t o = 0;
+    while (o < out_len) {
+        if (ip >= iend) return false;
+        unsigned token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return false;
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > (size_t)(iend - ip) || lit > out_len - o) return false;
+        memcpy(dst + o, ip, lit);
+        ip += lit;
+        o += lit;
+        if (o == out_len) break;
+
+        if (iend - ip < 2) return false;
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        size_t mlen = token & 15;
+        if (mlen == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return false;
+                b = *ip++;
+                mlen += b;
+            } while (b == 255);
+        }
+        mlen += LZ_MIN_MATCH;
+        if (offset == 0 || offset > o || mlen > out_len - o) return false;
+        if (offset >= mlen) {
+            memcpy(dst + o, dst + o - offset, mlen);
+        } else {
+            for (size_t i = 0; i < mlen; i++) dst[o + i] = dst[o + i - offset];
+        }
+        o += mlen;
+    }
+    return true;
+}
+
+static bool is_compressed(const Inode* node) {
+    return node->flags & INODE_FLAG_COMPRESSED;
+}
+
+// Число кластеров файла размером size
+static uint32_t cluster_count(uint64_t size) {
+    return (uint32_t)((size + MYFS_CLUSTER_SIZE - 1) / MYFS_CLUSTER_SIZE);
+}
+
+// Несжатая длина кластера k файла размером size
+static size_t cluster_raw_len(uint64_t size, uint32_t k) {
+    uint64_t left = size - (uint64_t)k * MYFS_CLUSTER_SIZE;
+    return left < MYFS_CLUSTER_SIZE ? (size_t)left : MYFS_CLUSTER_SIZE;
+}
+
+// Длина кластера в потоке по записи таблицы
+static uint32_t cluster_stored(uint32_t entry) {
+    return entry & ~MYFS_CLUSTER_RAW;
+}
+
+// Новое поколение таблицы кластеров (см. ClusterCache)
+static uint64_t cluster_gen(myfs_t* fs) {
+    return __atomic_add_fetch(&fs->cluster_gen, 1, __ATOMIC_RELAXED);
+}
+
+// Выделяет таблицу на count кластеров (записи обнулены)
+static bool cluster_table_alloc(ClusterTable* t, uint32_t count) {
+    t->len = calloc(2 * (size_t)count, sizeof(uint32_t));
+    if (!t->len) return false;
+    t->start = t->len + count;
+    t->count = count;
+    return true;
+}
+
+// Расставляет начала кластеров по длинам: каждый — с границы блока
+static void cluster_table_index(const myfs_t* fs, ClusterTable* t) {
+    uint32_t block = 0;
+    for (uint32_t k = 0; k < t->count; k++) {
+        t->start[k] = block;
+        block += blocks_for(fs, cluster_stored(t->len[k]));
+    }
+}
+
+// Снимает сжатие с inode (карта при этом не меняется)
+static void comp_drop(CachedInode* ci) {
+    free(ci->clusters.len);
+    memset(&ci->clusters, 0, sizeof(ci->clusters));
+    ci->node.flags &= ~(uint32_t)INODE_FLAG_COMPRESSED;
+}
+
+// Функция: comp_load
+// Назначение: Читает таблицу кластеров из конца потока и проверяет её:
+// длины должны соответствовать размеру файла, а кластеры — помещаться в
+// поток перед таблицей.
+static bool comp_load(myfs_t* fs, CachedInode* ci) {
+    uint64_t size = ci->node.size;
+    uint32_t count = cluster_count(size);
+    uint64_t stream = (uint64_t)ci->map.blocks << fs->block_shift;
+    uint64_t table_bytes = (uint64_t)count * sizeof(uint32_t);
+    ClusterTable t;
+    if (count == 0 || table_bytes > stream || !cluster_table_alloc(&t, count)) return false;
+    if (!map_read(fs, &ci->map, stream - table_bytes, t.len, (size_t)table_bytes)) {
+        free(t.len);
+        return false;
+    }
+
+    for (uint32_t k = 0; k < count; k++) {
+        size_t raw = cluster_raw_len(size, k);
+        uint32_t stored = cluster_stored(t.len[k]);
+        bool valid = (t.len[k] & MYFS_CLUSTER_RAW) ? stored == raw : stored > 0 && stored < raw;
+        if (!valid) {
+            free(t.len);
+            return false;
+        }
+    }
+    cluster_table_index(fs, &t);
+    uint64_t data_end = ((uint64_t)t.start[count - 1] << fs->block_shift) + cluster_stored(t.len[count - 1]);
+    if (data_end + table_bytes > stream) {
+        free(t.len);
+        return false;
+    }
+    ci->clusters = t;
+    ci->gen = cluster_gen(fs);
+    return true;
+}
+
+// Функция: comp_read_cluster
+// Назначение: Распаковывает кластер k целиком в out. Несжатый кластер
+// читается прямо в out; сжатый в режиме mmap распаковывается прямо из
+// отображения, если лежит в одном экстенте, иначе читается в *scratch
+// (выделяется при первой надобности, освобождает вызывающий).
+static bool comp_read_cluster(myfs_t* fs, const CachedInode* ci, uint32_t k, uint8_t* out, uint8_t** scratch) {
+    size_t raw = cluster_raw_len(ci->node.size, k);
+    uint32_t entry = ci->clusters.len[k];
+    uint32_t stored = cluster_stored(entry);
+    uint32_t first = ci->clusters.start[k];
+    uint64_t at = (uint64_t)first << fs->block_shift;
+    if (entry & MYFS_CLUSTER_RAW) return map_read(fs, &ci->map, at, out, raw);
+
+    const uint8_t* src = NULL;
+    if (fs->backend == MYFS_BACKEND_MMAP) {
+        int idx = map_find(&ci->map, first);
+        const MapExtent* e = idx >= 0 ? &ci->map.ext[idx] : NULL;
+        if (e && first + blocks_for(fs, stored) <= e->lblock + e->len) {
+            long phys = block_offset(fs, e->start + (first - e->lblock));
+            if ((size_t)phys + stored <= fs->map_size) src = fs->map + phys;
+        }
+    }
+    if (!src) {
+        if (!*scratch && !(*scratch = malloc(MYFS_CLUSTER_SIZE))) return false;
+        if (!map_read(fs, &ci->map, at, *scratch, stored)) return false;
+        src = *scratch;
+    }
+    if (!lz_decompress(src, stored, out, raw)) {
+        fprintf(stderr, "Ошибка: сжатый кластер %u повреждён\n", k);
+        errno = EIO;
+        return false;
+    }
+    STAT_ADD(fs, decomp_clusters, 1);
+    return true;
+}
+
+// Функция: comp_pread
+// Назначение: file_pread для сжатого файла (len уже не выходит за конец).
+// Кластеры, нужные целиком, распаковываются прямо в buf, из несжатых
+// читается только нужная часть, а часть сжатого распаковывается в кэш
+// дескриптора cc (NULL — во временный буфер).
+static ssize_t comp_pread(myfs_t* fs, const CachedInode* ci, uint8_t* buf, size_t len, uint64_t offset, ClusterCache* cc) {
+    uint8_t* scratch = NULL;
+    uint8_t* tmp = NULL;
+    bool ok = true;
+    for (size_t done = 0, n; ok && done < len; done += n) {
+        uint64_t pos = offset + done;
+        uint32_t k = (uint32_t)(pos / MYFS_CLUSTER_SIZE);
+        size_t within = (size_t)(pos % MYFS_CLUSTER_SIZE);
+        size_t raw = cluster_raw_len(ci->node.size, k);
+        n = raw - within < len - done ? raw - within : len - done;
+
+        if (n == raw) {
+            ok = comp_read_cluster(fs, ci, k, buf + done, &scratch);
+        } else if (ci->clusters.len[k] & MYFS_CLUSTER_RAW) {
+            uint64_t at = ((uint64_t)ci->clusters.start[k] << fs->block_shift) + within;
+            ok = map_read(fs, &ci->map, at, buf + done, n);
+        } else if (cc && cc->gen == ci->gen && cc->index == k) {
+            memcpy(buf + done, cc->data + within, n);
+        } else {
+            uint8_t** cluster = cc ? &cc->data : &tmp;
+            if (cc) cc->gen = 0;
+            ok = (*cluster || (*cluster = malloc(MYFS_CLUSTER_SIZE))) &&
+                 comp_read_cluster(fs, ci, k, *cluster, &scratch);
+            if (ok) {
+                memcpy(buf + done, *cluster + within, n);
+                if (cc) *cc = (ClusterCache){.data = cc->data, .index = k, .gen = ci->gen};
+            }
+        }
+    }
+    free(scratch);
+    free(tmp);
+    return ok ? (ssize_t)len : -1;
+}
+
+// Часть потока сжатого файла, в которой лежат кластеры байт [*from, *to) файла
+static void comp_span(const myfs_t* fs, const CachedInode* ci, uint64_t* from, uint64_t* to) {
+    uint32_t first = (uint32_t)(*from / MYFS_CLUSTER_SIZE);
+    uint32_t last = (uint32_t)((*to - 1) / MYFS_CLUSTER_SIZE);
+    *from = (uint64_t)ci->clusters.start[first] << fs->block_shift;
+    *to = ((uint64_t)ci->clusters.start[last] << fs->block_shift) + cluster_stored(ci->clusters.len[last]);
+}
+
+// -----------------------------------------------------------------------------
+// Упреждающее чтение (см. myfs.h). Состояние Readahead живёт в дескрипторе
+// файла или на время одного myfs_read_stream. Запрошенные окна идут подряд,
+// поэтому запрошенная часть файла — один отрезок [start, end). Подсказки
+// ядру асинхронны: они только ставят чтение блоков в очередь.
+// -----------------------------------------------------------------------------
+
+#define RA_MIN_BLOCKS 4          // Первое окно после начала последовательного чтения
+
+typedef struct {
+    uint64_t next;           // Где начнётся следующее чтение, если оно последовательное
+    uint64_t start, end;     // Запрошенная упреждающим чтением часть файла
+    uint32_t window;         // Размер последнего окна, блоков (0 — окон ещё не было)
+} Readahead;
+
+// Функция: readahead_hint
+// Назначение: Просит ядро подгрузить байты файла [from, to) — по подсказке на
+// каждый затронутый экстент, кроме экстента cur, который сейчас читается:
+// его продолжение ядро и так читает вперёд, видя последовательные запросы к
+// образу, а подсказка поверх только сбила бы его собственное окно. Ошибки
+// подсказок не важны и не проверяются.
+// Возвращает: сколько байт попало в подсказки
+static uint64_t readahead_hint(myfs_t* fs, const ExtentMap* map, int cur, uint64_t from, uint64_t to) {
+    uint64_t hinted = 0;
+    while (from < to) {
+        int idx = map_find(map, block_index(fs, from));
+        if (idx < 0) break;
+
+        const MapExtent* e = &map->ext[idx];
+        uint64_t ext_end = (uint64_t)(e->lblock + e->len) << fs->block_shift;
+        uint64_t chunk = (ext_end < to ? ext_end : to) - from;
+        if (idx == cur) {
+            from += chunk;
+            continue;
+        }
+        uint64_t phys = (uint64_t)block_offset(fs, e->start) + (from - ((uint64_t)e->lblock << fs->block_shift));
+        if (fs->backend == MYFS_BACKEND_MMAP) {
+            // madvise принимает только адрес, выровненный на страницу
+            uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+            uint64_t aligned = phys & ~(page - 1);
+            madvise(fs->map + aligned, (size_t)(phys + chunk - aligned), MADV_WILLNEED);
+        } else {
+            posix_fadvise(image_fd(fs), (off_t)phys, (off_t)chunk, POSIX_FADV_WILLNEED);
+        }
+        hinted += chunk;
+        from += chunk;
+    }
+    return hinted;
+}
+
+// Функция: readahead_note
+// Назначение: Учитывает предстоящее чтение [offset, offset + len) файла ci.
+// Чтение с места, где кончилось предыдущее, — последовательное: когда до
+// конца запрошенной части остаётся меньше половины последнего окна,
+// запрашивается следующее окно, вдвое больше прежнего (не больше
+// readahead_max). Чтение с другого места сбрасывает окно.
+// Вызывается под блокировкой inode до самого чтения.
+static void readahead_note(myfs_t* fs, const CachedInode* ci, Readahead* ra, uint64_t offset, size_t len) {
+    uint64_t size = ci->node.size;
+    if (!fs->readahead_max || is_inline(&ci->node) || offset >= size) return;
+    uint64_t end = (len < size - offset) ? offset + len : size;
+    if (offset != ra->next) {
+        if (ra->window) STAT_ADD(fs, ra_resets, 1);
+        *ra = (Readahead){.next = end};
+        return;
+    }
+    ra->next = end;
+    STAT_ADD(fs, ra_sequential, 1);
+
+    // Попадание: байты чтения, уже запрошенные прошлыми окнами
+    uint64_t lo = offset > ra->start ? offset : ra->start;
+    uint64_t hi = end < ra->end ? end : ra->end;
+    if (hi > lo) STAT_ADD(fs, ra_hit_bytes, hi - lo);
+
+    uint64_t ahead = ra->end > end ? ra->end - end : 0;
+    if (ra->window && ahead > ((uint64_t)ra->window << fs->block_shift) / 2) return;
+
+    uint32_t blocks = ra->window ? ra->window * 2 : RA_MIN_BLOCKS;
+    if (blocks > fs->readahead_max) blocks = fs->readahead_max;
+    uint64_t from = ra->end > end ? ra->end : end;
+    uint64_t to = from + ((uint64_t)blocks << fs->block_shift);
+    if (to > size) to = size;
+    if (from >= to) return;
+
+    // Крупное чтение могло перескочить запрошенную часть: она начинается заново
+    if (from != ra->end) ra->start = from;
+    ra->end = to;
+    ra->window = blocks;
+    STAT_ADD(fs, ra_windows, 1);
+    STAT_ADD(fs, ra_bytes, to - from);
+
+    // У сжатого файла окно переводится в часть потока с его кластерами
+    uint64_t last = end - 1;
+    if (is_compressed(&ci->node)) {
+        uint64_t cur_to = end;
+        comp_span(fs, ci, &last, &cur_to);
+        comp_span(fs, ci, &from, &to);
+    }
+    int cur = map_find(&ci->map, block_index(fs, last));
+    STAT_ADD(fs, ra_hinted, readahead_hint(fs, &ci->map, cur, from, to));
+}
+
+// Функция: file_pread
+// Назначение: Читает до len байт файла начиная с offset (не дальше конца
+// файла); cc — кэш кластера дескриптора для сжатого файла (может быть NULL).
+// Возвращает: число прочитанных байт или -1 при ошибке ввода-вывода
+static ssize_t file_pread(myfs_t* fs, const CachedInode* ci, void* buf, size_t len, uint64_t offset, ClusterCache* cc) {
+    uint64_t size = ci->node.size;
+    if (offset >= size) return 0;
+    if (len > size - offset) len = (size_t)(size - offset);
+    if (is_inline(&ci->node)) {
+        memcpy(buf, (const uint8_t*)ci->node.blocks + offset, len);
+        return (ssize_t)len;
+    }
+    if (is_compressed(&ci->node)) return comp_pread(fs, ci, buf, len, offset, cc);
+    if (offset + len > (uint64_t)ci->map.blocks << fs->block_shift) {
+        fprintf(stderr, "Ошибка: размер файла больше, чем выделено блоков\n");
+        return -1;
+    }
+    if (!map_read(fs, &ci->map, offset, buf, len)) return -1;
+    return (ssize_t)len;
+}
+
+// Функция: zero_range
+// Назначение: Заполняет нулями байты файла [from, to). Нужна при записи за
+// концом файла: хвост последнего блока и переиспользованные блоки могут
+// хранить старые данные, если пробивание дыр не поддерживается.
+static bool zero_range(myfs_t* fs, const ExtentMap* map, uint64_t from, uint64_t to) {
+    static const uint8_t zeros[4096];
+    while (from < to) {
+        size_t chunk = sizeof(zeros) - (size_t)(from % sizeof(zeros));
+        if (chunk > to - from) chunk = (size_t)(to - from);
+        if (!map_write(fs, map, from, zeros, chunk)) return false;
+        from += chunk;
+    }
+    return true;
+}
+
+// Функция: comp_encode
+// Назначение: Сжимает кластеры k0.. файла размером size (data — его байты с
+// начала кластера k0) в поток, который ляжет с блока, где начинается
+// кластер k0: кластеры подряд с границ блоков, затем таблица всех кластеров
+// файла (первые k0 записей — из old). Кластер сохраняется сжатым, только если
+// так он займёт хотя бы на блок меньше.
+// Возвращает: буфер потока (*bytes байт, кратно блоку) или NULL без памяти
+static uint8_t* comp_encode(myfs_t* fs, const ClusterTable* old, uint32_t k0, const uint8_t* data, uint64_t size,
+                            ClusterTable* table, size_t* bytes) {
+    uint32_t count = cluster_count(size);
+    uint64_t tail = size - (uint64_t)k0 * MYFS_CLUSTER_SIZE;
+    size_t table_bytes = (size_t)count * sizeof(uint32_t);
+    size_t cap = (size_t)tail + (size_t)(count - k0 + 1) * fs->block_size + table_bytes;
+    uint8_t* out = calloc(1, cap);
+    if (!out || !cluster_table_alloc(table, count)) {
+        free(out);
+        return NULL;
+    }
+    if (k0 > 0) memcpy(table->len, old->len, k0 * sizeof(uint32_t));
+
+    size_t pos = 0, data_end = 0;
+    for (uint32_t k = k0; k < count; k++) {
+        const uint8_t* src = data + (size_t)(k - k0) * MYFS_CLUSTER_SIZE;
+        size_t raw = cluster_raw_len(size, k);
+        size_t limit = (size_t)(blocks_for(fs, raw) - 1) << fs->block_shift;
+        size_t packed = limit ? lz_compress(src, raw, out + pos, limit) : 0;
+        if (packed) {
+            table->len[k] = (uint32_t)packed;
+            STAT_ADD(fs, comp_clusters, 1);
+        } else {
+            memcpy(out + pos, src, raw);
+            table->len[k] = (uint32_t)raw | MYFS_CLUSTER_RAW;
+            STAT_ADD(fs, comp_raw_clusters, 1);
+        }
+        size_t stored = cluster_stored(table->len[k]);
+        STAT_ADD(fs, comp_bytes_in, raw);
+        STAT_ADD(fs, comp_bytes_out, (uint64_t)blocks_for(fs, stored) << fs->block_shift);
+        data_end = pos + stored;
+        pos += (size_t)blocks_for(fs, stored) << fs->block_shift;
+    }
+
+    *bytes = (size_t)blocks_for(fs, data_end + table_bytes) << fs->block_shift;
+    memcpy(out + *bytes - table_bytes, table->len, table_bytes);
+    cluster_table_index(fs, table);
+    return out;
+}
+
+// Функция: comp_write_tail
+// Назначение: Переписывает сжатый файл с кластера k0 до конца: его новый
+// размер — size, data — байты с начала кластера k0. Кластеры до k0 остаются
+// на месте. Так же файл любого вида (встроенный, обычный) становится
+// сжатым при k0 = 0. Вызывается под блокировкой inode на запись.
+static bool comp_write_tail(myfs_t* fs, int ino, CachedInode* ci, uint32_t k0, const uint8_t* data, uint64_t size) {
+    const ClusterTable* old = &ci->clusters;
+    uint32_t base = k0 ? old->start[k0 - 1] + blocks_for(fs, cluster_stored(old->len[k0 - 1])) : 0;
+    ClusterTable table;
+    size_t bytes;
+    uint8_t* stream = comp_encode(fs, old, k0, data, size, &table, &bytes);
+    if (!stream) {
+        perror("Ошибка сжатия данных");
+        return false;
+    }
+    uint32_t blocks = base + (uint32_t)(bytes >> fs->block_shift);
+    uint32_t old_blocks = ci->map.blocks;
+
+    bool ok = true;
+    if (blocks > old_blocks) {
+        meta_wrlock(fs);
+        ok = map_extend(fs, &ci->map, blocks);
+        meta_unlock(fs);
+        if (!ok) fprintf(stderr, "Недостаточно свободных блоков\n");
+    }
+    if (ok && !map_write(fs, &ci->map, (uint64_t)base << fs->block_shift, stream, bytes)) {
+        perror("Ошибка записи данных");
+        meta_wrlock(fs);
+        map_truncate(fs, &ci->map, old_blocks);  // Новые блоки inode на диске не принадлежат
+        drop_inode(fs, ino);
+        meta_unlock(fs);
+        ok = false;
+    }
+    free(stream);
+    if (!ok) {
+        free(table.len);
+        return false;
+    }
+
+    meta_wrlock(fs);
+    if (ci->map.blocks > blocks) map_truncate(fs, &ci->map, blocks);
+    clear_inline(&ci->node);
+    free(ci->clusters.len);
+    ci->clusters = table;
+    ci->gen = cluster_gen(fs);
+    ci->node.flags |= INODE_FLAG_EXTENTS | INODE_FLAG_COMPRESSED;
+    ci->node.size = (uint32_t)size;
+    ci->node.mtime = time(NULL);
+    ok = store_inode(fs, ino);
+    meta_unlock(fs);
+    return ok;
+}
+
+// Функция: comp_patch
+// Назначение: Переписывает кластер k сжатого файла на месте, если новые
+// данные (data, вся длина кластера) помещаются в его прежние блоки: сжатый
+// дополняется нулями до того же числа блоков, несжатый пишется как есть.
+// Возвращает: 1 — кластер записан, 0 — не помещается, -1 — ошибка записи
+static int comp_patch(myfs_t* fs, int ino, CachedInode* ci, uint32_t k, const uint8_t* data) {
+    ClusterTable* t = &ci->clusters;
+    size_t raw = cluster_raw_len(ci->node.size, k);
+    uint32_t slot = blocks_for(fs, cluster_stored(t->len[k]));
+    uint64_t at = (uint64_t)t->start[k] << fs->block_shift;
+    uint64_t table_at = ((uint64_t)ci->map.blocks << fs->block_shift) - (uint64_t)t->count * sizeof(uint32_t);
+
+    uint32_t entry = t->len[k];
+    uint8_t* packed = NULL;
+    const uint8_t* src = data;
+    if (!(entry & MYFS_CLUSTER_RAW)) {
+        size_t room = (size_t)slot << fs->block_shift;
+        packed = calloc(1, room);
+        size_t n = packed ? lz_compress(data, raw, packed, room) : 0;
+        size_t least = ((size_t)(slot - 1) << fs->block_shift) + 1;  // Меньше — освободился бы блок
+        if (n > 0 && n < least) n = least;
+        if (n == 0 || at + n > table_at) {
+            free(packed);
+            return 0;
+        }
+        entry = (uint32_t)n;
+        src = packed;
+        STAT_ADD(fs, comp_clusters, 1);
+    } else {
+        STAT_ADD(fs, comp_raw_clusters, 1);
+    }
+    STAT_ADD(fs, comp_bytes_in, raw);
+    STAT_ADD(fs, comp_bytes_out, (uint64_t)slot << fs->block_shift);
+
+    bool ok = map_write(fs, &ci->map, at, src, cluster_stored(entry)) &&
+              (entry == t->len[k] || map_write(fs, &ci->map, table_at + (uint64_t)k * sizeof(uint32_t), &entry, sizeof(entry)));
+    free(packed);
+    if (!ok) {
+        perror("Ошибка записи данных");
+        meta_wrlock(fs);
+        drop_inode(fs, ino);
+        meta_unlock(fs);
+        return -1;
+    }
+    t->len[k] = entry;
+    ci->gen = cluster_gen(fs);
+    return 1;
+}
+
+// Собирает в out новые байты файла [from, to): прежнее содержимое (нули за
+// старым концом файла), поверх — запись buf в offset. Прежнее не читается,
+// если запись покрывает весь участок
+static bool comp_assemble(myfs_t* fs, const CachedInode* ci, uint64_t from, uint64_t to,
+                          uint64_t offset, const void* buf, size_t len, uint8_t* out) {
+    uint64_t end = offset + len;
+    if (offset > from || end < to) {
+        uint64_t old_end = ci->node.size < to ? ci->node.size : to;
+        size_t keep = old_end > from ? (size_t)(old_end - from) : 0;
+        if (keep > 0 && file_pread(fs, ci, out, keep, from, NULL) != (ssize_t)keep) {
+            perror("Ошибка чтения данных блока");
+            return false;
+        }
+        memset(out + keep, 0, (size_t)(to - from) - keep);
+    }
+    uint64_t lo = offset > from ? offset : from;
+    uint64_t hi = end < to ? end : to;
+    if (hi > lo) memcpy(out + (lo - from), (const uint8_t*)buf + (lo - offset), (size_t)(hi - lo));
+    return true;
+}
+
+// Пишется ли файл ci размером size сжатым: сжатый остаётся сжатым, а при
+// сжатии образа им становится любой файл, не помещающийся в inode (кроме
+// файлов старого формата: у них нет карты экстентов)
+static bool compress_wanted(const myfs_t* fs, const CachedInode* ci, uint64_t size) {
+    return is_compressed(&ci->node) ||
+           (fs->compress && size > MYFS_INLINE_MAX && (ci->node.flags & INODE_FLAG_EXTENTS));
+}
+
+// Функция: comp_update
+// Назначение: Изменение сжатого файла (или файла, который им станет): новый
+// размер size, поверх — запись buf (len байт) с offset. Запись без
+// изменения размера переписывает свои кластеры на месте, пока они
+// помещаются в прежние блоки; остальное перепаковывается с первого
+// изменённого кластера до конца файла (при дозаписи — с последнего).
+// Файл до MYFS_INLINE_MAX байт становится встроенным и несжатым.
+// Вызывается под блокировкой inode на запись.
+static bool comp_update(myfs_t* fs, int ino, CachedInode* ci, uint64_t size, uint64_t offset, const void* buf, size_t len) {
+    uint64_t old_size = ci->node.size;
+    bool packed = is_compressed(&ci->node);
+
+    if (size <= MYFS_INLINE_MAX) {
+        uint8_t data[MYFS_INLINE_MAX];
+        if (!comp_assemble(fs, ci, 0, size, offset, buf, len, data)) return false;
+        meta_wrlock(fs);
+        map_release(fs, &ci->map);
+        comp_drop(ci);
+        make_inline(&ci->node);
+        memcpy(inline_data(&ci->node), data, (size_t)size);
+        ci->node.size = (uint32_t)size;
+        ci->node.mtime = time(NULL);
+        bool ok = store_inode(fs, ino);
+        meta_unlock(fs);
+        return ok;
+    }
+
+    uint64_t first = offset < old_size ? offset : old_size;
+    if (size < first) first = size;
+    uint32_t k0 = packed ? (uint32_t)(first / MYFS_CLUSTER_SIZE) : 0;
+    if (packed && size == old_size && len > 0) {
+        uint32_t last = (uint32_t)((offset + len - 1) / MYFS_CLUSTER_SIZE);
+        uint8_t* cluster = NULL;
+        int fit = 1;
+        for (; k0 <= last; k0++) {
+            uint64_t from = (uint64_t)k0 * MYFS_CLUSTER_SIZE;
+            uint64_t to = from + cluster_raw_len(size, k0);
+            const uint8_t* src = cluster;
+            if (offset <= from && offset + len >= to) {
+                src = (const uint8_t*)buf + (from - offset);
+            } else if (!(cluster || (cluster = malloc(MYFS_CLUSTER_SIZE))) ||
+                       !comp_assemble(fs, ci, from, to, offset, buf, len, cluster)) {
+                fit = -1;
+            } else {
+                src = cluster;
+            }
+            if (fit > 0) fit = comp_patch(fs, ino, ci, k0, src);
+            if (fit <= 0) break;
+        }
+        free(cluster);
+        if (fit < 0) return false;
+        if (fit > 0) {
+            ci->node.mtime = time(NULL);
+            ci->dirty = true;
+            return !fs->shared || writeback_inode(fs, ino);
+        }
+    }
+    if ((uint64_t)k0 * MYFS_CLUSTER_SIZE >= size) k0--;
+
+    // Всё от кластера k0 до конца файла собирается в памяти и сжимается заново
+    uint64_t from = (uint64_t)k0 * MYFS_CLUSTER_SIZE;
+    uint8_t* data = malloc((size_t)(size - from));
+    if (!data) {
+        perror("Ошибка сжатия данных");
+        return false;
+    }
+    bool ok = comp_assemble(fs, ci, from, size, offset, buf, len, data) &&
+              comp_write_tail(fs, ino, ci, k0, data, size);
+    free(data);
+    return ok;
+}
+
+// Функция: file_pwrite
+// Назначение: Записывает len байт в файл с позиции offset. Пишутся только
+// затронутые блоки; промежуток между старым концом файла и offset заполняется
+// нулями. Inode записывается сразу, если изменились размер или карта блоков,
+// иначе только помечается изменённым (mtime) до закрытия или синхронизации.
+// Вызывается под блокировкой inode на запись; meta_lock берётся только на
+// выделение блоков и запись inode, сами данные пишутся без него.
+// Возвращает: число записанных байт или -1 при ошибке
+static ssize_t file_pwrite(myfs_t* fs, int ino, const void* buf, size_t len, uint64_t offset) {
+    CachedInode* ci = acquire_inode(fs, ino);
+    if (!ci) return -1;
+
+    uint64_t end = offset + len;
+    if (end > UINT32_MAX || end < offset) {
+        fprintf(stderr, "Ошибка: файл слишком большой\n");
+        return -1;
+    }
+    if (len == 0) return 0;
+
+    uint64_t size = end > ci->node.size ? end : ci->node.size;
+    if (compress_wanted(fs, ci, size)) {
+        return comp_update(fs, ino, ci, size, offset, buf, len) ? (ssize_t)len : -1;
+    }
+
+    // Крошечный файл пишется прямо в inode, блоки ему не нужны
+    if (inline_fits(ci, end)) {
+        Inode* node = &ci->node;
+        make_inline(node);
+        memcpy(inline_data(node) + offset, buf, len);
+        if (end > node->size) node->size = (uint32_t)end;
+        node->mtime = time(NULL);
+        ci->dirty = true;
+        return writeback_inode(fs, ino) ? (ssize_t)len : -1;
+    }
+
+    // Недостающие блоки выделяются как можно более длинными непрерывными
+    // отрезками; встроенные данные при этом переносятся в первый блок
+    uint32_t old_blocks = ci->map.blocks;
+    uint32_t required_blocks = blocks_for(fs, end);
+    if (is_inline(&ci->node)) {
+        meta_wrlock(fs);
+        bool spilled = inline_spill(fs, ci, required_blocks);
+        meta_unlock(fs);
+        if (!spilled) return -1;
+    } else if (required_blocks > old_blocks) {
+        meta_wrlock(fs);
+        bool extended = map_extend(fs, &ci->map, required_blocks);
+        meta_unlock(fs);
+        if (!extended) {
+            fprintf(stderr, "Недостаточно свободных блоков\n");
+            return -1;
+        }
+    }
+
+    uint64_t old_size = ci->node.size;
+    if ((offset > old_size && !zero_range(fs, &ci->map, old_size, offset)) ||
+        !map_write(fs, &ci->map, offset, buf, len)) {
+        // Новые блоки возвращаются: inode на диске на них не ссылается
+        perror("Ошибка записи данных");
+        meta_wrlock(fs);
+        map_truncate(fs, &ci->map, old_blocks);
+        drop_inode(fs, ino);
+        meta_unlock(fs);
+        return -1;
+    }
+
+    if (end > old_size) ci->node.size = (uint32_t)end;
+    ci->node.mtime = time(NULL);
+
+    bool ok = true;
+    if (ci->map.blocks != old_blocks) {
+        meta_wrlock(fs);
+        ok = store_inode(fs, ino);
+        meta_unlock(fs);
+    } else {
+        // В режиме shared копия inode живёт только под блокировкой, поэтому
+        // и mtime пишется сразу
+        ci->dirty = true;
+        if (ci->node.size != old_size || fs->shared) ok = writeback_inode(fs, ino);
+    }
+    return ok ? (ssize_t)len : -1;
+}
+
+// Функция: resize_inode
+// Назначение: Устанавливает размер файла. При уменьшении освобождает лишние
+// блоки, при увеличении добавляет блоки и заполняет новую часть нулями.
+// Файл без блоков, помещающийся в inode, остаётся встроенным.
+static bool resize_inode(myfs_t* fs, int ino, uint64_t size) {
+    CachedInode* ci = get_inode(fs, ino);
+    if (!ci) return false;
+    if (size > UINT32_MAX) {
+        fprintf(stderr, "Ошибка: файл слишком большой\n");
+        return false;
+    }
+
+    uint64_t old_size = ci->node.size;
+    if (size == old_size) return true;
+
+    uint32_t old_blocks = ci->map.blocks;
+    uint32_t required_blocks = blocks_for(fs, size);
+    if (inline_fits(ci, size)) {
+        make_inline(&ci->node);
+        if (size < old_size) memset(inline_data(&ci->node) + size, 0, old_size - size);
+    } else if (is_inline(&ci->node)) {
+        if (!inline_spill(fs, ci, required_blocks)) return false;
+        if (!zero_range(fs, &ci->map, old_size, size)) {
+            perror("Ошибка записи данных");
+            map_truncate(fs, &ci->map, old_blocks);
+            drop_inode(fs, ino);
+            return false;
+        }
+    } else if (size < old_size) {
+        map_truncate(fs, &ci->map, required_blocks);
+    } else {
+        if (!map_extend(fs, &ci->map, required_blocks)) {
+            fprintf(stderr, "Недостаточно свободных блоков\n");
+            return false;
+        }
+        if (!zero_range(fs, &ci->map, old_size, size)) {
+            perror("Ошибка записи данных");
+            map_truncate(fs, &ci->map, old_blocks);
+            drop_inode(fs, ino);
+            return false;
+        }
+    }
+
+    ci->node.size = (uint32_t)size;
+    ci->node.mtime = time(NULL);
+    return store_inode(fs, ino);
+}
+
+// Функция: file_truncate
+// Назначение: resize_inode под блокировкой inode на запись (усечение редкое,
+// поэтому целиком под meta_lock). Сжатый файл перепаковывает последний
+// кластер через comp_update: она сама берёт meta_lock.
+static bool file_truncate(myfs_t* fs, int ino, uint64_t size) {
+    CachedInode* ci = acquire_inode(fs, ino);
+    if (ci && size != ci->node.size && size <= UINT32_MAX && compress_wanted(fs, ci, size)) {
+        return comp_update(fs, ino, ci, size, ci->node.size, NULL, 0);
+    }
+    meta_wrlock(fs);
+    bool ok = resize_inode(fs, ino, size);
+    meta_unlock(fs);
+    return ok;
+}
+
+// -----------------------------------------------------------------------------
+// Индекс имён: хеш-таблица с открытой адресацией (линейное пробирование) по
+// паре «каталог, имя» и списки записей каждого каталога. Строятся при
+// монтировании и поддерживаются create_file/delete_file/myfs_mkdir/myfs_rmdir,
+// поэтому разбор пути, проверка на дубликат, удаление и обход каталога не
+// сканируют таблицу inode.
+// -----------------------------------------------------------------------------
+
+#define ROOT_DIR (-1)       // Корневой каталог в parent[] и при разборе пути
+#define PATH_MISSING (-2)   // path_walk/dir_lookup: каталога нет
+
+// FNV-1a по имени, затем номер каталога: одинаковые имена в разных каталогах
+// попадают в разные ячейки
+static uint32_t name_hash(int dir, const char* name, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return (h ^ (uint32_t)(dir + 1)) * 16777619u;
+}
+
+static void index_init(myfs_t* fs) {
+    for (uint32_t i = 0; i <= fs->name_index_mask; i++) {
+        fs->name_index[i].ino = NAME_INDEX_EMPTY;
+    }
+    for (int i = 0; i <= fs->inode_count; i++) {
+        fs->dir_first[i] = -1;
+    }
+}
+
+// Возвращает номер ячейки с именем name (len байт) в каталоге dir или -1
+static int index_find_slot(const myfs_t* fs, int dir, const char* name, size_t len, uint32_t hash) {
+    uint32_t mask = fs->name_index_mask;
+    for (uint32_t pos = hash & mask; ; pos = (pos + 1) & mask) {
+        const NameSlot* slot = &fs->name_index[pos];
+        if (slot->ino == NAME_INDEX_EMPTY) return -1;
+        const char* other = fs->names[slot->ino];
+        if (slot->hash == hash && fs->parent[slot->ino] == dir && strncmp(other, name, len) == 0 &&
+            other[len] == '\0') {
+            return (int)pos;
+        }
     }
-    if (fwrite(sb, sizeof(SuperBlock), 1, fs) != 1) {   // Записываем структуру SuperBlock в файл
-        perror("Ошибка fwrite при записи суперблока");
-        return false;
+}
+
+// Функция: index_lookup
+// Назначение: Находит запись name (len байт) каталога dir за O(1) в среднем.
+// Возвращает: номер inode или -1, если записи нет
+static int index_lookup(const myfs_t* fs, int dir, const char* name, size_t len) {
+    int pos = index_find_slot(fs, dir, name, len, name_hash(dir, name, len));
+    return pos < 0 ? -1 : fs->name_index[pos].ino;
+}
+
+// Функция: path_walk
+// Назначение: Проходит каталоги пути до последнего компонента. Пустые
+// компоненты (ведущий, конечный и двойной '/') пропускаются.
+// Возвращает: каталог последнего компонента или PATH_MISSING, если одного из
+// каталогов пути нет; сам компонент — в *leaf и *len (*len == 0 — корень)
+static int path_walk(const myfs_t* fs, const char* path, const char** leaf, size_t* len) {
+    int dir = ROOT_DIR;
+    const char* comp = path + strspn(path, "/");
+    size_t comp_len = strcspn(comp, "/");
+    for (;;) {
+        const char* next = comp + comp_len;
+        next += strspn(next, "/");
+        if (*next == '\0') break;
+        int ino = index_lookup(fs, dir, comp, comp_len);
+        if (ino < 0 || !fs->is_dir[ino]) return PATH_MISSING;
+        dir = ino;
+        comp = next;
+        comp_len = strcspn(comp, "/");
+    }
+    *leaf = comp;
+    *len = comp_len;
+    return dir;
+}
+
+// Функция: path_lookup
+// Назначение: Находит файл или каталог по пути.
+// Возвращает: номер inode или -1, если записи нет (корень записью не считается)
+static int path_lookup(const myfs_t* fs, const char* path) {
+    const char* leaf;
+    size_t len;
+    int dir = path_walk(fs, path, &leaf, &len);
+    if (dir == PATH_MISSING || len == 0) return -1;
+    return index_lookup(fs, dir, leaf, len);
+}
+
+// То же, но только файл (dir = false) или только каталог (dir = true)
+static int entry_lookup(const myfs_t* fs, const char* path, bool dir) {
+    int ino = path_lookup(fs, path);
+    return ino >= 0 && fs->is_dir[ino] == dir ? ino : -1;
+}
+
+// Функция: dir_lookup
+// Назначение: Находит каталог по пути ("" и "/" — корень).
+// Возвращает: номер inode каталога, ROOT_DIR или PATH_MISSING
+static int dir_lookup(const myfs_t* fs, const char* path) {
+    const char* leaf;
+    size_t len;
+    int dir = path_walk(fs, path, &leaf, &len);
+    if (dir == PATH_MISSING || len == 0) return dir;
+    int ino = index_lookup(fs, dir, leaf, len);
+    return ino >= 0 && fs->is_dir[ino] ? ino : PATH_MISSING;
+}
+
+// Функция: path_of
+// Назначение: Собирает полный путь inode ino в buf (с обрезкой до size байт,
+// как snprintf).
+// Возвращает: длину полного пути
+static size_t path_of(const myfs_t* fs, int ino, char* buf, size_t size) {
+    // Глубина ограничена числом inode: повреждённые ссылки не зациклят обход
+    int depth = 0;
+    size_t total = 0;
+    for (int i = ino; i >= 0 && fs->names[i] && depth < fs->inode_count; i = fs->parent[i]) {
+        total += strlen(fs->names[i]) + (depth++ > 0);
+    }
+
+    char* out = total < size ? buf : malloc(total + 1);
+    if (out) {
+        size_t end = total;
+        out[end] = '\0';
+        int i = ino;
+        for (int d = 0; d < depth; d++, i = fs->parent[i]) {
+            size_t len = strlen(fs->names[i]);
+            end -= len;
+            memcpy(out + end, fs->names[i], len);
+            if (d + 1 < depth) out[--end] = '/';
+        }
+    }
+    if (out != buf && size > 0) {
+        if (out) memcpy(buf, out, size - 1);
+        buf[out ? size - 1 : 0] = '\0';
+        free(out);
+    }
+    return total;
+}
+
+// Функция: index_link
+// Назначение: Вносит inode с заполненными names[ino] и parent[ino] в индекс и
+// в начало списка записей его каталога.
+static void index_link(myfs_t* fs, int ino) {
+    const char* name = fs->names[ino];
+    int dir = fs->parent[ino];
+    uint32_t hash = name_hash(dir, name, strlen(name));
+    uint32_t mask = fs->name_index_mask;
+    uint32_t pos = hash & mask;
+    while (fs->name_index[pos].ino != NAME_INDEX_EMPTY) {
+        pos = (pos + 1) & mask;
     }
+    fs->name_index[pos].hash = hash;
+    fs->name_index[pos].ino = ino;
+
+    int32_t* head = &fs->dir_first[dir + 1];
+    fs->dir_prev[ino] = -1;
+    fs->dir_next[ino] = *head;
+    if (*head >= 0) fs->dir_prev[*head] = ino;
+    *head = ino;
+}
+
+// Функция: index_insert
+// Назначение: Добавляет запись name (len байт) каталога dir в индекс (имя
+// копируется в fs->names[ino]).
+// Возвращает: false при нехватке памяти
+static bool index_insert(myfs_t* fs, int dir, const char* name, size_t len, int ino, bool is_dir) {
+    char* copy = strndup(name, len);
+    if (!copy) return false;
+    free(fs->names[ino]);
+    fs->names[ino] = copy;
+    fs->parent[ino] = dir;
+    fs->is_dir[ino] = is_dir;
+    index_link(fs, ino);
     return true;
 }
 
-// Функция: read_superblock
-// Назначение: Считывает суперблок из файла образа файловой системы.
-// Параметры:
-//   - fs: указатель на открытый файл образа файловой системы
-//   - sb: указатель на структуру SuperBlock, куда будут загружены данные
-// Возвращает:
-//   - true, если операция чтения прошла успешно
-//   - false, если возникла ошибка при перемещении указателя или чтении
-static bool read_superblock(FILE* fs, SuperBlock* sb) {
-    if (fseek(fs, SUPERBLOCK_OFFSET, SEEK_SET) != 0) {  // Устанавливаем указатель в начало суперблока
-        perror("Ошибка fseek при чтении суперблока");
-        return false;
+// Функция: index_remove
+// Назначение: Удаляет запись inode ino из индекса и из списка его каталога.
+// В хеше используется обратный сдвиг вместо «надгробий», чтобы цепочки
+// пробирования не деградировали со временем.
+static void index_remove(myfs_t* fs, int ino) {
+    const char* name = fs->names[ino];
+    if (!name) return;
+    int dir = fs->parent[ino];
+    size_t len = strlen(name);
+    int found = index_find_slot(fs, dir, name, len, name_hash(dir, name, len));
+    if (found >= 0) {
+        uint32_t mask = fs->name_index_mask;
+        uint32_t hole = (uint32_t)found;
+        for (uint32_t pos = (hole + 1) & mask; fs->name_index[pos].ino != NAME_INDEX_EMPTY; pos = (pos + 1) & mask) {
+            // Ячейку можно сдвинуть в «дыру», если её исходная позиция не лежит между дырой и ней самой
+            uint32_t home = fs->name_index[pos].hash & mask;
+            if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+                fs->name_index[hole] = fs->name_index[pos];
+                hole = pos;
+            }
+        }
+        fs->name_index[hole].ino = NAME_INDEX_EMPTY;
     }
-    if (fread(sb, sizeof(SuperBlock), 1, fs) != 1) {    // Считываем суперблок из файла в структуру
-        perror("Ошибка fread при чтении суперблока");
-        return false;
+
+    int next = fs->dir_next[ino], prev = fs->dir_prev[ino];
+    if (next >= 0) fs->dir_prev[next] = prev;
+    if (prev >= 0) {
+        fs->dir_next[prev] = next;
+    } else {
+        fs->dir_first[dir + 1] = next;
+    }
+
+    free(fs->names[ino]);
+    fs->names[ino] = NULL;
+    fs->is_dir[ino] = false;
+}
+
+// Имён, читаемых index_build за один запрос
+#define NAME_READ_SLOTS 256
+
+// Функция: index_build
+// Назначение: Заполняет индекс при монтировании. Ячейки области имён и записи
+// inode читаются пачками по NAME_READ_SLOTS: одним запросом от первого до
+// последнего занятого inode пачки, а пачки без занятых inode пропускаются.
+// Записи связываются с каталогами, когда прочитаны все: каталог может иметь
+// больший номер, чем его записи.
+static bool index_build(myfs_t* fs) {
+    index_init(fs);
+
+    // В режиме mmap имена и inode читаются прямо из отображения
+    char* buffer = NULL;
+    Inode* nodes = NULL;
+    if (fs->backend != MYFS_BACKEND_MMAP) {
+        buffer = malloc((size_t)NAME_READ_SLOTS * MYFS_NAME_SLOT);
+        nodes = malloc((size_t)NAME_READ_SLOTS * sizeof(Inode));
+        if (!buffer || !nodes) {
+            perror("Ошибка выделения памяти под имена");
+            free(buffer);
+            free(nodes);
+            return false;
+        }
+    }
+
+    bool ok = true;
+    uint32_t count = (uint32_t)fs->inode_count;
+    char name[MYFS_NAME_SLOT];
+    for (uint32_t first = 0; first < count && ok; first += NAME_READ_SLOTS) {
+        uint32_t end = first + NAME_READ_SLOTS < count ? first + NAME_READ_SLOTS : count;
+        uint32_t lo = bitmap_find_set(fs->inode_bitmap, count, first, end);
+        if (lo == end) continue;
+        uint32_t hi = lo;
+        for (uint32_t i = lo; i < end; i++) {
+            if (fs->inode_bitmap[i / 8] & (1 << (i % 8))) hi = i;
+        }
+
+        long offset = fs->sb->name_table + (long)lo * MYFS_NAME_SLOT;
+        long table = fs->sb->inode_table + (long)lo * (long)sizeof(Inode);
+        const char* slots;
+        const Inode* records;
+        if (buffer) {
+            if (!read_region(fs, offset, buffer, (size_t)(hi - lo + 1) * MYFS_NAME_SLOT) ||
+                !read_region(fs, table, nodes, (size_t)(hi - lo + 1) * sizeof(Inode))) {
+                perror("Ошибка чтения области имён");
+                ok = false;
+                break;
+            }
+            slots = buffer;
+            records = nodes;
+        } else {
+            slots = (const char*)fs->map + offset;
+            records = (const Inode*)(fs->map + table);
+        }
+        for (uint32_t i = lo; i <= hi && ok; i++) {
+            if (!(fs->inode_bitmap[i / 8] & (1 << (i % 8)))) continue;
+            const Inode* node = &records[i - lo];
+            memcpy(name, slots + (size_t)(i - lo) * MYFS_NAME_SLOT, sizeof(name) - 1);
+            name[sizeof(name) - 1] = '\0';
+            fs->names[i] = strdup(name);
+            fs->parent[i] = (node->flags & INODE_FLAG_EXTENTS) ? (int32_t)node->blocks[INODE_PARENT] - 1 : ROOT_DIR;
+            fs->is_dir[i] = node->flags & INODE_FLAG_DIR;
+            ok = fs->names[i] != NULL;
+        }
+    }
+    free(buffer);
+    free(nodes);
+    if (!ok) return false;
+
+    for (int i = 0; i < fs->inode_count; i++) {
+        if (!fs->names[i]) continue;
+        int dir = fs->parent[i];
+        if (dir != ROOT_DIR && (dir < 0 || dir >= fs->inode_count || !fs->names[dir] || !fs->is_dir[dir])) {
+            fprintf(stderr, "Предупреждение: каталог inode %d не найден, запись показана в корне\n", i);
+            fs->parent[i] = ROOT_DIR;
+        }
+        index_link(fs, i);
+    }
+    return true;
+}
+
+static void index_free(myfs_t* fs) {
+    for (int i = 0; i < fs->inode_count; i++) {
+        free(fs->names[i]);
+        fs->names[i] = NULL;
+        fs->is_dir[i] = false;
+    }
+}
+
+// Функция: lock_entry
+// Назначение: Находит файл (dir = false) или каталог (dir = true) по пути и
+// захватывает блокировку его inode. Путь перепроверяется под блокировкой:
+// пока её ждали, запись могли удалить, а inode отдать другому файлу.
+// Возвращает: номер inode (блокировка захвачена) или -1, если записи нет
+static int lock_entry(myfs_t* fs, const char* name, bool write, bool dir) {
+    for (;;) {
+        meta_rdlock(fs);
+        int ino = entry_lookup(fs, name, dir);
+        meta_unlock(fs);
+        if (ino < 0 || !(fs->thread_safe || fs->shared)) return ino;
+
+        inode_lock(fs, ino, write);
+        meta_rdlock(fs);
+        bool same = entry_lookup(fs, name, dir) == ino;
+        meta_unlock(fs);
+        if (same) return ino;
+        inode_unlock(fs, ino);
+    }
+}
+
+static int lock_file(myfs_t* fs, const char* name, bool write) {
+    return lock_entry(fs, name, write, false);
+}
+
+// Функция: find_file
+// Назначение: Находит файл по имени и возвращает его inode из кэша. Если файл
+// найден, его блокировка захвачена (освобождается inode_unlock).
+// Возвращает: загруженный inode (номер — в *ino) или NULL, если файла нет
+// или inode не прочитан
+static CachedInode* find_file(myfs_t* fs, const char* name, bool write, int* ino) {
+    *ino = lock_file(fs, name, write);
+    if (*ino < 0) return NULL;
+    return acquire_inode(fs, *ino);
+}
+
+// -----------------------------------------------------------------------------
+// Совместный доступ нескольких процессов (myfs_options.shared). У каждого
+// процесса свои копии суперблока, битовых карт, индекса имён и inode, поэтому:
+//   - блокировка inode — блокировка записи inode в таблице; при захвате копия
+//     inode выбрасывается и при обращении читается заново. Блоки данных файла
+//     принадлежат только ему и защищены этой же блокировкой;
+//   - meta_lock — блокировка участка суперблока и битовых карт. При захвате
+//     битовые карты перечитываются, если изменился sb->generation, индекс
+//     имён перестраивается при смене sb->name_generation; при освобождении
+//     изменённые структуры сразу пишутся на место.
+// -----------------------------------------------------------------------------
+
+// Открытые дескрипторы отмечаются блокировкой чтения байта за пределами
+// образа (OPEN_MARK_BASE + номер inode): так delete_file видит, что файл
+// открыт в другом процессе
+#define OPEN_MARK_BASE ((off_t)1 << 40)
+
+static off_t inode_record(const myfs_t* fs, int ino) {
+    return (off_t)fs->sb->inode_table + (off_t)ino * (off_t)sizeof(Inode);
+}
+
+static void shared_inode_lock(myfs_t* fs, int ino, short type) {
+    range_lock(fs, inode_record(fs, ino), sizeof(Inode), type);
+    drop_inode(fs, ino);
+}
+
+static void shared_inode_unlock(myfs_t* fs, int ino) {
+    range_lock(fs, inode_record(fs, ino), sizeof(Inode), F_UNLCK);
+}
+
+// Функция: shared_refresh
+// Назначение: Подтягивает изменения метаданных, сделанные другими процессами.
+// В режиме mmap суперблок и битовые карты и так читаются из общего отображения.
+static bool shared_refresh(myfs_t* fs) {
+    if (fs->backend == MYFS_BACKEND_STDIO) {
+        if (!read_region(fs, SUPERBLOCK_OFFSET, fs->sb, sizeof(SuperBlock))) return false;
+        if (fs->sb->generation != fs->generation &&
+            (!read_region(fs, fs->sb->inode_bitmap, fs->inode_bitmap, fs->inode_bitmap_size) ||
+             !read_region(fs, fs->sb->block_bitmap, fs->block_bitmap, fs->block_bitmap_size))) {
+            return false;
+        }
+    }
+    if (fs->generation != fs->sb->generation) fs->inode_hint = 0;  // Другой процесс мог освободить inode
+    fs->generation = fs->sb->generation;
+
+    if (fs->sb->name_generation != fs->name_generation) {
+        index_free(fs);
+        if (!index_build(fs)) return false;
+        fs->name_generation = fs->sb->name_generation;
     }
     return true;
 }
 
+static void shared_meta_lock(myfs_t* fs, short type) {
+    if (range_lock(fs, SUPERBLOCK_OFFSET, fs->sb->inode_table, type) && !shared_refresh(fs)) {
+        perror("Ошибка чтения метаданных");
+    }
+}
+
+// Функция: shared_meta_unlock
+// Назначение: Пишет на место изменённые под meta_lock структуры с новым
+// номером поколения и снимает блокировку.
+static void shared_meta_unlock(myfs_t* fs) {
+    bool names = fs->inode_bitmap_dirty;
+    if (names || fs->block_bitmap_dirty || fs->sb_dirty) {
+        fs->sb->generation++;
+        if (names) fs->sb->name_generation++;
+        fs->generation = fs->sb->generation;
+        fs->name_generation = fs->sb->name_generation;
+
+        bool ok = true;
+        if (fs->backend == MYFS_BACKEND_MMAP) {
+            // Изменения уже в отображении; msync — при синхронизации
+            mark_dirty(fs, SUPERBLOCK_OFFSET, fs->sb->block_bitmap + fs->block_bitmap_size);
+        } else {
+            ok = (!fs->inode_bitmap_dirty ||
+                  write_region(fs, fs->sb->inode_bitmap, fs->inode_bitmap, fs->inode_bitmap_size)) &&
+                 (!fs->block_bitmap_dirty ||
+                  write_region(fs, fs->sb->block_bitmap, fs->block_bitmap, fs->block_bitmap_size)) &&
+                 write_region(fs, SUPERBLOCK_OFFSET, fs->sb, sizeof(SuperBlock));
+        }
+        if (!ok) perror("Ошибка записи метаданных");
+        fs->inode_bitmap_dirty = fs->block_bitmap_dirty = fs->sb_dirty = false;
+    }
+    range_lock(fs, SUPERBLOCK_OFFSET, fs->sb->inode_table, F_UNLCK);
+}
+
+static void shared_mark_open(myfs_t* fs, int ino, bool open) {
+    range_lock(fs, OPEN_MARK_BASE + ino, 1, open ? F_RDLCK : F_UNLCK);
+}
+
+// Открыт ли файл в другом процессе (свои отметки F_OFD_GETLK не видит)
+static bool shared_open_elsewhere(myfs_t* fs, int ino) {
+    struct flock fl = {.l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = OPEN_MARK_BASE + ino, .l_len = 1};
+    return fcntl(image_fd(fs), F_OFD_GETLK, &fl) == 0 && fl.l_type != F_UNLCK;
+}
+
 // -----------------------------------------------------------------------------
 // Функция: format_fs
 // Назначение: Форматирует и инициализирует структуру файловой системы.
@@ -57,6 +4138,29 @@ static bool read_superblock(FILE* fs, SuperBlock* sb) {
 // -----------------------------------------------------------------------------
 
 bool format_fs(const char* filename) {
+    return format_fs_ex(filename, NULL);
+}
+
+// Функция: format_fs_ex
+// Назначение: Быстрое форматирование. Записываются только суперблок и битовые
+// карты; размер образа задаётся через ftruncate (разреженный файл) или
+// posix_fallocate (место резервируется без записи нулей). Таблица inode и
+// область данных после усечения файла читаются как нули, поэтому не пишутся.
+// Геометрия берётся из opts (нулевые поля — значения по умолчанию), смещения
+// областей вычисляет layout_compute.
+bool format_fs_ex(const char* filename, const myfs_format_options* opts) {
+    // Инициализируем суперблок — метаинформацию о структуре ФС
+    SuperBlock sb = {
+        .magic = FS_MAGIC,       // Сигнатура файловой системы
+        .journal_seq = 1
+    };
+    uint32_t block_size = (opts && opts->block_size) ? opts->block_size : BLOCK_SIZE;
+    uint32_t inode_count = (opts && opts->inode_count) ? opts->inode_count : INODE_COUNT;
+    uint32_t block_count = (opts && opts->block_count) ? opts->block_count : BLOCK_COUNT;
+    // Недопустимая геометрия не должна затереть существующий образ
+    if (!layout_compute(&sb, block_size, inode_count, block_count)) return false;
+    if (opts && opts->compress) sb.flags |= MYFS_SB_COMPRESS;
+
     // Открываем файл-образ файловой системы с обнулением содержимого
     FILE* fs = fopen(filename, "wb+");
     if (!fs) {
@@ -64,20 +4168,6 @@ bool format_fs(const char* filename) {
         return false;
     }
 
-    // Инициализируем суперблок — метаинформацию о структуре ФС
-    SuperBlock sb = {
-        .magic = FS_MAGIC,                // Сигнатура файловой системы
-        .block_size = BLOCK_SIZE,        // Размер одного блока
-        .inode_count = INODE_COUNT,      // Общее количество inode
-        .block_count = BLOCK_COUNT,      // Общее количество блоков данных
-        .free_inodes = INODE_COUNT,      // Все inode свободны
-        .free_blocks = BLOCK_COUNT,      // Все блоки данных свободны
-        .inode_bitmap = INODE_BITMAP_OFFSET,  // Смещение битовой карты inode
-        .block_bitmap = BLOCK_BITMAP_OFFSET,  // Смещение битовой карты блоков
-        .inode_table = INODE_TABLE_OFFSET,    // Смещение таблицы inode
-        .data_start = DATA_BLOCKS_OFFSET      // Смещение начала данных
-    };
-
     // Пишем суперблок в файл
     if (!write_superblock(fs, &sb)) {
         perror("Ошибка записи суперблока");
@@ -86,45 +4176,56 @@ bool format_fs(const char* filename) {
     }
 
     // Инициализируем битовые карты (всё свободно)
-    uint8_t inode_bitmap[INODE_COUNT / 8] = {0};
-    uint8_t block_bitmap[BLOCK_COUNT / 8] = {0};
-
-    // Запись битовой карты inode
-    fseek(fs, INODE_BITMAP_OFFSET, SEEK_SET);
-    if (fwrite(inode_bitmap, sizeof(inode_bitmap), 1, fs) != 1) {
-        perror("Ошибка записи битмапа inode");
+    uint8_t* inode_bitmap = calloc(inode_count / 8, 1);
+    uint8_t* block_bitmap = calloc(block_count / 8, 1);
+    if (!inode_bitmap || !block_bitmap) {
+        perror("Ошибка выделения памяти под битовые карты");
+        free(inode_bitmap);
+        free(block_bitmap);
         fclose(fs);
         return false;
     }
+    block_bitmap[0] = 1;  // Блок 0 зарезервирован: 0 в inode означает «блок не выделен»
+
+    // Запись битовой карты inode
+    fseek(fs, sb.inode_bitmap, SEEK_SET);
+    bool ok = fwrite(inode_bitmap, inode_count / 8, 1, fs) == 1;
+    if (!ok) perror("Ошибка записи битмапа inode");
 
     // Запись битовой карты блоков
-    fseek(fs, BLOCK_BITMAP_OFFSET, SEEK_SET);
-    if (fwrite(block_bitmap, sizeof(block_bitmap), 1, fs) != 1) {
-        perror("Ошибка записи битмапа блоков");
+    if (ok) {
+        fseek(fs, sb.block_bitmap, SEEK_SET);
+        ok = fwrite(block_bitmap, block_count / 8, 1, fs) == 1;
+        if (!ok) perror("Ошибка записи битмапа блоков");
+    }
+    free(inode_bitmap);
+    free(block_bitmap);
+    if (!ok) {
         fclose(fs);
         return false;
     }
 
-    // Инициализируем все inode как пустые (включая нулевой)
-    Inode empty_inode = {0};
-    fseek(fs, INODE_TABLE_OFFSET, SEEK_SET);
-    for (int i = 0; i < INODE_COUNT; i++) {
-        if (fwrite(&empty_inode, sizeof(Inode), 1, fs) != 1) {
-            perror("Ошибка записи inode таблицы");
-            fclose(fs);
-            return false;
-        }
+    if (fflush(fs) != 0) {
+        perror("Ошибка сброса буферов");
+        fclose(fs);
+        return false;
     }
 
-    // Инициализируем область данных (все блоки нулями)
-    uint8_t zero_block[BLOCK_SIZE] = {0};
-    fseek(fs, DATA_BLOCKS_OFFSET, SEEK_SET);
-    for (int i = 0; i < BLOCK_COUNT; ++i) {
-        if (fwrite(zero_block, BLOCK_SIZE, 1, fs) != 1) {
-            perror("Ошибка обнуления блоков данных");
+    // Задаём полный размер образа без записи нулей
+    int fd = fileno(fs);
+    off_t image_size = (off_t)sb.journal_start + sb.journal_size;
+    if (opts && opts->preallocate) {
+        int err = posix_fallocate(fd, 0, image_size);
+        if (err != 0) {
+            errno = err;
+            perror("Ошибка резервирования места под образ");
             fclose(fs);
             return false;
         }
+    } else if (ftruncate(fd, image_size) != 0) {
+        perror("Ошибка установки размера образа");
+        fclose(fs);
+        return false;
     }
 
     // Завершаем форматирование
@@ -141,203 +4242,635 @@ bool format_fs(const char* filename) {
  */
 
 /**
- * Открывает существующую файловую систему
+ * Открывает существующую файловую систему и монтирует её:
+ * суперблок и обе битовые карты считываются один раз и далее живут в памяти.
  * @param filename Имя файла-образа ФС
- * @return Указатель на FILE или NULL при ошибке
+ * @return Дескриптор смонтированной ФС или NULL при ошибке
  */
-FILE* open_fs(const char* filename) {
-    // 1. Открываем файл в режиме чтения+записи (бинарный режим)
-    FILE* fs = fopen(filename, "rb+");
-    if (!fs) {
+myfs_t* open_fs(const char* filename) {
+    return open_fs_ex(filename, NULL);
+}
+
+// Функция: mount_mmap
+// Назначение: Отображает весь образ в память; метаданные используются на месте.
+static bool mount_mmap(myfs_t* fs, const char* filename) {
+    fs->fd = open(filename, O_RDWR);
+    if (fs->fd < 0) {
         perror("Ошибка открытия файла ФС");
-        return NULL;
+        return false;
     }
 
-    // 2. Читаем суперблок из начала файла
-    SuperBlock sb;
-    if (!read_superblock(fs, &sb)) {
+    struct stat st;
+    if (fstat(fs->fd, &st) != 0) {
+        perror("Ошибка fstat файла ФС");
+        return false;
+    }
+    if ((size_t)st.st_size < sizeof(SuperBlock)) {
+        fprintf(stderr, "Ошибка: файл ФС слишком мал (%lld байт)\n", (long long)st.st_size);
+        return false;
+    }
+
+    fs->map_size = (size_t)st.st_size;
+    void* map = mmap(NULL, fs->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fs->fd, 0);
+    if (map == MAP_FAILED) {
+        perror("Ошибка mmap файла ФС");
+        return false;
+    }
+    fs->map = map;
+    fs->sb = (SuperBlock*)(fs->map + SUPERBLOCK_OFFSET);
+    return true;
+}
+
+// Функция: mount_stdio
+// Назначение: Открывает образ через stdio и загружает суперблок в память.
+static bool mount_stdio(myfs_t* fs, const char* filename) {
+    fs->fp = fopen(filename, "rb+");
+    if (!fs->fp) {
+        perror("Ошибка открытия файла ФС");
+        return false;
+    }
+
+    fs->fp_pos = -1;
+    fs->sb = &fs->sb_copy;
+    if (!read_superblock(fs->fp, fs->sb)) {
         fprintf(stderr, "Ошибка: не удалось прочитать суперблок\n");
-        fclose(fs);
-        return NULL;
+        return false;
     }
+    return true;
+}
 
-    // 3. Проверка сигнатуры файловой системы (магическое число)
-    if (sb.magic != FS_MAGIC) {
-        fprintf(stderr, "Ошибка: файл не содержит MYFS (магическое число 0x%X)\n", sb.magic);
-        fclose(fs);
+// Освобождает ресурсы дескриптора без записи метаданных
+static void release_fs(myfs_t* fs) {
+    io_free(fs);
+    locks_free(fs);
+    inode_cache_free(fs);
+    cache_free(fs);
+    free(fs->txn_buf);
+    free(fs->txn_index);
+    index_free(fs);
+    geometry_free(fs);
+    if (fs->map) munmap(fs->map, fs->map_size);
+    if (fs->fd >= 0) close(fs->fd);
+    if (fs->fp) fclose(fs->fp);
+    free(fs->stats);
+    free(fs);
+}
+
+// Функция: open_image
+// Назначение: Тело open_fs_ex. С v1 = true открывает образ v1 для
+// myfs_convert_v1: журнал повторяется, битовые карты загружаются, а индекс
+// имён, журнал для новых изменений и блокировки не создаются — такой
+// дескриптор только читается и освобождается release_fs.
+static myfs_t* open_image(const char* filename, const myfs_options* opts, bool v1) {
+    myfs_t* fs = calloc(1, sizeof(myfs_t));
+    if (fs) fs->stats = aligned_alloc(_Alignof(StatsShard), STATS_SHARDS * sizeof(StatsShard));
+    if (!fs || !fs->stats) {
+        perror("Ошибка выделения памяти под дескриптор ФС");
+        free(fs);
         return NULL;
     }
+    memset(fs->stats, 0, STATS_SHARDS * sizeof(StatsShard));
+    fs->fd = -1;
+    fs->backend = opts ? opts->backend : MYFS_BACKEND_STDIO;
+    int32_t ra_blocks = (opts && opts->readahead_blocks) ? opts->readahead_blocks : MYFS_DEFAULT_READAHEAD_BLOCKS;
+    fs->readahead_max = ra_blocks > 0 ? (uint32_t)ra_blocks : 0;
+
+    // 1. Открываем образ и получаем доступ к суперблоку
+    bool mounted = (fs->backend == MYFS_BACKEND_MMAP) ? mount_mmap(fs, filename)
+                                                      : mount_stdio(fs, filename);
+    if (!mounted) goto fail;
+
+    // 2. Проверка сигнатуры файловой системы (магическое число)
+    if (fs->sb->magic != FS_MAGIC) {
+        fprintf(stderr, "Ошибка: файл не содержит MYFS (магическое число 0x%X)\n", fs->sb->magic);
+        goto fail;
+    }
+    if (fs->sb->version != (v1 ? 0 : MYFS_VERSION)) {
+        if (fs->sb->version == 0) {
+            fprintf(stderr, "Ошибка: образ разметки v1, перенесите его в v2 (myfs_convert_v1, myfs convert)\n");
+        } else {
+            fprintf(stderr, "Ошибка: неподдерживаемая версия разметки %u\n", fs->sb->version);
+        }
+        goto fail;
+    }
 
-    // 4. Проверка совместимости размеров блока
-    if (sb.block_size != BLOCK_SIZE) {
-        fprintf(stderr, "Ошибка: несовместимый размер блока (%u != %u)\n", 
-                sb.block_size, BLOCK_SIZE);
-        fclose(fs);
-        return NULL;
+    if (!v1 && (fs->sb->flags & ~(uint32_t)MYFS_SB_COMPRESS)) {
+        fprintf(stderr, "Ошибка: неподдерживаемые свойства образа 0x%X\n", fs->sb->flags);
+        goto fail;
+    }
+    fs->compress = !v1 && ((opts && opts->compress) || (fs->sb->flags & MYFS_SB_COMPRESS));
+
+    // 3. Геометрия образа: размеры из суперблока, под них — массивы в памяти
+    if (!geometry_init(fs)) goto fail;
+
+    // Совместный доступ: восстановление и загрузка метаданных идут под
+    // блокировкой метаданных, чтобы не застать другой процесс посреди изменения
+    bool shared = opts && opts->shared;
+    myfs_io_engine engine = opts ? opts->io_engine : MYFS_IO_SYNC;
+    bool thread_safe = opts && (opts->thread_safe || engine != MYFS_IO_SYNC);
+    if (engine > MYFS_IO_THREADS) {
+        fprintf(stderr, "Ошибка: неизвестный исполнитель ввода-вывода %d\n", (int)engine);
+        goto fail;
+    }
+    if (shared) {
+        if (thread_safe) {
+            fprintf(stderr, "Ошибка: режим shared несовместим с thread_safe и исполнителем ввода-вывода\n");
+            goto fail;
+        }
+        if (!range_lock(fs, SUPERBLOCK_OFFSET, fs->sb->inode_table, F_WRLCK)) goto fail;
+        // Суперблок перечитывается мимо буфера stdio: fseek внутри уже
+        // заполненного буфера вернул бы копию, прочитанную до блокировки
+        if (fs->fp) {
+            if (fflush(fs->fp) != 0) goto fail;
+            fs->pio = true;
+            if (!read_region(fs, SUPERBLOCK_OFFSET, fs->sb, sizeof(SuperBlock))) goto fail;
+        }
+    }
+
+    // 4. Журнал: повтор зафиксированных транзакций; в режиме stdio метаданные
+    //    дальше пишутся через журнал (журнала нет только у ранних образов v1)
+    if (fs->sb->journal_size > 0) {
+        if (fs->sb->journal_size > 64 * journal_size_for(fs->block_size, (uint32_t)fs->inode_count, fs->block_count)) {
+            fprintf(stderr, "Ошибка: недопустимый размер журнала (%u байт)\n", fs->sb->journal_size);
+            goto fail;
+        }
+        if (!journal_recover(fs)) goto fail;
+    } else if (!v1) {
+        fprintf(stderr, "Ошибка: в образе нет журнала\n");
+        goto fail;
+    }
+    if (fs->backend == MYFS_BACKEND_STDIO && !shared && !v1) {
+        uint32_t latency_us = (opts && opts->commit_latency_us) ? opts->commit_latency_us
+                                                                : MYFS_DEFAULT_COMMIT_LATENCY_US;
+        fs->journal = true;
+        fs->commit_latency_ns = (uint64_t)latency_us * 1000;
+        fs->sync_each_op = opts && opts->sync_each_op;
+
+        int32_t frames = (opts && opts->cache_blocks) ? opts->cache_blocks : MYFS_DEFAULT_CACHE_BLOCKS;
+        if (frames > 0 && !cache_init(fs, (uint32_t)frames)) goto fail;
+    }
+
+    // 5. Битовые карты: в режиме mmap — прямо в отображении, иначе загружаем копии
+    if (fs->backend == MYFS_BACKEND_MMAP) {
+        size_t image_size = fs->sb->data_start + (size_t)fs->sb->block_count * fs->sb->block_size;
+        if (fs->map_size < image_size) {
+            fprintf(stderr, "Ошибка: образ ФС усечён (%zu < %zu байт)\n", fs->map_size, image_size);
+            goto fail;
+        }
+        fs->inode_bitmap = fs->map + fs->sb->inode_bitmap;
+        fs->block_bitmap = fs->map + fs->sb->block_bitmap;
+    } else {
+        fs->inode_bitmap = fs->inode_bitmap_copy;
+        fs->block_bitmap = fs->block_bitmap_copy;
+        if (!read_region(fs, fs->sb->inode_bitmap, fs->inode_bitmap, fs->inode_bitmap_size)) {
+            perror("Ошибка чтения битмапа inode");
+            goto fail;
+        }
+        if (!read_region(fs, fs->sb->block_bitmap, fs->block_bitmap, fs->block_bitmap_size)) {
+            perror("Ошибка чтения битмапа блоков");
+            goto fail;
+        }
+    }
+
+    if (v1) return fs;
+    check_counters(fs);
+
+    // 6. Строим индекс имён
+    if (!index_build(fs)) {
+        goto fail;
+    }
+
+    // 7. Потокобезопасный режим: дальше образ читается и пишется через
+    //    pread/pwrite (в режиме shared — уже с шага 3), поэтому буфер stdio
+    //    сбрасывается заранее
+    if (thread_safe) {
+        if (fs->fp && fflush(fs->fp) != 0) {
+            perror("Ошибка записи образа");
+            goto fail;
+        }
+        fs->pio = true;
+    }
+    if (thread_safe && !locks_init(fs)) {
+        perror("Ошибка выделения памяти под блокировки");
+        goto fail;
+    }
+
+    // 8. Исполнитель ввода-вывода и его пул потоков
+    if (engine != MYFS_IO_SYNC &&
+        !io_init(fs, engine, opts->io_threads ? opts->io_threads : MYFS_DEFAULT_IO_THREADS)) {
+        perror("Ошибка запуска исполнителя ввода-вывода");
+        goto fail;
+    }
+    if (shared) {
+        fs->generation = fs->sb->generation;
+        fs->name_generation = fs->sb->name_generation;
+        fs->shared = true;
+        shared_meta_unlock(fs);
     }
 
     // Файл ФС успешно открыт и проверен
     return fs;
-}
 
+fail:
+    release_fs(fs);
+    return NULL;
+}
 
 /**
- * Закрывает файловую систему
- * @param fs Указатель на открытую ФС
- * Разработчик: Дарья
+ * Открывает файловую систему с заданными параметрами монтирования
+ * @param filename Имя файла-образа ФС
+ * @param opts     Параметры монтирования (NULL — по умолчанию: stdio)
+ * @return Дескриптор смонтированной ФС или NULL при ошибке
  */
-void close_fs(FILE* fs) {
-    if (!fs) return;
+myfs_t* open_fs_ex(const char* filename, const myfs_options* opts) {
+    uint64_t start = op_begin();
+    myfs_t* fs = open_image(filename, opts, false);
+    op_end(fs, MYFS_OP_OPEN_FS, start, fs != NULL);
+    return fs;
+}
 
-    // 1. Сбрасываем буферы на диск
-    if (fflush(fs) != 0) {
-        perror("Предупреждение: ошибка сброса буферов");
+// -----------------------------------------------------------------------------
+// Перенос образа разметки v1 в v2 (myfs_convert_v1). Геометрия сохраняется, а
+// номера блоков отсчитываются от начала области данных, поэтому занятые блоки
+// копируются под теми же номерами: карты экстентов, косвенные блоки и прямые
+// номера блоков старых файлов остаются верными. Записи inode переписываются в
+// 64-байтный формат, имена — в область имён, а имена с '/' становятся путями
+// в каталогах. Исходный образ не меняется (разве что повторяется его журнал,
+// как при обычном открытии).
+// -----------------------------------------------------------------------------
+
+// Запись таблицы inode разметки v1 (320 байт)
+typedef struct {
+    uint32_t size;
+    uint32_t flags;
+    int64_t mtime;
+    uint32_t blocks[12];
+    char name[256];
+} InodeV1;
+
+static int create_inode(myfs_t* fs, const char* name, bool dir);
+
+#define CONVERT_INODES 256            // Записей inode v1 за один запрос
+#define CONVERT_CHUNK (1024 * 1024)   // Буфер копирования блоков данных
+
+// Функция: convert_data
+// Назначение: Копирует занятые блоки данных src в те же блоки dst — по
+// отрезкам карты блоков, крупными запросами мимо кэша. Свободные блоки
+// остаются дырами образа.
+static bool convert_data(myfs_t* src, myfs_t* dst) {
+    uint8_t* buf = malloc(CONVERT_CHUNK);
+    if (!buf) {
+        perror("Ошибка выделения памяти под перенос данных");
+        return false;
     }
+    uint32_t count = src->block_count;
+    bool ok = true;
+    for (uint32_t pos = 1; ok && pos < count; ) {  // Блок 0 зарезервирован
+        uint32_t start = bitmap_find_set(src->block_bitmap, count, pos, count);
+        if (start >= count) break;
+        uint32_t end = bitmap_find_clear(src->block_bitmap, count, start, count);
+        uint64_t from = (uint64_t)start << src->block_shift;
+        uint64_t to = (uint64_t)end << src->block_shift;
+        for (uint64_t off = from; ok && off < to; off += CONVERT_CHUNK) {
+            size_t n = to - off < CONVERT_CHUNK ? (size_t)(to - off) : CONVERT_CHUNK;
+            ok = read_region(src, (long)(src->sb->data_start + off), buf, n) &&
+                 write_region(dst, (long)(dst->sb->data_start + off), buf, n);
+        }
+        pos = end;
+    }
+    if (!ok) perror("Ошибка переноса блоков данных");
+    free(buf);
+    return ok;
+}
 
-    // 2. Закрываем файл
-    if (fclose(fs) != 0) {
-        perror("Предупреждение: ошибка при закрытии файла");
+// Функция: convert_entry
+// Назначение: Вносит файл v1 с номером ino в пространство имён dst. Имя v1 с
+// '/' становится путём: недостающие каталоги создаются. Карта прямых номеров
+// блоков переводится в экстенты — в старом формате нет места под каталог.
+static bool convert_entry(myfs_t* dst, int ino, Inode* node, const char* name) {
+    size_t name_len = strlen(name);
+    for (const char* slash = strchr(name, '/'); slash; slash = strchr(slash + 1, '/')) {
+        char* prefix = strndup(name, (size_t)(slash - name));
+        if (!prefix) return false;
+        bool ok = dir_lookup(dst, prefix) != PATH_MISSING ||
+                  (path_lookup(dst, prefix) < 0 && create_inode(dst, prefix, true) >= 0 && journal_op_end(dst));
+        if (!ok) fprintf(stderr, "Ошибка: не удалось создать каталог '%s' для файла '%s'\n", prefix, name);
+        free(prefix);
+        if (!ok) return false;
     }
+
+    const char* leaf;
+    size_t len;
+    int parent = path_walk(dst, name, &leaf, &len);
+    if (parent == PATH_MISSING || len == 0 || name_len >= MYFS_NAME_SLOT || index_lookup(dst, parent, leaf, len) >= 0) {
+        fprintf(stderr, "Ошибка: файл '%s' не переносится (пустое имя или дубликат)\n", name);
+        return false;
+    }
+
+    if (!(node->flags & INODE_FLAG_EXTENTS)) {
+        ExtentMap map;
+        if (!map_load(dst, node, &map)) return false;
+        bool ok = map_store(dst, node, &map);
+        map_free(&map);
+        if (!ok) return false;
+    }
+    node->flags &= ~(uint32_t)INODE_FLAG_DIR;
+    node->blocks[INODE_PARENT] = (uint32_t)(parent + 1);
+    if (!write_inode(dst, ino, node) || !write_name(dst, ino, leaf, len)) {
+        perror("Ошибка записи inode");
+        return false;
+    }
+    return index_insert(dst, parent, leaf, len, ino, false) && journal_op_end(dst);
+}
+
+// Функция: convert_inodes
+// Назначение: Переписывает занятые записи inode v1 в таблицу и область имён
+// dst (через журнал dst). Таблица v1 читается пачками по CONVERT_INODES.
+static bool convert_inodes(myfs_t* src, myfs_t* dst) {
+    InodeV1* table = malloc(CONVERT_INODES * sizeof(InodeV1));
+    if (!table) {
+        perror("Ошибка выделения памяти под таблицу inode");
+        return false;
+    }
+    uint32_t count = (uint32_t)src->inode_count;
+    bool ok = true;
+    for (uint32_t first = 0; ok && first < count; first += CONVERT_INODES) {
+        uint32_t n = count - first < CONVERT_INODES ? count - first : CONVERT_INODES;
+        if (bitmap_find_set(src->inode_bitmap, count, first, first + n) == first + n) continue;
+        if (!read_region(src, (long)(src->sb->inode_table + (uint64_t)first * sizeof(InodeV1)),
+                         table, n * sizeof(InodeV1))) {
+            perror("Ошибка чтения таблицы inode v1");
+            ok = false;
+            break;
+        }
+        for (uint32_t i = 0; ok && i < n; i++) {
+            int ino = (int)(first + i);
+            if (!(src->inode_bitmap[ino / 8] & (1 << (ino % 8)))) continue;
+            const InodeV1* old = &table[i];
+            Inode node = {.size = old->size, .flags = old->flags, .mtime = old->mtime};
+            memcpy(node.blocks, old->blocks, sizeof(node.blocks));
+            char name[MYFS_NAME_SLOT];
+            memcpy(name, old->name, sizeof(name) - 1);
+            name[sizeof(name) - 1] = '\0';
+            ok = convert_entry(dst, ino, &node, name);
+        }
+    }
+    free(table);
+    return ok;
+}
+
+// Совпадают ли пути с одним и тем же файлом (путь b может не существовать)
+static bool same_file(const char* a, const char* b) {
+    struct stat sa, sb;
+    return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
 }
 
 /**
- * @file create_file.c
- * @brief Создание нового файла в файловой системе MYFS.
- * @author Игорь
+ * Переносит образ разметки v1 в новый образ разметки v2 с той же геометрией
+ * @param src Образ v1 (не изменяется, кроме повтора его журнала)
+ * @param dst Новый образ; существующий файл перезаписывается
+ * @return true при успехе; при ошибке dst может остаться неполным
  */
+bool myfs_convert_v1(const char* src, const char* dst) {
+    if (!src || !dst) return false;
+    if (same_file(src, dst)) {
+        fprintf(stderr, "Ошибка: образ v2 должен быть отдельным файлом\n");
+        return false;
+    }
+    myfs_t* old = open_image(src, NULL, true);
+    if (!old) return false;
+
+    myfs_format_options fmt = {
+        .block_size = old->block_size,
+        .inode_count = (uint32_t)old->inode_count,
+        .block_count = old->block_count,
+    };
+    myfs_t* fs = format_fs_ex(dst, &fmt) ? open_fs(dst) : NULL;
+    if (fs) {
+        // Битовые карты — как в исходном образе, ещё до переноса: промежуточные
+        // фиксации журнала не должны видеть занятые блоки свободными
+        memcpy(fs->inode_bitmap, old->inode_bitmap, fs->inode_bitmap_size);
+        memcpy(fs->block_bitmap, old->block_bitmap, fs->block_bitmap_size);
+        fs->inode_bitmap_dirty = fs->block_bitmap_dirty = true;
+        check_counters(fs);
+    }
+    bool ok = fs && convert_data(old, fs) && convert_inodes(old, fs) && sync_fs(fs);
+    if (fs) close_fs(fs);
+    release_fs(old);
+    return ok;
+}
+
+// Функция: sync_mmap
+// Назначение: Сбрасывает на диск изменённые участки отображения через msync.
+static bool sync_mmap(myfs_t* fs) {
+    if (fs->inode_bitmap_dirty) {
+        if (!msync_range(fs, fs->sb->inode_bitmap, fs->inode_bitmap_size)) return false;
+        fs->inode_bitmap_dirty = false;
+    }
+    if (fs->block_bitmap_dirty) {
+        if (!msync_range(fs, fs->sb->block_bitmap, fs->block_bitmap_size)) return false;
+        fs->block_bitmap_dirty = false;
+    }
+    if (fs->sb_dirty) {
+        if (!msync_range(fs, SUPERBLOCK_OFFSET, sizeof(SuperBlock))) return false;
+        fs->sb_dirty = false;
+    }
+    io_lock(fs);
+    size_t lo = fs->dirty_lo, hi = fs->dirty_hi;
+    fs->dirty_lo = fs->dirty_hi = 0;
+    io_unlock(fs);
+    if (hi > lo && !msync_range(fs, lo, hi - lo)) {
+        // Диапазон возвращается, чтобы следующая синхронизация повторила msync
+        io_lock(fs);
+        if (fs->dirty_hi == 0 || lo < fs->dirty_lo) fs->dirty_lo = lo;
+        if (hi > fs->dirty_hi) fs->dirty_hi = hi;
+        io_unlock(fs);
+        return false;
+    }
+    return true;
+}
 
 /**
- * Создаёт новый файл в ФС
- * @param fs     Указатель на открытую ФС
- * @param name   Имя файла (макс 255 символов)
- * @return       Номер inode или -1 при ошибке
+ * Записывает на диск только те метаданные, которые изменились с последней синхронизации.
+ * В режиме stdio — фиксирует транзакцию журнала с fsync.
+ * @param fs Дескриптор смонтированной ФС
+ * @return true при успехе, false при ошибке записи
  */
-int create_file(FILE* fs, const char* name) {
-    // Проверка параметров
-    if (!fs || !name) {
-        fprintf(stderr, "Error: Invalid parameters\n");
-        return -1;
+bool sync_fs(myfs_t* fs) {
+    if (!fs) return false;
+    uint64_t start = op_begin();
+    bool ok;
+
+    // Отложенные изменения inode (mtime после записи без изменения размера)
+    if (!flush_inodes(fs)) {
+        ok = false;
+    } else if (fs->shared) {
+        // shared: метаданные уже на месте, остаётся сделать их долговечными
+        ok = fs->backend == MYFS_BACKEND_MMAP ? sync_mmap(fs) : image_sync(fs);
+    } else {
+        meta_wrlock(fs);
+        if (fs->backend == MYFS_BACKEND_MMAP) {
+            ok = sync_mmap(fs);
+        } else {
+            // Битовые карты и суперблок входят в транзакцию журнала; после фиксации
+            // состояние в памяти совпадает с диском, и можно пробить дыры в свободных блоках
+            ok = journal_commit(fs);
+            if (ok && fs->trim_pending) trim_free_blocks(fs);
+        }
+        meta_unlock(fs);
     }
+    op_end(fs, MYFS_OP_SYNC, start, ok);
+    return ok;
+}
+
+
+/**
+ * Закрывает файловую систему
+ * @param fs Дескриптор открытой ФС
+ * Разработчик: Дарья
+ */
+void close_fs(myfs_t* fs) {
+    if (!fs) return;
+    io_free(fs);  // Асинхронные чтения завершаются до записи метаданных
 
-    if (strlen(name) >= 256) {
-        fprintf(stderr, "Error: Filename too long\n");
-        return -1;
+    // 1. Фиксируем изменённые метаданные; после чистого закрытия журнал пуст
+    if (!sync_fs(fs) || (fs->journal && !journal_reset(fs))) {
+        fprintf(stderr, "Предупреждение: не все метаданные записаны на диск\n");
     }
 
-    // Чтение суперблока
-    SuperBlock sb;
-    if (fseek(fs, SUPERBLOCK_OFFSET, SEEK_SET) != 0 || 
-        fread(&sb, sizeof(SuperBlock), 1, fs) != 1) {
-        perror("Superblock read failed");
-        return -1;
+    // 2. Закрываем файл и освобождаем дескриптор
+    if (fs->fp && fclose(fs->fp) != 0) {
+        perror("Предупреждение: ошибка при закрытии файла");
     }
+    fs->fp = NULL;
+    release_fs(fs);
+}
+
+/**
+ * @file create_file.c
+ * @brief Создание нового файла в файловой системе MYFS.
+ * @author Игорь
+ */
 
+// Функция: create_inode
+// Назначение: Тело create_file и myfs_mkdir (под meta_lock на запись, без
+// фиксации журнала). Блоки данных не выделяются: новый файл пуст и встроен
+// в inode (INODE_FLAG_INLINE), блоки появятся при первой большой записи.
+static int create_inode(myfs_t* fs, const char* name, bool dir) {
     // Проверка свободных inodes
-    if (sb.free_inodes == 0) {
+    if (fs->sb->free_inodes == 0) {
         fprintf(stderr, "Error: No free inodes\n");
         return -1;
     }
 
-    // Поиск существующего файла и свободного inode
-    uint8_t inode_bitmap[INODE_COUNT/8];
-    if (fseek(fs, sb.inode_bitmap, SEEK_SET) != 0 ||
-        fread(inode_bitmap, sizeof(inode_bitmap), 1, fs) != 1) {
-        perror("Inode bitmap read failed");
+    // Каталог, в котором создаётся запись, и её имя
+    const char* leaf;
+    size_t len;
+    int parent = path_walk(fs, name, &leaf, &len);
+    if (parent == PATH_MISSING) {
+        fprintf(stderr, "Error: Directory of '%s' not found\n", name);
         return -1;
     }
-
-    int free_inode = -1;
-    Inode temp;
-
-    for (int i = 0; i < INODE_COUNT; i++) {
-        if (inode_bitmap[i/8] & (1 << (i%8))) {
-            if (fseek(fs, sb.inode_table + i*sizeof(Inode), SEEK_SET) != 0 ||
-                fread(&temp, sizeof(Inode), 1, fs) != 1) {
-                continue;
-            }
-
-            if (strcmp(temp.name, name) == 0) {
-                fprintf(stderr, "Error: File '%s' already exists\n", name);
-                return -1;
-            }
-        } 
-        else if (free_inode == -1) {
-            free_inode = i;
-        }
+    if (len == 0 || (len == 1 && leaf[0] == '.') || (len == 2 && strncmp(leaf, "..", 2) == 0)) {
+        fprintf(stderr, "Error: Invalid name '%s'\n", name);
+        return -1;
+    }
+    if (len >= MYFS_NAME_SLOT) {
+        fprintf(stderr, "Error: Filename too long\n");
+        return -1;
     }
 
-    if (free_inode == -1) {
-        fprintf(stderr, "Error: No free inodes found\n");
+    // Проверка на дубликат по индексу имён
+    if (index_lookup(fs, parent, leaf, len) >= 0) {
+        fprintf(stderr, "Error: File '%s' already exists\n", name);
         return -1;
     }
 
-    // Выделение блоков при создании (1 блок по умолчанию)
-    uint8_t block_bitmap[BLOCK_COUNT/8];
-    if (fseek(fs, sb.block_bitmap, SEEK_SET) != 0 ||
-        fread(block_bitmap, sizeof(block_bitmap), 1, fs) != 1) {
-        perror("Block bitmap read failed");
+    // Выделение свободного inode
+    int ino = alloc_inode(fs);
+    if (ino == -1) {
+        fprintf(stderr, "Error: No free inodes found\n");
         return -1;
     }
 
     Inode new_inode = {0};
-    strncpy(new_inode.name, name, sizeof(new_inode.name)-1);
     new_inode.mtime = time(NULL);
-    
-    // Выделяем 1 начальный блок
-    int blocks_allocated = 0;
-    for (int i = 0; i < BLOCK_COUNT && blocks_allocated < 1; i++) {
-        if (!(block_bitmap[i/8] & (1 << (i%8)))) {
-            block_bitmap[i/8] |= (1 << (i%8));
-            new_inode.blocks[blocks_allocated] = i;
-            blocks_allocated++;
-            sb.free_blocks--;
-
-            // Инициализация блока нулями
-            char zero_block[BLOCK_SIZE] = {0};
-            if (fseek(fs, sb.data_start + i*BLOCK_SIZE, SEEK_SET) != 0 ||
-                fwrite(zero_block, BLOCK_SIZE, 1, fs) != 1) {
-                perror("Block initialization failed");
-                return -1;
-            }
-        }
-    }
+    new_inode.flags = INODE_FLAG_EXTENTS | (dir ? INODE_FLAG_DIR : INODE_FLAG_INLINE);
+    new_inode.blocks[INODE_PARENT] = (uint32_t)(parent + 1);
 
-    if (blocks_allocated == 0) {
-        fprintf(stderr, "Error: No free blocks available\n");
-        return -1;
+    // Запись inode и имени; битовые карты и суперблок обновляются в памяти
+    if (!write_inode(fs, ino, &new_inode) || !write_name(fs, ino, leaf, len)) {
+        perror("Inode write failed");
+        goto fail;
     }
 
-    // Обновление структур
-    inode_bitmap[free_inode/8] |= (1 << (free_inode%8));
-    sb.free_inodes--;
-
-    // Запись изменений
-    if (fseek(fs, sb.inode_bitmap, SEEK_SET) != 0 ||
-        fwrite(inode_bitmap, sizeof(inode_bitmap), 1, fs) != 1) {
-        perror("Inode bitmap update failed");
-        return -1;
+    if (!index_insert(fs, parent, leaf, len, ino, dir)) {
+        perror("Name index update failed");
+        goto fail;
     }
+    return ino;
+
+fail:
+    // inode возвращается в карту, а его запись и имя — из транзакции
+    free_inode(fs, ino);
+    journal_revoke(fs, fs->sb->inode_table + ino * sizeof(Inode), sizeof(Inode));
+    journal_revoke(fs, fs->sb->name_table + (long)ino * MYFS_NAME_SLOT, MYFS_NAME_SLOT);
+    return -1;
+}
 
-    if (fseek(fs, sb.inode_table + free_inode*sizeof(Inode), SEEK_SET) != 0 ||
-        fwrite(&new_inode, sizeof(Inode), 1, fs) != 1) {
-        perror("Inode write failed");
+// Функция: create_entry
+// Назначение: Общая часть create_file и myfs_mkdir
+static int create_entry(myfs_t* fs, const char* name, bool dir, myfs_op op) {
+    // Проверка параметров
+    if (!fs || !name) {
+        fprintf(stderr, "Error: Invalid parameters\n");
         return -1;
     }
 
-    if (fseek(fs, sb.block_bitmap, SEEK_SET) != 0 ||
-        fwrite(block_bitmap, sizeof(block_bitmap), 1, fs) != 1) {
-        perror("Block bitmap update failed");
-        return -1;
-    }
+    // Дальше — только под блокировкой метаданных
+    uint64_t start = op_begin();
+    meta_wrlock(fs);
+    int ino = create_inode(fs, name, dir);
+    if (ino >= 0 && !journal_op_end(fs)) ino = -1;
+    meta_unlock(fs);
+    op_end(fs, op, start, ino >= 0);
+    return ino;
+}
 
-    if (fseek(fs, SUPERBLOCK_OFFSET, SEEK_SET) != 0 ||
-        fwrite(&sb, sizeof(SuperBlock), 1, fs) != 1) {
-        perror("Superblock update failed");
-        return -1;
+/**
+ * Создаёт новый файл в ФС
+ * @param fs     Указатель на открытую ФС
+ * @param name   Путь файла (имя внутри каталога — макс 255 символов)
+ * @return       Номер inode или -1 при ошибке
+ */
+int create_file(myfs_t* fs, const char* name) {
+    return create_entry(fs, name, false, MYFS_OP_CREATE);
+}
+
+/**
+ * Создаёт каталог
+ * @param fs    Указатель на открытую ФС
+ * @param path  Путь каталога; каталоги выше него должны существовать
+ * @return      Номер inode или -1 при ошибке
+ */
+int myfs_mkdir(myfs_t* fs, const char* path) {
+    return create_entry(fs, path, true, MYFS_OP_MKDIR);
+}
+
+// Функция: remove_inode
+// Назначение: Тело delete_file и myfs_rmdir (под блокировкой inode и meta_lock на запись)
+static void remove_inode(myfs_t* fs, int ino, CachedInode* ci, const char* name) {
+    // Освобождение всех блоков, связанных с файлом (каждый экстент — одним отрезком)
+    if (ci) {
+        map_release(fs, &ci->map);
+        drop_inode(fs, ino);
+    } else {
+        fprintf(stderr, "Предупреждение: карта блоков файла '%s' повреждена, блоки не освобождены\n", name);
     }
 
-    fflush(fs);
-    return free_inode;
+    // Очистка inode; битовые карты и суперблок будут записаны при синхронизации
+    free_inode(fs, ino);
+    index_remove(fs, ino);
 }
 
 /**
@@ -347,147 +4880,121 @@ int create_file(FILE* fs, const char* name) {
  * @return      true при успехе, false при ошибке
  * @author Татьяна
  */
-bool delete_file(FILE* fs, const char* name) {
-    SuperBlock sb;
-
-    // Чтение суперблока
-    if (fseek(fs, SUPERBLOCK_OFFSET, SEEK_SET) != 0 ||
-        fread(&sb, sizeof(SuperBlock), 1, fs) != 1) {
-        perror("Ошибка чтения суперблока");
-        return false;
-    }
-
-    // Загрузка битмапов
-    uint8_t inode_bitmap[INODE_COUNT / 8];
-    uint8_t block_bitmap[BLOCK_COUNT / 8];
-
-    if (fseek(fs, sb.inode_bitmap, SEEK_SET) != 0 ||
-        fread(inode_bitmap, sizeof(inode_bitmap), 1, fs) != 1) {
-        perror("Ошибка чтения битмапа inode");
-        return false;
-    }
-
-    if (fseek(fs, sb.block_bitmap, SEEK_SET) != 0 ||
-        fread(block_bitmap, sizeof(block_bitmap), 1, fs) != 1) {
-        perror("Ошибка чтения битмапа блоков");
-        return false;
-    }
-
+bool delete_file(myfs_t* fs, const char* name) {
     // Поиск файла по имени
-    int inode_num = -1;
-    Inode inode;
-
-    for (int i = 0; i < INODE_COUNT; i++) {
-        if (!(inode_bitmap[i / 8] & (1 << (i % 8)))) continue;
-
-        if (fseek(fs, sb.inode_table + i * sizeof(Inode), SEEK_SET) != 0 ||
-            fread(&inode, sizeof(Inode), 1, fs) != 1) {
-            perror("Ошибка чтения inode");
-            return false;
-        }
-
-        if (strcmp(inode.name, name) == 0) {
-            inode_num = i;
-            break;
-        }
-    }
+    uint64_t start = op_begin();
+    int inode_num;
+    CachedInode* ci = find_file(fs, name, true, &inode_num);
 
-    if (inode_num == -1) {
+    if (inode_num < 0) {
         printf("Файл '%s' не найден\n", name);
+        op_end(fs, MYFS_OP_DELETE, start, false);
         return false;
     }
 
-    // Освобождение всех блоков, связанных с файлом
-    for (int i = 0; i < 12; ++i) {
-        if (inode.blocks[i] != 0) {
-            block_bitmap[inode.blocks[i] / 8] &= ~(1 << (inode.blocks[i] % 8));
-            sb.free_blocks++;
-        }
-    }
-
-    // Очистка inode
-    inode_bitmap[inode_num / 8] &= ~(1 << (inode_num % 8));
-
-    // Обновление битмапов
-    if (fseek(fs, sb.block_bitmap, SEEK_SET) != 0 ||
-        fwrite(block_bitmap, sizeof(block_bitmap), 1, fs) != 1) {
-        perror("Ошибка записи битмапа блоков");
+    if (fs->open_count[inode_num] > 0 || (fs->shared && shared_open_elsewhere(fs, inode_num))) {
+        inode_unlock(fs, inode_num);
+        printf("Файл '%s' открыт, удаление невозможно\n", name);
+        op_end(fs, MYFS_OP_DELETE, start, false);
         return false;
     }
+    meta_wrlock(fs);
+    remove_inode(fs, inode_num, ci, name);
+    bool committed = journal_op_end(fs);
+    meta_unlock(fs);
+    inode_unlock(fs, inode_num);
+    op_end(fs, MYFS_OP_DELETE, start, committed);
+    if (!committed) return false;
+    printf("Файл '%s' (inode %d) успешно удалён\n", name, inode_num);
+    return true;
+}
 
-    if (fseek(fs, sb.inode_bitmap, SEEK_SET) != 0 ||
-        fwrite(inode_bitmap, sizeof(inode_bitmap), 1, fs) != 1) {
-        perror("Ошибка записи битмапа inode");
+/**
+ * Удаляет пустой каталог
+ * @param fs    Указатель на открытую файловую систему
+ * @param path  Путь каталога
+ * @return      true при успехе, false если каталога нет, он не пуст или при ошибке
+ */
+bool myfs_rmdir(myfs_t* fs, const char* path) {
+    if (!fs || !path) return false;
+    uint64_t start = op_begin();
+    int ino = lock_entry(fs, path, true, true);
+    if (ino < 0) {
+        fprintf(stderr, "Каталог '%s' не найден\n", path);
+        op_end(fs, MYFS_OP_RMDIR, start, false);
         return false;
     }
 
-    // Обновление суперблока
-    sb.free_inodes++;
-    if (fseek(fs, SUPERBLOCK_OFFSET, SEEK_SET) != 0 ||
-        fwrite(&sb, sizeof(SuperBlock), 1, fs) != 1) {
-        perror("Ошибка записи суперблока");
-        return false;
+    // Пустоту проверяем под meta_lock: записи создаются и удаляются под ним же
+    meta_wrlock(fs);
+    bool ok = fs->dir_first[ino + 1] < 0;
+    if (ok) {
+        remove_inode(fs, ino, get_inode(fs, ino), path);
+        ok = journal_op_end(fs);
+    } else {
+        fprintf(stderr, "Каталог '%s' не пуст\n", path);
     }
-
-    printf("Файл '%s' (inode %d) успешно удалён\n", name, inode_num);
-    return true;
+    meta_unlock(fs);
+    inode_unlock(fs, ino);
+    op_end(fs, MYFS_OP_RMDIR, start, ok);
+    return ok;
 }
 /**
  * Выводит список всех файлов в файловой системе
  * @param fs Указатель на открытую файловую систему
  * Автор: Тимур
  */
-void list_files(FILE* fs) {
-    SuperBlock sb;
-
-    // Чтение суперблока
-    if (fseek(fs, SUPERBLOCK_OFFSET, SEEK_SET) != 0 ||
-        fread(&sb, sizeof(SuperBlock), 1, fs) != 1) {
-        perror("Ошибка чтения суперблока");
-        return;
-    }
-
-    // Чтение битовой карты inode
-    uint8_t inode_bitmap[INODE_COUNT / 8];
-    if (fseek(fs, sb.inode_bitmap, SEEK_SET) != 0 ||
-        fread(inode_bitmap, sizeof(inode_bitmap), 1, fs) != 1) {
-        perror("Ошибка чтения битмапа inode");
-        return;
-    }
+void list_files(myfs_t* fs) {
+    uint64_t start = op_begin();
+    const uint8_t* inode_bitmap = fs->inode_bitmap;
+    meta_rdlock(fs);
 
     printf("\n%-6s %-15s %-10s %-8s %-20s %-6s\n", 
            "INODE", "NAME", "TYPE", "SIZE", "MTIME", "BLOCKS");
 
-    for (int i = 0; i < INODE_COUNT; i++) {
+    for (int i = 0; i < fs->inode_count; i++) {
         // Проверяем, занят ли inode
         if (inode_bitmap[i / 8] & (1 << (i % 8))) {
             Inode node;
             
             // Читаем inode из таблицы
-            if (fseek(fs, sb.inode_table + i * sizeof(Inode), SEEK_SET) != 0 ||
-                fread(&node, sizeof(Inode), 1, fs) != 1) {
+            if (!read_inode(fs, i, &node)) {
                 fprintf(stderr, "Ошибка чтения inode %d\n", i);
                 continue;
             }
 
             // Подсчёт используемых блоков
             int used_blocks = 0;
-            for (int j = 0; j < 12; j++) {
-                if (node.blocks[j] != 0) used_blocks++;
+            if (node.flags & INODE_FLAG_INLINE) {
+                used_blocks = 0;  // Данные в самом inode
+            } else if (node.flags & INODE_FLAG_COMPRESSED) {
+                // Блоков у сжатого файла меньше, чем данных: их число знает только карта
+                ExtentMap map;
+                if (map_load(fs, &node, &map)) {
+                    used_blocks = (int)map.blocks;
+                    map_free(&map);
+                }
+            } else if (node.flags & INODE_FLAG_EXTENTS) {
+                used_blocks = (int)blocks_for(fs, node.size);
+            } else {
+                for (int j = 0; j < 12; j++) {
+                    if (node.blocks[j] != 0) used_blocks++;
+                }
             }
 
             if (node.size == 0)
                 used_blocks = 0;
 
-            // Форматирование имени (обрезаем до 15 символов)
+            // Форматирование пути (обрезаем до 15 символов); имена берутся из индекса
+            const char* name = fs->names[i] ? fs->names[i] : "";
             char short_name[16];
-            strncpy(short_name, node.name, 15);
-            short_name[15] = '\0';
+            path_of(fs, i, short_name, sizeof(short_name));
 
             // Определение типа файла
             const char* type = "file";
-            if (strstr(node.name, ".txt")) type = "text";
-            else if (strstr(node.name, ".dat")) type = "data";
+            if (fs->is_dir[i]) type = "dir";
+            else if (strstr(name, ".txt")) type = "text";
+            else if (strstr(name, ".dat")) type = "data";
 
             
             char timebuf[20] = "unknown";
@@ -508,6 +5015,24 @@ void list_files(FILE* fs) {
                    i, short_name, type, node.size, timebuf, used_blocks);
         }
     }
+    meta_unlock(fs);
+    op_end(fs, MYFS_OP_LIST, start, true);
+}
+
+/**
+ * Находит файл или каталог по пути через индекс имён, не обращаясь к диску
+ * @param fs   Указатель на открытую файловую систему
+ * @param name Путь файла
+ * @return     Номер inode или -1, если файла нет
+ */
+int lookup_file(myfs_t* fs, const char* name) {
+    if (!fs || !name) return -1;
+    uint64_t start = op_begin();
+    meta_rdlock(fs);
+    int ino = path_lookup(fs, name);
+    meta_unlock(fs);
+    op_end(fs, MYFS_OP_LOOKUP, start, true);
+    return ino;
 }
 
 /**
@@ -518,7 +5043,7 @@ void list_files(FILE* fs) {
  * @return         1 при успехе, 0 при ошибке
  * Автор: Анатолий 
  */
-int write_file(FILE* fs, const char* filename, const char* data) {
+int write_file(myfs_t* fs, const char* filename, const char* data) {
     // Проверка параметров
     if (!fs || !filename || !data) {
         fprintf(stderr, "Error: Invalid parameters\n");
@@ -531,409 +5056,1588 @@ int write_file(FILE* fs, const char* filename, const char* data) {
         return 0;
     }
 
-    // Чтение метаданных
-    SuperBlock sb;
-    if (fseek(fs, SUPERBLOCK_OFFSET, SEEK_SET) != 0 || 
-        fread(&sb, sizeof(SuperBlock), 1, fs) != 1) {
-        perror("Superblock read failed");
-        return 0;
+    if (data_len > UINT32_MAX) {
+        fprintf(stderr, "Error: File too large\n");
+        return 0;
+    }
+
+    // Поиск файла
+    uint64_t start = op_begin();
+    int inode_idx;
+    CachedInode* ci = find_file(fs, filename, true, &inode_idx);
+
+    if (inode_idx == -1) {
+        fprintf(stderr, "Error: File '%s' not found\n", filename);
+        op_end(fs, MYFS_OP_WRITE_FILE, start, false);
+        return 0;
+    }
+    if (!ci) {
+        inode_unlock(fs, inode_idx);
+        fprintf(stderr, "Error: Corrupted block map of '%s'\n", filename);
+        op_end(fs, MYFS_OP_WRITE_FILE, start, false);
+        return 0;
+    }
+
+    // Сначала отрезаем лишнее (освобождая блоки), затем пишем с начала файла:
+    // недостающие блоки выделяются как можно более длинными непрерывными отрезками
+    bool ok = (data_len >= ci->node.size || file_truncate(fs, inode_idx, data_len)) &&
+              file_pwrite(fs, inode_idx, data, data_len, 0) == (ssize_t)data_len;
+    if (ok) {
+        meta_wrlock(fs);
+        ok = flush_inode(fs, inode_idx) && journal_op_end(fs);
+        meta_unlock(fs);
+    }
+    inode_unlock(fs, inode_idx);
+    op_end(fs, MYFS_OP_WRITE_FILE, start, ok);
+    return ok ? 1 : 0;
+}
+
+/**
+ * Читает содержимое файла из файловой системы
+ * @param fs        Указатель на открытую файловую систему
+ * @param filename  Имя файла для чтения
+ * @param buffer    Буфер для записи содержимого файла
+ * @param max_size  Максимальный размер данных для чтения (включая '\0')
+ * @return          Количество прочитанных байт (без учета '\0') или 0 при ошибке
+ * Автор: Дмитрий
+ */
+int read_file(myfs_t* fs, const char* filename, char* buffer, size_t max_size) {
+    // Проверка входных параметров
+    if (!fs || !filename || !buffer || max_size == 0) {
+        fprintf(stderr, "Ошибка: некорректные параметры (fs=%p, filename=%p, buffer=%p, max_size=%zu)\n",
+                (void*)fs, (const void*)filename, (void*)buffer, max_size);
+        return 0;
+    }
+
+    // Поиск файла по индексу имён
+    uint64_t start = op_begin();
+    int found_inode;
+    CachedInode* ci = find_file(fs, filename, false, &found_inode);
+
+    if (found_inode == -1) {
+        fprintf(stderr, "Файл '%s' не найден в файловой системе\n", filename);
+        op_end(fs, MYFS_OP_READ_FILE, start, false);
+        return 0;
+    }
+    if (!ci) {
+        inode_unlock(fs, found_inode);
+        buffer[0] = '\0';
+        op_end(fs, MYFS_OP_READ_FILE, start, false);
+        return 0;
+    }
+
+    // Читаем сколько поместится (оставляем место для '\0'); один
+    // последовательный запрос на каждый экстент
+    ssize_t got = file_pread(fs, ci, buffer, max_size - 1, 0, NULL);
+    inode_unlock(fs, found_inode);
+    op_end(fs, MYFS_OP_READ_FILE, start, got >= 0);
+    if (got < 0) {
+        perror("Ошибка чтения данных блока");
+        got = 0;
+    }
+    size_t bytes_read = (size_t)got;
+
+    // Гарантируем null-terminated строку
+    buffer[bytes_read] = '\0';
+    return (int)bytes_read;
+}
+
+
+// Автор: Татьяна 
+// Дозапись через myfs_append с разделителем "\n" между старым и новым содержимым
+int write_file1(myfs_t* fs, const char* filename, const char* data) {
+    if (!fs || !filename || !data) {
+        fprintf(stderr, "Ошибка: некорректные параметры\n");
+        return 0;
+    }
+
+    uint64_t start = op_begin();
+    myfs_file_t* f = myfs_open(fs, filename, 0);
+    if (!f) {
+        op_end(fs, MYFS_OP_WRITE_FILE1, start, false);
+        return 0;
+    }
+
+    ssize_t written = myfs_append(f, data, strlen(data), MYFS_APPEND_SEPARATOR);
+    bool closed = myfs_close(f);
+    op_end(fs, MYFS_OP_WRITE_FILE1, start, written >= 0 && closed);
+    return (written >= 0 && closed) ? 1 : 0;
+}
+
+
+// Функция: inode_pread
+// Назначение: Тело myfs_pread и myfs_read; ra и cc — состояние упреждающего
+// чтения и кэш кластера дескриптора (NULL — без них)
+static ssize_t inode_pread(myfs_t* fs, int ino, void* buf, size_t len, uint64_t offset, Readahead* ra, ClusterCache* cc) {
+    if (!fs || (!buf && len > 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (ino < 0 || ino >= fs->inode_count) {
+        errno = ENOENT;
+        return -1;
+    }
+    uint64_t start = op_begin();
+    inode_lock(fs, ino, false);
+    CachedInode* ci = acquire_inode(fs, ino);
+    if (ci && ra) readahead_note(fs, ci, ra, offset, len);
+    ssize_t n = ci ? file_pread(fs, ci, buf, len, offset, cc) : -1;
+    inode_unlock(fs, ino);
+    op_end(fs, MYFS_OP_PREAD, start, n >= 0);
+    if (!ci) errno = ENOENT;
+    return n;
+}
+
+/**
+ * Позиционное чтение фрагмента файла. Нужный блок находится по карте
+ * экстентов, поэтому чтение небольшого фрагмента большого файла стоит
+ * одного обращения к блоку данных, а не копирования всего файла.
+ * @param fs     Указатель на открытую файловую систему
+ * @param ino    Номер inode (см. lookup_file)
+ * @param buf    Буфер для данных (не NUL-терминируется)
+ * @param len    Сколько байт прочитать
+ * @param offset Смещение от начала файла
+ * @return       Число прочитанных байт, 0 за концом файла, -1 при ошибке
+ */
+ssize_t myfs_pread(myfs_t* fs, int ino, void* buf, size_t len, uint64_t offset) {
+    return inode_pread(fs, ino, buf, len, offset, NULL, NULL);
+}
+
+_Static_assert(MYFS_CLUSTER_SIZE <= MYFS_STREAM_CHUNK, "кластер передаётся обработчику одним фрагментом");
+
+// Функция: comp_stream
+// Назначение: stream_inode для сжатого файла: по фрагменту на кластер,
+// распакованному в один буфер на весь проход
+static bool comp_stream(myfs_t* fs, const CachedInode* ci, uint64_t offset, myfs_read_cb cb, void* ctx) {
+    uint64_t size = ci->node.size;
+    if (offset >= size) return true;
+    uint8_t* cluster = malloc(MYFS_CLUSTER_SIZE);
+    if (!cluster) return false;
+
+    uint8_t* scratch = NULL;
+    Readahead ra = {.next = offset};
+    bool ok = true;
+    while (ok && offset < size) {
+        uint32_t k = (uint32_t)(offset / MYFS_CLUSTER_SIZE);
+        size_t within = (size_t)(offset % MYFS_CLUSTER_SIZE);
+        size_t chunk = cluster_raw_len(size, k) - within;
+        readahead_note(fs, ci, &ra, offset, chunk);
+        if (!comp_read_cluster(fs, ci, k, cluster, &scratch)) {
+            perror("Ошибка чтения данных блока");
+            ok = false;
+            break;
+        }
+        ok = cb(cluster + within, chunk, offset, ctx);
+        offset += chunk;
+    }
+
+    free(scratch);
+    free(cluster);
+    return ok;
+}
+
+// Функция: stream_inode
+// Назначение: Тело myfs_read_stream (под блокировкой inode на чтение)
+static bool stream_inode(myfs_t* fs, const CachedInode* ci, uint64_t offset, myfs_read_cb cb, void* ctx) {
+    uint64_t size = ci->node.size;
+    if (is_inline(&ci->node)) {
+        return offset >= size || cb((const uint8_t*)ci->node.blocks + offset, (size_t)(size - offset), offset, ctx);
+    }
+    if (is_compressed(&ci->node)) return comp_stream(fs, ci, offset, cb, ctx);
+    if (size > ((uint64_t)ci->map.blocks << fs->block_shift)) {
+        fprintf(stderr, "Ошибка: размер файла больше, чем выделено блоков\n");
+        return false;
+    }
+
+    uint8_t* chunk_buf = NULL;
+    if (fs->backend != MYFS_BACKEND_MMAP && offset < size) {
+        chunk_buf = malloc(MYFS_STREAM_CHUNK);
+        if (!chunk_buf) return false;
+    }
+
+    Readahead ra = {.next = offset};
+    bool ok = true;
+    while (ok && offset < size) {
+        int idx = map_find(&ci->map, block_index(fs, offset));
+        if (idx < 0) {
+            ok = false;
+            break;
+        }
+
+        // Фрагмент не выходит за экстент, конец файла и размер буфера
+        const MapExtent* e = &ci->map.ext[idx];
+        uint64_t ext_end = (uint64_t)(e->lblock + e->len) << fs->block_shift;
+        uint64_t limit = ext_end < size ? ext_end : size;
+        size_t chunk = (size_t)(limit - offset);
+        if (chunk > MYFS_STREAM_CHUNK) chunk = MYFS_STREAM_CHUNK;
+        long phys = block_offset(fs, e->start) + (long)(offset - ((uint64_t)e->lblock << fs->block_shift));
+        readahead_note(fs, ci, &ra, offset, chunk);
+
+        const void* data;
+        if (fs->backend == MYFS_BACKEND_MMAP) {
+            if ((size_t)phys + chunk > fs->map_size) {
+                ok = false;
+                break;
+            }
+            data = fs->map + phys;
+        } else {
+            if (!read_region(fs, phys, chunk_buf, chunk)) {
+                perror("Ошибка чтения данных блока");
+                ok = false;
+                break;
+            }
+            data = chunk_buf;
+        }
+
+        ok = cb(data, chunk, offset, ctx);
+        offset += chunk;
+    }
+
+    free(chunk_buf);
+    return ok;
+}
+
+/**
+ * Потоковое чтение файла от offset до конца. Файл передаётся обработчику
+ * фрагментами в пределах одного экстента и не больше MYFS_STREAM_CHUNK байт.
+ * В режиме mmap обработчик получает указатель прямо в отображение, в режиме
+ * stdio — один и тот же буфер на весь проход.
+ * @param fs     Указатель на открытую файловую систему
+ * @param ino    Номер inode (см. lookup_file)
+ * @param offset Смещение, с которого начинать
+ * @param cb     Обработчик фрагментов
+ * @param ctx    Контекст обработчика
+ * @return       true, если файл передан до конца
+ */
+bool myfs_read_stream(myfs_t* fs, int ino, uint64_t offset, myfs_read_cb cb, void* ctx) {
+    if (!fs || !cb || ino < 0 || ino >= fs->inode_count) return false;
+    uint64_t start = op_begin();
+    inode_lock(fs, ino, false);
+    CachedInode* ci = acquire_inode(fs, ino);
+    bool ok = ci && stream_inode(fs, ci, offset, cb, ctx);
+    inode_unlock(fs, ino);
+    op_end(fs, MYFS_OP_READ_STREAM, start, ok);
+    return ok;
+}
+
+/**
+ * Асинхронное позиционное чтение: ставит myfs_pread в очередь пула потоков
+ * исполнителя ввода-вывода и сразу возвращается. Обработчик вызывает
+ * myfs_aio_poll в своём потоке.
+ * @param fs     Указатель на открытую файловую систему (io_engine != MYFS_IO_SYNC)
+ * @param ino    Номер inode (см. lookup_file)
+ * @param buf    Буфер для данных; должен жить до вызова обработчика
+ * @param len    Сколько байт прочитать
+ * @param offset Смещение от начала файла
+ * @param cb     Обработчик завершения: число прочитанных байт или -errno
+ * @param ctx    Контекст обработчика
+ * @return       true, если чтение поставлено в очередь
+ */
+bool myfs_pread_async(myfs_t* fs, int ino, void* buf, size_t len, uint64_t offset,
+                      myfs_aio_cb cb, void* ctx) {
+    if (!fs || !cb || (!buf && len > 0)) {
+        errno = EINVAL;
+        return false;
+    }
+    IoPool* p = fs->pool;
+    if (!p) {
+        errno = ENOTSUP;
+        return false;
+    }
+    IoJob* job = calloc(1, sizeof(IoJob));
+    if (!job) return false;
+    job->seg = (IoSeg){.buf = buf, .size = len};
+    job->ino = ino;
+    job->offset = offset;
+    job->cb = cb;
+    job->ctx = ctx;
+
+    pthread_mutex_lock(&p->lock);
+    pool_push(p, job);
+    p->in_flight++;
+    pthread_cond_signal(&p->work);
+    pthread_mutex_unlock(&p->lock);
+    return true;
+}
+
+/**
+ * Дескриптор eventfd завершений асинхронных чтений: читаем, когда есть
+ * необработанные завершения. Сбрасывает его myfs_aio_poll.
+ * @return eventfd или -1, если исполнитель ввода-вывода не включён
+ */
+int myfs_aio_fd(myfs_t* fs) {
+    return (fs && fs->pool) ? fs->pool->event_fd : -1;
+}
+
+/**
+ * Вызывает обработчики завершённых асинхронных чтений в вызывающем потоке.
+ * @param fs   Указатель на открытую файловую систему
+ * @param wait Если завершений нет, ждать хотя бы одного (когда есть чтения в полёте)
+ * @return     Число вызванных обработчиков или -1, если исполнитель не включён
+ */
+int myfs_aio_poll(myfs_t* fs, bool wait) {
+    IoPool* p = fs ? fs->pool : NULL;
+    if (!p) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    // Счётчик eventfd сбрасывается до снятия очереди: завершение, пришедшее
+    // позже, снова сделает дескриптор читаемым
+    uint64_t events;
+    if (read(p->event_fd, &events, sizeof(events)) < 0 && errno != EAGAIN) {
+        perror("Ошибка чтения eventfd");
+    }
+    pthread_mutex_lock(&p->lock);
+    while (wait && !p->completed && p->in_flight > 0) pthread_cond_wait(&p->done, &p->lock);
+    IoJob* list = p->completed;
+    p->completed = NULL;
+    p->completed_tail = &p->completed;
+    pthread_mutex_unlock(&p->lock);
+
+    int count = 0;
+    while (list) {
+        IoJob* job = list;
+        list = job->next;
+        job->cb(job->result, job->ctx);
+        free(job);
+        count++;
+    }
+    return count;
+}
+
+// Фактический исполнитель ввода-вывода (MYFS_IO_SYNC — исполнителя нет)
+myfs_io_engine myfs_get_io_engine(myfs_t* fs) {
+    return fs ? fs->io_engine : MYFS_IO_SYNC;
+}
+
+// -----------------------------------------------------------------------------
+// Дескрипторы открытых файлов: номер inode и текущая позиция. Имя ищется один
+// раз при открытии, дальнейшие операции обращаются к inode напрямую.
+// -----------------------------------------------------------------------------
+
+struct myfs_file {
+    myfs_t* fs;
+    int ino;
+    uint64_t pos;            // Позиция для myfs_read/myfs_write
+    uint32_t tail_ext;       // Экстент, в котором последний раз заканчивался файл (подсказка для дозаписи)
+    uint32_t appends;        // Число дозаписей через дескриптор
+    bool reserved;           // Выделены блоки впрок, лишние освобождаются при закрытии
+    Readahead ra;            // Упреждающее чтение для myfs_read
+    ClusterCache cluster;    // Последний распакованный кластер сжатого файла для myfs_read
+};
+
+// Сколько блоков выделять впрок при повторных дозаписях через один дескриптор
+#define APPEND_RESERVE_BLOCKS 16
+
+/**
+ * Открывает файл и возвращает дескриптор
+ * @param fs    Указатель на открытую файловую систему
+ * @param name  Имя файла
+ * @param flags MYFS_O_CREAT — создать, если файла нет; MYFS_O_TRUNC — обрезать до нуля
+ * @return      Дескриптор или NULL при ошибке
+ */
+myfs_file_t* myfs_open(myfs_t* fs, const char* name, int flags) {
+    if (!fs || !name) return NULL;
+
+    uint64_t start = op_begin();
+    int ino = lock_file(fs, name, true);
+    if (ino < 0) {
+        if (!(flags & MYFS_O_CREAT)) {
+            fprintf(stderr, "Файл '%s' не найден\n", name);
+            op_end(fs, MYFS_OP_OPEN, start, false);
+            return NULL;
+        }
+        // Файл мог успеть создать другой поток: тогда create_file откажет,
+        // а lock_file его найдёт
+        create_file(fs, name);
+        ino = lock_file(fs, name, true);
+        if (ino < 0) {
+            op_end(fs, MYFS_OP_OPEN, start, false);
+            return NULL;
+        }
+    }
+
+    myfs_file_t* f = NULL;
+    if (acquire_inode(fs, ino) &&
+        (!(flags & MYFS_O_TRUNC) || (file_truncate(fs, ino, 0) && finish_op(fs)))) {
+        f = malloc(sizeof(myfs_file_t));
+    }
+    if (f) {
+        f->fs = fs;
+        f->ino = ino;
+        f->pos = 0;
+        f->tail_ext = 0;
+        f->appends = 0;
+        f->reserved = false;
+        f->ra = (Readahead){0};
+        f->cluster = (ClusterCache){0};
+        // Счётчик защищён блокировкой inode: delete_file берёт её же
+        if (fs->open_count[ino]++ == 0 && fs->shared) shared_mark_open(fs, ino, true);
+    }
+    inode_unlock(fs, ino);
+    op_end(fs, MYFS_OP_OPEN, start, f != NULL);
+    return f;
+}
+
+/**
+ * Закрывает дескриптор, записывая отложенные изменения inode.
+ * Все дескрипторы должны быть закрыты до close_fs.
+ * @return false, если inode не удалось записать
+ */
+bool myfs_close(myfs_file_t* f) {
+    if (!f) return false;
+    myfs_t* fs = f->fs;
+    uint64_t start = op_begin();
+    bool ok = true;
+    inode_lock(fs, f->ino, true);
+
+    // Блоки, выделенные впрок дозаписью, но так и не использованные (у
+    // сжатого файла запаса нет, а блоков может быть больше, чем данных)
+    CachedInode* ci = f->reserved ? acquire_inode(fs, f->ino) : NULL;
+    uint32_t used_blocks = ci ? blocks_for(fs, ci->node.size) : 0;
+    if (ci && !is_compressed(&ci->node) && ci->map.blocks > used_blocks) {
+        meta_wrlock(fs);
+        map_truncate(fs, &ci->map, used_blocks);
+        ok = store_inode(fs, f->ino);
+        meta_unlock(fs);
+    }
+
+    if (!writeback_inode(fs, f->ino) || !finish_op(fs)) ok = false;
+    if (--fs->open_count[f->ino] == 0 && fs->shared) shared_mark_open(fs, f->ino, false);
+    inode_unlock(fs, f->ino);
+    free(f->cluster.data);
+    free(f);
+    op_end(fs, MYFS_OP_CLOSE, start, ok);
+    return ok;
+}
+
+// Номер inode открытого файла (для myfs_pread/myfs_read_stream)
+int myfs_file_ino(const myfs_file_t* f) {
+    return f ? f->ino : -1;
+}
+
+// Текущий размер открытого файла в байтах
+uint64_t myfs_file_size(myfs_file_t* f) {
+    if (!f) return 0;
+    inode_lock(f->fs, f->ino, false);
+    CachedInode* ci = acquire_inode(f->fs, f->ino);
+    uint64_t size = ci ? ci->node.size : 0;
+    inode_unlock(f->fs, f->ino);
+    return size;
+}
+
+/**
+ * Записывает len байт (любых, включая нулевые) с позиции offset, не меняя
+ * позицию дескриптора. Перезаписываются только затронутые блоки; запись за
+ * концом файла заполняет промежуток нулями.
+ * @return Число записанных байт или -1 при ошибке
+ */
+ssize_t myfs_pwrite(myfs_file_t* f, const void* buf, size_t len, uint64_t offset) {
+    if (!f || (!buf && len > 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    uint64_t start = op_begin();
+    inode_lock(f->fs, f->ino, true);
+    ssize_t n = file_pwrite(f->fs, f->ino, buf, len, offset);
+    if (n >= 0 && !finish_op(f->fs)) n = -1;
+    inode_unlock(f->fs, f->ino);
+    op_end(f->fs, MYFS_OP_PWRITE, start, n >= 0);
+    return n;
+}
+
+// Записывает len байт с текущей позиции и сдвигает её
+ssize_t myfs_write(myfs_file_t* f, const void* buf, size_t len) {
+    ssize_t n = myfs_pwrite(f, buf, len, f ? f->pos : 0);
+    if (n > 0) f->pos += (uint64_t)n;
+    return n;
+}
+
+// Читает до len байт с текущей позиции и сдвигает её
+ssize_t myfs_read(myfs_file_t* f, void* buf, size_t len) {
+    if (!f) {
+        errno = EINVAL;
+        return -1;
     }
+    ssize_t n = inode_pread(f->fs, f->ino, buf, len, f->pos, &f->ra, &f->cluster);
+    if (n > 0) f->pos += (uint64_t)n;
+    return n;
+}
 
-    // Поиск файла
-    Inode node;
-    int inode_idx = -1;
-    uint8_t inode_bitmap[INODE_COUNT/8];
-    
-    if (fseek(fs, sb.inode_bitmap, SEEK_SET) != 0 ||
-        fread(inode_bitmap, sizeof(inode_bitmap), 1, fs) != 1) {
-        perror("Inode bitmap read failed");
-        return 0;
+/**
+ * Перемещает позицию дескриптора
+ * @param whence SEEK_SET, SEEK_CUR или SEEK_END
+ * @return       Новая позиция или -1 при ошибке
+ */
+int64_t myfs_seek(myfs_file_t* f, int64_t offset, int whence) {
+    if (!f) return -1;
+    int64_t base;
+    switch (whence) {
+        case SEEK_SET: base = 0; break;
+        case SEEK_CUR: base = (int64_t)f->pos; break;
+        case SEEK_END: base = (int64_t)myfs_file_size(f); break;
+        default: return -1;
     }
+    if (base + offset < 0) return -1;
+    f->pos = (uint64_t)(base + offset);
+    return (int64_t)f->pos;
+}
 
-    for (int i = 0; i < INODE_COUNT; i++) {
-        if (!(inode_bitmap[i/8] & (1 << (i%8)))) continue;
+// Устанавливает размер файла: лишние блоки освобождаются, новая часть читается как нули
+bool myfs_truncate(myfs_file_t* f, uint64_t size) {
+    if (!f) return false;
+    uint64_t start = op_begin();
+    inode_lock(f->fs, f->ino, true);
+    bool ok = file_truncate(f->fs, f->ino, size) && finish_op(f->fs);
+    inode_unlock(f->fs, f->ino);
+    op_end(f->fs, MYFS_OP_TRUNCATE, start, ok);
+    return ok;
+}
 
-        if (fseek(fs, sb.inode_table + i*sizeof(Inode), SEEK_SET) != 0 ||
-            fread(&node, sizeof(Inode), 1, fs) != 1) {
-            perror("Inode read failed");
-            continue;
+// Функция: append_io
+// Назначение: Пишет данные в уже выделенные блоки с позиции offset. Экстент
+// конца файла запоминается в дескрипторе, так что последовательные дозаписи
+// не ищут его по карте.
+static bool append_io(myfs_file_t* f, CachedInode* ci, uint64_t offset, const uint8_t* buf, size_t len) {
+    const ExtentMap* map = &ci->map;
+    uint32_t idx = f->tail_ext;
+    while (len > 0) {
+        uint32_t lblock = block_index(f->fs, offset);
+        if (!(idx < map->count && lblock >= map->ext[idx].lblock &&
+              lblock < map->ext[idx].lblock + map->ext[idx].len)) {
+            if (idx + 1 < map->count && lblock >= map->ext[idx + 1].lblock &&
+                lblock < map->ext[idx + 1].lblock + map->ext[idx + 1].len) {
+                idx++;
+            } else {
+                int found = map_find(map, lblock);
+                if (found < 0) return false;
+                idx = (uint32_t)found;
+            }
         }
 
-        if (strcmp(node.name, filename) == 0) {
-            inode_idx = i;
-            break;
-        }
-    }
+        const MapExtent* e = &map->ext[idx];
+        uint64_t ext_end = (uint64_t)(e->lblock + e->len) << f->fs->block_shift;
+        size_t chunk = (ext_end - offset < len) ? (size_t)(ext_end - offset) : len;
+        long phys = block_offset(f->fs, e->start) + (long)(offset - ((uint64_t)e->lblock << f->fs->block_shift));
+        if (!write_region(f->fs, phys, buf, chunk)) return false;
 
-    if (inode_idx == -1) {
-        fprintf(stderr, "Error: File '%s' not found\n", filename);
-        return 0;
+        buf += chunk;
+        offset += chunk;
+        len -= chunk;
     }
+    f->tail_ext = idx;
+    return true;
+}
 
-    // Расчет необходимых блоков
-    size_t required_blocks = (data_len + BLOCK_SIZE - 1) / BLOCK_SIZE;
-    if (required_blocks > 12) {
-        fprintf(stderr, "Error: File too large (max 12 blocks)\n");
-        return 0;
+// Функция: file_append
+// Назначение: Тело myfs_append (под блокировкой inode на запись)
+static ssize_t file_append(myfs_file_t* f, const void* buf, size_t len, int flags) {
+    myfs_t* fs = f->fs;
+    CachedInode* ci = acquire_inode(fs, f->ino);
+    if (!ci) return -1;
+
+    uint64_t size = ci->node.size;
+    size_t sep = ((flags & MYFS_APPEND_SEPARATOR) && size > 0) ? 1 : 0;
+    uint64_t end = size + sep + len;
+    if (end > UINT32_MAX) {
+        fprintf(stderr, "Файл слишком большой\n");
+        return -1;
     }
+    if (end == size) return 0;
 
-    // Проверка выделенных блоков
-    int current_blocks = 0;
-    while (current_blocks < 12 && node.blocks[current_blocks] != 0) {
-        current_blocks++;
+    // Встроенный файл растёт через file_pwrite: он же переносит данные в блоки
+    if (is_inline(&ci->node) || inline_fits(ci, end)) {
+        if ((sep && file_pwrite(fs, f->ino, "\n", 1, size) != 1) ||
+            file_pwrite(fs, f->ino, buf, len, size + sep) != (ssize_t)len) {
+            return -1;
+        }
+        return finish_op(fs) ? (ssize_t)len : -1;
     }
 
-    // Выделение дополнительных блоков при необходимости
-    if (required_blocks > current_blocks) {
-        uint8_t block_bitmap[BLOCK_COUNT/8];
-        if (fseek(fs, sb.block_bitmap, SEEK_SET) != 0 ||
-            fread(block_bitmap, sizeof(block_bitmap), 1, fs) != 1) {
-            perror("Block bitmap read failed");
-            return 0;
+    // Сжатый файл перепаковывает только свой последний кластер вместе с новыми данными
+    if (compress_wanted(fs, ci, end)) {
+        uint8_t* data = malloc(sep + len);
+        if (!data) {
+            perror("Ошибка сжатия данных");
+            return -1;
         }
+        if (sep) data[0] = '\n';
+        memcpy(data + sep, buf, len);
+        bool ok = comp_update(fs, f->ino, ci, end, size, data, sep + len);
+        free(data);
+        return ok && finish_op(fs) ? (ssize_t)len : -1;
+    }
 
-        int blocks_needed = required_blocks - current_blocks;
-        int blocks_allocated = 0;
-        
-        for (int i = 0; i < BLOCK_COUNT && blocks_allocated < blocks_needed; i++) {
-            if (!(block_bitmap[i/8] & (1 << (i%8)))) {
-                block_bitmap[i/8] |= (1 << (i%8));
-                node.blocks[current_blocks + blocks_allocated] = i;
-                blocks_allocated++;
-                sb.free_blocks--;
-
-                // Инициализация нового блока
-                char zero_block[BLOCK_SIZE] = {0};
-                if (fseek(fs, sb.data_start + i*BLOCK_SIZE, SEEK_SET) != 0 ||
-                    fwrite(zero_block, BLOCK_SIZE, 1, fs) != 1) {
-                    perror("Block initialization failed");
-                    return 0;
-                }
-            }
+    // Выделение недостающих блоков: сначала с запасом, при нехватке места — ровно
+    uint32_t required_blocks = blocks_for(fs, end);
+    uint32_t old_blocks = ci->map.blocks;
+    f->appends++;
+    if (required_blocks > old_blocks) {
+        uint32_t reserve = f->appends > 1 ? APPEND_RESERVE_BLOCKS : 0;
+        meta_wrlock(fs);
+        bool ok = true;
+        if (reserve > 0 && map_extend(fs, &ci->map, required_blocks + reserve)) {
+            f->reserved = true;
+        } else if (!map_extend(fs, &ci->map, required_blocks)) {
+            fprintf(stderr, "Недостаточно свободных блоков\n");
+            ok = false;
         }
-
-        if (blocks_allocated < blocks_needed) {
-            fprintf(stderr, "Error: Not enough free blocks\n");
-            return 0;
+        if (ok) {
+            ci->node.mtime = time(NULL);
+            ok = store_inode(fs, f->ino);
         }
+        meta_unlock(fs);
+        if (!ok) return -1;
+    }
 
-        // Обновление битмапа блоков
-        if (fseek(fs, sb.block_bitmap, SEEK_SET) != 0 ||
-            fwrite(block_bitmap, sizeof(block_bitmap), 1, fs) != 1) {
-            perror("Block bitmap update failed");
-            return 0;
+    if ((sep && !append_io(f, ci, size, (const uint8_t*)"\n", 1)) ||
+        !append_io(f, ci, size + sep, buf, len)) {
+        // Новые блоки (и запас) уже записаны в inode на диске: карта
+        // укорачивается обратно, и inode записывается заново
+        perror("Ошибка записи данных");
+        meta_wrlock(fs);
+        if (ci->map.blocks > old_blocks) {
+            map_truncate(fs, &ci->map, old_blocks);
+            store_inode(fs, f->ino);
         }
+        drop_inode(fs, f->ino);
+        meta_unlock(fs);
+        f->tail_ext = 0;
+        return -1;
     }
 
-    // Запись данных
-    for (int i = 0; i < required_blocks; i++) {
-        size_t offset = i * BLOCK_SIZE;
-        size_t to_write = (offset + BLOCK_SIZE > data_len) 
-                        ? data_len - offset 
-                        : BLOCK_SIZE;
+    // Новый размер остаётся в кэше до закрытия дескриптора или синхронизации
+    // (в режиме shared — только до снятия блокировки inode)
+    ci->node.size = (uint32_t)end;
+    ci->node.mtime = time(NULL);
+    ci->dirty = true;
+    if ((fs->shared && !writeback_inode(fs, f->ino)) || !finish_op(fs)) return -1;
+    return (ssize_t)len;
+}
 
-        if (fseek(fs, sb.data_start + node.blocks[i]*BLOCK_SIZE, SEEK_SET) != 0 ||
-            fwrite(data + offset, 1, to_write, fs) != to_write) {
-            perror("Data write failed");
-            return 0;
-        }
+/**
+ * Дозаписывает данные в конец файла. Пишутся только новые байты; карта
+ * блоков, битовые карты и суперблок меняются лишь при выделении новых
+ * блоков, а новый размер inode записывается при myfs_close или sync_fs.
+ * Начиная со второй дозаписи через дескриптор блоки выделяются с запасом
+ * (APPEND_RESERVE_BLOCKS), неиспользованный запас освобождается при закрытии.
+ * @param f     Дескриптор файла
+ * @param buf   Данные (могут содержать нулевые байты)
+ * @param len   Длина данных
+ * @param flags MYFS_APPEND_SEPARATOR — перед данными вставить "\n", если файл не пуст
+ * @return      Число дозаписанных байт данных (без разделителя) или -1 при ошибке
+ */
+ssize_t myfs_append(myfs_file_t* f, const void* buf, size_t len, int flags) {
+    if (!f || (!buf && len > 0)) {
+        errno = EINVAL;
+        return -1;
     }
+    uint64_t start = op_begin();
+    inode_lock(f->fs, f->ino, true);
+    ssize_t n = file_append(f, buf, len, flags);
+    inode_unlock(f->fs, f->ino);
+    op_end(f->fs, MYFS_OP_APPEND, start, n >= 0);
+    return n;
+}
 
-    // Обновление метаданных
-    node.size = data_len;
-    node.mtime = time(NULL);
-
+/**
+ * Возвращает счётчики буферного кэша блоков
+ * @param fs    Указатель на открытую файловую систему
+ * @param stats Куда записать счётчики
+ * @return      false, если кэш выключен (режим mmap или cache_blocks < 0)
+ */
+bool myfs_get_cache_stats(myfs_t* fs, myfs_cache_stats* stats) {
+    if (!fs || !stats || !fs->cache) return false;
+    io_lock(fs);
+    *stats = fs->cache_stats;
+    stats->used = fs->cache_used;
+    io_unlock(fs);
+    return true;
+}
 
-    if (fseek(fs, sb.inode_table + inode_idx*sizeof(Inode), SEEK_SET) != 0 ||
-        fwrite(&node, sizeof(Inode), 1, fs) != 1) {
-        perror("Inode update failed");
-        return 0;
+/**
+ * Перечисляет файлы по возрастанию номера inode
+ * @param fs   Указатель на открытую файловую систему
+ * @param ino  Номер предыдущего файла (-1 — начать с первого)
+ * @param name Куда скопировать полный путь файла (может быть NULL)
+ * @param size Размер буфера name
+ * @return     Номер inode следующего файла или -1, если файлов больше нет
+ */
+int myfs_next_file(myfs_t* fs, int ino, char* name, size_t size) {
+    if (!fs || ino < -1) return -1;
+    uint64_t start = op_begin();
+    meta_rdlock(fs);
+    uint32_t count = (uint32_t)fs->inode_count;
+    uint32_t next = (uint32_t)(ino + 1);
+    while ((next = bitmap_find_set(fs->inode_bitmap, count, next, count)) < count && fs->is_dir[next]) {
+        next++;
     }
+    int found = next < count ? (int)next : -1;
+    if (found >= 0 && name && size > 0) path_of(fs, found, name, size);
+    meta_unlock(fs);
+    op_end(fs, MYFS_OP_NEXT_FILE, start, true);
+    return found;
+}
 
-    if (fseek(fs, SUPERBLOCK_OFFSET, SEEK_SET) != 0 ||
-        fwrite(&sb, sizeof(SuperBlock), 1, fs) != 1) {
-        perror("Superblock update failed");
-        return 0;
+// Функция: set_compressed
+// Назначение: Тело myfs_set_compressed (под блокировкой inode на запись).
+// Содержимое читается в память и записывается заново в нужном виде.
+static bool set_compressed(myfs_t* fs, int ino, CachedInode* ci, const char* name, bool on) {
+    uint64_t size = ci->node.size;
+    if (on == is_compressed(&ci->node) || (on && size <= MYFS_INLINE_MAX)) return true;
+    if (on && !(ci->node.flags & INODE_FLAG_EXTENTS)) {
+        fprintf(stderr, "Ошибка: файл '%s' старого формата не сжимается\n", name);
+        return false;
+    }
+    if (!on && fs->compress) {
+        fprintf(stderr, "Ошибка: в образе со сжатием файл '%s' не распаковывается\n", name);
+        return false;
     }
 
-    fflush(fs);
-    return 1;
+    uint8_t* data = malloc((size_t)size);
+    if (!data || file_pread(fs, ci, data, (size_t)size, 0, NULL) != (ssize_t)size) {
+        perror("Ошибка чтения данных блока");
+        free(data);
+        return false;
+    }
+    bool ok;
+    if (on) {
+        ok = comp_write_tail(fs, ino, ci, 0, data, size);
+    } else {
+        // Сначала файл становится пустым несжатым, затем пишется обычным путём
+        meta_wrlock(fs);
+        map_truncate(fs, &ci->map, 0);
+        comp_drop(ci);
+        ci->node.size = 0;
+        ok = store_inode(fs, ino);
+        meta_unlock(fs);
+        ok = ok && file_pwrite(fs, ino, data, (size_t)size, 0) == (ssize_t)size;
+    }
+    free(data);
+    return ok;
 }
 
 /**
- * Читает содержимое файла из файловой системы
- * @param fs        Указатель на открытую файловую систему
- * @param filename  Имя файла для чтения
- * @param buffer    Буфер для записи содержимого файла
- * @param max_size  Максимальный размер данных для чтения (включая '\0')
- * @return          Количество прочитанных байт (без учета '\0') или 0 при ошибке
- * Автор: Дмитрий
+ * Сжимает файл или распаковывает его (см. раздел «Сжатие данных» в myfs.h)
+ * @param fs   Указатель на открытую файловую систему
+ * @param name Путь файла
+ * @param on   true — сжать, false — хранить несжатым
+ * @return     false, если файла нет, его нельзя перевести или не хватило места
  */
-int read_file(FILE* fs, const char* filename, char* buffer, size_t max_size) {
-    // Проверка входных параметров
-    if (!fs || !filename || !buffer || max_size == 0) {
-        fprintf(stderr, "Ошибка: некорректные параметры (fs=%p, filename=%p, buffer=%p, max_size=%zu)\n",
-                fs, filename, buffer, max_size);
-        return 0;
+bool myfs_set_compressed(myfs_t* fs, const char* name, bool on) {
+    if (!fs || !name) return false;
+    uint64_t start = op_begin();
+    int ino;
+    CachedInode* ci = find_file(fs, name, true, &ino);
+    if (ino == -1) {
+        fprintf(stderr, "Файл '%s' не найден\n", name);
+        op_end(fs, MYFS_OP_SET_COMPRESSED, start, false);
+        return false;
     }
 
-    // Чтение суперблока - основной метаинформации ФС
-    SuperBlock sb;
-    if (fseek(fs, SUPERBLOCK_OFFSET, SEEK_SET) != 0) {
-        perror("Ошибка позиционирования суперблока");
-        return 0;
+    bool ok = ci && set_compressed(fs, ino, ci, name, on);
+    if (!ci) fprintf(stderr, "Error: Corrupted block map of '%s'\n", name);
+    if (ok) {
+        meta_wrlock(fs);
+        ok = flush_inode(fs, ino) && journal_op_end(fs);
+        meta_unlock(fs);
     }
-    if (fread(&sb, sizeof(SuperBlock), 1, fs) != 1) {
-        perror("Ошибка чтения суперблока");
-        return 0;
+    inode_unlock(fs, ino);
+    op_end(fs, MYFS_OP_SET_COMPRESSED, start, ok);
+    return ok;
+}
+
+/**
+ * Обходит записи каталога. Читаются только inode записей этого каталога.
+ * @param fs    Указатель на открытую файловую систему
+ * @param path  Путь каталога ("" или "/" — корень)
+ * @param cb    Обработчик записи (под блокировкой метаданных)
+ * @param ctx   Передаётся обработчику
+ * @return      false, если каталога нет, inode не прочитан или обработчик прервал обход
+ */
+bool myfs_list_dir(myfs_t* fs, const char* path, myfs_dir_cb cb, void* ctx) {
+    if (!fs || !path || !cb) return false;
+    uint64_t start = op_begin();
+    meta_rdlock(fs);
+    int dir = dir_lookup(fs, path);
+    bool ok = dir != PATH_MISSING;
+    if (!ok) fprintf(stderr, "Каталог '%s' не найден\n", path);
+    for (int ino = ok ? fs->dir_first[dir + 1] : -1; ino >= 0 && ok; ino = fs->dir_next[ino]) {
+        Inode node;
+        if (!read_inode(fs, ino, &node)) {
+            fprintf(stderr, "Ошибка чтения inode %d\n", ino);
+            ok = false;
+            break;
+        }
+        myfs_dirent entry = {
+            .name = fs->names[ino],
+            .ino = ino,
+            .is_dir = fs->is_dir[ino],
+            .size = node.size,
+            .mtime = node.mtime,
+        };
+        ok = cb(&entry, ctx);
     }
+    meta_unlock(fs);
+    op_end(fs, MYFS_OP_LIST_DIR, start, ok);
+    return ok;
+}
 
-    // Проверка валидности файловой системы
-    if (sb.magic != FS_MAGIC) {
-        fprintf(stderr, "Ошибка: неверная файловая система (magic=0x%X, ожидалось 0x%X)\n",
-                sb.magic, FS_MAGIC);
-        return 0;
+// -----------------------------------------------------------------------------
+// Перенос данных между файлами хоста и образом (myfs_import_fd/myfs_export_fd).
+// Данные идут по экстентам файла прямо между дескрипторами: copy_file_range
+// копирует их внутри ядра, минуя память процесса (на ФС хоста с reflink —
+// вовсе без копирования). Если ядро или ФС хоста этого не умеют, данные
+// копируются через буфер. В режиме mmap файл хоста читается прямо в
+// отображение и пишется прямо из него.
+// -----------------------------------------------------------------------------
+
+#define COPY_CHUNK (1024 * 1024)  // Буфер копирования, когда copy_file_range недоступен
+
+// Функция: direct_io_begin
+// Назначение: Готовит участок образа к вводу-выводу мимо кэша и потока stdio:
+// изменённые кадры участка и буфер stdio записываются, перед записью кадры
+// участка выбрасываются. Позиция потока после этого считается неизвестной.
+static bool direct_io_begin(myfs_t* fs, long offset, size_t size, bool write) {
+    if (fs->cache) {
+        uint32_t first, count;
+        region_blocks(fs, offset, size, &first, &count);
+        io_lock(fs);
+        bool ok = cache_flush_range(fs, first, count);
+        if (ok && write) cache_drop(fs, first, count);
+        io_unlock(fs);
+        if (!ok) return false;
+    }
+    if (!fs->pio) {
+        if (fflush(fs->fp) != 0) return false;
+        fs->fp_pos = -1;
     }
+    return true;
+}
 
-    // Чтение битовой карты inode (отмечает занятые/свободные inode)
-    uint8_t inode_bitmap[INODE_COUNT / 8];
-    if (fseek(fs, sb.inode_bitmap, SEEK_SET) != 0) {
-        perror("Ошибка позиционирования битмапа inode");
-        return 0;
+// Функция: copy_range
+// Назначение: Копирует size байт между дескрипторами через copy_file_range.
+// Возвращает: 1 — скопировано; 0 — copy_file_range для этой пары файлов не
+// работает и ничего не скопировано; -1 — ошибка или файл-источник короче
+static int copy_range(int in, off_t in_off, int out, off_t out_off, size_t size) {
+    bool started = false;
+    while (size > 0) {
+        ssize_t n = copy_file_range(in, &in_off, out, &out_off, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (!started && (n == 0 || (n < 0 && (errno == EXDEV || errno == ENOSYS ||
+                                              errno == EOPNOTSUPP || errno == EINVAL)))) {
+            return 0;
+        }
+        if (n <= 0) return -1;
+        started = true;
+        size -= (size_t)n;
     }
-    if (fread(inode_bitmap, sizeof(inode_bitmap), 1, fs) != 1) {
-        perror("Ошибка чтения битмапа inode");
-        return 0;
+    return 1;
+}
+
+// Функция: copy_extent
+// Назначение: Переносит size байт между файлом хоста fd (смещение host) и
+// участком образа phys в одну сторону: import — в образ, иначе — из образа.
+// Буфер *buf выделяется при первой надобности и живёт до конца переноса.
+static bool copy_extent(myfs_t* fs, int fd, uint64_t host, long phys, size_t size, bool import, uint8_t** buf) {
+    if (fs->backend == MYFS_BACKEND_MMAP) {
+        if (phys < 0 || (size_t)phys + size > fs->map_size) return false;
+        stat_region(fs, phys, size, import);
+        if (!import) return pio_write(fd, (long)host, fs->map + phys, size);
+        if (!pio_read(fd, (long)host, fs->map + phys, size)) return false;
+        mark_dirty(fs, (size_t)phys, size);
+        return true;
     }
 
-    // Поиск файла по имени в таблице inode
-    Inode node;
-    int found_inode = -1;
-    for (int i = 0; i < INODE_COUNT; i++) {
-        // Пропускаем свободные inode
-        if (!(inode_bitmap[i / 8] & (1 << (i % 8)))) continue;
+    if (!direct_io_begin(fs, phys, size, import)) return false;
+    int img = fileno(fs->fp);
+    int copied = import ? copy_range(fd, (off_t)host, img, phys, size)
+                        : copy_range(img, phys, fd, (off_t)host, size);
+    if (copied > 0) {
+        stat_region(fs, phys, size, import);
+        STAT_ADD(fs, image_writes, import);
+        STAT_ADD(fs, image_reads, !import);
+    }
+    if (copied != 0) return copied > 0;
+
+    if (!*buf && !(*buf = malloc(COPY_CHUNK))) return false;
+    while (size > 0) {
+        size_t chunk = size < COPY_CHUNK ? size : COPY_CHUNK;
+        bool ok = import ? pio_read(fd, (long)host, *buf, chunk) && write_region(fs, phys, *buf, chunk)
+                         : read_region(fs, phys, *buf, chunk) && pio_write(fd, (long)host, *buf, chunk);
+        if (!ok) return false;
+        host += chunk;
+        phys += (long)chunk;
+        size -= chunk;
+    }
+    return true;
+}
 
-        // Читаем inode из таблицы
-        if (fseek(fs, sb.inode_table + i * sizeof(Inode), SEEK_SET) != 0) {
-            perror("Ошибка позиционирования inode");
-            continue;
-        }
-        if (fread(&node, sizeof(Inode), 1, fs) != 1) {
-            perror("Ошибка чтения inode");
-            continue;
-        }
+// Функция: copy_file_data
+// Назначение: Переносит первые len байт файла по его карте экстентов.
+static bool copy_file_data(myfs_t* fs, const ExtentMap* map, int fd, uint64_t len, bool import) {
+    uint8_t* buf = NULL;
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < map->count; i++) {
+        const MapExtent* e = &map->ext[i];
+        uint64_t from = (uint64_t)e->lblock << fs->block_shift;
+        if (from >= len) break;
+        uint64_t bytes = (uint64_t)e->len << fs->block_shift;
+        if (bytes > len - from) bytes = len - from;
+        ok = copy_extent(fs, fd, from, block_offset(fs, e->start), (size_t)bytes, import, &buf);
+    }
+    free(buf);
+    return ok;
+}
 
-        // Сравниваем имя файла
-        if (strncmp(node.name, filename, sizeof(node.name)) == 0) {
-            found_inode = i;
-            break;
-        }
+// Функция: file_import
+// Назначение: Тело myfs_import_fd (под блокировкой inode на запись). Старые
+// блоки освобождаются, новые выделяются сразу на весь размер — одним
+// отрезком, если есть место; inode записывается после данных. Файл до
+// MYFS_INLINE_MAX байт встраивается в inode.
+static bool file_import(myfs_file_t* f, int fd, uint64_t len) {
+    myfs_t* fs = f->fs;
+    CachedInode* ci = acquire_inode(fs, f->ino);
+    if (!ci) return false;
+    if (len > UINT32_MAX) {
+        fprintf(stderr, "Ошибка: файл слишком большой\n");
+        return false;
+    }
+    f->tail_ext = 0;
+    f->reserved = false;
+
+    if (len <= MYFS_INLINE_MAX) {
+        uint8_t data[MYFS_INLINE_MAX];
+        bool ok = pio_read(fd, 0, data, (size_t)len);
+        if (!ok) perror("Ошибка переноса данных в образ");
+        meta_wrlock(fs);
+        map_release(fs, &ci->map);
+        comp_drop(ci);
+        make_inline(&ci->node);
+        memset(inline_data(&ci->node), 0, MYFS_INLINE_MAX);
+        if (ok) memcpy(inline_data(&ci->node), data, (size_t)len);
+        ci->node.size = ok ? (uint32_t)len : 0;
+        ci->node.mtime = time(NULL);
+        if (!store_inode(fs, f->ino)) ok = false;
+        meta_unlock(fs);
+        return ok;
     }
 
-    if (found_inode == -1) {
-        fprintf(stderr, "Файл '%s' не найден в файловой системе\n", filename);
-        return 0;
+    // Сжимаемый файл проходит через память: кластеры сжимаются до записи
+    if (compress_wanted(fs, ci, len)) {
+        uint8_t* data = malloc((size_t)len);
+        bool ok = data && pio_read(fd, 0, data, (size_t)len);
+        if (!ok) perror("Ошибка переноса данных в образ");
+        ok = ok && comp_write_tail(fs, f->ino, ci, 0, data, len);
+        free(data);
+        return ok;
     }
 
-    // Проверка размера файла
-    if (node.size == 0) {
-        buffer[0] = '\0';
-        return 0;  // Файл существует, но пустой
+    meta_wrlock(fs);
+    clear_inline(&ci->node);
+    map_truncate(fs, &ci->map, 0);
+    bool extended = map_extend(fs, &ci->map, blocks_for(fs, len));
+    if (!extended) {
+        fprintf(stderr, "Недостаточно свободных блоков\n");
+        ci->node.size = 0;
+        store_inode(fs, f->ino);
     }
+    meta_unlock(fs);
+    if (!extended) return false;
+
+    bool ok = copy_file_data(fs, &ci->map, fd, len, true);
+    if (!ok) perror("Ошибка переноса данных в образ");
+
+    meta_wrlock(fs);
+    ci->node.size = ok ? (uint32_t)len : 0;
+    ci->node.mtime = time(NULL);
+    if (!ok) map_truncate(fs, &ci->map, 0);
+    if (!store_inode(fs, f->ino)) ok = false;
+    meta_unlock(fs);
+    return ok;
+}
 
-    // Вычисляем сколько байт будем читать (оставляем место для '\0')
-    size_t to_read = (node.size < max_size - 1) ? node.size : max_size - 1;
-    size_t bytes_read = 0;
+/**
+ * Заменяет содержимое открытого файла первыми len байтами файла хоста.
+ * Блоки под весь размер выделяются сразу, данные копируются по экстентам
+ * мимо памяти процесса (см. раздел «Перенос данных»). Позиция fd не меняется.
+ * @param f   Дескриптор файла ФС
+ * @param fd  Дескриптор файла хоста, открытый на чтение
+ * @param len Сколько байт перенести (файл хоста должен быть не короче)
+ * @return    true при успехе; при ошибке файл ФС остаётся пустым
+ */
+bool myfs_import_fd(myfs_file_t* f, int fd, uint64_t len) {
+    if (!f || fd < 0) {
+        errno = EINVAL;
+        return false;
+    }
+    uint64_t start = op_begin();
+    inode_lock(f->fs, f->ino, true);
+    bool ok = file_import(f, fd, len) && finish_op(f->fs);
+    inode_unlock(f->fs, f->ino);
+    op_end(f->fs, MYFS_OP_IMPORT, start, ok);
+    return ok;
+}
 
-    // Чтение данных из блоков
-    for (int i = 0; i < 12 && bytes_read < to_read; i++) {
-        if (node.blocks[i] == 0) break;  // Нет больше блоков
+// Обработчик comp_stream для myfs_export_fd: ctx — дескриптор файла хоста
+static bool export_chunk(const void* data, size_t len, uint64_t offset, void* ctx) {
+    return pio_write(*(const int*)ctx, (long)offset, data, len);
+}
 
-        // Проверка валидности номера блока
-        if (node.blocks[i] >= BLOCK_COUNT) {
-            fprintf(stderr, "Ошибка: недопустимый номер блока %u\n", node.blocks[i]);
-            break;
-        }
+/**
+ * Записывает содержимое файла ФС в файл хоста с его начала (размер файла
+ * хоста не уменьшается — открывайте его с O_TRUNC). Позиция fd не меняется.
+ * @param fs  Указатель на открытую файловую систему
+ * @param ino Номер inode (см. lookup_file, myfs_next_file)
+ * @param fd  Дескриптор файла хоста, открытый на запись
+ * @return    Число перенесённых байт или -1 при ошибке
+ */
+ssize_t myfs_export_fd(myfs_t* fs, int ino, int fd) {
+    if (!fs || fd < 0 || ino < 0 || ino >= fs->inode_count) {
+        errno = EINVAL;
+        return -1;
+    }
+    uint64_t start = op_begin();
+    inode_lock(fs, ino, false);
+    CachedInode* ci = acquire_inode(fs, ino);
+    ssize_t n = -1;
+    if (!ci) {
+        errno = ENOENT;
+    } else if (is_inline(&ci->node)) {
+        if (pio_write(fd, 0, ci->node.blocks, ci->node.size)) n = (ssize_t)ci->node.size;
+        else perror("Ошибка переноса данных из образа");
+    } else if (is_compressed(&ci->node)) {
+        // Данные распаковываются, поэтому переносятся через память процесса
+        if (comp_stream(fs, ci, 0, export_chunk, &fd)) n = (ssize_t)ci->node.size;
+        else perror("Ошибка переноса данных из образа");
+    } else if (ci->node.size > ((uint64_t)ci->map.blocks << fs->block_shift)) {
+        fprintf(stderr, "Ошибка: размер файла больше, чем выделено блоков\n");
+    } else if (copy_file_data(fs, &ci->map, fd, ci->node.size, false)) {
+        n = (ssize_t)ci->node.size;
+    } else {
+        perror("Ошибка переноса данных из образа");
+    }
+    inode_unlock(fs, ino);
+    op_end(fs, MYFS_OP_EXPORT, start, n >= 0);
+    return n;
+}
 
-        // Позиционируемся на начало блока
-        long block_offset = sb.data_start + node.blocks[i] * BLOCK_SIZE;
-        if (fseek(fs, block_offset, SEEK_SET) != 0) {
-            perror("Ошибка позиционирования блока данных");
-            break;
-        }
+// -----------------------------------------------------------------------------
+// Пакеты изменений (myfs_batch_*). Операции только запоминаются, а применяются
+// все сразу в myfs_batch_commit под блокировками затронутых файлов и meta_lock:
+//   - метаданные копятся в транзакции (в режиме mmap — тоже, на место они
+//     переносятся, когда удались все операции), поэтому inode и блок карты,
+//     изменённые несколько раз, пишутся один раз;
+//   - новое содержимое файла получает новые блоки, а старые освобождаются в
+//     той же транзакции: до фиксации прежние данные целы;
+//   - блоки данных пишутся после всех операций, по возрастанию номера блока.
+// При ошибке суперблок и битовые карты возвращаются к снимку, транзакция
+// отбрасывается, а кэш inode и индекс имён перечитываются с диска.
+// -----------------------------------------------------------------------------
 
-        // Вычисляем сколько читать из текущего блока
-        size_t remaining = to_read - bytes_read;
-        size_t chunk = (remaining < BLOCK_SIZE) ? remaining : BLOCK_SIZE;
-        
+typedef enum {
+    BATCH_CREATE,
+    BATCH_WRITE,
+    BATCH_DELETE
+} BatchOpType;
+
+typedef struct {
+    BatchOpType type;
+    char* name;
+    uint8_t* data;           // Копия нового содержимого (BATCH_WRITE)
+    uint8_t* packed;         // Поток сжатого файла (см. comp_encode): пишется вместо data
+    size_t len;
+    int ino;                 // Номер inode по имени на момент захвата блокировок (-1 — файла нет)
+} BatchOp;
+
+// Новые блоки данных и их содержимое
+typedef struct {
+    uint32_t start;          // Первый блок
+    uint32_t count;          // Число блоков
+    const uint8_t* src;
+    size_t bytes;            // Хвост последнего блока за концом файла не пишется
+} BatchExtent;
+
+// Метаданные в памяти на начало фиксации
+typedef struct {
+    SuperBlock sb;
+    uint8_t* inode_bitmap;   // Обе карты — в одном выделении (batch_snapshot)
+    uint8_t* block_bitmap;
+    bool sb_dirty, inode_bitmap_dirty, block_bitmap_dirty, trim_pending;
+} BatchSnapshot;
+
+struct myfs_batch {
+    myfs_t* fs;
+    BatchOp* ops;
+    size_t count, cap;
+    const BatchSnapshot* snap;  // Дальше — состояние фиксации
+    BatchExtent* data;
+    size_t data_count, data_cap;
+    uint8_t* pending;        // Биты блоков, на которые есть отрезки в data (NULL — отрезков нет)
+    bool failed;             // Не хватило памяти
+};
 
-        // Читаем данные
-        size_t actually_read = fread(buffer + bytes_read, 1, chunk, fs);
-        if (actually_read != chunk) {
-            perror("Ошибка чтения данных блока");
-            fprintf(stderr, "Ожидалось %zu, прочитано %zu байт\n", chunk, actually_read);
-            break;
-        }
+/**
+ * Начинает пакет изменений
+ * @param fs  Указатель на открытую файловую систему
+ * @return    Пустой пакет или NULL при ошибке
+ */
+myfs_batch_t* myfs_batch_begin(myfs_t* fs) {
+    if (!fs) return NULL;
+    if (fs->shared) {
+        fprintf(stderr, "Ошибка: пакеты в режиме shared не поддерживаются\n");
+        return NULL;
+    }
+    myfs_batch_t* b = calloc(1, sizeof(myfs_batch_t));
+    if (!b) {
+        perror("Ошибка выделения памяти под пакет");
+        return NULL;
+    }
+    b->fs = fs;
+    return b;
+}
 
-        bytes_read += actually_read;
+// Добавляет операцию в конец пакета, копируя имя и данные
+static bool batch_push(myfs_batch_t* b, BatchOpType type, const char* name, const void* data, size_t len) {
+    if (!b || !name || (!data && len > 0)) {
+        fprintf(stderr, "Error: Invalid parameters\n");
+        return false;
+    }
+    if (strlen(name) >= 256) {
+        fprintf(stderr, "Error: Filename too long\n");
+        return false;
+    }
+    if (len > UINT32_MAX) {
+        fprintf(stderr, "Error: File too large\n");
+        return false;
     }
 
-    // Гарантируем null-terminated строку
-    buffer[bytes_read] = '\0';
+    if (b->count == b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 64;
+        BatchOp* ops = realloc(b->ops, cap * sizeof(BatchOp));
+        if (!ops) {
+            perror("Ошибка выделения памяти под пакет");
+            return false;
+        }
+        b->ops = ops;
+        b->cap = cap;
+    }
 
-    // Дополнительная проверка целостности
-    if (bytes_read < to_read && bytes_read < node.size) {
-        fprintf(stderr, "Предупреждение: прочитано %zu из %u байт файла '%s'\n",
-                bytes_read, node.size, filename);
+    BatchOp op = {.type = type, .name = strdup(name), .len = len, .ino = -1};
+    if (op.name && len > 0) {
+        op.data = malloc(len);
+        if (op.data) memcpy(op.data, data, len);
     }
+    if (!op.name || (len > 0 && !op.data)) {
+        perror("Ошибка выделения памяти под пакет");
+        free(op.name);
+        free(op.data);
+        return false;
+    }
+    b->ops[b->count++] = op;
+    return true;
+}
 
-    return (int)bytes_read;
+/**
+ * Добавляет в пакет создание пустого файла
+ * @return false при ошибке (пакет остаётся прежним)
+ */
+bool myfs_batch_create(myfs_batch_t* b, const char* name) {
+    return batch_push(b, BATCH_CREATE, name, NULL, 0);
 }
 
+/**
+ * Добавляет в пакет замену содержимого файла
+ * @param data  Новое содержимое (копируется; может содержать нулевые байты)
+ * @param len   Длина содержимого
+ * @return      false при ошибке (пакет остаётся прежним)
+ */
+bool myfs_batch_write(myfs_batch_t* b, const char* name, const void* data, size_t len) {
+    return batch_push(b, BATCH_WRITE, name, data, len);
+}
 
-// Автор: Татьяна 
-int write_file1(FILE* fs, const char* filename, const char* data) {
-    if (!fs || !filename || !data) {
-        fprintf(stderr, "Ошибка: некорректные параметры\n");
-        return 0;
-    }
+/**
+ * Добавляет в пакет удаление файла
+ * @return false при ошибке (пакет остаётся прежним)
+ */
+bool myfs_batch_delete(myfs_batch_t* b, const char* name) {
+    return batch_push(b, BATCH_DELETE, name, NULL, 0);
+}
 
-    SuperBlock sb;
-    if (fseek(fs, SUPERBLOCK_OFFSET, SEEK_SET) != 0 || 
-        fread(&sb, sizeof(SuperBlock), 1, fs) != 1) {
-        perror("Ошибка чтения суперблока");
-        return 0;
+/**
+ * Освобождает пакет, не применяя его операций
+ */
+void myfs_batch_abort(myfs_batch_t* b) {
+    if (!b) return;
+    for (size_t i = 0; i < b->count; i++) {
+        free(b->ops[i].name);
+        free(b->ops[i].data);
+        free(b->ops[i].packed);
     }
+    free(b->ops);
+    free(b->data);
+    free(b->pending);
+    free(b);
+}
 
-    uint8_t inode_bitmap[INODE_COUNT / 8];
-    if (fseek(fs, sb.inode_bitmap, SEEK_SET) != 0 || 
-        fread(inode_bitmap, sizeof(inode_bitmap), 1, fs) != 1) {
-        perror("Ошибка чтения битмапа inode");
-        return 0;
+static bool batch_add_data(myfs_batch_t* b, uint32_t start, uint32_t count, const uint8_t* src, size_t bytes) {
+    if (!b->pending && !(b->pending = calloc(1, b->fs->block_bitmap_size))) return false;
+    if (b->data_count == b->data_cap) {
+        size_t cap = b->data_cap ? b->data_cap * 2 : 64;
+        BatchExtent* data = realloc(b->data, cap * sizeof(BatchExtent));
+        if (!data) return false;
+        b->data = data;
+        b->data_cap = cap;
     }
+    b->data[b->data_count++] = (BatchExtent){.start = start, .count = count, .src = src, .bytes = bytes};
+    bitmap_fill(b->pending, start, count, true);
+    return true;
+}
 
-    Inode node;
-    int found_inode = -1;
-    for (int i = 0; i < INODE_COUNT; i++) {
-        if (inode_bitmap[i / 8] & (1 << (i % 8))) {
-            if (fseek(fs, sb.inode_table + i * sizeof(Inode), SEEK_SET) != 0 || 
-                fread(&node, sizeof(Inode), 1, fs) != 1) {
-                perror("Ошибка чтения inode");
-                continue;
-            }
-
-            if (strncmp(node.name, filename, sizeof(node.name)) == 0) {
-                found_inode = i;
-                break;
+// Функция: batch_forget
+// Назначение: Вызывается из free_blocks во время фиксации. Данные блоков,
+// освобождённых позже в том же пакете (файл переписан ещё раз или удалён),
+// не пишутся: эти блоки может получить другой файл.
+// Обычно в освобождённых и только что выделенных блоках отрезков нет — это
+// видно по битам pending без просмотра всех отрезков пакета.
+static void batch_forget(myfs_batch_t* b, uint32_t start, uint32_t count) {
+    uint32_t end = start + count;
+    if (!b->pending || bitmap_find_set(b->pending, b->fs->block_count, start, end) == end) return;
+    bitmap_fill(b->pending, start, count, false);
+    size_t n = b->data_count;
+    for (size_t i = 0; i < n; i++) {
+        BatchExtent e = b->data[i];
+        uint32_t e_end = e.start + e.count;
+        if (e.count == 0 || e_end <= start || e.start >= end) continue;
+
+        // Часть до освобождённого участка остаётся на месте, часть после — новым отрезком
+        b->data[i].count = e.start < start ? start - e.start : 0;
+        size_t head = (size_t)b->data[i].count << b->fs->block_shift;
+        if (b->data[i].bytes > head) b->data[i].bytes = head;
+        if (e_end > end) {
+            size_t skip = (size_t)(end - e.start) << b->fs->block_shift;
+            if (e.bytes > skip && !batch_add_data(b, end, e_end - end, e.src + skip, e.bytes - skip)) {
+                b->failed = true;
             }
         }
     }
+}
 
-    if (found_inode == -1) {
-        fprintf(stderr, "Файл '%s' не найден\n", filename);
-        return 0;
+// Функция: batch_replace
+// Назначение: Заменяет содержимое файла. Новые блоки выделяются отдельно от
+// старых (копирование при записи) и запоминаются для записи при фиксации.
+// У файла, созданного этим же пакетом, прежнего содержимого нет: его карта
+// меняется на месте. Содержимое до MYFS_INLINE_MAX байт встраивается в inode
+// и пишется вместе с ним в транзакции.
+// Сжимаемое содержимое сжимается здесь же, и при фиксации пишется его поток.
+// Ошибки не откатываются здесь: это сделает batch_rollback.
+static bool batch_replace(myfs_batch_t* b, int ino, CachedInode* ci, BatchOp* op) {
+    myfs_t* fs = b->fs;
+    bool fresh = !(b->snap->inode_bitmap[ino / 8] & (1 << (ino % 8)));
+
+    if (op->len <= MYFS_INLINE_MAX) {
+        map_release(fs, &ci->map);
+        comp_drop(ci);
+        make_inline(&ci->node);
+        memset(inline_data(&ci->node), 0, MYFS_INLINE_MAX);
+        if (op->len > 0) memcpy(inline_data(&ci->node), op->data, op->len);
+        ci->node.size = (uint32_t)op->len;
+        ci->node.mtime = time(NULL);
+        return store_inode(fs, ino);
     }
 
-    const char* newline = "\n";
-    size_t prefix_len = (node.size > 0) ? strlen(newline) : 0;
-    size_t data_len = strlen(data);
-    size_t total_data_len = prefix_len + data_len;
+    // Сжатый файл получает поток целиком: кластеров прежнего содержимого он не хранит
+    const uint8_t* src = op->data;
+    size_t len = op->len;
+    ClusterTable table = {0};
+    bool packed = compress_wanted(fs, ci, op->len);
+    if (packed) {
+        free(op->packed);
+        op->packed = comp_encode(fs, &ci->clusters, 0, op->data, op->len, &table, &len);
+        if (!op->packed) {
+            errno = ENOMEM;
+            perror("Ошибка выделения памяти под пакет");
+            return false;
+        }
+        src = op->packed;
+    }
+    uint32_t blocks = blocks_for(fs, len);
+
+    ExtentMap map;
+    memset(&map, 0, sizeof(map));
+    ExtentMap* target = fresh ? &ci->map : &map;
+    if (fresh) map_truncate(fs, target, blocks);
+    if (!map_extend(fs, target, blocks)) {
+        fprintf(stderr, "Недостаточно свободных блоков\n");
+        map_free(&map);
+        free(table.len);
+        return false;
+    }
+    for (uint32_t i = 0; i < target->count; i++) {
+        const MapExtent* e = &target->ext[i];
+        size_t from = (size_t)e->lblock << fs->block_shift;
+        size_t bytes = len - from < ((size_t)e->len << fs->block_shift) ? len - from : ((size_t)e->len << fs->block_shift);
+        batch_forget(b, e->start, e->len);  // Данные прошлой записи в эти же блоки
+        if (!batch_add_data(b, e->start, e->len, src + from, bytes)) {
+            map_free(&map);
+            free(table.len);
+            errno = ENOMEM;
+            perror("Ошибка выделения памяти под пакет");
+            return false;
+        }
+    }
 
-    size_t current_size = node.size;
-    size_t total_size = current_size + total_data_len;
+    if (!fresh) {
+        map_release(fs, &ci->map);
+        map_free(&ci->map);
+        ci->map = map;
+    }
+    if (packed) {
+        free(ci->clusters.len);
+        ci->clusters = table;
+        ci->gen = cluster_gen(fs);
+        ci->node.flags |= INODE_FLAG_COMPRESSED;
+    }
+    clear_inline(&ci->node);
+    ci->node.size = (uint32_t)op->len;
+    ci->node.mtime = time(NULL);
+    return store_inode(fs, ino);
+}
 
-    size_t current_blocks = (current_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
-    size_t required_blocks = (total_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+// Функция: batch_apply
+// Назначение: Выполняет операции пакета по порядку над метаданными в памяти
+static bool batch_apply(myfs_batch_t* b) {
+    myfs_t* fs = b->fs;
+    for (size_t i = 0; i < b->count; i++) {
+        BatchOp* op = &b->ops[i];
+        if (op->type == BATCH_CREATE) {
+            if (create_inode(fs, op->name, false) < 0) return false;
+            continue;
+        }
 
-    if (required_blocks > 12) {
-        fprintf(stderr, "Файл слишком большой (максимум 12 блоков)\n");
-        return 0;
+        int ino = entry_lookup(fs, op->name, false);
+        if (ino < 0) {
+            fprintf(stderr, "Файл '%s' не найден\n", op->name);
+            return false;
+        }
+        CachedInode* ci = get_inode(fs, ino);
+        if (!ci) {
+            fprintf(stderr, "Error: Corrupted block map of '%s'\n", op->name);
+            return false;
+        }
+        if (op->type == BATCH_DELETE) {
+            if (fs->open_count[ino] > 0) {
+                fprintf(stderr, "Файл '%s' открыт, удаление невозможно\n", op->name);
+                return false;
+            }
+            remove_inode(fs, ino, ci, op->name);
+        } else if (!batch_replace(b, ino, ci, op)) {
+            return false;
+        }
     }
+    return !b->failed;
+}
 
-    uint8_t block_bitmap[BLOCK_COUNT / 8];
-    if (fseek(fs, sb.block_bitmap, SEEK_SET) != 0 || 
-        fread(block_bitmap, sizeof(block_bitmap), 1, fs) != 1) {
-        perror("Ошибка чтения битмапа блоков");
-        return 0;
-    }
+static int batch_extent_cmp(const void* a, const void* b) {
+    uint32_t x = ((const BatchExtent*)a)->start, y = ((const BatchExtent*)b)->start;
+    return (x > y) - (x < y);
+}
 
-    // Выделение недостающих блоков
-    for (int i = current_blocks; i < required_blocks; i++) {
-        int allocated = 0;
-        for (int j = 0; j < BLOCK_COUNT; j++) {
-            if (!(block_bitmap[j / 8] & (1 << (j % 8)))) {
-                block_bitmap[j / 8] |= (1 << (j % 8));
-                node.blocks[i] = j;
-                sb.free_blocks--;
-                allocated = 1;
+// Пишет новые данные пакета по возрастанию номеров блоков. Отрезки, которые
+// лежат в образе вплотную друг к другу (обычно новые файлы пакета), пишутся
+// одним pwritev; неполный последний блок отрезка внутри такого участка
+// дополняется нулями, иначе мелкие файлы шли бы по одному через кэш блоков
+static bool batch_write_data(myfs_batch_t* b) {
+    static const uint8_t zeros[MYFS_MAX_BLOCK_SIZE];
+    myfs_t* fs = b->fs;
+    if (b->data_count > 1) qsort(b->data, b->data_count, sizeof(BatchExtent), batch_extent_cmp);
+    struct iovec iov[2 * CACHE_RUN_BLOCKS];
+    for (size_t i = 0, run; i < b->data_count; i += run) {
+        const BatchExtent* e = &b->data[i];
+        run = 1;
+        if (e->bytes == 0) continue;
+
+        int cnt = 0;
+        iov[cnt++] = (struct iovec){.iov_base = (void*)e->src, .iov_len = e->bytes};
+        size_t bytes = e->bytes;
+        while (i + run < b->data_count && run < CACHE_RUN_BLOCKS) {
+            const BatchExtent* prev = &b->data[i + run - 1];
+            const BatchExtent* next = &b->data[i + run];
+            size_t prev_size = (size_t)prev->count << fs->block_shift;
+            if (next->start != prev->start + prev->count || next->bytes == 0 ||
+                prev_size - prev->bytes >= fs->block_size) {
                 break;
             }
+            if (prev->bytes < prev_size) {
+                iov[cnt++] = (struct iovec){.iov_base = (void*)zeros, .iov_len = prev_size - prev->bytes};
+                bytes += prev_size - prev->bytes;
+            }
+            iov[cnt++] = (struct iovec){.iov_base = (void*)next->src, .iov_len = next->bytes};
+            bytes += next->bytes;
+            run++;
         }
-        if (!allocated) {
-            fprintf(stderr, "Недостаточно свободных блоков\n");
-            return 0;
-        }
-    }
 
-    // Пишем перевод строки, если нужно
-    size_t file_offset = current_size;
-    if (prefix_len > 0) {
-        size_t block_index = file_offset / BLOCK_SIZE;
-        size_t offset_in_block = file_offset % BLOCK_SIZE;
-        long write_pos = sb.data_start + node.blocks[block_index] * BLOCK_SIZE + offset_in_block;
-        if (fseek(fs, write_pos, SEEK_SET) != 0 ||
-            fwrite(newline, 1, prefix_len, fs) != prefix_len) {
-            perror("Ошибка записи перевода строки");
-            return 0;
+        long offset = block_offset(fs, e->start);
+        bool ok = cnt == 1 ? write_region(fs, offset, e->src, e->bytes)
+                           : write_regionv(fs, offset, iov, cnt, bytes);
+        if (!ok) {
+            perror("Ошибка записи данных");
+            return false;
         }
-        file_offset += prefix_len;
     }
+    return true;
+}
 
-    // Пишем основное содержимое
-    size_t data_offset = 0;
-    while (data_offset < data_len) {
-        size_t block_index = file_offset / BLOCK_SIZE;
-        size_t offset_in_block = file_offset % BLOCK_SIZE;
-        size_t space_in_block = BLOCK_SIZE - offset_in_block;
-        size_t to_write = (data_len - data_offset < space_in_block) ? (data_len - data_offset) : space_in_block;
+static int int_cmp(const void* a, const void* b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
 
-        long write_pos = sb.data_start + node.blocks[block_index] * BLOCK_SIZE + offset_in_block;
-        if (fseek(fs, write_pos, SEEK_SET) != 0 ||
-            fwrite(data + data_offset, 1, to_write, fs) != to_write) {
-            perror("Ошибка записи данных");
-            return 0;
+// Функция: batch_lock
+// Назначение: Захватывает блокировки уже существующих файлов пакета — по
+// возрастанию номеров inode, чтобы два пакета не ждали друг друга по кругу, —
+// и meta_lock на запись. Если пока их ждали, имя стало указывать на другой
+// inode, всё отпускается и захватывается заново (как в lock_file).
+// Возвращает: номера захваченных inode (освобождаются batch_unlock) или NULL
+static int* batch_lock(myfs_batch_t* b, size_t* nlocked) {
+    myfs_t* fs = b->fs;
+    int* inos = malloc((b->count + 1) * sizeof(int));
+    if (!inos) return NULL;
+
+    for (;;) {
+        size_t n = 0;
+        meta_rdlock(fs);
+        for (size_t i = 0; i < b->count; i++) {
+            b->ops[i].ino = entry_lookup(fs, b->ops[i].name, false);
+            if (b->ops[i].ino >= 0) inos[n++] = b->ops[i].ino;
+        }
+        meta_unlock(fs);
+
+        qsort(inos, n, sizeof(int), int_cmp);
+        size_t u = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (u == 0 || inos[u - 1] != inos[i]) inos[u++] = inos[i];
         }
+        for (size_t i = 0; i < u; i++) inode_lock(fs, inos[i], true);
+        meta_wrlock(fs);
 
-        file_offset += to_write;
-        data_offset += to_write;
+        bool same = true;
+        for (size_t i = 0; i < b->count && same; i++) {
+            same = entry_lookup(fs, b->ops[i].name, false) == b->ops[i].ino;
+        }
+        if (same) {
+            *nlocked = u;
+            return inos;
+        }
+        meta_unlock(fs);
+        for (size_t i = 0; i < u; i++) inode_unlock(fs, inos[i]);
     }
+}
 
-    node.size = (uint32_t)total_size;
-    node.mtime = time(NULL); // корректная метка времени
+static void batch_unlock(myfs_t* fs, int* inos, size_t nlocked) {
+    meta_unlock(fs);
+    for (size_t i = 0; i < nlocked; i++) inode_unlock(fs, inos[i]);
+    free(inos);
+}
 
+static bool batch_snapshot(myfs_t* fs, BatchSnapshot* snap) {
+    snap->inode_bitmap = malloc(fs->inode_bitmap_size + fs->block_bitmap_size);
+    if (!snap->inode_bitmap) return false;
+    snap->block_bitmap = snap->inode_bitmap + fs->inode_bitmap_size;
+    snap->sb = *fs->sb;
+    memcpy(snap->inode_bitmap, fs->inode_bitmap, fs->inode_bitmap_size);
+    memcpy(snap->block_bitmap, fs->block_bitmap, fs->block_bitmap_size);
+    snap->sb_dirty = fs->sb_dirty;
+    snap->inode_bitmap_dirty = fs->inode_bitmap_dirty;
+    snap->block_bitmap_dirty = fs->block_bitmap_dirty;
+    snap->trim_pending = fs->trim_pending;
+    return true;
+}
 
-    // Запись inode
-    if (fseek(fs, sb.inode_table + found_inode * sizeof(Inode), SEEK_SET) != 0 ||
-        fwrite(&node, sizeof(Inode), 1, fs) != 1) {
-        perror("Ошибка обновления inode");
-        return 0;
+// Функция: batch_rollback
+// Назначение: Возвращает метаданные в памяти к снимку. Транзакция пакета ещё
+// не записана, и на диске изменились разве что новые блоки данных — в них
+// снова пробиваются дыры.
+static void batch_rollback(myfs_t* fs, const BatchSnapshot* snap, const int* locked, size_t nlocked, bool wrote) {
+    *fs->sb = snap->sb;
+    memcpy(fs->inode_bitmap, snap->inode_bitmap, fs->inode_bitmap_size);
+    memcpy(fs->block_bitmap, snap->block_bitmap, fs->block_bitmap_size);
+    fs->inode_hint = 0;
+    fs->sb_dirty = snap->sb_dirty;
+    fs->inode_bitmap_dirty = snap->inode_bitmap_dirty;
+    fs->block_bitmap_dirty = snap->block_bitmap_dirty;
+    journal_clear_txn(fs);
+
+    // Копии inode, которые мог изменить пакет: его файлы и inode, которые он занимал
+    for (size_t i = 0; i < nlocked; i++) drop_inode(fs, locked[i]);
+    for (int i = 0; i < fs->inode_count; i++) {
+        if (!(fs->inode_bitmap[i / 8] & (1 << (i % 8)))) drop_inode(fs, i);
     }
+    index_free(fs);
+    if (!index_build(fs)) fprintf(stderr, "Предупреждение: индекс имён не восстановлен\n");
 
-    // Запись битмапа
-    if (fseek(fs, sb.block_bitmap, SEEK_SET) != 0 ||
-        fwrite(block_bitmap, sizeof(block_bitmap), 1, fs) != 1) {
-        perror("Ошибка записи битмапа блоков");
-        return 0;
+    if (wrote) {
+        trim_free_blocks(fs);
+    } else {
+        fs->trim_pending = snap->trim_pending;
     }
+}
 
-    // Запись суперблока
-    if (fseek(fs, SUPERBLOCK_OFFSET, SEEK_SET) != 0 ||
-        fwrite(&sb, sizeof(SuperBlock), 1, fs) != 1) {
-        perror("Ошибка записи суперблока");
-        return 0;
+/**
+ * Применяет операции пакета одной транзакцией и освобождает пакет
+ * @param b  Пакет
+ * @return   true, если применены все операции; при false не применена ни одна
+ */
+bool myfs_batch_commit(myfs_batch_t* b) {
+    if (!b) return false;
+    myfs_t* fs = b->fs;
+    uint64_t start = op_begin();
+    size_t nlocked = 0;
+    int* locked = batch_lock(b, &nlocked);
+    if (!locked) {
+        perror("Ошибка выделения памяти под пакет");
+        myfs_batch_abort(b);
+        op_end(fs, MYFS_OP_BATCH_COMMIT, start, false);
+        return false;
     }
 
-    return 1;
-}
+    // В транзакции должны быть только изменения пакета: при откате она
+    // отбрасывается целиком
+    bool ok = true;
+    if (fs->journal && (fs->txn_records > 0 || fs->inode_bitmap_dirty || fs->block_bitmap_dirty || fs->sb_dirty)) {
+        ok = journal_commit(fs);
+    }
 
+    BatchSnapshot snap;
+    if (!batch_snapshot(fs, &snap)) {
+        perror("Ошибка выделения памяти под пакет");
+        batch_unlock(fs, locked, nlocked);
+        myfs_batch_abort(b);
+        op_end(fs, MYFS_OP_BATCH_COMMIT, start, false);
+        return false;
+    }
+    b->snap = &snap;
+    fs->batch = b;
+    ok = ok && batch_apply(b);
+    bool wrote = ok;
+    ok = ok && batch_write_data(b);
+    fs->batch = NULL;
+
+    if (!ok) {
+        batch_rollback(fs, &snap, locked, nlocked, wrote);
+    } else if (fs->journal) {
+        ok = journal_commit(fs);
+    } else {
+        // mmap: журнала нет, транзакция переносится прямо в отображение
+        ok = journal_apply(fs, fs->txn_buf, fs->txn_len) && sync_mmap(fs);
+        journal_clear_txn(fs);
+    }
+    if (ok && fs->trim_pending) trim_free_blocks(fs);
+    free(snap.inode_bitmap);
 
+    batch_unlock(fs, locked, nlocked);
+    myfs_batch_abort(b);
+    op_end(fs, MYFS_OP_BATCH_COMMIT, start, ok);
+    return ok;
+}
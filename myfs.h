@@ -5,24 +5,33 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <time.h>
+#include <sys/types.h>
 
 // -----------------------------
 // Основные параметры файловой системы
 // -----------------------------
 
+// Геометрия задаётся при форматировании (myfs_format_options) и хранится в
+// суперблоке; при открытии образа действуют значения из него. Ниже —
+// значения по умолчанию.
 #define BLOCK_SIZE 4096         // Размер одного блока данных (в байтах)
 #define INODE_COUNT 1024        // Общее количество inode (табличных записей для файлов)
 #define BLOCK_COUNT 4096        // Общее количество блоков данных
 
+// Допустимый размер блока: степень двойки в этих пределах
+#define MYFS_MIN_BLOCK_SIZE 512
+#define MYFS_MAX_BLOCK_SIZE (64 * 1024)
+
 // -----------------------------
-// Смещения системных структур в файле-образе
+// Размещение системных структур в файле-образе
 // -----------------------------
 
+// Суперблок лежит в начале образа; остальные области идут за ним в порядке
+// битовая карта inode, битовая карта блоков, таблица inode, область имён,
+// область данных, журнал. Каждая область начинается с границы блока, смещения записываются
+// в суперблок при форматировании. Все смещения — 32-битные, поэтому образ
+// вместе с журналом не больше 4 ГиБ.
 #define SUPERBLOCK_OFFSET 0             // Смещение суперблока (начало файла)
-#define INODE_BITMAP_OFFSET 4096        // Смещение битовой карты inodes
-#define BLOCK_BITMAP_OFFSET 8192        // Смещение битовой карты блоков данных
-#define INODE_TABLE_OFFSET 12288        // Смещение таблицы inode
-#define DATA_BLOCKS_OFFSET 53248        // Смещение начала области данных (где хранятся содержимое файлов)
 
 // -----------------------------
 // Структура суперблока файловой системы
@@ -39,35 +48,452 @@ typedef struct {
     uint32_t block_bitmap;   // Смещение битовой карты блоков данных от начала файла
     uint32_t inode_table;    // Смещение таблицы inode от начала файла
     uint32_t data_start;     // Смещение начала области хранения данных
+    uint32_t journal_start;  // Смещение журнала метаданных (0 — журнала нет, образ старого формата)
+    uint32_t journal_size;   // Размер журнала в байтах
+    uint32_t journal_seq;    // Номер первой транзакции журнала, которая может быть не перенесена на место
+    uint32_t generation;     // Счётчик изменений суперблока и битовых карт (совместный доступ, см. myfs_options.shared)
+    uint32_t name_generation; // Счётчик созданий и удалений файлов (совместный доступ)
+    uint32_t version;        // Версия разметки, MYFS_VERSION (в образах v1 поля нет — читается 0)
+    uint32_t name_table;     // Смещение области имён
+    uint32_t flags;          // Свойства образа, MYFS_SB_* (в ранних образах — 0)
 } SuperBlock;
 
+#define MYFS_SB_COMPRESS 0x1    // Данные файлов сжимаются при записи (см. «Сжатие данных»)
+
+// Версия разметки. v1 хранила имя (256 байт) внутри 320-байтной записи inode,
+// а её таблица на образах по умолчанию заходила в область данных. В v2 запись
+// inode — 64 байта, имена вынесены в отдельную область; образ v1 переносится
+// в v2 функцией myfs_convert_v1.
+#define MYFS_VERSION 2
+
+// Журнал метаданных размещается сразу за областью данных. Размер — не меньше
+// JOURNAL_SIZE и не меньше четырёх копий обеих битовых карт (при фиксации они
+// пишутся в журнал целиком), с округлением до блока.
+#define JOURNAL_SIZE (1024 * 1024)
+
 // -----------------------------
 // Структура inode (информация о каждом файле)
 // -----------------------------
 
+// Запись таблицы inode: 64 байта без неявного выравнивания, поэтому таблица,
+// начинающаяся с границы блока, укладывает каждую запись ровно в одну строку
+// кэша. Имя файла (последний компонент пути) хранится в области имён, в
+// ячейке с тем же номером, каталог, в котором лежит файл, — в blocks[INODE_PARENT].
 typedef struct {
     uint32_t size;           // Размер файла (в байтах)
-    time_t mtime;          // Время последнего изменения файла (Unix-время)
-    uint32_t blocks[12];     // Массив номеров блоков, в которых хранятся данные файла (прямая адресация)
-    char name[256];          // Имя файла 
+    uint32_t flags;          // Флаги INODE_FLAG_*
+    int64_t mtime;           // Время последнего изменения файла (Unix-время)
+    uint32_t blocks[12];     // Номера блоков (прямая адресация) или карта экстентов, см. INODE_FLAG_EXTENTS
 } Inode;
 
+_Static_assert(sizeof(Inode) == 64, "запись inode должна занимать 64 байта");
+
+// Ячейка области имён: имя до 255 символов и завершающий '\0'
+#define MYFS_NAME_SLOT 256
+
+// -----------------------------
+// Каталоги
+// -----------------------------
+
+// Каталог — inode с флагом INODE_FLAG_DIR без блоков данных. Пути разделяются
+// '/', корневой каталог не занимает inode. Записи каталогов хранятся не в его
+// блоках, а в области имён: ячейка inode — имя, blocks[INODE_PARENT] — номер
+// родительского каталога плюс 1 (0 — корень). При монтировании по ним строится
+// хеш-индекс «(каталог, имя) -> inode» и списки записей каждого каталога:
+// разбор пути — один поиск в хеше на компонент, а обход каталога касается
+// только его записей, сколько бы файлов ни было в других каталогах.
+// Файлы старого формата (без INODE_FLAG_EXTENTS) всегда лежат в корне.
+
+// -----------------------------
+// Экстентная адресация данных
+// -----------------------------
+
+// Отрезок подряд идущих блоков данных
+typedef struct {
+    uint32_t start;          // Первый блок отрезка
+    uint32_t len;            // Количество блоков (0 — запись не используется)
+} Extent;
+
+#define INODE_FLAG_EXTENTS 0x1  // blocks[] содержит карту экстентов вместо прямых номеров блоков
+#define INODE_FLAG_DIR     0x2  // Каталог (см. раздел «Каталоги»)
+#define INODE_FLAG_INLINE  0x4  // Данные хранятся прямо в inode (см. MYFS_INLINE_MAX)
+#define INODE_FLAG_COMPRESSED 0x8  // Данные хранятся сжатыми кластерами (см. MYFS_CLUSTER_SIZE)
+
+// Раскладка blocks[] при INODE_FLAG_EXTENTS:
+//   blocks[0..7] — INODE_INLINE_EXTENTS экстентов прямо в inode;
+//   blocks[8]    — косвенный блок: массив EXTENTS_PER_BLOCK экстентов;
+//   blocks[9]    — двойной косвенный блок: POINTERS_PER_BLOCK номеров блоков с экстентами;
+//   blocks[10]   — родительский каталог (INODE_PARENT);
+//   blocks[11]   зарезервирован.
+#define INODE_INLINE_EXTENTS 4
+#define INODE_EXTENT_IND     8
+#define INODE_EXTENT_DIND    9
+#define INODE_PARENT         10
+
+// Встроенные данные: файл не длиннее MYFS_INLINE_MAX байт хранится прямо в
+// blocks[0..INODE_PARENT - 1] с флагом INODE_FLAG_INLINE (вместе с
+// INODE_FLAG_EXTENTS) и не занимает блоков данных; байты за концом файла там
+// нулевые. Новый файл создаётся без блоков: они выделяются при первой записи,
+// которая не помещается в inode, и данные переносятся в блоки.
+#define MYFS_INLINE_MAX (INODE_PARENT * sizeof(uint32_t))
+
+// Сжатые данные (INODE_FLAG_COMPRESSED вместе с INODE_FLAG_EXTENTS): файл
+// делится на кластеры по MYFS_CLUSTER_SIZE байт (последний — короче), и
+// каждый кластер сжимается независимо, поэтому чтение из середины файла
+// распаковывает только свои кластеры. Карта экстентов описывает поток
+// блоков: кластеры подряд, каждый с границы блока, а в последних байтах
+// последнего блока — таблица кластеров, по uint32_t на кластер: длина
+// кластера в потоке, старший бит (MYFS_CLUSTER_RAW) — кластер не сжат.
+// Таблица может делить блок с последним кластером. Размер inode — размер
+// несжатых данных. Сжатый кластер хранится, только если он хотя бы на блок
+// короче исходного; в сжатом кластере за данными кодека могут идти нули.
+// Формат кодека — последовательности LZ77: байт-признак (старшие 4 бита —
+// число литералов, младшие — длина совпадения минус 4, значение 15 продолжается
+// байтами до первого меньшего 255), литералы, смещение совпадения (2 байта,
+// little-endian) и продолжение длины совпадения. Последняя последовательность
+// состоит из одних литералов.
+#define MYFS_CLUSTER_SIZE (64 * 1024)
+#define MYFS_CLUSTER_RAW  0x80000000u
+#define EXTENTS_PER_BLOCK(block_size)  ((block_size) / sizeof(Extent))
+#define POINTERS_PER_BLOCK(block_size) ((block_size) / sizeof(uint32_t))
+
+// -----------------------------
+// Дескриптор смонтированной файловой системы
+// -----------------------------
+
+// Суперблок и битовые карты загружаются один раз при open_fs и живут в памяти;
+// на диск записываются только изменённые структуры (sync_fs / close_fs).
+// В режиме stdio изменения метаданных сначала попадают в журнал: несколько
+// операций фиксируются одной транзакцией с одним fsync (групповая фиксация),
+// после сбоя зафиксированные транзакции повторяются при открытии образа.
+// Содержимое структуры скрыто в myfs.c.
+typedef struct myfs myfs_t;
+
+// Способ доступа к образу ФС, выбираемый при открытии
+typedef enum {
+    MYFS_BACKEND_STDIO = 0,  // Буферизованный ввод-вывод stdio (fseek/fread/fwrite)
+    MYFS_BACKEND_MMAP        // Образ отображается в память: метаданные и данные читаются на месте,
+                             // долговечность обеспечивается msync изменённых диапазонов
+} myfs_backend;
+
+// Исполнитель запросов к блокам данных (см. «Исполнитель ввода-вывода» ниже)
+typedef enum {
+    MYFS_IO_SYNC = 0,        // Отрезки операции читаются и пишутся по очереди (pread/pwrite)
+    MYFS_IO_URING,           // Все отрезки операции — одним пакетом io_uring; если ядро не даёт
+                             // io_uring (и в режиме mmap), работает как MYFS_IO_THREADS
+    MYFS_IO_THREADS          // Отрезки операции выполняются параллельно пулом потоков
+} myfs_io_engine;
+
+// Параметры монтирования (нулевая структура — значения по умолчанию)
+typedef struct {
+    myfs_backend backend;        // Способ доступа к образу
+    uint32_t commit_latency_us;  // Сколько изменения метаданных могут ждать групповой фиксации
+                                 // (0 — MYFS_DEFAULT_COMMIT_LATENCY_US)
+    bool sync_each_op;           // Фиксировать журнал с fsync после каждой операции
+    int32_t cache_blocks;        // Размер буферного кэша в блоках (0 — MYFS_DEFAULT_CACHE_BLOCKS,
+                                 // меньше 0 — без кэша; в режиме mmap кэш не используется)
+    bool thread_safe;            // Разрешить вызовы из нескольких потоков (см. ниже)
+    bool shared;                 // Образ одновременно открыт несколькими процессами (см. ниже)
+    myfs_io_engine io_engine;    // Исполнитель запросов к данным (не MYFS_IO_SYNC включает thread_safe)
+    uint32_t io_threads;         // Потоков пула исполнителя (0 — MYFS_DEFAULT_IO_THREADS)
+    int32_t readahead_blocks;    // Наибольшее окно упреждающего чтения в блоках
+                                 // (0 — MYFS_DEFAULT_READAHEAD_BLOCKS, меньше 0 — выключено)
+    bool compress;               // Сжимать данные файлов при записи (см. «Сжатие данных»)
+} myfs_options;
+
+// Потокобезопасный режим (thread_safe): функции ФС можно вызывать из разных
+// потоков одновременно. Чтения одного файла идут параллельно, изменения файла
+// исключают друг друга и чтения этого файла; разные файлы пишутся параллельно.
+// Образ в режиме stdio читается и пишется через pread/pwrite. Ограничения:
+//   - дескриптор myfs_file_t используется одним потоком за раз;
+//   - обработчик myfs_read_stream не должен изменять читаемый файл;
+//   - close_fs вызывается, когда остальные потоки закончили работу с ФС.
+//
+// Совместный доступ (shared): один образ одновременно открывают несколько
+// процессов, каждый со своим shared-дескриптором. Доступ согласуется
+// блокировками fcntl на участки образа: запись inode в таблице блокирует
+// только свой файл, суперблок и битовые карты блокируются лишь на время
+// выделения и освобождения. Процессы, работающие с разными файлами, не ждут
+// друг друга. Изменения метаданных сразу пишутся на место — журнал и кэш
+// блоков в этом режиме не используются. Все процессы должны открывать образ
+// в режиме shared; совмещение с thread_safe не поддерживается.
+//
+// Исполнитель ввода-вывода (io_engine): если операция затрагивает несколько
+// экстентов файла, их запросы отправляются одним пакетом — в io_uring (один
+// системный вызов на пакет) или параллельно потокам пула — вместо
+// последовательных pread/pwrite. Пакет идёт мимо буферного кэша, как крупные
+// запросы. С исполнителем работают асинхронные чтения (myfs_pread_async).
+// Режим включает thread_safe и несовместим с shared.
+//
+// Упреждающее чтение: дескриптор myfs_file_t и myfs_read_stream замечают
+// последовательное чтение (очередной запрос начинается там, где кончился
+// предыдущий) и заранее просят ядро подгрузить следующие блоки файла
+// (posix_fadvise WILLNEED, в режиме mmap — madvise), не дожидаясь их.
+// Подсказки нужны на стыках экстентов: внутри экстента запросы к образу идут
+// подряд, и там ядро читает вперёд само.
+// Окно начинается с нескольких блоков и удваивается, пока чтение остаётся
+// последовательным, до readahead_blocks; следующее окно запрашивается, когда
+// чтение дошло до второй половины предыдущего. Переход на другое место файла
+// сбрасывает окно. myfs_pread без дескриптора упреждающего чтения не делает.
+
+#define MYFS_DEFAULT_COMMIT_LATENCY_US 10000
+#define MYFS_DEFAULT_CACHE_BLOCKS 1024
+#define MYFS_DEFAULT_IO_THREADS 4
+#define MYFS_DEFAULT_READAHEAD_BLOCKS 256
+
+// Счётчики буферного кэша блоков
+typedef struct {
+    uint64_t hits;           // Блок найден в кэше
+    uint64_t misses;         // Блок пришлось читать из образа (или занять кадр под запись)
+    uint64_t evictions;      // Кадр вытеснен под другой блок
+    uint64_t writebacks;     // Изменённый кадр записан в образ
+    uint32_t capacity;       // Всего кадров
+    uint32_t used;           // Кадров занято
+} myfs_cache_stats;
+
+// -----------------------------
+// Статистика операций
+// -----------------------------
+
+// Публичные операции, по которым ведётся статистика. myfs_read и myfs_write
+// учитываются как MYFS_OP_PREAD и MYFS_OP_PWRITE; вызовы, сделанные изнутри
+// другой операции (myfs_open внутри write_file1 и т. п.), отдельно не
+// считаются. format_fs и close_fs выполняются без смонтированной ФС и в
+// статистику не попадают.
+typedef enum {
+    MYFS_OP_OPEN_FS,
+    MYFS_OP_SYNC,
+    MYFS_OP_CREATE,
+    MYFS_OP_DELETE,
+    MYFS_OP_LIST,
+    MYFS_OP_LOOKUP,
+    MYFS_OP_WRITE_FILE,
+    MYFS_OP_WRITE_FILE1,
+    MYFS_OP_READ_FILE,
+    MYFS_OP_PREAD,
+    MYFS_OP_READ_STREAM,
+    MYFS_OP_OPEN,
+    MYFS_OP_CLOSE,
+    MYFS_OP_PWRITE,
+    MYFS_OP_TRUNCATE,
+    MYFS_OP_APPEND,
+    MYFS_OP_NEXT_FILE,
+    MYFS_OP_IMPORT,
+    MYFS_OP_EXPORT,
+    MYFS_OP_BATCH_COMMIT,
+    MYFS_OP_MKDIR,
+    MYFS_OP_RMDIR,
+    MYFS_OP_LIST_DIR,
+    MYFS_OP_SET_COMPRESSED,
+    MYFS_OP_COUNT
+} myfs_op;
+
+#define MYFS_STATS_BUCKETS 32   // Корзины гистограммы задержек
+
+// Счётчики одной операции
+typedef struct {
+    uint64_t calls;          // Вызовов
+    uint64_t errors;         // Из них завершились ошибкой
+    uint64_t total_ns;       // Суммарное время
+    uint64_t hist[MYFS_STATS_BUCKETS];  // hist[i] — вызовы длительностью [2^i, 2^(i+1)) нс,
+                                        // в последней корзине — и все более долгие
+} myfs_op_stats;
+
+// Статистика смонтированной ФС с момента open_fs (или myfs_reset_stats).
+// Запросы к образу делятся по области: данные — блоки данных, метаданные —
+// суперблок, битовые карты, таблица inode и журнал.
+typedef struct {
+    myfs_op_stats ops[MYFS_OP_COUNT];
+    uint64_t bytes_read;         // Прочитано из образа, байт (включая попадания в кэш)
+    uint64_t bytes_written;      // Записано в образ, байт
+    uint64_t data_reads;         // Запросов чтения области данных
+    uint64_t data_writes;        // Запросов записи области данных
+    uint64_t meta_reads;         // Запросов чтения метаданных
+    uint64_t meta_writes;        // Запросов записи метаданных
+    uint64_t image_reads;        // Вызовов fread/pread файла образа (mmap — 0)
+    uint64_t image_writes;       // Вызовов fwrite/pwrite файла образа
+    uint64_t image_seeks;        // Вызовов fseek
+    uint64_t image_syncs;        // Вызовов fdatasync/msync
+    uint64_t blocks_allocated;   // Выделено блоков данных
+    uint64_t blocks_freed;       // Освобождено блоков данных
+    uint64_t alloc_calls;        // Поисков свободного отрезка блоков
+    uint64_t alloc_scanned;      // Просмотрено позиций карты блоков при этих поисках
+    uint64_t ra_sequential;      // Чтений, распознанных как последовательные
+    uint64_t ra_resets;          // Сбросов окна из-за перехода на другое место файла
+    uint64_t ra_windows;         // Запрошено окон упреждающего чтения
+    uint64_t ra_bytes;           // Байт в этих окнах (средний размер окна — ra_bytes / ra_windows)
+    uint64_t ra_hinted;          // Из них подсказано ядру: кроме продолжения читаемого экстента
+    uint64_t ra_hit_bytes;       // Прочитано байт, уже запрошенных упреждающим чтением
+    uint64_t comp_clusters;      // Кластеров записано сжатыми
+    uint64_t comp_raw_clusters;  // Кластеров записано несжатыми (сжатие не сэкономило бы блок)
+    uint64_t comp_bytes_in;      // Байт данных в записанных кластерах
+    uint64_t comp_bytes_out;     // Байт, которые эти кластеры заняли в образе
+    uint64_t decomp_clusters;    // Сжатых кластеров распаковано при чтении
+} myfs_stats;
+
+// Параметры форматирования (нулевая структура — значения по умолчанию)
+typedef struct {
+    bool preallocate;        // Зарезервировать место под весь образ (fallocate) вместо разреженного файла
+    uint32_t block_size;     // Размер блока: степень двойки от MYFS_MIN_BLOCK_SIZE до MYFS_MAX_BLOCK_SIZE
+                             // (0 — BLOCK_SIZE)
+    uint32_t inode_count;    // Количество inode, кратно 8 (0 — INODE_COUNT)
+    uint32_t block_count;    // Количество блоков данных, кратно 8 (0 — BLOCK_COUNT)
+    bool compress;           // Сжимать данные файлов в этом образе при любом монтировании (MYFS_SB_COMPRESS)
+} myfs_format_options;
+
 // -----------------------------
 // Объявления основных функций работы с ФС
 // -----------------------------
 
 bool format_fs(const char* filename);                           // Форматирует (инициализирует) файловую систему
-FILE* open_fs(const char* filename);                           // Открывает файл с образом файловой системы
-void close_fs(FILE* fs);                                       // Закрывает файловую систему
+bool format_fs_ex(const char* filename, const myfs_format_options* opts);  // То же с параметрами форматирования
+myfs_t* open_fs(const char* filename);                         // Открывает образ ФС и загружает метаданные в память
+myfs_t* open_fs_ex(const char* filename, const myfs_options* opts);  // То же с параметрами монтирования
+bool myfs_convert_v1(const char* src, const char* dst);        // Переносит образ v1 в новый образ v2
+bool sync_fs(myfs_t* fs);                                      // Фиксирует изменения метаданных на диске (fsync)
+void close_fs(myfs_t* fs);                                     // Синхронизирует и закрывает файловую систему
+bool myfs_get_cache_stats(myfs_t* fs, myfs_cache_stats* stats); // Счётчики буферного кэша блоков
+bool myfs_get_stats(myfs_t* fs, myfs_stats* stats);            // Статистика операций (сумма по потокам)
+void myfs_reset_stats(myfs_t* fs);                             // Обнуляет статистику операций
+const char* myfs_op_name(myfs_op op);                          // Имя операции ("create_file", ...)
+
+// Имена файлов — пути от корня через '/' ("logs/2024/app.log"); каталоги пути
+// должны существовать. Каждый компонент — до 255 символов.
+int create_file(myfs_t* fs, const char* name);                 // Создаёт новый файл
+bool delete_file(myfs_t* fs, const char* name);                // Удаляет файл
+void list_files(myfs_t* fs);                                   // Выводит список файлов
+int lookup_file(myfs_t* fs, const char* name);                 // Возвращает номер inode файла или каталога, или -1
+
+int write_file(myfs_t* fs, const char* filename, const char* data);   // Записывает данные в файл (реализация 1)
+int write_file1(myfs_t* fs, const char* filename, const char* data);  // Альтернативная реализация записи
+
+int read_file(myfs_t* fs, const char* filename, char* buffer, size_t max_size);  // Считывает содержимое файла
+
+// Позиционное чтение: до len байт файла с номером inode ino начиная с offset.
+// Возвращает число прочитанных байт (0 — за концом файла) или -1 при ошибке.
+ssize_t myfs_pread(myfs_t* fs, int ino, void* buf, size_t len, uint64_t offset);
+
+// Обработчик потокового чтения: получает очередной фрагмент файла и его смещение.
+// Данные действительны только во время вызова. Возврат false прерывает чтение.
+typedef bool (*myfs_read_cb)(const void* data, size_t len, uint64_t offset, void* ctx);
+
+// Потоковое чтение файла с offset до конца фрагментами не больше MYFS_STREAM_CHUNK,
+// без буфера под весь файл. Возвращает false при ошибке или прерывании обработчиком.
+#define MYFS_STREAM_CHUNK (64 * 1024)
+bool myfs_read_stream(myfs_t* fs, int ino, uint64_t offset, myfs_read_cb cb, void* ctx);
+
+// Асинхронное чтение (только с исполнителем ввода-вывода, io_engine != MYFS_IO_SYNC):
+// myfs_pread_async ставит чтение в очередь пула и сразу возвращается, buf должен
+// жить до завершения. Завершения копятся в ФС: myfs_aio_fd — eventfd, который
+// становится читаемым, когда они есть (для poll/epoll цикла событий), а
+// myfs_aio_poll вызывает их обработчики в вызывающем потоке. Перед close_fs
+// дождитесь всех завершений: необработанные отбрасываются без вызова.
+// Обработчик получает число прочитанных байт или -errno.
+typedef void (*myfs_aio_cb)(ssize_t result, void* ctx);
+bool myfs_pread_async(myfs_t* fs, int ino, void* buf, size_t len, uint64_t offset,
+                      myfs_aio_cb cb, void* ctx);
+int myfs_aio_fd(myfs_t* fs);                   // eventfd завершений или -1 без исполнителя
+int myfs_aio_poll(myfs_t* fs, bool wait);      // Обрабатывает завершения (wait — ждать хотя бы
+                                               // одного, если есть чтения в полёте); число или -1
+myfs_io_engine myfs_get_io_engine(myfs_t* fs); // Фактический исполнитель (с учётом замены io_uring)
+
+// -----------------------------
+// Дескрипторы открытых файлов (двоичные данные, позиционная запись)
+// -----------------------------
+
+typedef struct myfs_file myfs_file_t;
+
+#define MYFS_O_CREAT 0x1        // Создать файл, если его нет
+#define MYFS_O_TRUNC 0x2        // Обрезать файл до нулевой длины
+
+myfs_file_t* myfs_open(myfs_t* fs, const char* name, int flags);           // Открывает файл по имени
+bool myfs_close(myfs_file_t* f);                                           // Закрывает, записывая отложенные изменения
+int myfs_file_ino(const myfs_file_t* f);                                   // Номер inode открытого файла
+uint64_t myfs_file_size(myfs_file_t* f);                                   // Текущий размер файла
+ssize_t myfs_pwrite(myfs_file_t* f, const void* buf, size_t len, uint64_t offset);  // Запись с позиции offset
+ssize_t myfs_write(myfs_file_t* f, const void* buf, size_t len);           // Запись с текущей позиции
+ssize_t myfs_read(myfs_file_t* f, void* buf, size_t len);                  // Чтение с текущей позиции
+int64_t myfs_seek(myfs_file_t* f, int64_t offset, int whence);             // Перемещает позицию (SEEK_SET/CUR/END)
+bool myfs_truncate(myfs_file_t* f, uint64_t size);                         // Устанавливает размер файла
+
+#define MYFS_APPEND_SEPARATOR 0x1  // Вставлять "\n" перед данными, если файл не пуст (как write_file1)
+
+ssize_t myfs_append(myfs_file_t* f, const void* buf, size_t len, int flags);  // Дозапись в конец файла
 
-int create_file(FILE* fs, const char* name);                   // Создаёт новый файл
-bool delete_file(FILE* fs, const char* name);                  // Удаляет файл
-void list_files(FILE* fs);                                     // Выводит список файлов
+// Перечисление файлов: номер inode следующего после ino файла (ino = -1 — первого)
+// и его полный путь в name; каталоги пропускаются; -1 — файлов больше нет
+int myfs_next_file(myfs_t* fs, int ino, char* name, size_t size);
+
+// -----------------------------
+// Сжатие данных
+// -----------------------------
+
+// Сжатие включается для всего образа (myfs_format_options.compress — навсегда,
+// myfs_options.compress — на время монтирования) или для отдельного файла
+// (myfs_set_compressed). В режиме образа сжатым становится каждый файл, в
+// который что-то записывается; сжатый файл остаётся сжатым при любых
+// изменениях. Дозапись и запись в конец файла перепаковывают только
+// последний кластер, запись в середину — кластер на месте, если он
+// помещается в прежние блоки, иначе все кластеры от него до конца файла.
+// Чтение распаковывает кластеры прямо в буфер вызывающего, если кластер
+// нужен целиком. Файл до MYFS_INLINE_MAX байт хранится в inode несжатым.
+bool myfs_set_compressed(myfs_t* fs, const char* name, bool on);  // Сжимает файл или распаковывает его
+                                                                   // (распаковать нельзя при сжатии образа)
+
+// -----------------------------
+// Каталоги
+// -----------------------------
+
+int myfs_mkdir(myfs_t* fs, const char* path);                  // Создаёт каталог, возвращает номер inode или -1
+bool myfs_rmdir(myfs_t* fs, const char* path);                 // Удаляет пустой каталог
+
+// Запись каталога, передаваемая обработчику myfs_list_dir
+typedef struct {
+    const char* name;        // Имя внутри каталога (действительно только во время вызова)
+    int ino;                 // Номер inode
+    bool is_dir;             // Запись — каталог
+    uint64_t size;           // Размер файла (у каталога — 0)
+    int64_t mtime;           // Время изменения
+} myfs_dirent;
+
+// Обработчик обхода каталога. Возврат false прерывает обход. Вызывается под
+// блокировкой метаданных: функции ФС из него вызывать нельзя.
+typedef bool (*myfs_dir_cb)(const myfs_dirent* entry, void* ctx);
+
+// Обходит записи каталога path ("" или "/" — корень) в произвольном порядке.
+// Возвращает false, если каталога нет, при ошибке или прерывании обработчиком.
+bool myfs_list_dir(myfs_t* fs, const char* path, myfs_dir_cb cb, void* ctx);
+
+// -----------------------------
+// Перенос данных между файлами хоста и образом
+// -----------------------------
+
+// Данные копируются по экстентам прямо между дескрипторами (copy_file_range,
+// без буфера в процессе; если ядро или ФС хоста не умеют — через буфер).
+// Позиция дескриптора хоста не меняется: перенос идёт с начала файла хоста.
+bool myfs_import_fd(myfs_file_t* f, int fd, uint64_t len);   // Заменяет содержимое файла len байтами из fd
+ssize_t myfs_export_fd(myfs_t* fs, int ino, int fd);         // Пишет файл целиком в fd, возвращает число байт
+
+// -----------------------------
+// Пакеты изменений: массовое создание, запись и удаление файлов
+// -----------------------------
 
-int write_file(FILE* fs, const char* filename, const char* data);     // Записывает данные в файл (реализация 1)
-int write_file1(FILE* fs, const char* filename, const char* data);    // Альтернативная реализация записи
+// Операции пакета только запоминаются (данные копируются) и применяются по
+// порядку в myfs_batch_commit одной транзакцией: либо все, либо ни одна.
+// Запись заменяет содержимое файла целиком; файл должен существовать или
+// создаваться раньше в том же пакете. Новое содержимое пишется в свободные
+// блоки, поэтому на время фиксации места нужно и под старые, и под новые
+// данные. В режиме mmap журнала нет: при ошибке пакет откатывается целиком,
+// но сбой посреди фиксации может оставить её незавершённой. В режиме shared
+// пакеты не поддерживаются.
+typedef struct myfs_batch myfs_batch_t;
 
-int read_file(FILE* fs, const char* filename, char* buffer, size_t max_size);  // Считывает содержимое файла
+myfs_batch_t* myfs_batch_begin(myfs_t* fs);                                  // Начинает пустой пакет
+bool myfs_batch_create(myfs_batch_t* b, const char* name);                   // Создание файла
+bool myfs_batch_write(myfs_batch_t* b, const char* name, const void* data, size_t len);  // Замена содержимого
+bool myfs_batch_delete(myfs_batch_t* b, const char* name);                   // Удаление файла
+bool myfs_batch_commit(myfs_batch_t* b);                                     // Применяет пакет и освобождает его
+void myfs_batch_abort(myfs_batch_t* b);                                      // Освобождает пакет, ничего не применяя
 
 #endif
 
@@ -0,0 +1,473 @@
+// -----------------------------------------------------------------------------
+// Утилита командной строки MYFS: загрузка каталога хоста в образ, выгрузка
+// образа в каталог хоста и статистика операций
+// Сборка: make myfs
+// Запуск: ./myfs [-j потоков] [-m] [-s] [-z] [-b блок] [-i inode] [-n блоков] <образ> import <каталог>
+//         ./myfs [-j потоков] [-m] [-s] <образ> export <каталог>
+//         ./myfs [-j потоков] [-m] <образ> stats
+//         ./myfs <образ v1> convert <новый образ v2>
+//   -j N  число рабочих потоков (по умолчанию — по числу процессоров, до 16)
+//   -m    открыть образ в режиме mmap
+//   -s    после команды вывести статистику операций (JSON) в stderr
+//   -z    сжимать данные файлов: новый образ форматируется со сжатием,
+//         существующий сжимает записываемые файлы до размонтирования
+//   -b, -i, -n  размер блока, число inode и число блоков данных для
+//         форматирования нового образа (по умолчанию — значения myfs.h)
+// stats читает все файлы образа и выводит статистику операций в stdout в виде
+// одного объекта JSON — для сбора системой мониторинга.
+// Файлы каталога хоста становятся файлами ФС с путями относительно каталога,
+// подкаталоги — каталогами ФС; при выгрузке подкаталоги создаются заново.
+// Образ, которого ещё нет, при загрузке форматируется.
+// convert переносит образ старой разметки v1 в новый образ v2 (myfs_convert_v1).
+// -----------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "myfs.h"
+
+#define MAX_JOBS 16
+
+// Файл, который переносит рабочий поток
+typedef struct {
+    char* name;              // Имя в ФС (путь относительно каталога хоста)
+    int ino;                 // Номер inode (выгрузка)
+} ToolFile;
+
+// Общее состояние переноса: очередь файлов и счётчики
+typedef struct {
+    myfs_t* fs;
+    const char* dir;         // Каталог хоста
+    ToolFile* files;
+    size_t count, cap;
+    atomic_size_t next;      // Следующий файл очереди
+    atomic_size_t done;      // Перенесено файлов
+    atomic_size_t failed;    // Файлов с ошибкой
+    atomic_uint_fast64_t bytes;
+} ToolJob;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool job_add(ToolJob* job, const char* name, int ino) {
+    if (job->count == job->cap) {
+        size_t cap = job->cap ? job->cap * 2 : 256;
+        ToolFile* files = realloc(job->files, cap * sizeof(ToolFile));
+        if (!files) return false;
+        job->files = files;
+        job->cap = cap;
+    }
+    job->files[job->count].name = strdup(name);
+    job->files[job->count].ino = ino;
+    if (!job->files[job->count].name) return false;
+    job->count++;
+    return true;
+}
+
+static void job_free(ToolJob* job) {
+    for (size_t i = 0; i < job->count; i++) free(job->files[i].name);
+    free(job->files);
+}
+
+// Путь к файлу хоста: каталог + имя в ФС
+static bool host_path(const ToolJob* job, const char* name, char* path, size_t size) {
+    return (size_t)snprintf(path, size, "%s/%s", job->dir, name) < size;
+}
+
+// Запускает jobs потоков worker над очередью и ждёт их завершения
+static bool run_pool(ToolJob* job, int jobs, void* (*worker)(void*)) {
+    pthread_t tid[MAX_JOBS];
+    int started = 0;
+    for (; started < jobs; started++) {
+        if (pthread_create(&tid[started], NULL, worker, job) != 0) break;
+    }
+    // Без единого потока очередь разбирает вызывающий
+    if (started == 0) worker(job);
+    for (int i = 0; i < started; i++) pthread_join(tid[i], NULL);
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// import: каталог хоста -> образ
+// -----------------------------------------------------------------------------
+
+static ToolJob* walk_job;       // Для обработчика nftw
+static size_t walk_root_len;
+
+// Каталоги создаются в ФС сразу при обходе (nftw заходит в каталог раньше,
+// чем в его содержимое), файлы ставятся в очередь
+static int collect_file(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+    (void)st;
+    if (type != FTW_F && type != FTW_D) return 0;
+    const char* name = path + walk_root_len;
+    while (*name == '/') name++;
+    if (name[0] == '\0') return 0;  // Сам каталог хоста — корень ФС
+    if (strlen(path + ftw->base) >= 256) {
+        fprintf(stderr, "Пропущен '%s': имя длиннее 255 символов\n", name);
+        walk_job->failed++;
+        return 0;
+    }
+    if (type == FTW_D) {
+        if (lookup_file(walk_job->fs, name) < 0 && myfs_mkdir(walk_job->fs, name) < 0) walk_job->failed++;
+        return 0;
+    }
+    return job_add(walk_job, name, -1) ? 0 : -1;
+}
+
+static void* import_worker(void* arg) {
+    ToolJob* job = arg;
+    char path[4096];
+    size_t i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->count) {
+        const char* name = job->files[i].name;
+        bool ok = false;
+        int fd = host_path(job, name, path, sizeof(path)) ? open(path, O_RDONLY) : -1;
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            fprintf(stderr, "Ошибка открытия '%s': %s\n", path, strerror(errno));
+        } else {
+            myfs_file_t* f = myfs_open(job->fs, name, MYFS_O_CREAT | MYFS_O_TRUNC);
+            ok = f && myfs_import_fd(f, fd, (uint64_t)st.st_size);
+            if (f && !myfs_close(f)) ok = false;
+            if (ok) atomic_fetch_add(&job->bytes, (uint64_t)st.st_size);
+        }
+        if (fd >= 0) close(fd);
+        atomic_fetch_add(ok ? &job->done : &job->failed, 1);
+    }
+    return NULL;
+}
+
+static bool cmd_import(ToolJob* job, int jobs) {
+    walk_job = job;
+    walk_root_len = strlen(job->dir);
+    if (nftw(job->dir, collect_file, 64, FTW_PHYS) != 0) {
+        perror("Ошибка обхода каталога");
+        return false;
+    }
+    return run_pool(job, jobs, import_worker);
+}
+
+// -----------------------------------------------------------------------------
+// export: образ -> каталог хоста
+// -----------------------------------------------------------------------------
+
+// Имя из ФС не должно выводить за пределы каталога хоста
+static bool safe_name(const char* name) {
+    if (name[0] == '\0' || name[0] == '/') return false;
+    for (const char* p = name; *p; ) {
+        size_t len = strcspn(p, "/");
+        if (len == 0 || (len == 1 && p[0] == '.') || (len == 2 && p[0] == '.' && p[1] == '.')) return false;
+        p += len;
+        if (*p == '/') p++;
+    }
+    return true;
+}
+
+// Создаёт подкаталоги пути к файлу (как mkdir -p для dirname)
+static bool make_parents(char* path, size_t root_len) {
+    for (char* p = path + root_len + 1; (p = strchr(p, '/')) != NULL; p++) {
+        *p = '\0';
+        bool ok = mkdir(path, 0755) == 0 || errno == EEXIST;
+        *p = '/';
+        if (!ok) return false;
+    }
+    return true;
+}
+
+static void* export_worker(void* arg) {
+    ToolJob* job = arg;
+    char path[4096];
+    size_t i;
+    size_t root_len = strlen(job->dir);
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->count) {
+        const ToolFile* file = &job->files[i];
+        bool ok = false;
+        int fd = -1;
+        if (!safe_name(file->name)) {
+            fprintf(stderr, "Пропущен файл с недопустимым именем '%s'\n", file->name);
+        } else if (!host_path(job, file->name, path, sizeof(path)) || !make_parents(path, root_len) ||
+                   (fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+            fprintf(stderr, "Ошибка создания '%s': %s\n", path, strerror(errno));
+        } else {
+            ssize_t n = myfs_export_fd(job->fs, file->ino, fd);
+            ok = n >= 0;
+            if (ok) atomic_fetch_add(&job->bytes, (uint64_t)n);
+        }
+        if (fd >= 0 && close(fd) != 0) ok = false;
+        atomic_fetch_add(ok ? &job->done : &job->failed, 1);
+    }
+    return NULL;
+}
+
+// Записи одного каталога ФС при обходе для выгрузки
+typedef struct {
+    ToolJob* job;
+    const char* prefix;      // Путь каталога ("" — корень)
+    char** dirs;             // Пути подкаталогов
+    size_t ndirs, cap;
+    bool ok;
+} ExportDir;
+
+// Обработчик myfs_list_dir: файлы — в очередь, подкаталоги — в список.
+// Функции ФС отсюда вызывать нельзя, поэтому подкаталоги обходятся потом
+static bool collect_entry(const myfs_dirent* e, void* ctx) {
+    ExportDir* d = ctx;
+    char path[4096];
+    if ((size_t)snprintf(path, sizeof(path), "%s%s%s", d->prefix, d->prefix[0] ? "/" : "", e->name) >= sizeof(path)) {
+        fprintf(stderr, "Пропущен '%s/%s': слишком длинный путь\n", d->prefix, e->name);
+        d->job->failed++;
+        return true;
+    }
+    if (!e->is_dir) {
+        d->ok = job_add(d->job, path, e->ino);
+        return d->ok;
+    }
+    if (d->ndirs == d->cap) {
+        size_t cap = d->cap ? d->cap * 2 : 16;
+        char** dirs = realloc(d->dirs, cap * sizeof(char*));
+        if (!dirs) return d->ok = false;
+        d->dirs = dirs;
+        d->cap = cap;
+    }
+    d->dirs[d->ndirs] = strdup(path);
+    d->ok = d->dirs[d->ndirs] != NULL;
+    if (d->ok) d->ndirs++;
+    return d->ok;
+}
+
+// Обходит каталог prefix: создаёт его подкаталоги на хосте (и пустые тоже),
+// файлы ставит в очередь
+static bool collect_dir(ToolJob* job, const char* prefix) {
+    ExportDir d = {.job = job, .prefix = prefix, .ok = true};
+    bool ok = myfs_list_dir(job->fs, prefix, collect_entry, &d) && d.ok;
+    char path[4096];
+    for (size_t i = 0; i < d.ndirs; i++) {
+        if (ok && !safe_name(d.dirs[i])) {
+            fprintf(stderr, "Пропущен каталог с недопустимым именем '%s'\n", d.dirs[i]);
+        } else if (ok && (!host_path(job, d.dirs[i], path, sizeof(path)) ||
+                          (mkdir(path, 0755) != 0 && errno != EEXIST))) {
+            fprintf(stderr, "Ошибка создания '%s': %s\n", path, strerror(errno));
+            job->failed++;
+        } else if (ok) {
+            ok = collect_dir(job, d.dirs[i]);
+        }
+        free(d.dirs[i]);
+    }
+    free(d.dirs);
+    return ok;
+}
+
+static bool cmd_export(ToolJob* job, int jobs) {
+    if (mkdir(job->dir, 0755) != 0 && errno != EEXIST) {
+        perror("Ошибка создания каталога");
+        return false;
+    }
+    if (!collect_dir(job, "")) {
+        perror("Ошибка обхода ФС");
+        return false;
+    }
+    return run_pool(job, jobs, export_worker);
+}
+
+// -----------------------------------------------------------------------------
+// stats: чтение всех файлов и статистика операций
+// -----------------------------------------------------------------------------
+
+static bool discard_chunk(const void* data, size_t len, uint64_t offset, void* ctx) {
+    (void)data;
+    (void)offset;
+    *(uint64_t*)ctx += len;
+    return true;
+}
+
+static void* read_worker(void* arg) {
+    ToolJob* job = arg;
+    size_t i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->count) {
+        uint64_t n = 0;
+        bool ok = myfs_read_stream(job->fs, job->files[i].ino, 0, discard_chunk, &n);
+        if (ok) atomic_fetch_add(&job->bytes, n);
+        atomic_fetch_add(ok ? &job->done : &job->failed, 1);
+    }
+    return NULL;
+}
+
+static bool cmd_stats(ToolJob* job, int jobs) {
+    char name[4096];
+    for (int ino = myfs_next_file(job->fs, -1, name, sizeof(name)); ino >= 0;
+         ino = myfs_next_file(job->fs, ino, name, sizeof(name))) {
+        if (!job_add(job, name, ino)) {
+            perror("Ошибка выделения памяти");
+            return false;
+        }
+    }
+    return run_pool(job, jobs, read_worker);
+}
+
+// Статистика в JSON: операции без вызовов пропускаются, у гистограммы
+// выводятся только непустые корзины ("нижняя граница в нс": вызовов)
+static void print_stats(FILE* out, const myfs_stats* st) {
+    fprintf(out, "{\"ops\": {");
+    const char* sep = "";
+    for (int op = 0; op < MYFS_OP_COUNT; op++) {
+        const myfs_op_stats* o = &st->ops[op];
+        if (o->calls == 0) continue;
+        fprintf(out, "%s\n  \"%s\": {\"calls\": %llu, \"errors\": %llu, \"total_us\": %.1f, \"hist_ns\": {",
+                sep, myfs_op_name((myfs_op)op), (unsigned long long)o->calls,
+                (unsigned long long)o->errors, o->total_ns / 1e3);
+        const char* hsep = "";
+        for (int b = 0; b < MYFS_STATS_BUCKETS; b++) {
+            if (o->hist[b] == 0) continue;
+            fprintf(out, "%s\"%llu\": %llu", hsep, 1ULL << b, (unsigned long long)o->hist[b]);
+            hsep = ", ";
+        }
+        fprintf(out, "}}");
+        sep = ",";
+    }
+    fprintf(out, "\n },\n \"io\": {\"bytes_read\": %llu, \"bytes_written\": %llu, "
+            "\"data_reads\": %llu, \"data_writes\": %llu, \"meta_reads\": %llu, \"meta_writes\": %llu, "
+            "\"image_reads\": %llu, \"image_writes\": %llu, \"image_seeks\": %llu, \"image_syncs\": %llu},\n",
+            (unsigned long long)st->bytes_read, (unsigned long long)st->bytes_written,
+            (unsigned long long)st->data_reads, (unsigned long long)st->data_writes,
+            (unsigned long long)st->meta_reads, (unsigned long long)st->meta_writes,
+            (unsigned long long)st->image_reads, (unsigned long long)st->image_writes,
+            (unsigned long long)st->image_seeks, (unsigned long long)st->image_syncs);
+    fprintf(out, " \"alloc\": {\"blocks_allocated\": %llu, \"blocks_freed\": %llu, "
+            "\"calls\": %llu, \"scanned\": %llu},\n",
+            (unsigned long long)st->blocks_allocated, (unsigned long long)st->blocks_freed,
+            (unsigned long long)st->alloc_calls, (unsigned long long)st->alloc_scanned);
+    fprintf(out, " \"readahead\": {\"sequential\": %llu, \"resets\": %llu, \"windows\": %llu, "
+            "\"bytes\": %llu, \"hinted\": %llu, \"hit_bytes\": %llu, \"hit_rate\": %.3f},\n",
+            (unsigned long long)st->ra_sequential, (unsigned long long)st->ra_resets,
+            (unsigned long long)st->ra_windows, (unsigned long long)st->ra_bytes, (unsigned long long)st->ra_hinted,
+            (unsigned long long)st->ra_hit_bytes,
+            st->ra_bytes ? (double)st->ra_hit_bytes / (double)st->ra_bytes : 0.0);
+    fprintf(out, " \"compress\": {\"clusters\": %llu, \"raw_clusters\": %llu, \"bytes_in\": %llu, "
+            "\"bytes_out\": %llu, \"ratio\": %.2f, \"decompressed\": %llu}}\n",
+            (unsigned long long)st->comp_clusters, (unsigned long long)st->comp_raw_clusters,
+            (unsigned long long)st->comp_bytes_in, (unsigned long long)st->comp_bytes_out,
+            st->comp_bytes_out ? (double)st->comp_bytes_in / (double)st->comp_bytes_out : 0.0,
+            (unsigned long long)st->decomp_clusters);
+}
+
+typedef struct {
+    const char* name;
+    bool (*run)(ToolJob* job, int jobs);
+    bool format;             // Форматировать образ, если его нет
+    bool dir;                // Команде нужен каталог хоста
+} Command;
+
+static const Command commands[] = {
+    {"import", cmd_import, true, true},
+    {"export", cmd_export, false, true},
+    {"stats", cmd_stats, false, false},
+};
+
+static void usage(void) {
+    fprintf(stderr, "Использование: myfs [-j потоков] [-m] [-s] [-z] [-b блок] [-i inode] [-n блоков] <образ> import|export <каталог>\n"
+                    "               myfs [-j потоков] [-m] <образ> stats\n"
+                    "               myfs <образ v1> convert <новый образ v2>\n");
+}
+
+int main(int argc, char** argv) {
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs < 1) jobs = 1;
+    if (jobs > MAX_JOBS) jobs = MAX_JOBS;
+    myfs_options opts = {0};
+    myfs_format_options fmt = {0};
+    bool show_stats = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:mszb:i:n:")) != -1) {
+        if (opt == 'j') {
+            jobs = strtol(optarg, NULL, 10);
+            if (jobs < 1 || jobs > MAX_JOBS) {
+                fprintf(stderr, "Число потоков должно быть от 1 до %d\n", MAX_JOBS);
+                return 2;
+            }
+        } else if (opt == 'm') {
+            opts.backend = MYFS_BACKEND_MMAP;
+        } else if (opt == 's') {
+            show_stats = true;
+        } else if (opt == 'z') {
+            fmt.compress = true;
+            opts.compress = true;
+        } else if (opt == 'b' || opt == 'i' || opt == 'n') {
+            // Допустимость геометрии проверяет format_fs_ex
+            unsigned long v = strtoul(optarg, NULL, 10);
+            if (v == 0 || v > UINT32_MAX) {
+                fprintf(stderr, "Недопустимое значение -%c: %s\n", opt, optarg);
+                return 2;
+            }
+            uint32_t* field = opt == 'b' ? &fmt.block_size : opt == 'i' ? &fmt.inode_count : &fmt.block_count;
+            *field = (uint32_t)v;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (argc - optind < 2) {
+        usage();
+        return 2;
+    }
+    const char* image = argv[optind];
+    if (strcmp(argv[optind + 1], "convert") == 0) {
+        if (argc - optind != 3) {
+            usage();
+            return 2;
+        }
+        return myfs_convert_v1(image, argv[optind + 2]) ? 0 : 1;
+    }
+    const Command* cmd = NULL;
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (strcmp(argv[optind + 1], commands[i].name) == 0) cmd = &commands[i];
+    }
+    if (!cmd || argc - optind != (cmd->dir ? 3 : 2)) {
+        usage();
+        return 2;
+    }
+
+    if (cmd->format && access(image, F_OK) != 0 && !format_fs_ex(image, &fmt)) {
+        fprintf(stderr, "Не удалось отформатировать образ '%s'\n", image);
+        return 1;
+    }
+    opts.thread_safe = jobs > 1;
+    ToolJob job = {.dir = cmd->dir ? argv[optind + 2] : NULL};
+    double start = now_sec();
+    job.fs = open_fs_ex(image, &opts);
+    if (!job.fs) return 1;
+
+    bool ok = cmd->run(&job, (int)jobs);
+    myfs_stats stats;
+    bool have_stats = myfs_get_stats(job.fs, &stats);
+    close_fs(job.fs);  // Время включает запись метаданных и fsync
+    double s = now_sec() - start;
+
+    if (!cmd->dir) {
+        // stats: в stdout только JSON, итог переноса не выводится
+        if (have_stats) print_stats(stdout, &stats);
+        job_free(&job);
+        return ok && have_stats && atomic_load(&job.failed) == 0 ? 0 : 1;
+    }
+    if (show_stats && have_stats) print_stats(stderr, &stats);
+
+    size_t done = atomic_load(&job.done), failed = atomic_load(&job.failed);
+    double mib = atomic_load(&job.bytes) / (1024.0 * 1024.0);
+    printf("%s: %zu файлов, %.1f МиБ за %.3f с (%ld потоков): %.0f файлов/с, %.1f МиБ/с\n",
+           cmd->name, done, mib, s, jobs, done / s, mib / s);
+    if (failed) printf("Ошибок: %zu\n", failed);
+    job_free(&job);
+    return ok && failed == 0 ? 0 : 1;
+}